@@ -0,0 +1,553 @@
+#ifndef _AUDIO_MANAGER_F32_H_
+#define _AUDIO_MANAGER_F32_H_
+
+#include "callable.h"
+#include "ConcurrentRoundQueue.h"
+#include "File.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AUDIO_X86 1
+#else
+#define AUDIO_X86 0
+#endif
+
+/* Sample kernels for the mixer, in scalar, SSE2 and AVX2/FMA versions. The AVX2 ones are compiled
+ * with a target attribute and only picked when the CPU has them, so the same binary runs
+ * anywhere. Counts are in samples; none of them need aligned pointers.
+*/
+namespace WellSpring {
+  namespace audio {
+    // Frames per mixing block
+    constexpr int BLOCK = 256;
+
+    enum class Simd { SCALAR, SSE, AVX2 };
+
+    struct Kernels {
+      // out[i] += in[i] * (gain + i * step), a gain ramp across the run
+      void (*mix)(float *out, const float *in, int count, float gain, float step);
+      // Little-endian PCM to floats in [-1, 1)
+      void (*pcm16)(float *out, const unsigned char *in, int count);
+      void (*pcm24)(float *out, const unsigned char *in, int count);
+      void (*pcm32)(float *out, const unsigned char *in, int count);
+      Simd simd;
+    };
+
+    namespace scalar {
+      inline void mix(float *out, const float *in, int count, float gain, float step) {
+        for (int i = 0; i < count; ++i) out[i] += in[i] * (gain + i * step);
+      }
+      inline void pcm16(float *out, const unsigned char *in, int count) {
+        for (int i = 0; i < count; ++i) out[i] = (int16_t) (in[2 * i] | in[2 * i + 1] << 8) * (1.0f / 32768);
+      }
+      inline void pcm24(float *out, const unsigned char *in, int count) {
+        for (int i = 0; i < count; ++i) {
+          int32_t value = (int32_t) ((uint32_t) in[3 * i] << 8 | (uint32_t) in[3 * i + 1] << 16 | (uint32_t) in[3 * i + 2] << 24);
+          out[i] = value * (1.0f / 2147483648.0f);
+        }
+      }
+      inline void pcm32(float *out, const unsigned char *in, int count) {
+        for (int i = 0; i < count; ++i) {
+          int32_t value = (int32_t) ((uint32_t) in[4 * i] | (uint32_t) in[4 * i + 1] << 8 |
+            (uint32_t) in[4 * i + 2] << 16 | (uint32_t) in[4 * i + 3] << 24);
+          out[i] = value * (1.0f / 2147483648.0f);
+        }
+      }
+    }
+
+#if AUDIO_X86 && defined(__SSE2__)
+    namespace sse {
+      inline void mix(float *out, const float *in, int count, float gain, float step) {
+        __m128 g = _mm_setr_ps(gain, gain + step, gain + 2 * step, gain + 3 * step);
+        __m128 dg = _mm_set1_ps(4 * step);
+        int i = 0;
+        for (; i + 4 <= count; i += 4) {
+          __m128 o = _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(in + i), g));
+          _mm_storeu_ps(out + i, o);
+          g = _mm_add_ps(g, dg);
+        }
+        for (; i < count; ++i) out[i] += in[i] * (gain + i * step);
+      }
+      inline void pcm16(float *out, const unsigned char *in, int count) {
+        const __m128 scale = _mm_set1_ps(1.0f / 32768);
+        int i = 0;
+        for (; i + 8 <= count; i += 8) {
+          __m128i x = _mm_loadu_si128((const __m128i *) (in + 2 * i));
+          // Each sample into the top half of a 32-bit lane, then shifted down with its sign
+          __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+          __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+          _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+          _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+        }
+        scalar::pcm16(out + i, in + 2 * i, count - i);
+      }
+      inline void pcm32(float *out, const unsigned char *in, int count) {
+        const __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+        int i = 0;
+        for (; i + 4 <= count; i += 4) {
+          __m128i x = _mm_loadu_si128((const __m128i *) (in + 4 * i));
+          _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(x), scale));
+        }
+        scalar::pcm32(out + i, in + 4 * i, count - i);
+      }
+    }
+
+    namespace avx2 {
+      __attribute__((target("avx2,fma"))) inline void mix(float *out, const float *in, int count, float gain, float step) {
+        __m256 g = _mm256_add_ps(_mm256_set1_ps(gain),
+          _mm256_mul_ps(_mm256_set1_ps(step), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7)));
+        __m256 dg = _mm256_set1_ps(8 * step);
+        int i = 0;
+        for (; i + 8 <= count; i += 8) {
+          _mm256_storeu_ps(out + i, _mm256_fmadd_ps(_mm256_loadu_ps(in + i), g, _mm256_loadu_ps(out + i)));
+          g = _mm256_add_ps(g, dg);
+        }
+        for (; i < count; ++i) out[i] += in[i] * (gain + i * step);
+      }
+      __attribute__((target("avx2,fma"))) inline void pcm16(float *out, const unsigned char *in, int count) {
+        const __m256 scale = _mm256_set1_ps(1.0f / 32768);
+        int i = 0;
+        for (; i + 8 <= count; i += 8) {
+          __m256i x = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) (in + 2 * i)));
+          _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+        }
+        scalar::pcm16(out + i, in + 2 * i, count - i);
+      }
+      // Four packed 3-byte samples per shuffle, placed in the top of each lane to keep their sign
+      __attribute__((target("avx2,fma"))) inline void pcm24(float *out, const unsigned char *in, int count) {
+        const __m128i spread = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+        const __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+        int i = 0;
+        // Each 16-byte load covers 12 bytes of samples; stop while it still fits in the input
+        for (; 3 * (i + 8) + 4 <= 3 * count; i += 8) {
+          __m128i lo = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (in + 3 * i)), spread);
+          __m128i hi = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (in + 3 * i + 12)), spread);
+          __m256i x = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+          _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+        }
+        scalar::pcm24(out + i, in + 3 * i, count - i);
+      }
+      __attribute__((target("avx2,fma"))) inline void pcm32(float *out, const unsigned char *in, int count) {
+        const __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+        int i = 0;
+        for (; i + 8 <= count; i += 8) {
+          __m256i x = _mm256_loadu_si256((const __m256i *) (in + 4 * i));
+          _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+        }
+        scalar::pcm32(out + i, in + 4 * i, count - i);
+      }
+    }
+#endif
+
+    // The best the CPU supports
+    inline Simd best_simd() {
+#if AUDIO_X86 && defined(__SSE2__)
+      if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return Simd::AVX2;
+      return Simd::SSE;
+#else
+      return Simd::SCALAR;
+#endif
+    }
+
+    // Levels the build or the CPU lacks fall back to the next one down
+    inline Kernels kernels(Simd simd = best_simd()) {
+      if (simd > best_simd()) simd = best_simd();
+#if AUDIO_X86 && defined(__SSE2__)
+      if (simd == Simd::AVX2) return Kernels{avx2::mix, avx2::pcm16, avx2::pcm24, avx2::pcm32, simd};
+      if (simd == Simd::SSE) return Kernels{sse::mix, sse::pcm16, scalar::pcm24, sse::pcm32, simd};
+#endif
+      return Kernels{scalar::mix, scalar::pcm16, scalar::pcm24, scalar::pcm32, Simd::SCALAR};
+    }
+  }
+}
+
+/* A .WAV file decoded to float as it plays: the file is read a chunk at a time into a byte ring
+ * and converted a block at a time, so only a few KB of it are ever in memory. PCM 16/24/32 and
+ * float32, mono or stereo. Throws std::runtime_error for files it can't play.
+*/
+class WavStream {
+public:
+  static constexpr int RING_BYTES = 64 << 10;
+private:
+  File _file;
+  int _channels = 0, _bits = 0, _rate = 0;
+  bool _float = false, _loop;
+  size_t _data_start = 0, _data_size = 0, _data_read = 0;
+  // Mirrored, so a frame never wraps
+  MirroredRoundQueue<unsigned char> _bytes;
+  std::vector<float> _interleaved;
+
+  static uint32_t _u32(const unsigned char *p) { return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24; }
+  static uint16_t _u16(const unsigned char *p) { return (uint16_t) (p[0] | p[1] << 8); }
+
+  [[noreturn]] void _fail(const char *why) const { throw std::runtime_error(_file.path() + ": " + why); }
+
+  void _parse() {
+    unsigned char header[12];
+    _file.read_at(header, 12, 0);
+    if (memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) _fail("not a WAVE file");
+    size_t at = 12, size = _file.size();
+    bool format = false;
+    while (at + 8 <= size) {
+      unsigned char chunk[8];
+      _file.read_at(chunk, 8, at);
+      uint32_t length = _u32(chunk + 4);
+      at += 8;
+      if (memcmp(chunk, "fmt ", 4) == 0) {
+        unsigned char fmt[40] = {};
+        _file.read_at(fmt, length < sizeof(fmt) ? length : sizeof(fmt), at);
+        uint16_t tag = _u16(fmt);
+        // WAVE_FORMAT_EXTENSIBLE keeps the real tag at the start of its sub-format GUID
+        if (tag == 0xFFFE && length >= 26) tag = _u16(fmt + 24);
+        _channels = _u16(fmt + 2);
+        _rate = (int) _u32(fmt + 4);
+        _bits = _u16(fmt + 14);
+        _float = tag == 3;
+        if (tag != 1 && tag != 3) _fail("only PCM and float WAV files are supported");
+        if (_float ? _bits != 32 : _bits != 16 && _bits != 24 && _bits != 32) _fail("unsupported sample size");
+        if (_channels != 1 && _channels != 2) _fail("only mono and stereo are supported");
+        format = true;
+      } else if (memcmp(chunk, "data", 4) == 0) {
+        if (!format) _fail("data before fmt chunk");
+        _data_start = at;
+        _data_size = length < size - at ? length : size - at;
+        _data_size -= _data_size % frame_bytes();
+        _file.seek(_data_start);
+        return;
+      }
+      at += length + (length & 1);
+    }
+    _fail("no data chunk");
+  }
+
+  // Tops up the ring from the file; false once the data is exhausted (and not looping)
+  bool _refill() {
+    if (_data_read == _data_size) {
+      if (!_loop || _data_size == 0) return false;
+      _file.seek(_data_start);
+      _data_read = 0;
+    }
+    size_t want = (size_t) (_bytes.capacity() - _bytes.size());
+    if (want > _data_size - _data_read) want = _data_size - _data_read;
+    size_t got = _file.read(_bytes, (int) want);
+    if (got == 0) _fail("file shrank while playing");
+    _data_read += got;
+    return true;
+  }
+public:
+  explicit WavStream(const std::string &path, bool loop = false) : _file(path), _loop(loop), _bytes(RING_BYTES) {
+    _parse();
+    _file.sequential();
+  }
+
+  int channels() const { return _channels; }
+  int sample_rate() const { return _rate; }
+  int bits() const { return _bits; }
+  int frame_bytes() const { return _channels * _bits / 8; }
+  double seconds() const { return (double) _data_size / frame_bytes() / _rate; }
+
+  /* Decodes up to frames frames into left (and right, for stereo files). Returns how many;
+   * fewer than asked for means the file ended.
+  */
+  int read(const WellSpring::audio::Kernels &kernels, float *left, float *right, int frames) {
+    int done = 0, frame = frame_bytes();
+    while (done < frames) {
+      if (_bytes.size() < frame && !_refill()) break;
+      RoundQueue<unsigned char, MirroredStorage<unsigned char>>::Regions queued = _bytes.readable();
+      int count = queued.first.size / frame;
+      if (count > frames - done) count = frames - done;
+      int samples = count * _channels;
+      const unsigned char *in = queued.first.data;
+      float *out = _channels == 1 ? left + done : (_interleaved.resize(samples), _interleaved.data());
+      if (_float) memcpy(out, in, samples * sizeof(float));
+      else if (_bits == 16) kernels.pcm16(out, in, samples);
+      else if (_bits == 24) kernels.pcm24(out, in, samples);
+      else kernels.pcm32(out, in, samples);
+      if (_channels == 2) {
+        for (int i = 0; i < count; ++i) {
+          left[done + i] = out[2 * i];
+          right[done + i] = out[2 * i + 1];
+        }
+      }
+      _bytes.consume(count * frame);
+      done += count;
+    }
+    return done;
+  }
+};
+
+/* Mixes any number of voices (streamed .WAV files and generated audio) into stereo float blocks
+ * of WellSpring::audio::BLOCK frames. Each voice has a gain and a constant-power pan; changes are
+ * ramped across a block so they don't click. WAV files play at the mixer's rate as they are; there
+ * is no resampling.
+ *
+ * Voices are owned by whichever thread mixes. play(), stop(), set_gain() and set_pan() may be
+ * called from any thread: they are queued without a lock and applied at the start of the next
+ * block.
+ *
+ * Two ways to run it:
+ *  - start_output(): a mixer thread renders blocks ahead and hands them to the output thread through a
+ *    lock-free queue, where the device callback takes them with pull().
+ *  - render()/render_to_file(): mix on the calling thread, e.g. headless tests and benchmarks.
+*/
+class AudioManagerF32 {
+public:
+  static constexpr int BLOCK = WellSpring::audio::BLOCK;
+  typedef uint32_t VoiceId;
+  // Fills a mono run of frames and returns how many it filled; fewer ends the voice
+  typedef Delegate<int(float *out, int frames)> Generator;
+
+  struct Block {
+    float left[BLOCK];
+    float right[BLOCK];
+  };
+private:
+  struct Voice {
+    VoiceId id;
+    float gain, pan;
+    float applied_left = 0, applied_right = 0;
+    bool started = false, stopping = false;
+    std::unique_ptr<WavStream> wav;
+    Generator generator;
+  };
+
+  struct Command {
+    enum Type { PLAY, STOP, GAIN, PAN } type;
+    VoiceId id;
+    float value;
+    Voice *voice;
+  };
+
+  int _rate;
+  WellSpring::audio::Kernels _kernels;
+  MpmcRoundQueue<Command> _commands;
+  std::atomic<VoiceId> _next_id{1};
+  std::atomic<int> _playing{0};
+
+  // Only touched by the mixing thread
+  std::vector<Voice *> _voices;
+  alignas(32) float _scratch_left[BLOCK];
+  alignas(32) float _scratch_right[BLOCK];
+
+  std::unique_ptr<SpscRoundQueue<Block>> _blocks;
+  std::thread _mixer;
+  std::atomic<bool> _running{false};
+
+  void _send(Command command) {
+    if (!_commands.push(command)) {
+      delete command.voice;
+      throw std::runtime_error("AudioManagerF32: command queue full");
+    }
+  }
+
+  VoiceId _play(Voice *voice, float gain, float pan) {
+    voice->id = _next_id.fetch_add(1);
+    voice->gain = gain;
+    voice->pan = pan;
+    _send(Command{Command::PLAY, voice->id, 0, voice});
+    return voice->id;
+  }
+
+  Voice *_find(VoiceId id) {
+    for (Voice *voice : _voices) {
+      if (voice->id == id) return voice;
+    }
+    return nullptr;
+  }
+
+  void _apply_commands() {
+    Command command;
+    while (_commands.pop(command)) {
+      if (command.type == Command::PLAY) {
+        _voices.push_back(command.voice);
+        continue;
+      }
+      Voice *voice = _find(command.id);
+      if (!voice) continue;
+      if (command.type == Command::STOP) voice->gain = 0, voice->stopping = true;
+      else if (command.type == Command::GAIN) voice->gain = command.value;
+      else voice->pan = command.value;
+    }
+  }
+
+  // Constant power for mono sources; stereo ones keep their image and only attenuate a side
+  static void _gains(const Voice &voice, bool stereo, float &left, float &right) {
+    float pan = voice.pan < -1 ? -1 : voice.pan > 1 ? 1 : voice.pan;
+    if (stereo) {
+      left = voice.gain * (pan > 0 ? 1 - pan : 1);
+      right = voice.gain * (pan < 0 ? 1 + pan : 1);
+    } else {
+      float angle = (pan + 1) * 0.78539816f;
+      left = voice.gain * std::cos(angle);
+      right = voice.gain * std::sin(angle);
+    }
+  }
+
+  // False once the voice has finished
+  bool _mix_voice(Voice &voice, Block &out) {
+    bool stereo = voice.wav && voice.wav->channels() == 2;
+    int frames = 0;
+    if (voice.wav) frames = voice.wav->read(_kernels, _scratch_left, _scratch_right, BLOCK);
+    else if (voice.generator) frames = voice.generator(_scratch_left, BLOCK);
+
+    float left, right;
+    _gains(voice, stereo, left, right);
+    // A new voice starts at its gain; later changes ramp over the block
+    if (!voice.started) {
+      voice.applied_left = left;
+      voice.applied_right = right;
+      voice.started = true;
+    }
+    float step_left = (left - voice.applied_left) / BLOCK, step_right = (right - voice.applied_right) / BLOCK;
+    _kernels.mix(out.left, _scratch_left, frames, voice.applied_left, step_left);
+    _kernels.mix(out.right, stereo ? _scratch_right : _scratch_left, frames, voice.applied_right, step_right);
+    voice.applied_left = left;
+    voice.applied_right = right;
+    return frames == BLOCK && !voice.stopping;
+  }
+
+  void _run(std::chrono::nanoseconds period) {
+    Block block;
+    while (_running.load(std::memory_order_relaxed)) {
+      mix(block);
+      // Stay the queue's length ahead of the output thread
+      while (!_blocks->push(block)) {
+        if (!_running.load(std::memory_order_relaxed)) return;
+        std::this_thread::sleep_for(period / 2);
+      }
+    }
+  }
+public:
+  explicit AudioManagerF32(int sample_rate = 48000, WellSpring::audio::Simd simd = WellSpring::audio::best_simd(),
+      int command_capacity = 4096) :
+    _rate(sample_rate), _kernels(WellSpring::audio::kernels(simd)), _commands(command_capacity) {}
+
+  AudioManagerF32(const AudioManagerF32 &) = delete;
+  AudioManagerF32 &operator=(const AudioManagerF32 &) = delete;
+
+  ~AudioManagerF32() {
+    stop_output();
+    _apply_commands();
+    for (Voice *voice : _voices) delete voice;
+  }
+
+  int sample_rate() const { return _rate; }
+  WellSpring::audio::Simd simd() const { return _kernels.simd; }
+
+  // Voices playing as of the last mixed block
+  int playing() const { return _playing.load(std::memory_order_relaxed); }
+
+  // Opens the file here, on the calling thread; throws if it can't be played
+  VoiceId play(const std::string &wav_path, float gain = 1, float pan = 0, bool loop = false) {
+    Voice *voice = new Voice();
+    voice->wav.reset(new WavStream(wav_path, loop));
+    return _play(voice, gain, pan);
+  }
+
+  VoiceId play(Generator generator, float gain = 1, float pan = 0) {
+    Voice *voice = new Voice();
+    voice->generator = generator;
+    return _play(voice, gain, pan);
+  }
+
+  // Fades the voice out over one block and drops it; unknown or finished voices are ignored
+  void stop(VoiceId id) { _send(Command{Command::STOP, id, 0, nullptr}); }
+  void set_gain(VoiceId id, float gain) { _send(Command{Command::GAIN, id, gain, nullptr}); }
+  // -1 is hard left, 1 hard right
+  void set_pan(VoiceId id, float pan) { _send(Command{Command::PAN, id, pan, nullptr}); }
+
+  // Mixes the next block on the calling thread. Not while the output runs.
+  void mix(Block &out) {
+    _apply_commands();
+    memset(out.left, 0, sizeof(out.left));
+    memset(out.right, 0, sizeof(out.right));
+    for (size_t i = 0; i < _voices.size();) {
+      if (_mix_voice(*_voices[i], out)) {
+        i++;
+        continue;
+      }
+      delete _voices[i];
+      _voices[i] = _voices.back();
+      _voices.pop_back();
+    }
+    _playing.store((int) _voices.size(), std::memory_order_relaxed);
+  }
+
+  static void interleave(const Block &block, float *out) {
+    for (int i = 0; i < BLOCK; ++i) {
+      out[2 * i] = block.left[i];
+      out[2 * i + 1] = block.right[i];
+    }
+  }
+
+  // Mixes blocks * BLOCK frames of interleaved stereo into out
+  void render(float *out, int blocks) {
+    Block block;
+    for (int b = 0; b < blocks; ++b) {
+      mix(block);
+      interleave(block, out + 2 * BLOCK * b);
+    }
+  }
+
+  // Mixes seconds of audio into a stereo float32 WAV file
+  void render_to_file(const std::string &path, double seconds) {
+    if (_running.load()) throw std::runtime_error("AudioManagerF32: rendering to a file while the output runs");
+    uint32_t frames = (uint32_t) std::ceil(seconds * _rate / BLOCK) * BLOCK;
+    uint32_t data_bytes = frames * 2 * sizeof(float);
+    unsigned char header[44];
+    auto put32 = [&](int at, uint32_t v) { for (int i = 0; i < 4; ++i) header[at + i] = (unsigned char) (v >> (8 * i)); };
+    auto put16 = [&](int at, uint16_t v) { header[at] = (unsigned char) v; header[at + 1] = (unsigned char) (v >> 8); };
+    memcpy(header, "RIFF", 4);
+    put32(4, 36 + data_bytes);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put32(16, 16);
+    put16(20, 3); // IEEE float
+    put16(22, 2);
+    put32(24, (uint32_t) _rate);
+    put32(28, (uint32_t) _rate * 2 * sizeof(float));
+    put16(32, 2 * sizeof(float));
+    put16(34, 32);
+    memcpy(header + 36, "data", 4);
+    put32(40, data_bytes);
+
+    File file(path, File::WRITE);
+    file.write(header, sizeof(header));
+    const int per_write = 64;
+    std::vector<float> samples(2 * BLOCK * per_write);
+    for (uint32_t done = 0; done < frames; done += BLOCK * per_write) {
+      int blocks = (int) ((frames - done) / BLOCK < (uint32_t) per_write ? (frames - done) / BLOCK : per_write);
+      render(samples.data(), blocks);
+      file.write(samples.data(), (size_t) blocks * 2 * BLOCK * sizeof(float));
+    }
+  }
+
+  // Starts the mixer thread, keeping latency_blocks (rounded up to a power of two) ready for pull()
+  void start_output(int latency_blocks = 4) {
+    if (_running.load()) return;
+    _blocks.reset(new SpscRoundQueue<Block>(latency_blocks));
+    _running.store(true);
+    std::chrono::nanoseconds period((int64_t) BLOCK * 1000000000 / _rate);
+    _mixer = std::thread(&AudioManagerF32::_run, this, period);
+  }
+
+  void stop_output() {
+    if (!_running.exchange(false)) return;
+    _mixer.join();
+  }
+
+  // For the output thread: the next block, or false on an underrun (play silence)
+  bool pull(Block &out) { return _blocks && _blocks->pop(out); }
+};
+
+#endif // _AUDIO_MANAGER_F32_H_
@@ -0,0 +1,199 @@
+#ifndef _CONCURRENT_ROUND_QUEUE_H_
+#define _CONCURRENT_ROUND_QUEUE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+/* Bounded ring buffers for handing data between threads without a lock. Unlike RoundQueue they
+ * never grow: push returns false when full, and the capacity is rounded up to a power of two.
+*/
+
+/* One producer thread, one consumer thread. Head and tail sit on their own cache lines, and each
+ * side keeps a private copy of the other's index, re-reading it only when the copy says full or
+ * empty. The producer can stage several elements and publish them with one commit().
+*/
+template<class T> class SpscRoundQueue {
+private:
+  T *_data;
+  uint64_t _mask;
+
+  // Consumer side
+  alignas(64) std::atomic<uint64_t> _head{0};
+  uint64_t _tail_cache = 0;
+
+  // Producer side; _staged runs ahead of _tail until commit()
+  alignas(64) std::atomic<uint64_t> _tail{0};
+  uint64_t _head_cache = 0;
+  uint64_t _staged = 0;
+  char _pad[64 - 3 * sizeof(uint64_t)];
+
+  static uint64_t _round_up(int size) {
+    if (size < 1 || size > (1 << 30)) throw std::length_error("Bad SpscRoundQueue capacity");
+    uint64_t capacity = 1;
+    while (capacity < (uint64_t) size) capacity <<= 1;
+    return capacity;
+  }
+public:
+  explicit SpscRoundQueue(int capacity) : _mask(_round_up(capacity) - 1) {
+    _data = new T[_mask + 1];
+  }
+
+  SpscRoundQueue(const SpscRoundQueue &) = delete;
+  SpscRoundQueue &operator=(const SpscRoundQueue &) = delete;
+
+  ~SpscRoundQueue() {
+    delete[] _data;
+  }
+
+  int capacity() const { return (int) (_mask + 1); }
+  // Exact only when called from one of the two threads while the other is idle
+  int size() const { return (int) (_tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire)); }
+
+  // Producer: writes without publishing; false when full
+  bool stage(T value) {
+    if (_staged - _head_cache > _mask) {
+      _head_cache = _head.load(std::memory_order_acquire);
+      if (_staged - _head_cache > _mask) return false;
+    }
+    _data[_staged & _mask] = std::move(value);
+    _staged++;
+    return true;
+  }
+
+  // Producer: makes everything staged visible to the consumer
+  void commit() {
+    _tail.store(_staged, std::memory_order_release);
+  }
+
+  // Producer
+  bool push(T value) {
+    if (!stage(std::move(value))) return false;
+    commit();
+    return true;
+  }
+
+  // Producer: pushes as many of count as fit with a single commit; returns how many that was
+  int push_n(const T *values, int count) {
+    int pushed = 0;
+    while (pushed < count && stage(values[pushed])) pushed++;
+    if (pushed) commit();
+    return pushed;
+  }
+
+  // Consumer: the front, or null when empty
+  T *peek() {
+    uint64_t head = _head.load(std::memory_order_relaxed);
+    if (head == _tail_cache) {
+      _tail_cache = _tail.load(std::memory_order_acquire);
+      if (head == _tail_cache) return nullptr;
+    }
+    return &_data[head & _mask];
+  }
+
+  // Consumer: drops the front
+  void pop() {
+    if (!peek()) throw std::runtime_error("Popping with nothing to pop!");
+    _head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // Consumer: false when empty
+  bool pop(T &out) {
+    T *front = peek();
+    if (!front) return false;
+    out = std::move(*front);
+    _head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer: moves up to count out and frees their slots at once; returns how many that was
+  int pop_n(T *out, int count) {
+    uint64_t head = _head.load(std::memory_order_relaxed);
+    if (_tail_cache - head < (uint64_t) count) _tail_cache = _tail.load(std::memory_order_acquire);
+    uint64_t available = _tail_cache - head;
+    int taken = available < (uint64_t) count ? (int) available : count;
+    for (int i = 0; i < taken; ++i) out[i] = std::move(_data[(head + i) & _mask]);
+    if (taken) _head.store(head + taken, std::memory_order_release);
+    return taken;
+  }
+};
+
+/* Any number of producers and consumers. Every slot carries a sequence number saying whether it
+ * is free for the push at its position or holds the element for the pop at its position, so
+ * each side only competes on its own counter (Vyukov's bounded queue).
+ * There is no peek: with several consumers the front can be taken between a peek and a pop.
+*/
+template<class T> class MpmcRoundQueue {
+private:
+  struct Slot {
+    std::atomic<uint64_t> sequence;
+    T value;
+  };
+
+  Slot *_slots;
+  uint64_t _mask;
+  alignas(64) std::atomic<uint64_t> _enqueue{0};
+  alignas(64) std::atomic<uint64_t> _dequeue{0};
+  char _pad[64 - sizeof(std::atomic<uint64_t>)];
+public:
+  explicit MpmcRoundQueue(int capacity) {
+    if (capacity < 1 || capacity > (1 << 30)) throw std::length_error("Bad MpmcRoundQueue capacity");
+    uint64_t size = 1;
+    while (size < (uint64_t) capacity) size <<= 1;
+    _mask = size - 1;
+    _slots = new Slot[size];
+    for (uint64_t i = 0; i < size; ++i) _slots[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  MpmcRoundQueue(const MpmcRoundQueue &) = delete;
+  MpmcRoundQueue &operator=(const MpmcRoundQueue &) = delete;
+
+  ~MpmcRoundQueue() {
+    delete[] _slots;
+  }
+
+  int capacity() const { return (int) (_mask + 1); }
+
+  // False when full
+  bool push(T value) {
+    uint64_t position = _enqueue.load(std::memory_order_relaxed);
+    while (true) {
+      Slot &slot = _slots[position & _mask];
+      int64_t diff = (int64_t) (slot.sequence.load(std::memory_order_acquire) - position);
+      if (diff == 0) {
+        if (_enqueue.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          slot.value = std::move(value);
+          slot.sequence.store(position + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        position = _enqueue.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // False when empty
+  bool pop(T &out) {
+    uint64_t position = _dequeue.load(std::memory_order_relaxed);
+    while (true) {
+      Slot &slot = _slots[position & _mask];
+      int64_t diff = (int64_t) (slot.sequence.load(std::memory_order_acquire) - (position + 1));
+      if (diff == 0) {
+        if (_dequeue.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          out = std::move(slot.value);
+          slot.sequence.store(position + _mask + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        position = _dequeue.load(std::memory_order_relaxed);
+      }
+    }
+  }
+};
+
+#endif // _CONCURRENT_ROUND_QUEUE_H_
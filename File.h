@@ -0,0 +1,372 @@
+#ifndef _FILE_H_
+#define _FILE_H_
+
+#include "MirroredRing.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* A read-only memory mapping of (part of) a file, unmapped when destroyed. Pages are read in on
+ * first touch, so mapping a multi-GB pack costs nothing until it is used; advise() and prefetch()
+ * tell the kernel what is coming, release() lets it drop pages that are done with.
+*/
+class MappedView {
+public:
+  enum class Advice { NORMAL, SEQUENTIAL, RANDOM };
+private:
+  unsigned char *_base = nullptr; // Page-aligned start of the mapping
+  size_t _mapped = 0;
+  const unsigned char *_data = nullptr;
+  size_t _size = 0;
+
+  // Page-aligned range covering [offset, offset + length) of the view, clipped to it
+  bool _pages(size_t offset, size_t length, unsigned char *&start, size_t &bytes) const {
+    if (offset >= _size) return false;
+    if (length > _size - offset) length = _size - offset;
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (uintptr_t) (_data + offset) & ~(uintptr_t) (page - 1);
+    start = (unsigned char *) begin;
+    bytes = (uintptr_t) (_data + offset + length) - begin;
+    return true;
+  }
+
+  MappedView(unsigned char *base, size_t mapped, const unsigned char *data, size_t size) :
+    _base(base), _mapped(mapped), _data(data), _size(size) {}
+  friend class File;
+public:
+  MappedView() {}
+  MappedView(const MappedView &) = delete;
+  MappedView &operator=(const MappedView &) = delete;
+  MappedView(MappedView &&other) noexcept { *this = std::move(other); }
+  MappedView &operator=(MappedView &&other) noexcept {
+    std::swap(_base, other._base);
+    std::swap(_mapped, other._mapped);
+    std::swap(_data, other._data);
+    std::swap(_size, other._size);
+    return *this;
+  }
+  ~MappedView() {
+    if (_base) munmap(_base, _mapped);
+  }
+
+  const unsigned char *data() const { return _data; }
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+  std::string_view view() const { return std::string_view((const char *) _data, _size); }
+
+  void advise(Advice advice) {
+    if (!_base) return;
+    int flag = advice == Advice::SEQUENTIAL ? MADV_SEQUENTIAL : advice == Advice::RANDOM ? MADV_RANDOM : MADV_NORMAL;
+    madvise(_base, _mapped, flag);
+  }
+
+  // Starts reading the range in the background
+  void prefetch(size_t offset, size_t length) {
+    unsigned char *start;
+    size_t bytes;
+    if (_pages(offset, length, start, bytes)) madvise(start, bytes, MADV_WILLNEED);
+  }
+
+  // Drops the range's pages; touching it again reads the file again
+  void release(size_t offset, size_t length) {
+    unsigned char *start;
+    size_t bytes;
+    if (_pages(offset, length, start, bytes)) madvise(start, bytes, MADV_DONTNEED);
+  }
+};
+
+/* A file in the file system, open for as long as the object lives. Three ways to get at the
+ * contents, none of which copy the whole file to the heap unless asked to:
+ *  - map(): a MappedView of the file or of a range of it.
+ *  - Sequential reads from the current position, into a caller's buffer, into a byte RoundQueue's
+ *    free space, or chunk by chunk through a callback with stream().
+ *  - read_at()/write_at() at explicit offsets, which leave the position alone.
+ * Errors throw std::runtime_error naming the file and the failing call.
+*/
+class File {
+public:
+  enum Mode { READ, WRITE, READ_WRITE };
+  // Mappings at least this large are aligned for transparent huge pages
+  static constexpr size_t HUGE_PAGE = (size_t) 2 << 20;
+  static constexpr size_t CHUNK = (size_t) 1 << 20;
+private:
+  int _fd = -1;
+  std::string _path;
+
+  [[noreturn]] void _fail(const char *call) const {
+    throw std::runtime_error(_path + ": " + call + " failed: " + strerror(errno));
+  }
+public:
+  // WRITE creates or truncates; READ_WRITE creates if missing
+  explicit File(const std::string &path, Mode mode = READ) : _path(path) {
+    int flags = mode == READ ? O_RDONLY : mode == WRITE ? O_WRONLY | O_CREAT | O_TRUNC : O_RDWR | O_CREAT;
+    _fd = ::open(path.c_str(), flags | O_CLOEXEC, 0644);
+    if (_fd < 0) _fail("open");
+  }
+
+  File(const File &) = delete;
+  File &operator=(const File &) = delete;
+  File(File &&other) noexcept : _fd(other._fd), _path(std::move(other._path)) { other._fd = -1; }
+  File &operator=(File &&other) noexcept {
+    std::swap(_fd, other._fd);
+    std::swap(_path, other._path);
+    return *this;
+  }
+  ~File() {
+    if (_fd >= 0) close(_fd);
+  }
+
+  static bool exists(const std::string &path) {
+    struct stat info;
+    return stat(path.c_str(), &info) == 0;
+  }
+
+  int fd() const { return _fd; }
+  const std::string &path() const { return _path; }
+
+  size_t size() const {
+    struct stat info;
+    if (fstat(_fd, &info) != 0) _fail("fstat");
+    return (size_t) info.st_size;
+  }
+
+  /* Maps length bytes from offset (to the end by default), hinting the expected access pattern.
+   * Large mappings are placed on a huge page boundary and marked for huge pages, which the kernel
+   * uses where the file system supports them.
+  */
+  MappedView map(size_t offset = 0, size_t length = SIZE_MAX, MappedView::Advice advice = MappedView::Advice::SEQUENTIAL) const {
+    size_t total = size();
+    if (offset > total) throw std::out_of_range(_path + ": mapping past the end");
+    if (length > total - offset) length = total - offset;
+    if (length == 0) return MappedView();
+
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t start = offset & ~(page - 1);
+    size_t mapped = offset - start + length;
+    unsigned char *base;
+    // Only worth it when the file offset is itself huge page aligned
+    if (mapped >= HUGE_PAGE && start % HUGE_PAGE == 0) {
+      void *reserved = mmap(nullptr, mapped + HUGE_PAGE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (reserved == MAP_FAILED) _fail("mmap");
+      uintptr_t aligned = ((uintptr_t) reserved + HUGE_PAGE - 1) & ~(uintptr_t) (HUGE_PAGE - 1);
+      void *at = mmap((void *) aligned, mapped, PROT_READ, MAP_PRIVATE | MAP_FIXED, _fd, (off_t) start);
+      if (at == MAP_FAILED) {
+        munmap(reserved, mapped + HUGE_PAGE);
+        _fail("mmap");
+      }
+      // Give back the unused reservation on either side
+      size_t before = aligned - (uintptr_t) reserved;
+      size_t tail = (mapped + page - 1) & ~(page - 1);
+      if (before) munmap(reserved, before);
+      munmap((unsigned char *) aligned + tail, HUGE_PAGE - before);
+      base = (unsigned char *) at;
+#ifdef MADV_HUGEPAGE
+      madvise(base, mapped, MADV_HUGEPAGE);
+#endif
+    } else {
+      void *at = mmap(nullptr, mapped, PROT_READ, MAP_PRIVATE, _fd, (off_t) start);
+      if (at == MAP_FAILED) _fail("mmap");
+      base = (unsigned char *) at;
+    }
+    MappedView view(base, mapped, base + (offset - start), length);
+    view.advise(advice);
+    return view;
+  }
+
+  size_t tell() const {
+    off_t at = lseek(_fd, 0, SEEK_CUR);
+    if (at < 0) _fail("lseek");
+    return (size_t) at;
+  }
+
+  void seek(size_t offset) {
+    if (lseek(_fd, (off_t) offset, SEEK_SET) < 0) _fail("lseek");
+  }
+
+  // Tells the kernel to read ahead aggressively for sequential reads
+  void sequential() {
+    posix_fadvise(_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+
+  // Up to size bytes from the current position; 0 at the end
+  size_t read(void *buffer, size_t size) {
+    while (true) {
+      ssize_t got = ::read(_fd, buffer, size);
+      if (got >= 0) return (size_t) got;
+      if (errno != EINTR) _fail("read");
+    }
+  }
+
+  // Reads straight into the queue's free space (growing it to at_most first); 0 at the end
+  template<class Storage> size_t read(RoundQueue<unsigned char, Storage> &queue, int at_most) {
+    while (true) {
+      ssize_t got = read_into(queue, _fd, at_most);
+      if (got >= 0) return (size_t) got;
+      if (errno != EINTR) _fail("readv");
+    }
+  }
+
+  /* Calls f(const unsigned char *data, size_t size) for the rest of the file, chunk bytes at a
+   * time, through one reused buffer. Returning false from f stops early.
+  */
+  template<class F> void stream(F &&f, size_t chunk = CHUNK) {
+    std::unique_ptr<unsigned char[]> buffer(new unsigned char[chunk]);
+    sequential();
+    while (size_t got = read(buffer.get(), chunk)) {
+      if (!f((const unsigned char *) buffer.get(), got)) break;
+    }
+  }
+
+  // Reads exactly size bytes at offset, or throws
+  void read_at(void *buffer, size_t size, size_t offset) const {
+    size_t done = 0;
+    while (done < size) {
+      ssize_t got = pread(_fd, (char *) buffer + done, size - done, (off_t) (offset + done));
+      if (got > 0) done += (size_t) got;
+      else if (got == 0) throw std::out_of_range(_path + ": reading past the end");
+      else if (errno != EINTR) _fail("pread");
+    }
+  }
+
+  void write_at(const void *buffer, size_t size, size_t offset) {
+    size_t done = 0;
+    while (done < size) {
+      ssize_t put = pwrite(_fd, (const char *) buffer + done, size - done, (off_t) (offset + done));
+      if (put >= 0) done += (size_t) put;
+      else if (errno != EINTR) _fail("pwrite");
+    }
+  }
+
+  void write(const void *buffer, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+      ssize_t put = ::write(_fd, (const char *) buffer + done, size - done);
+      if (put >= 0) done += (size_t) put;
+      else if (errno != EINTR) _fail("write");
+    }
+  }
+
+  // The whole file as a string, for small files
+  std::string read_all() const {
+    std::string contents(size(), '\0');
+    read_at(&contents[0], contents.size(), 0);
+    return contents;
+  }
+};
+
+/* A directory. Enumeration reads raw entries with getdents64 into one reused buffer and hands
+ * them out as views into it, so listing allocates nothing per entry. Names are only valid during
+ * the callback. stat_each() adds statx metadata, looked up relative to the open directory so no
+ * paths are built.
+*/
+class FileDir {
+public:
+  // DT_* values from <dirent.h>: DT_REG, DT_DIR, DT_LNK, ... DT_UNKNOWN on some file systems
+  struct Entry {
+    const char *name;
+    uint64_t inode;
+    unsigned char type;
+  };
+
+  static constexpr size_t BUFFER = (size_t) 64 << 10;
+private:
+  // The layout getdents64 fills in
+  struct RawEntry {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+  };
+
+  int _fd = -1;
+  std::string _path;
+  std::unique_ptr<unsigned char[]> _buffer;
+
+  [[noreturn]] void _fail(const char *call) const {
+    throw std::runtime_error(_path + ": " + call + " failed: " + strerror(errno));
+  }
+public:
+  explicit FileDir(const std::string &path) : _path(path), _buffer(new unsigned char[BUFFER]) {
+    _fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (_fd < 0) _fail("open");
+  }
+
+  FileDir(const FileDir &) = delete;
+  FileDir &operator=(const FileDir &) = delete;
+  FileDir(FileDir &&other) noexcept : _fd(other._fd), _path(std::move(other._path)), _buffer(std::move(other._buffer)) {
+    other._fd = -1;
+  }
+  ~FileDir() {
+    if (_fd >= 0) close(_fd);
+  }
+
+  int fd() const { return _fd; }
+  const std::string &path() const { return _path; }
+
+  // Opens an entry of this directory
+  File open(const char *name, File::Mode mode = File::READ) const { return File(_path + "/" + name, mode); }
+  FileDir subdirectory(const char *name) const { return FileDir(_path + "/" + name); }
+
+  // Calls f(const Entry &) for every entry but "." and "..". Returning false from f stops early.
+  template<class F> void for_each(F &&f) {
+    if (lseek(_fd, 0, SEEK_SET) < 0) _fail("lseek");
+    while (true) {
+      long got = syscall(SYS_getdents64, _fd, _buffer.get(), BUFFER);
+      if (got < 0) {
+        if (errno == EINTR) continue;
+        _fail("getdents64");
+      }
+      if (got == 0) return;
+      for (long at = 0; at < got;) {
+        const RawEntry *raw = (const RawEntry *) (_buffer.get() + at);
+        at += raw->d_reclen;
+        const char *name = raw->d_name;
+        if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) continue;
+        if (!f(Entry{name, raw->d_ino, raw->d_type})) return;
+      }
+    }
+  }
+
+  /* Calls f(const Entry &, const struct statx &) for every entry, with the fields in mask filled
+   * in. Symlinks are described, not followed. Entries that vanish in between are skipped.
+  */
+  template<class F> void stat_each(F &&f, unsigned mask = STATX_TYPE | STATX_SIZE | STATX_MTIME) {
+    struct statx info;
+    for_each([&](const Entry &entry) {
+      if (statx(_fd, entry.name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, mask, &info) != 0) {
+        if (errno == ENOENT) return true;
+        _fail("statx");
+      }
+      return (bool) f(entry, (const struct statx &) info);
+    });
+  }
+
+  size_t count() {
+    size_t n = 0;
+    for_each([&](const Entry &) { return ++n, true; });
+    return n;
+  }
+
+  // Names of all entries, for when they need to outlive the enumeration
+  std::vector<std::string> list() {
+    std::vector<std::string> names;
+    for_each([&](const Entry &entry) { return names.emplace_back(entry.name), true; });
+    return names;
+  }
+};
+
+#endif // _FILE_H_
@@ -0,0 +1,102 @@
+#ifndef _MIRRORED_RING_H_
+#define _MIRRORED_RING_H_
+
+#include "RoundQueue.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* RoundQueue storage for Linux that maps the same memory twice, back to back. Element i and
+ * element i + capacity are the same memory, so a run that wraps around the end is still one
+ * contiguous span: readable() and writable() never return a second piece, and parsers can look at
+ * the whole queue through one pointer. Only for trivially copyable T; capacities are powers of two
+ * large enough to fill whole pages.
+*/
+template<class T> struct MirroredStorage {
+  static_assert(std::is_trivially_copyable<T>::value, "Mirrored storage only holds trivially copyable types");
+
+  static constexpr bool MIRRORED = true;
+
+  static int round_up(int size) {
+    // The buffer must be whole pages: at least page / (largest power of two dividing sizeof(T))
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t minimum = page / (sizeof(T) & (~sizeof(T) + 1));
+    if (minimum == 0) minimum = 1;
+    size_t capacity = 1;
+    while (capacity < (size_t) size || capacity < minimum) capacity <<= 1;
+    if (capacity * sizeof(T) > ((size_t) 1 << 30)) throw std::length_error("RoundQueue too large");
+    return (int) capacity;
+  }
+
+  static T *allocate(int capacity) {
+    size_t bytes = (size_t) capacity * sizeof(T);
+    int fd = memfd_create("RoundQueue", MFD_CLOEXEC);
+    if (fd < 0) _fail("memfd_create");
+    if (ftruncate(fd, (off_t) bytes) != 0) {
+      close(fd);
+      _fail("ftruncate");
+    }
+    // Reserve both halves first so nothing else can land in between
+    char *base = (char *) mmap(nullptr, 2 * bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+      close(fd);
+      _fail("mmap");
+    }
+    for (int half = 0; half < 2; ++half) {
+      void *mapped = mmap(base + half * bytes, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+      if (mapped == MAP_FAILED) {
+        munmap(base, 2 * bytes);
+        close(fd);
+        _fail("mmap");
+      }
+    }
+    // The mappings keep the memory alive
+    close(fd);
+    return (T *) base;
+  }
+
+  static void release(T *data, int capacity) {
+    munmap((void *) data, 2 * (size_t) capacity * sizeof(T));
+  }
+
+  [[noreturn]] static void _fail(const char *call) {
+    throw std::runtime_error(std::string("Mirrored RoundQueue: ") + call + " failed: " + strerror(errno));
+  }
+};
+
+template<class T> using MirroredRoundQueue = RoundQueue<T, MirroredStorage<T>>;
+
+/* Moves bytes between a file descriptor and a byte queue without staging copies: reads land
+ * directly in the free space (grown first so that at_most fit), writes come straight from the
+ * queued bytes. Works with either storage; heap queues use two iovecs when the region wraps.
+ * Return what read(2)/write(2) return; the queue only changes by what was transferred.
+*/
+template<class T, class Storage> ssize_t read_into(RoundQueue<T, Storage> &queue, int fd, int at_most) {
+  static_assert(sizeof(T) == 1, "read_into is for byte queues");
+  typename RoundQueue<T, Storage>::Regions free = queue.writable(at_most);
+  int first = free.first.size < at_most ? free.first.size : at_most;
+  int second = free.second.size < at_most - first ? free.second.size : at_most - first;
+  struct iovec parts[2] = {{free.first.data, (size_t) first}, {free.second.data, (size_t) second}};
+  ssize_t got = readv(fd, parts, second ? 2 : 1);
+  if (got > 0) queue.commit((int) got);
+  return got;
+}
+
+template<class T, class Storage> ssize_t write_from(RoundQueue<T, Storage> &queue, int fd) {
+  static_assert(sizeof(T) == 1, "write_from is for byte queues");
+  typename RoundQueue<T, Storage>::Regions used = queue.readable();
+  if (used.size() == 0) return 0;
+  struct iovec parts[2] = {{used.first.data, (size_t) used.first.size}, {used.second.data, (size_t) used.second.size}};
+  ssize_t sent = writev(fd, parts, used.second.size ? 2 : 1);
+  if (sent > 0) queue.consume((int) sent);
+  return sent;
+}
+
+#endif // _MIRRORED_RING_H_
@@ -0,0 +1,704 @@
+#ifndef _NETWORKING_H_
+#define _NETWORKING_H_
+
+#include "concurrent_events.cpp"
+#include "MirroredRing.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Networking core for NetworkingServer and NetworkingClient: one event loop per core, each a
+ * thread around an edge-triggered epoll instance that owns its sockets outright, so no locks are
+ * taken per message.
+ *  - TCP carries messages framed by a little-endian 32-bit length. Listening sockets are opened
+ *    once per loop with SO_REUSEPORT and the kernel spreads new connections across them.
+ *    Connections only hold a receive buffer while they have a partial frame; the buffers come
+ *    from a per-loop pool.
+ *  - UDP sockets are also one per loop on a shared port, read and written in batches with
+ *    recvmmsg/sendmmsg.
+ * Received messages are delivered through ConcurrentEvents, on the loop's thread; with several
+ * loops, listeners run concurrently. The data they see is only valid during the call.
+ * IPv4 only.
+*/
+
+typedef uint64_t ConnectionId;
+
+struct NetMessage {
+  ConnectionId connection; // 0 for datagrams
+  const unsigned char *data;
+  uint32_t size;
+  const sockaddr_in *from; // Datagrams only
+  int loop;
+};
+
+struct NetConfig {
+  int loops = 0;            // 0 for one per core
+  bool pin = true;          // Pin loop i to core i
+  size_t buffer_size = 64 << 10;
+  uint32_t max_frame = 1 << 20; // Larger frames close the connection
+  int udp_batch = 64;       // Datagrams per recvmmsg/sendmmsg
+  size_t udp_size = 2048;   // Larger datagrams are dropped
+};
+
+// Fixed-size receive buffers, recycled within one loop
+class NetBufferPool {
+  std::vector<unsigned char *> _free;
+  size_t _size;
+public:
+  explicit NetBufferPool(size_t size) : _size(size) {}
+  NetBufferPool(const NetBufferPool &) = delete;
+  NetBufferPool &operator=(const NetBufferPool &) = delete;
+  ~NetBufferPool() {
+    for (unsigned char *buffer : _free) delete[] buffer;
+  }
+
+  size_t buffer_size() const { return _size; }
+  size_t idle() const { return _free.size(); }
+
+  unsigned char *acquire() {
+    if (_free.empty()) return new unsigned char[_size];
+    unsigned char *buffer = _free.back();
+    _free.pop_back();
+    return buffer;
+  }
+
+  void release(unsigned char *buffer) { _free.push_back(buffer); }
+};
+
+class NetReactor;
+
+class NetLoop {
+  friend class NetReactor;
+
+  static constexpr uint64_t TAG_WAKE = ~(uint64_t) 0, TAG_LISTEN = TAG_WAKE - 1, TAG_UDP = TAG_WAKE - 2;
+  static constexpr int PAGE_BITS = 10, MAX_PAGES = 256;
+
+  struct Connection {
+    int fd = -1;
+    uint32_t generation = 1; // Never 0, so no connection id is 0
+    bool connecting = false, dirty = false;
+    unsigned char *in = nullptr;
+    size_t in_used = 0, in_capacity = 0;
+    RoundQueue<unsigned char> out;
+  };
+
+  // Work handed to the loop from other threads; payloads live in a shared byte vector
+  struct Command {
+    enum Type { ADOPT, SEND, CLOSE, DATAGRAM } type;
+    ConnectionId id;
+    int fd;
+    uint32_t offset, size;
+    sockaddr_in to;
+  };
+
+  struct Datagram {
+    sockaddr_in to;
+    uint32_t offset, size;
+  };
+
+  NetReactor &_reactor;
+  int _index;
+  const NetConfig &_config;
+  int _epoll = -1, _wake = -1, _listen = -1, _udp = -1;
+  std::thread _thread;
+  std::atomic<bool> _running{false};
+  NetBufferPool _pool;
+
+  // Any thread may claim a slot (connect), but only the loop fills it in and uses it
+  std::mutex _slot_lock;
+  Connection *_pages[MAX_PAGES] = {};
+  std::vector<uint32_t> _free_slots;
+  std::atomic<uint32_t> _slot_count{0};
+
+  std::mutex _outbox_lock;
+  std::vector<Command> _outbox;
+  std::vector<unsigned char> _outbox_bytes;
+  std::atomic<bool> _woken{false};
+  // Swapped with the outbox, so both keep their capacity
+  std::vector<Command> _inbox;
+  std::vector<unsigned char> _inbox_bytes;
+
+  std::vector<uint32_t> _dirty;
+  std::vector<Datagram> _udp_pending;
+  std::vector<unsigned char> _udp_bytes;
+  size_t _udp_sent = 0;
+
+  std::vector<mmsghdr> _messages;
+  std::vector<iovec> _parts;
+  std::vector<sockaddr_in> _addresses;
+  std::unique_ptr<unsigned char[]> _udp_buffer;
+
+  static NetLoop *&_current() {
+    static thread_local NetLoop *loop = nullptr;
+    return loop;
+  }
+
+  static uint32_t _slot_of(ConnectionId id) { return (uint32_t) id & 0xffffff; }
+  static uint32_t _generation_of(ConnectionId id) { return (uint32_t) (id >> 32); }
+  ConnectionId _id(uint32_t slot, uint32_t generation) const {
+    return (uint64_t) generation << 32 | (uint64_t) _index << 24 | slot;
+  }
+
+  Connection &_slot(uint32_t slot) { return _pages[slot >> PAGE_BITS][slot & ((1 << PAGE_BITS) - 1)]; }
+
+  // Null if the id is stale
+  Connection *_find(ConnectionId id) {
+    uint32_t slot = _slot_of(id);
+    if (slot >= _slot_count.load(std::memory_order_acquire)) return nullptr;
+    Connection &connection = _slot(slot);
+    return connection.fd >= 0 && connection.generation == _generation_of(id) ? &connection : nullptr;
+  }
+
+  ConnectionId _claim() {
+    std::lock_guard<std::mutex> lock(_slot_lock);
+    uint32_t slot;
+    if (!_free_slots.empty()) {
+      slot = _free_slots.back();
+      _free_slots.pop_back();
+    } else {
+      slot = _slot_count.load(std::memory_order_relaxed);
+      if (slot == (uint32_t) MAX_PAGES << PAGE_BITS) throw std::runtime_error("NetLoop: too many connections");
+      if (!_pages[slot >> PAGE_BITS]) _pages[slot >> PAGE_BITS] = new Connection[1 << PAGE_BITS];
+      _slot_count.store(slot + 1, std::memory_order_release);
+    }
+    return _id(slot, _slot(slot).generation);
+  }
+
+  // Loop only
+  void _adopt(ConnectionId id, int fd, bool connecting) {
+    Connection &connection = _slot(_slot_of(id));
+    connection.fd = fd;
+    connection.connecting = connecting;
+    _watch(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP, id);
+  }
+
+  void _wake_up() {
+    if (_woken.exchange(true)) return;
+    uint64_t one = 1;
+    (void) !::write(_wake, &one, sizeof(one));
+  }
+
+  void _post(Command command, const void *data, uint32_t size) {
+    {
+      std::lock_guard<std::mutex> lock(_outbox_lock);
+      command.offset = (uint32_t) _outbox_bytes.size();
+      command.size = size;
+      _outbox_bytes.insert(_outbox_bytes.end(), (const unsigned char *) data, (const unsigned char *) data + size);
+      _outbox.push_back(command);
+    }
+    _wake_up();
+  }
+
+  void _watch(int fd, uint32_t events, uint64_t tag) {
+    epoll_event event;
+    event.events = events | EPOLLET;
+    event.data.u64 = tag;
+    if (epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &event) != 0) _fail("epoll_ctl");
+  }
+
+  [[noreturn]] static void _fail(const char *call) {
+    throw std::runtime_error(std::string("NetLoop: ") + call + " failed: " + strerror(errno));
+  }
+
+  void _release_input(Connection &connection) {
+    if (!connection.in) return;
+    if (connection.in_capacity == _pool.buffer_size()) _pool.release(connection.in);
+    else delete[] connection.in;
+    connection.in = nullptr;
+    connection.in_used = connection.in_capacity = 0;
+  }
+
+  void _queue_frame(Connection &connection, ConnectionId id, const void *data, uint32_t size) {
+    unsigned char header[4] = {(unsigned char) size, (unsigned char) (size >> 8), (unsigned char) (size >> 16), (unsigned char) (size >> 24)};
+    connection.out.push_n(header, 4);
+    connection.out.push_n((const unsigned char *) data, (int) size);
+    if (!connection.dirty) {
+      connection.dirty = true;
+      _dirty.push_back(_slot_of(id));
+    }
+  }
+
+  void _close(ConnectionId id);
+  void _accept();
+  void _read(ConnectionId id, Connection &connection);
+  void _flush(ConnectionId id, Connection &connection);
+  void _receive_datagrams();
+  void _flush_datagrams();
+  void _drain_inbox();
+  void _run();
+public:
+  NetLoop(NetReactor &reactor, int index, const NetConfig &config);
+  NetLoop(const NetLoop &) = delete;
+  NetLoop &operator=(const NetLoop &) = delete;
+  ~NetLoop();
+
+  int index() const { return _index; }
+  size_t pooled_buffers() const { return _pool.idle(); }
+};
+
+class NetReactor {
+  friend class NetLoop;
+
+  NetConfig _config;
+  std::vector<std::unique_ptr<NetLoop>> _loops;
+  std::atomic<uint32_t> _next_loop{0};
+  bool _started = false;
+
+  NetLoop *_loop_of(ConnectionId id) {
+    uint32_t index = (uint32_t) (id >> 24) & 0xff;
+    return index < _loops.size() ? _loops[index].get() : nullptr;
+  }
+
+  // One socket per loop on the same port; returns the port (useful when asking for port 0)
+  uint16_t _bind_each(int type, uint16_t port, const char *host, int NetLoop::*member) {
+    sockaddr_in address = NetReactor::address(host, port);
+    for (std::unique_ptr<NetLoop> &loop : _loops) {
+      int fd = socket(AF_INET, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (fd < 0) NetLoop::_fail("socket");
+      int one = 1;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+      if (bind(fd, (const sockaddr *) &address, sizeof(address)) != 0) {
+        ::close(fd);
+        NetLoop::_fail("bind");
+      }
+      if (type == SOCK_STREAM && ::listen(fd, SOMAXCONN) != 0) {
+        ::close(fd);
+        NetLoop::_fail("listen");
+      }
+      socklen_t length = sizeof(address);
+      getsockname(fd, (sockaddr *) &address, &length);
+      (*loop).*member = fd;
+    }
+    return ntohs(address.sin_port);
+  }
+public:
+  // Called on loop threads; see the top of the file
+  ConcurrentEvent<ConnectionId> connected;    // Accepted, or an outgoing connect succeeded
+  ConcurrentEvent<ConnectionId> disconnected; // Including outgoing connects that failed
+  ConcurrentEvent<const NetMessage &> received;
+  ConcurrentEvent<const NetMessage &> datagram;
+
+  explicit NetReactor(NetConfig config = NetConfig()) : _config(config) {
+    if (_config.loops <= 0) _config.loops = (int) std::thread::hardware_concurrency();
+    if (_config.loops <= 0) _config.loops = 1;
+    if (_config.loops > 256) _config.loops = 256;
+    for (int i = 0; i < _config.loops; ++i) _loops.emplace_back(new NetLoop(*this, i, _config));
+  }
+
+  NetReactor(const NetReactor &) = delete;
+  NetReactor &operator=(const NetReactor &) = delete;
+  virtual ~NetReactor() { stop(); }
+
+  int loop_count() const { return (int) _loops.size(); }
+  const NetLoop &loop(int index) const { return *_loops[index]; }
+
+  static sockaddr_in address(const char *host, uint16_t port) {
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &address.sin_addr) == 1) return address;
+    addrinfo hints, *found = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    if (getaddrinfo(host, nullptr, &hints, &found) != 0 || !found)
+      throw std::runtime_error(std::string("NetReactor: can't resolve ") + host);
+    address.sin_addr = ((sockaddr_in *) found->ai_addr)->sin_addr;
+    freeaddrinfo(found);
+    return address;
+  }
+
+  // Before start(). Returns the port, which is chosen by the system when port is 0.
+  uint16_t listen(uint16_t port, const char *host = "0.0.0.0") {
+    if (_started) throw std::runtime_error("NetReactor: listen after start");
+    return _bind_each(SOCK_STREAM, port, host, &NetLoop::_listen);
+  }
+
+  uint16_t bind_udp(uint16_t port, const char *host = "0.0.0.0") {
+    if (_started) throw std::runtime_error("NetReactor: bind_udp after start");
+    return _bind_each(SOCK_DGRAM, port, host, &NetLoop::_udp);
+  }
+
+  void start();
+  void stop();
+
+  // Starts connecting on the next loop in turn; connected or disconnected follows
+  ConnectionId connect(const char *host, uint16_t port) {
+    sockaddr_in to = address(host, port);
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) NetLoop::_fail("socket");
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (::connect(fd, (const sockaddr *) &to, sizeof(to)) != 0 && errno != EINPROGRESS) {
+      ::close(fd);
+      NetLoop::_fail("connect");
+    }
+    NetLoop &loop = *_loops[_next_loop.fetch_add(1) % _loops.size()];
+    ConnectionId id;
+    try {
+      id = loop._claim();
+    } catch (...) {
+      ::close(fd);
+      throw;
+    }
+    loop._post(NetLoop::Command{NetLoop::Command::ADOPT, id, fd, 0, 0, {}}, nullptr, 0);
+    return id;
+  }
+
+  // Queues one message. From the connection's own loop (e.g. in a listener) this takes no lock.
+  void send(ConnectionId id, const void *data, uint32_t size) {
+    NetLoop *loop = _loop_of(id);
+    if (!loop) return;
+    if (NetLoop::_current() == loop) {
+      if (NetLoop::Connection *connection = loop->_find(id)) loop->_queue_frame(*connection, id, data, size);
+      return;
+    }
+    loop->_post(NetLoop::Command{NetLoop::Command::SEND, id, -1, 0, 0, {}}, data, size);
+  }
+
+  // Sent from the calling loop's socket, or loop 0's when called from elsewhere
+  void send_udp(const sockaddr_in &to, const void *data, uint32_t size) {
+    NetLoop *loop = NetLoop::_current();
+    if (loop && &loop->_reactor == this) {
+      loop->_udp_pending.push_back(NetLoop::Datagram{to, (uint32_t) loop->_udp_bytes.size(), size});
+      loop->_udp_bytes.insert(loop->_udp_bytes.end(), (const unsigned char *) data, (const unsigned char *) data + size);
+      return;
+    }
+    _loops[0]->_post(NetLoop::Command{NetLoop::Command::DATAGRAM, 0, -1, 0, 0, to}, data, size);
+  }
+
+  void close(ConnectionId id) {
+    NetLoop *loop = _loop_of(id);
+    if (!loop) return;
+    if (NetLoop::_current() == loop) loop->_close(id);
+    else loop->_post(NetLoop::Command{NetLoop::Command::CLOSE, id, -1, 0, 0, {}}, nullptr, 0);
+  }
+};
+
+// Accepts connections and datagrams on one port. Subscribe to the events, then start().
+class NetworkingServer : public NetReactor {
+  uint16_t _port;
+public:
+  explicit NetworkingServer(uint16_t port, NetConfig config = NetConfig()) : NetReactor(config) {
+    _port = listen(port);
+    bind_udp(_port);
+  }
+
+  uint16_t port() const { return _port; }
+};
+
+// Connects out; one loop unless configured otherwise. Subscribe to the events, then start().
+class NetworkingClient : public NetReactor {
+  static NetConfig _single(NetConfig config) {
+    if (config.loops <= 0) config.loops = 1;
+    return config;
+  }
+public:
+  explicit NetworkingClient(NetConfig config = NetConfig()) : NetReactor(_single(config)) {}
+};
+
+inline NetLoop::NetLoop(NetReactor &reactor, int index, const NetConfig &config) :
+  _reactor(reactor), _index(index), _config(config), _pool(config.buffer_size)
+{
+  _epoll = epoll_create1(EPOLL_CLOEXEC);
+  if (_epoll < 0) _fail("epoll_create1");
+  _wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (_wake < 0) _fail("eventfd");
+  _watch(_wake, EPOLLIN, TAG_WAKE);
+
+  int batch = config.udp_batch;
+  _messages.resize(batch);
+  _parts.resize(batch);
+  _addresses.resize(batch);
+  _udp_buffer.reset(new unsigned char[batch * config.udp_size]);
+}
+
+inline NetLoop::~NetLoop() {
+  for (uint32_t slot = 0; slot < _slot_count.load(); ++slot) {
+    Connection &connection = _slot(slot);
+    if (connection.fd >= 0) ::close(connection.fd);
+    _release_input(connection);
+  }
+  for (Connection *page : _pages) delete[] page;
+  if (_listen >= 0) ::close(_listen);
+  if (_udp >= 0) ::close(_udp);
+  ::close(_wake);
+  ::close(_epoll);
+}
+
+inline void NetLoop::_close(ConnectionId id) {
+  Connection *connection = _find(id);
+  if (!connection) return;
+  ::close(connection->fd);
+  connection->fd = -1;
+  _release_input(*connection);
+  connection->out.clear();
+  connection->dirty = false;
+  {
+    std::lock_guard<std::mutex> lock(_slot_lock);
+    connection->generation++;
+    _free_slots.push_back(_slot_of(id));
+  }
+  _reactor.disconnected.call(id);
+}
+
+inline void NetLoop::_accept() {
+  while (true) {
+    int fd = accept4(_listen, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      return; // EAGAIN, or out of descriptors until some close
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    ConnectionId id;
+    try {
+      id = _claim();
+    } catch (const std::runtime_error &) {
+      ::close(fd);
+      continue;
+    }
+    _adopt(id, fd, false);
+    _reactor.connected.call(id);
+  }
+}
+
+// Reads until the socket is drained (edge-triggered), delivering every complete frame
+inline void NetLoop::_read(ConnectionId id, Connection &connection) {
+  while (true) {
+    if (!connection.in) {
+      connection.in = _pool.acquire();
+      connection.in_capacity = _pool.buffer_size();
+    }
+    ssize_t got = 0;
+    if (connection.in_used < connection.in_capacity) {
+      got = ::read(connection.fd, connection.in + connection.in_used, connection.in_capacity - connection.in_used);
+      if (got == 0) return _close(id);
+      if (got < 0) {
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN) return _close(id);
+      } else {
+        connection.in_used += (size_t) got;
+        if (connection.in_used < connection.in_capacity) continue;
+      }
+    }
+
+    // Drained or full: deliver what is complete, keep the rest at the front
+    size_t at = 0;
+    uint32_t needed = 0;
+    while (connection.in_used - at >= 4) {
+      const unsigned char *p = connection.in + at;
+      uint32_t size = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+      if (size > _config.max_frame) return _close(id);
+      if (connection.in_used - at < 4 + (size_t) size) {
+        needed = 4 + size;
+        break;
+      }
+      _reactor.received.call(NetMessage{id, p + 4, size, nullptr, _index});
+      // A listener may have closed it
+      if (!_find(id)) return;
+      at += 4 + size;
+    }
+    size_t left = connection.in_used - at;
+    if (left == 0) _release_input(connection);
+    else {
+      if (at) memmove(connection.in, connection.in + at, left);
+      connection.in_used = left;
+      // A frame larger than a pooled buffer gets its own
+      if (needed > connection.in_capacity) {
+        unsigned char *bigger = new unsigned char[needed];
+        memcpy(bigger, connection.in, left);
+        _release_input(connection);
+        connection.in = bigger;
+        connection.in_used = left;
+        connection.in_capacity = needed;
+      }
+    }
+    if (got < 0) return; // EAGAIN
+  }
+}
+
+inline void NetLoop::_flush(ConnectionId id, Connection &connection) {
+  while (!connection.out.empty()) {
+    ssize_t sent = write_from(connection.out, connection.fd);
+    if (sent < 0) {
+      if (errno == EINTR) continue;
+      if (errno != EAGAIN) _close(id);
+      return; // EPOLLOUT says when to go on
+    }
+  }
+}
+
+inline void NetLoop::_receive_datagrams() {
+  int batch = (int) _messages.size();
+  while (true) {
+    for (int i = 0; i < batch; ++i) {
+      _parts[i] = iovec{_udp_buffer.get() + i * _config.udp_size, _config.udp_size};
+      memset(&_messages[i].msg_hdr, 0, sizeof(msghdr));
+      _messages[i].msg_hdr.msg_name = &_addresses[i];
+      _messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+      _messages[i].msg_hdr.msg_iov = &_parts[i];
+      _messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    int got = recvmmsg(_udp, _messages.data(), batch, MSG_DONTWAIT, nullptr);
+    if (got < 0) {
+      if (errno == EINTR) continue;
+      return;
+    }
+    for (int i = 0; i < got; ++i) {
+      if (_messages[i].msg_hdr.msg_flags & MSG_TRUNC) continue;
+      _reactor.datagram.call(NetMessage{0, (const unsigned char *) _parts[i].iov_base, _messages[i].msg_len, &_addresses[i], _index});
+    }
+    if (got < batch) return;
+  }
+}
+
+inline void NetLoop::_flush_datagrams() {
+  int batch = (int) _messages.size();
+  while (_udp_sent < _udp_pending.size()) {
+    int count = 0;
+    for (size_t i = _udp_sent; i < _udp_pending.size() && count < batch; ++i, ++count) {
+      Datagram &d = _udp_pending[i];
+      _parts[count] = iovec{_udp_bytes.data() + d.offset, d.size};
+      memset(&_messages[count].msg_hdr, 0, sizeof(msghdr));
+      _messages[count].msg_hdr.msg_name = &d.to;
+      _messages[count].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+      _messages[count].msg_hdr.msg_iov = &_parts[count];
+      _messages[count].msg_hdr.msg_iovlen = 1;
+    }
+    int sent = sendmmsg(_udp, _messages.data(), count, MSG_DONTWAIT);
+    if (sent < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN) return; // EPOLLOUT says when to go on
+      sent = 1; // Drop the one that failed, as the network would
+    }
+    _udp_sent += (size_t) sent;
+  }
+  _udp_pending.clear();
+  _udp_bytes.clear();
+  _udp_sent = 0;
+}
+
+inline void NetLoop::_drain_inbox() {
+  uint64_t count;
+  (void) !::read(_wake, &count, sizeof(count));
+  _woken.store(false);
+  {
+    std::lock_guard<std::mutex> lock(_outbox_lock);
+    _inbox.swap(_outbox);
+    _inbox_bytes.swap(_outbox_bytes);
+  }
+  for (const Command &command : _inbox) {
+    const unsigned char *data = _inbox_bytes.data() + command.offset;
+    if (command.type == Command::ADOPT) _adopt(command.id, command.fd, true);
+    else if (command.type == Command::SEND) {
+      if (Connection *connection = _find(command.id)) _queue_frame(*connection, command.id, data, command.size);
+    } else if (command.type == Command::CLOSE) {
+      _close(command.id);
+    } else {
+      _udp_pending.push_back(Datagram{command.to, (uint32_t) _udp_bytes.size(), command.size});
+      _udp_bytes.insert(_udp_bytes.end(), data, data + command.size);
+    }
+  }
+  _inbox.clear();
+  _inbox_bytes.clear();
+}
+
+inline void NetLoop::_run() {
+  _current() = this;
+  if (_config.pin) {
+    unsigned cores = std::thread::hardware_concurrency();
+    if (cores > 1) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(_index % cores, &set);
+      pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+  }
+  epoll_event events[256];
+  while (_running.load(std::memory_order_relaxed)) {
+    int count = epoll_wait(_epoll, events, 256, -1);
+    if (count < 0) {
+      if (errno == EINTR) continue;
+      _fail("epoll_wait");
+    }
+    for (int i = 0; i < count; ++i) {
+      uint64_t tag = events[i].data.u64;
+      uint32_t flags = events[i].events;
+      if (tag == TAG_WAKE) _drain_inbox();
+      else if (tag == TAG_LISTEN) _accept();
+      else if (tag == TAG_UDP) {
+        if (flags & EPOLLIN) _receive_datagrams();
+      } else if (Connection *connection = _find(tag)) {
+        if (connection->connecting && (flags & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+          int error = 0;
+          socklen_t length = sizeof(error);
+          getsockopt(connection->fd, SOL_SOCKET, SO_ERROR, &error, &length);
+          if (error) {
+            _close(tag);
+            continue;
+          }
+          connection->connecting = false;
+          _reactor.connected.call(tag);
+          if (!(connection = _find(tag))) continue;
+        }
+        if (flags & EPOLLIN) _read(tag, *connection);
+        if (!(connection = _find(tag))) continue;
+        if (flags & EPOLLOUT) _flush(tag, *connection);
+        if (!(connection = _find(tag))) continue;
+        if (flags & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) _close(tag);
+      }
+    }
+    // Everything queued while handling this batch goes out together
+    for (uint32_t slot : _dirty) {
+      Connection &connection = _slot(slot);
+      connection.dirty = false;
+      if (connection.fd >= 0 && !connection.connecting) _flush(_id(slot, connection.generation), connection);
+    }
+    _dirty.clear();
+    if (!_udp_pending.empty()) _flush_datagrams();
+  }
+  _current() = nullptr;
+}
+
+inline void NetReactor::start() {
+  if (_started) return;
+  _started = true;
+  for (std::unique_ptr<NetLoop> &loop : _loops) {
+    if (loop->_listen >= 0) loop->_watch(loop->_listen, EPOLLIN, NetLoop::TAG_LISTEN);
+    if (loop->_udp >= 0) loop->_watch(loop->_udp, EPOLLIN | EPOLLOUT, NetLoop::TAG_UDP);
+    loop->_running.store(true);
+    loop->_thread = std::thread(&NetLoop::_run, loop.get());
+  }
+}
+
+inline void NetReactor::stop() {
+  for (std::unique_ptr<NetLoop> &loop : _loops) {
+    if (!loop->_running.exchange(false)) continue;
+    uint64_t one = 1;
+    (void) !::write(loop->_wake, &one, sizeof(one));
+    loop->_thread.join();
+  }
+}
+
+#endif // _NETWORKING_H_
@@ -0,0 +1,572 @@
+#ifndef _RESOURCE_MANAGER_H_
+#define _RESOURCE_MANAGER_H_
+
+#include "events.cpp"
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define RESOURCE_MANAGER_URING 1
+#else
+#define RESOURCE_MANAGER_URING 0
+#endif
+
+/* A minimal io_uring for reads, driven with the raw system calls (no liburing). One thread owns
+ * it: queue reads, submit them, then reap completions tagged with what was queued. open() fails
+ * where the kernel has no io_uring or forbids it, and callers fall back to pread.
+*/
+class UringReader {
+#if RESOURCE_MANAGER_URING
+  int _fd = -1;
+  unsigned _sq_entries = 0, _queued = 0;
+  unsigned _in_flight = 0; // Submitted and not reaped yet
+  unsigned *_sq_head, *_sq_tail, *_sq_mask, *_sq_array;
+  unsigned *_cq_head, *_cq_tail, *_cq_mask;
+  io_uring_sqe *_sqes = nullptr;
+  io_uring_cqe *_cqes;
+  void *_sq_ring = MAP_FAILED, *_cq_ring = MAP_FAILED;
+  size_t _sq_ring_size = 0, _cq_ring_size = 0, _sqes_size = 0;
+
+  void _close() {
+    if (_sqes) munmap(_sqes, _sqes_size);
+    if (_cq_ring != MAP_FAILED && _cq_ring != _sq_ring) munmap(_cq_ring, _cq_ring_size);
+    if (_sq_ring != MAP_FAILED) munmap(_sq_ring, _sq_ring_size);
+    if (_fd >= 0) close(_fd);
+    _fd = -1;
+    _sqes = nullptr;
+    _sq_ring = _cq_ring = MAP_FAILED;
+  }
+public:
+  UringReader() {}
+  UringReader(const UringReader &) = delete;
+  UringReader &operator=(const UringReader &) = delete;
+  ~UringReader() { _close(); }
+
+  bool open(unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    _fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if (_fd < 0) return false;
+    _sq_entries = params.sq_entries;
+    _sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && _cq_ring_size > _sq_ring_size) _sq_ring_size = _cq_ring_size;
+    _sq_ring = mmap(nullptr, _sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+    if (_sq_ring == MAP_FAILED) return _close(), false;
+    _cq_ring = single ? _sq_ring :
+      mmap(nullptr, _cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+    if (_cq_ring == MAP_FAILED) return _close(), false;
+    _sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) return _close(), false;
+    _sqes = (io_uring_sqe *) sqes;
+
+    char *sq = (char *) _sq_ring, *cq = (char *) _cq_ring;
+    _sq_head = (unsigned *) (sq + params.sq_off.head);
+    _sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    _sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    _sq_array = (unsigned *) (sq + params.sq_off.array);
+    _cq_head = (unsigned *) (cq + params.cq_off.head);
+    _cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    _cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    _cqes = (io_uring_cqe *) (cq + params.cq_off.cqes);
+    return true;
+  }
+
+  // Queues a read of size bytes at offset; false if the submission ring is full
+  bool read(int fd, void *buffer, unsigned size, uint64_t offset, uint64_t tag) {
+    unsigned tail = *_sq_tail;
+    if (tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) >= _sq_entries) return false;
+    unsigned index = tail & *_sq_mask;
+    io_uring_sqe *sqe = &_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) buffer;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = tag;
+    _sq_array[index] = index;
+    __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    _queued++;
+    return true;
+  }
+
+  // Submits everything queued and waits for at least one completion. -errno on failure.
+  int submit_and_wait() {
+    while (true) {
+      int submitted = (int) syscall(__NR_io_uring_enter, _fd, _queued, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (submitted >= 0) {
+        _queued -= (unsigned) submitted;
+        _in_flight += (unsigned) submitted;
+        return submitted;
+      }
+      if (errno != EINTR) return -errno;
+    }
+  }
+
+  // Waits for a completion without submitting anything. -errno on failure.
+  int wait() {
+    while (true) {
+      if (syscall(__NR_io_uring_enter, _fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) >= 0) return 0;
+      if (errno != EINTR) return -errno;
+    }
+  }
+
+  // Reads the kernel has and may still be writing into the buffers of
+  unsigned in_flight() const { return _in_flight; }
+
+  // The next completion: the read's tag and what read(2) would have returned (-errno on failure)
+  bool reap(uint64_t &tag, int &result) {
+    unsigned head = *_cq_head;
+    if (head == __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE)) return false;
+    const io_uring_cqe &cqe = _cqes[head & *_cq_mask];
+    tag = cqe.user_data;
+    result = cqe.res;
+    __atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+    _in_flight--;
+    return true;
+  }
+#else
+public:
+  bool open(unsigned) { return false; }
+  bool read(int, void *, unsigned, uint64_t, uint64_t) { return false; }
+  int submit_and_wait() { return -ENOSYS; }
+  int wait() { return -ENOSYS; }
+  unsigned in_flight() const { return 0; }
+  bool reap(uint64_t &, int &) { return false; }
+#endif
+};
+
+/* Loads files on background I/O threads and keeps them in memory within a byte budget.
+ *
+ * load(path) returns a Handle at once; the bytes arrive later (wait() or data() block until then).
+ * Asking for a path that is already cached or on its way returns the same resource, so concurrent
+ * requests read the file only once. prefetch(path) queues a load behind every load() and without
+ * a handle, for data that will probably be wanted soon.
+ *
+ * Loaded bytes count against the budget. When it is exceeded, a clock sweep evicts resources
+ * nobody holds a Handle to, passing over ones requested since the last sweep (so prefetched
+ * data that was never asked for goes first). Held resources are never evicted, so the budget can
+ * be overrun while they are held. Failed loads are not cached; loading the path again retries.
+ *
+ * Workers read with io_uring, a batch of files per system call, where the kernel allows it, and
+ * with pread otherwise. Completions are announced through the loaded and evicted events, called
+ * from poll() on whichever thread calls it (typically once per frame on the main thread).
+*/
+class ResourceManager {
+public:
+  enum class State { PENDING, LOADING, READY, FAILED };
+  static constexpr int BATCH = 32;
+private:
+  struct Entry {
+    std::string path;
+    std::atomic<State> state{State::PENDING};
+    std::unique_ptr<unsigned char[]> data;
+    size_t size = 0;
+    std::string error;
+    std::atomic<int> handles{0};
+    std::atomic<bool> referenced{false};
+    // Guarded by the manager's lock
+    bool urgent = false, cached = false, evicted = false;
+    std::promise<void> promise;
+    std::shared_future<void> done;
+
+    explicit Entry(const std::string &path) : path(path), done(promise.get_future().share()) {}
+  };
+public:
+  // A resource being loaded or loaded. Resources are not evicted while a Handle to them exists.
+  class Handle {
+    std::shared_ptr<Entry> _entry;
+
+    explicit Handle(std::shared_ptr<Entry> entry) : _entry(std::move(entry)) {
+      if (_entry) _entry->handles.fetch_add(1);
+    }
+    friend class ResourceManager;
+  public:
+    Handle() {}
+    Handle(const Handle &other) : Handle(other._entry) {}
+    Handle(Handle &&other) noexcept : _entry(std::move(other._entry)) {}
+    Handle &operator=(Handle other) noexcept {
+      std::swap(_entry, other._entry);
+      return *this;
+    }
+    ~Handle() {
+      if (_entry) _entry->handles.fetch_sub(1);
+    }
+
+    explicit operator bool() const { return (bool) _entry; }
+    bool operator==(const Handle &other) const { return _entry == other._entry; }
+    bool operator!=(const Handle &other) const { return _entry != other._entry; }
+
+    const std::string &path() const { return _entry->path; }
+    State state() const { return _entry->state.load(std::memory_order_acquire); }
+    bool ready() const { return state() == State::READY; }
+    bool failed() const { return state() == State::FAILED; }
+
+    void wait() const { _entry->done.wait(); }
+
+    // Waits; the reason a load failed, empty if it did not
+    const std::string &error() const {
+      wait();
+      return _entry->error;
+    }
+
+    // Waits, then the file's bytes. Throws std::runtime_error if the load failed.
+    std::string_view data() const {
+      wait();
+      if (failed()) throw std::runtime_error(_entry->path + ": " + _entry->error);
+      return std::string_view((const char *) _entry->data.get(), _entry->size);
+    }
+
+    size_t size() const { return data().size(); }
+  };
+
+  // Called by poll(). Failed loads are announced too; check handle.failed().
+  Event<const Handle &> loaded;
+  Event<const std::string &> evicted;
+private:
+  struct Read {
+    std::shared_ptr<Entry> entry;
+    int fd = -1;
+    size_t done = 0;
+    std::string error;
+    bool queued = false; // On the ring, until its completion is reaped
+  };
+
+  std::mutex _lock;
+  std::condition_variable _work;
+  std::unordered_map<std::string, std::shared_ptr<Entry>> _entries;
+  std::deque<std::shared_ptr<Entry>> _urgent, _prefetch;
+  std::vector<std::shared_ptr<Entry>> _clock;
+  size_t _hand = 0;
+  size_t _budget, _used = 0;
+  std::vector<std::shared_ptr<Entry>> _completed;
+  std::vector<std::string> _evicted;
+  std::vector<std::thread> _threads;
+  bool _stop = false;
+  bool _use_uring;
+
+  // Called with the lock held
+  std::shared_ptr<Entry> _request(const std::string &path, bool urgent) {
+    auto found = _entries.find(path);
+    if (found != _entries.end()) {
+      std::shared_ptr<Entry> &entry = found->second;
+      if (urgent && !entry->urgent && entry->state.load() == State::PENDING) {
+        // Still queued as a prefetch; move it up. The stale queue entry is skipped later.
+        entry->urgent = true;
+        _urgent.push_back(entry);
+        _work.notify_one();
+      }
+      return entry;
+    }
+    std::shared_ptr<Entry> entry = std::make_shared<Entry>(path);
+    entry->urgent = urgent;
+    _entries.emplace(path, entry);
+    (urgent ? _urgent : _prefetch).push_back(entry);
+    _work.notify_one();
+    return entry;
+  }
+
+  void _drop(size_t slot) {
+    std::shared_ptr<Entry> entry = std::move(_clock[slot]);
+    _clock[slot] = std::move(_clock.back());
+    _clock.pop_back();
+    _used -= entry->size;
+    entry->cached = false;
+    entry->evicted = true;
+    entry->data.reset();
+    _entries.erase(entry->path);
+    _evicted.push_back(entry->path);
+  }
+
+  // Clock sweep: held entries are skipped, recently requested ones get another turn
+  void _evict() {
+    size_t limit = 2 * _clock.size();
+    for (size_t scanned = 0; _used > _budget && !_clock.empty() && scanned < limit; ++scanned) {
+      if (_hand >= _clock.size()) _hand = 0;
+      Entry &entry = *_clock[_hand];
+      if (entry.handles.load() > 0 || entry.referenced.exchange(false)) {
+        _hand++;
+        continue;
+      }
+      _drop(_hand);
+    }
+  }
+
+  void _open(Read &read) {
+    read.fd = ::open(read.entry->path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (read.fd < 0) {
+      read.error = strerror(errno);
+      return;
+    }
+    struct stat info;
+    if (fstat(read.fd, &info) != 0) read.error = strerror(errno);
+    else if (!S_ISREG(info.st_mode)) read.error = "not a regular file";
+    else {
+      read.entry->size = (size_t) info.st_size;
+      read.entry->data.reset(new unsigned char[info.st_size ? info.st_size : 1]);
+    }
+  }
+
+  void _read_blocking(Read &read) {
+    Entry &entry = *read.entry;
+    while (read.error.empty() && read.done < entry.size) {
+      ssize_t got = pread(read.fd, entry.data.get() + read.done, entry.size - read.done, (off_t) read.done);
+      if (got > 0) read.done += (size_t) got;
+      else if (got == 0) read.error = "file shrank while loading";
+      else if (errno != EINTR) read.error = strerror(errno);
+    }
+  }
+
+  void _queue(UringReader &ring, std::vector<Read> &batch, size_t index) {
+    Read &read = batch[index];
+    size_t left = read.entry->size - read.done;
+    unsigned size = left < ((size_t) 1 << 30) ? (unsigned) left : 1u << 30;
+    read.queued = ring.read(read.fd, read.entry->data.get() + read.done, size, read.done, index);
+  }
+
+  /* After the ring fails, waits out the reads the kernel already has, since it may still write
+   * into their buffers. If even waiting fails, those buffers are abandoned to it and the reads
+   * start over in new ones.
+  */
+  void _drain(UringReader &ring, std::vector<Read> &batch) {
+    uint64_t tag;
+    int result;
+    while (true) {
+      while (ring.reap(tag, result)) {
+        Read &read = batch[tag];
+        read.queued = false;
+        if (result > 0) read.done += (size_t) result; // Anything else is left for pread to redo
+      }
+      if (ring.in_flight() == 0) return;
+      if (ring.wait() < 0) break;
+    }
+    for (Read &read : batch) {
+      if (!read.queued) continue;
+      read.entry->data.release();
+      read.entry->data.reset(new unsigned char[read.entry->size ? read.entry->size : 1]);
+      read.done = 0;
+      read.queued = false;
+    }
+  }
+
+  // Returns false if the ring stopped working; unfinished reads are then left to pread
+  bool _read_uring(UringReader &ring, std::vector<Read> &batch) {
+    size_t active = 0;
+    for (size_t i = 0; i < batch.size(); ++i) {
+      if (batch[i].error.empty() && batch[i].done < batch[i].entry->size) {
+        _queue(ring, batch, i);
+        active++;
+      }
+    }
+    while (active) {
+      if (ring.submit_and_wait() < 0) {
+        _drain(ring, batch);
+        return false;
+      }
+      uint64_t tag;
+      int result;
+      while (ring.reap(tag, result)) {
+        Read &read = batch[tag];
+        read.queued = false;
+        if (result == -EINTR || result == -EAGAIN) {
+          _queue(ring, batch, tag);
+          continue;
+        }
+        if (result == -EINVAL || result == -EOPNOTSUPP) _read_blocking(read); // Kernel without IORING_OP_READ
+        else if (result < 0) read.error = strerror(-result);
+        else if (result == 0) read.error = "file shrank while loading";
+        else {
+          read.done += (size_t) result;
+          if (read.done < read.entry->size) {
+            _queue(ring, batch, tag);
+            continue;
+          }
+        }
+        active--;
+      }
+    }
+    return true;
+  }
+
+  void _finish(Read &read) {
+    if (read.fd >= 0) close(read.fd);
+    Entry &entry = *read.entry;
+    bool ok = read.error.empty();
+    if (!ok) {
+      entry.data.reset();
+      entry.size = 0;
+      entry.error = std::move(read.error);
+    }
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+      entry.state.store(ok ? State::READY : State::FAILED, std::memory_order_release);
+      if (ok) {
+        entry.cached = true;
+        _clock.push_back(read.entry);
+        _used += entry.size;
+        _evict();
+      } else {
+        auto found = _entries.find(entry.path);
+        if (found != _entries.end() && found->second == read.entry) _entries.erase(found);
+      }
+      _completed.push_back(read.entry);
+    }
+    entry.promise.set_value();
+  }
+
+  void _worker() {
+    UringReader ring;
+    bool uring = _use_uring && ring.open(BATCH);
+    std::vector<Read> batch;
+    while (true) {
+      batch.clear();
+      {
+        std::unique_lock<std::mutex> lock(_lock);
+        _work.wait(lock, [&] { return _stop || !_urgent.empty() || !_prefetch.empty(); });
+        if (_stop) return;
+        while (batch.size() < (size_t) BATCH && (!_urgent.empty() || !_prefetch.empty())) {
+          std::deque<std::shared_ptr<Entry>> &queue = _urgent.empty() ? _prefetch : _urgent;
+          std::shared_ptr<Entry> entry = std::move(queue.front());
+          queue.pop_front();
+          if (entry->state.load() != State::PENDING) continue;
+          entry->state.store(State::LOADING);
+          batch.emplace_back();
+          batch.back().entry = std::move(entry);
+        }
+      }
+      for (Read &read : batch) _open(read);
+      if (uring && !_read_uring(ring, batch)) uring = false;
+      for (Read &read : batch) {
+        _read_blocking(read);
+        _finish(read);
+      }
+    }
+  }
+
+  static void _cancel(std::deque<std::shared_ptr<Entry>> &queue) {
+    for (std::shared_ptr<Entry> &entry : queue) {
+      if (entry->state.load() != State::PENDING) continue;
+      entry->error = "ResourceManager destroyed before loading";
+      entry->state.store(State::FAILED, std::memory_order_release);
+      entry->promise.set_value();
+    }
+    queue.clear();
+  }
+public:
+  explicit ResourceManager(size_t budget_bytes, int io_threads = 2, bool use_uring = true) :
+    _budget(budget_bytes), _use_uring(use_uring)
+  {
+    // Probe once so that uses_uring() answers for every worker
+    if (_use_uring) {
+      UringReader probe;
+      _use_uring = probe.open(1);
+    }
+    if (io_threads < 1) io_threads = 1;
+    for (int i = 0; i < io_threads; ++i) _threads.emplace_back(&ResourceManager::_worker, this);
+  }
+
+  ResourceManager(const ResourceManager &) = delete;
+  ResourceManager &operator=(const ResourceManager &) = delete;
+
+  // Loads already started are finished; queued ones fail. Handles stay usable.
+  ~ResourceManager() {
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+      _stop = true;
+    }
+    _work.notify_all();
+    for (std::thread &t : _threads) t.join();
+    _cancel(_urgent);
+    _cancel(_prefetch);
+  }
+
+  bool uses_uring() const { return _use_uring; }
+
+  Handle load(const std::string &path) {
+    std::lock_guard<std::mutex> lock(_lock);
+    std::shared_ptr<Entry> entry = _request(path, true);
+    entry->referenced.store(true);
+    return Handle(std::move(entry));
+  }
+
+  void prefetch(const std::string &path) {
+    std::lock_guard<std::mutex> lock(_lock);
+    _request(path, false);
+  }
+
+  // Evicts path now if it is cached and not held; returns whether it was
+  bool release(const std::string &path) {
+    std::lock_guard<std::mutex> lock(_lock);
+    for (size_t i = 0; i < _clock.size(); ++i) {
+      if (_clock[i]->path == path) {
+        if (_clock[i]->handles.load() > 0) return false;
+        _drop(i);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void set_budget(size_t budget_bytes) {
+    std::lock_guard<std::mutex> lock(_lock);
+    _budget = budget_bytes;
+    _evict();
+  }
+
+  size_t budget() {
+    std::lock_guard<std::mutex> lock(_lock);
+    return _budget;
+  }
+
+  // Bytes of loaded resources currently cached
+  size_t used() {
+    std::lock_guard<std::mutex> lock(_lock);
+    return _used;
+  }
+
+  /* Calls loaded for every load finished since the last poll, then evicted for every path
+   * evicted since. Resources loaded and evicted in between are only reported as evicted.
+   * Returns how many loads were reported.
+  */
+  int poll() {
+    std::vector<std::shared_ptr<Entry>> completed;
+    std::vector<std::string> gone;
+    std::vector<Handle> handles;
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+      completed.swap(_completed);
+      gone.swap(_evicted);
+      for (std::shared_ptr<Entry> &entry : completed) {
+        if (!entry->evicted) handles.push_back(Handle(entry));
+      }
+    }
+    for (const Handle &handle : handles) loaded.call(handle);
+    for (const std::string &path : gone) evicted.call(path);
+    return (int) handles.size();
+  }
+};
+
+#endif // _RESOURCE_MANAGER_H_
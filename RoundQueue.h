@@ -1,96 +1,214 @@
+#ifndef _ROUND_QUEUE_H_
+#define _ROUND_QUEUE_H_
+
+#include <algorithm>
 #include <stdexcept>
-#include <cstring>
+#include <type_traits>
+#include <utility>
+
+/* Ring buffer queue. The capacity is always a power of two so that positions wrap with a mask.
+ * Besides push/pop one at a time, whole runs can be moved in and out with push_n/pop_n, or read
+ * and written in place through readable()/writable(), which describe the used and free parts of
+ * the buffer as at most two contiguous spans each (e.g. for read(2)/write(2) on byte queues).
+ * Storage decides where the buffer lives; see MirroredRing.h for one mapped twice in a row, where
+ * every region is a single span.
+*/
+
+// Default storage: a plain array
+template<class T> struct RoundQueueHeap {
+  // The buffer is not mapped twice, so regions may wrap
+  static constexpr bool MIRRORED = false;
+
+  static int round_up(int size) {
+    if (size > (1 << 30)) throw std::length_error("RoundQueue too large");
+    int capacity = 1;
+    while (capacity < size) capacity <<= 1;
+    return capacity;
+  }
+
+  static T *allocate(int capacity) { return new T[capacity]; }
+  static void release(T *data, int) { delete[] data; }
+};
+
+template<class T, class Storage = RoundQueueHeap<T>> class RoundQueue {
+public:
+  struct Span {
+    T *data;
+    int size;
+  };
 
-template<class T> class RoundQueue {
+  // Two spans in queue order; second is empty unless the region wraps around the end
+  struct Regions {
+    Span first, second;
+    int size() const { return first.size + second.size; }
+  };
 private:
   int _used = 0, _size = 0, _start = 0;
   T *_data = nullptr;
   int _index_to_buffer(int index) const {
-    return (index + _start) % _size;
+    return (index + _start) & (_size - 1);
+  }
+
+  // Popped slots stay constructed; give back whatever they hold
+  static void _release(T &slot) {
+    if constexpr (!std::is_trivially_destructible<T>::value) slot = T();
+  }
+
+  void _copy_from(const RoundQueue &other) {
+    if (!other._data) return;
+    _data = Storage::allocate(other._size);
+    _size = other._size;
+    for (int i = 0; i < other._used; ++i) _data[i] = other[i];
+    _used = other._used;
+  }
+
+  Regions _regions(int offset, int count) const {
+    if (count == 0) return Regions{{_data, 0}, {_data, 0}};
+    int begin = _index_to_buffer(offset);
+    if constexpr (Storage::MIRRORED) return Regions{{_data + begin, count}, {_data, 0}};
+    int first = std::min(count, _size - begin);
+    return Regions{{_data + begin, first}, {_data, count - first}};
   }
 public:
-  RoundQueue(int initial_size) : _size(initial_size), _data(new T[initial_size]) {}
+  RoundQueue(int initial_size) : _size(Storage::round_up(initial_size)), _data(Storage::allocate(_size)) {}
   RoundQueue() {}
-  RoundQueue(const RoundQueue &other) :
-    _used(other._used), _start(other._start), _size(other._size)
-  {
-    if (other._data) {
-      _data = new T[_size];
-      memcpy(_data, other._data, _size * sizeof(T));
-    }
-  }
-  
+  RoundQueue(const RoundQueue &other) { _copy_from(other); }
+  RoundQueue(RoundQueue &&other) noexcept { swap(other); }
+
   ~RoundQueue() {
-    delete[] _data;
+    if (_data) Storage::release(_data, _size);
   }
 
   int size() const { return _used; }
   int capacity() const { return _size; }
   T *data() { return _data; }
-  bool empty() { return _used == 0; }
-  void clear() { 
+  bool empty() const { return _used == 0; }
+  void clear() {
     _used = 0;
     _start = 0;
+    if (_data) Storage::release(_data, _size);
     _size = 0;
-    delete[] _data;
     _data = nullptr;
   }
-  
-  // Elaborate due to the possibility of x = x, in which case we use deleted memory unless we
-  //  do this
+
+  void swap(RoundQueue &other) noexcept {
+    std::swap(_used, other._used);
+    std::swap(_size, other._size);
+    std::swap(_start, other._start);
+    std::swap(_data, other._data);
+  }
+
+  // Copies first, so x = x and a failed copy both leave this as it was
   RoundQueue &operator=(const RoundQueue &other) {
-    _used = other._used;
-    _size = other._size;
-    _start = other._start;
-    if(_data)
-      delete[] _data;
-    if (other._data) {
-      _data = new T[_size];
-      memcpy(_data, other._data, size * sizeof(T));
-    }
+    RoundQueue copy(other);
+    swap(copy);
+    return *this;
+  }
+
+  RoundQueue &operator=(RoundQueue &&other) noexcept {
+    RoundQueue moved(std::move(other));
+    swap(moved);
+    return *this;
   }
-  
+
   T &peek() {
-    if (_size == 0) throw std::runtime_error("Peeking with nothing to peek!");
-    return _data[_index_to_buffer(0)];
+    if (_used == 0) throw std::runtime_error("Peeking with nothing to peek!");
+    return _data[_start];
   }
 
+  // 0 is the front (the next to be popped). Unchecked, like std::vector's.
+  T &operator[](int index) { return _data[_index_to_buffer(index)]; }
+  const T &operator[](int index) const { return _data[_index_to_buffer(index)]; }
+
   bool operator==(const RoundQueue &other) const {
-    if (_data == nullptr && other._data == nullptr) return true;
     if (_used != other._used) return false;
     for (int i = 0; i < _used; ++i) {
-      if (_data[_index_to_buffer(i)] != other._data[_index_to_buffer(i)]) return false;
+      if (!((*this)[i] == other[i])) return false;
     }
+    return true;
   }
 
   bool operator!=(const RoundQueue &other) const {
     return !(*this == other);
   }
 
+  // Grows the capacity by at least more, moving the contents to the front of the new buffer
   void rebuild(int more) {
     if (more < 0) throw std::length_error("More < 0");
-    T *data = new T[_size + more];
-    if (_data) {
-      for (int i = 0; i < _used; ++i) {
-        data[i] = _data[_index_to_buffer(i)];
-      }
-      delete[] _data;
-    }
+    if (more == 0 && _data) return;
+    int size = Storage::round_up(_size + more);
+    T *data = Storage::allocate(size);
+    for (int i = 0; i < _used; ++i) data[i] = std::move(_data[_index_to_buffer(i)]);
+    if (_data) Storage::release(_data, _size);
     _start = 0;
     _data = data;
-    _size += more;
+    _size = size;
+  }
+
+  // Makes room for count more without further growth
+  void reserve(int count) {
+    if (_used + count > _size) rebuild(_used + count - _size);
   }
-  
+
   void push(T value) {
+    if (_used == _size) rebuild(_size == 0 ? 1 : _size);
+    _data[_index_to_buffer(_used)] = std::move(value);
     _used++;
-    if (_used > _size) rebuild(_size == 0 ? 1 : _size);
-    _data[_index_to_buffer(_used - 1)] = value;
   }
-  
+
+  void push_n(const T *values, int count) {
+    if (count < 0) throw std::length_error("Count < 0");
+    Regions free = writable(count);
+    int first = std::min(count, free.first.size);
+    std::copy(values, values + first, free.first.data);
+    std::copy(values + first, values + count, free.second.data);
+    _used += count;
+  }
+
   void pop() {
     if (_used == 0) throw std::runtime_error("Popping with nothing to pop!");
+    _release(_data[_start]);
     _used--;
     if (_used == 0) _start = 0;
-    else _start = (_start + 1) % _size;
+    else _start = (_start + 1) & (_size - 1);
+  }
+
+  // Moves up to count from the front into out; returns how many that was
+  int pop_n(T *out, int count) {
+    count = std::max(0, std::min(count, _used));
+    Regions used = readable();
+    int first = std::min(count, used.first.size);
+    std::move(used.first.data, used.first.data + first, out);
+    std::move(used.second.data, used.second.data + (count - first), out + first);
+    consume(count);
+    return count;
+  }
+
+  // The queued elements, front first
+  Regions readable() const { return _regions(0, _used); }
+
+  // Free slots after the back, growing first if there are fewer than at_least of them.
+  //  Call commit() with how many were filled.
+  Regions writable(int at_least = 0) {
+    reserve(at_least);
+    return _regions(_used, _size - _used);
+  }
+
+  // Appends count elements already written through writable()
+  void commit(int count) {
+    if (count < 0 || _used + count > _size) throw std::length_error("Committing more than was writable");
+    _used += count;
+  }
+
+  // Drops count from the front, e.g. after they were read through readable()
+  void consume(int count) {
+    if (count < 0 || count > _used) throw std::length_error("Consuming more than is queued");
+    if constexpr (!std::is_trivially_destructible<T>::value) {
+      for (int i = 0; i < count; ++i) _release(_data[_index_to_buffer(i)]);
+    }
+    _used -= count;
+    _start = _used == 0 ? 0 : _index_to_buffer(count);
   }
 };
+
+#endif // _ROUND_QUEUE_H_
@@ -0,0 +1,359 @@
+#ifndef _SERIAL_BUFFER_H_
+#define _SERIAL_BUFFER_H_
+
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* Serializes readable and binary data into an append-only arena of chunks. Written bytes never
+ * move, and a single value never straddles two chunks, so a SerialReader can hand out views
+ * straight into the buffer. Integers are little-endian, fixed-width or LEB128 varints (zigzag for
+ * signed ones); strings and byte runs are a varint length followed by the bytes. The chunks can
+ * be handed to writev() as they are.
+ *
+ * Trivially copyable structs can be written whole with write_pod. They are tagged with a schema
+ * hash of their size, alignment and SERIAL_SCHEMA version (a static member, 0 if missing), so a
+ * reader expecting a different layout throws instead of misreading.
+*/
+
+namespace WellSpring {
+  namespace serial {
+    template<class T, class = void> struct _Version {
+      static constexpr uint32_t value = 0;
+    };
+    template<class T> struct _Version<T, std::void_t<decltype(T::SERIAL_SCHEMA)>> {
+      static constexpr uint32_t value = (uint32_t) T::SERIAL_SCHEMA;
+    };
+
+    // FNV-1a over the layout facts
+    template<class T> constexpr uint32_t schema_of() {
+      uint64_t facts[3] = {sizeof(T), alignof(T), _Version<T>::value};
+      uint32_t hash = 2166136261u;
+      for (uint64_t fact : facts) {
+        for (int i = 0; i < 8; ++i) hash = (hash ^ (uint8_t) (fact >> (8 * i))) * 16777619u;
+      }
+      return hash;
+    }
+
+    template<class T> void _store_le(unsigned char *out, T value) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+      memcpy(out, &value, sizeof(T));
+#else
+      unsigned char bytes[sizeof(T)];
+      memcpy(bytes, &value, sizeof(T));
+      for (size_t i = 0; i < sizeof(T); ++i) out[i] = bytes[sizeof(T) - 1 - i];
+#endif
+    }
+
+    template<class T> T _load_le(const unsigned char *in) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+      T value;
+      memcpy(&value, in, sizeof(T));
+      return value;
+#else
+      unsigned char bytes[sizeof(T)];
+      for (size_t i = 0; i < sizeof(T); ++i) bytes[i] = in[sizeof(T) - 1 - i];
+      T value;
+      memcpy(&value, bytes, sizeof(T));
+      return value;
+#endif
+    }
+
+    inline uint64_t zigzag(int64_t value) { return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63); }
+    inline int64_t unzigzag(uint64_t value) { return (int64_t) (value >> 1) ^ -(int64_t) (value & 1); }
+  }
+}
+
+class SerialBuffer {
+public:
+  static constexpr int MAX_VARINT = 10;
+private:
+  struct Chunk {
+    unsigned char *data;
+    size_t used, capacity;
+  };
+
+  std::vector<Chunk> _chunks;
+  size_t _chunk_size;
+  size_t _size = 0;
+
+  // n contiguous bytes at the end of the last chunk, starting a new chunk if they don't fit
+  unsigned char *_reserve(size_t n) {
+    if (_chunks.empty() || _chunks.back().capacity - _chunks.back().used < n) {
+      size_t capacity = n > _chunk_size ? n : _chunk_size;
+      _chunks.push_back(Chunk{new unsigned char[capacity], 0, capacity});
+    }
+    Chunk &chunk = _chunks.back();
+    return chunk.data + chunk.used;
+  }
+
+  void _commit(size_t n) {
+    _chunks.back().used += n;
+    _size += n;
+  }
+
+  template<class T> void _write_fixed(T value) {
+    WellSpring::serial::_store_le(_reserve(sizeof(T)), value);
+    _commit(sizeof(T));
+  }
+
+  // Length and payload share a chunk so that readers get one contiguous view
+  void _write_run(const void *data, size_t size) {
+    unsigned char *out = _reserve(MAX_VARINT + size);
+    size_t length = _encode_varint(out, size);
+    if (size) memcpy(out + length, data, size);
+    _commit(length + size);
+  }
+
+  static size_t _encode_varint(unsigned char *out, uint64_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+      out[n++] = (unsigned char) (value | 0x80);
+      value >>= 7;
+    }
+    out[n++] = (unsigned char) value;
+    return n;
+  }
+public:
+  // Chunks grow to fit larger single values
+  explicit SerialBuffer(size_t chunk_size = 16384) : _chunk_size(chunk_size ? chunk_size : 1) {}
+  SerialBuffer(const SerialBuffer &) = delete;
+  SerialBuffer &operator=(const SerialBuffer &) = delete;
+  SerialBuffer(SerialBuffer &&other) noexcept :
+    _chunks(std::move(other._chunks)), _chunk_size(other._chunk_size), _size(other._size)
+  {
+    other._chunks.clear();
+    other._size = 0;
+  }
+
+  ~SerialBuffer() {
+    for (Chunk &chunk : _chunks) delete[] chunk.data;
+  }
+
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+
+  // Keeps the first chunk for reuse; views into the buffer become invalid
+  void clear() {
+    for (size_t i = 1; i < _chunks.size(); ++i) delete[] _chunks[i].data;
+    if (!_chunks.empty()) {
+      _chunks.resize(1);
+      _chunks[0].used = 0;
+    }
+    _size = 0;
+  }
+
+  void write_u8(uint8_t value) { _write_fixed(value); }
+  void write_u16(uint16_t value) { _write_fixed(value); }
+  void write_u32(uint32_t value) { _write_fixed(value); }
+  void write_u64(uint64_t value) { _write_fixed(value); }
+  void write_i32(int32_t value) { _write_fixed(value); }
+  void write_i64(int64_t value) { _write_fixed(value); }
+  void write_f32(float value) { _write_fixed(value); }
+  void write_f64(double value) { _write_fixed(value); }
+
+  void write_varint(uint64_t value) {
+    _commit(_encode_varint(_reserve(MAX_VARINT), value));
+  }
+
+  void write_svarint(int64_t value) { write_varint(WellSpring::serial::zigzag(value)); }
+
+  void write_string(std::string_view text) { _write_run(text.data(), text.size()); }
+  void write_bytes(const void *data, size_t size) { _write_run(data, size); }
+
+  // Raw bytes with no length, for fixed layouts the reader already knows
+  void write_raw(const void *data, size_t size) {
+    memcpy(_reserve(size), data, size);
+    _commit(size);
+  }
+
+  template<class T> void write_pod(const T &value) { write_pods(&value, 1); }
+
+  // Schema tag, count, then the structs as they are in memory
+  template<class T> void write_pods(const T *values, size_t count) {
+    static_assert(std::is_trivially_copyable<T>::value, "write_pod is for trivially copyable types");
+    static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "write_pod stores the host layout, which must be little-endian");
+    unsigned char *out = _reserve(4 + MAX_VARINT + count * sizeof(T));
+    WellSpring::serial::_store_le(out, WellSpring::serial::schema_of<T>());
+    size_t length = 4 + _encode_varint(out + 4, count);
+    memcpy(out + length, values, count * sizeof(T));
+    _commit(length + count * sizeof(T));
+  }
+
+  // One iovec per chunk, for writev. Returns how many were filled; max may be too small.
+  int iovecs(struct iovec *out, int max) const {
+    int n = 0;
+    for (const Chunk &chunk : _chunks) {
+      if (n == max) break;
+      if (!chunk.used) continue;
+      out[n++] = iovec{chunk.data, chunk.used};
+    }
+    return n;
+  }
+
+  int chunk_count() const { return (int) _chunks.size(); }
+
+  // Writes everything, retrying after partial writes. Throws on errors.
+  void write_to(int fd) const {
+    std::vector<struct iovec> parts(_chunks.size());
+    int count = iovecs(parts.data(), (int) parts.size());
+    int first = 0;
+    while (first < count) {
+      int batch = count - first < IOV_MAX ? count - first : IOV_MAX;
+      ssize_t sent = writev(fd, parts.data() + first, batch);
+      if (sent < 0) throw std::runtime_error(std::string("SerialBuffer: writev failed: ") + strerror(errno));
+      while (first < count && (size_t) sent >= parts[first].iov_len) sent -= parts[first++].iov_len;
+      if (first < count) {
+        parts[first].iov_base = (char *) parts[first].iov_base + sent;
+        parts[first].iov_len -= sent;
+      }
+    }
+  }
+
+  // A flat copy, e.g. for storing elsewhere
+  std::string to_string() const {
+    std::string flat;
+    flat.reserve(_size);
+    for (const Chunk &chunk : _chunks) flat.append((const char *) chunk.data, chunk.used);
+    return flat;
+  }
+
+  friend class SerialReader;
+};
+
+// A run of structs read by SerialReader::read_pods, left where it is in the buffer
+template<class T> struct SerialArray {
+  const unsigned char *data;
+  size_t count;
+
+  // Copied out, since the bytes need not be aligned for T
+  T operator[](size_t index) const {
+    T value;
+    memcpy(&value, data + index * sizeof(T), sizeof(T));
+    return value;
+  }
+};
+
+/* Reads back what a SerialBuffer wrote, in the same order, from the buffer itself or from a flat
+ * copy of it. Strings and byte runs come back as views into the source, which must outlive them.
+ * Running past the end throws std::length_error; malformed data throws std::runtime_error.
+*/
+class SerialReader {
+  struct Segment {
+    const unsigned char *data;
+    size_t size;
+  };
+
+  std::vector<Segment> _segments;
+  size_t _segment = 0;
+  const unsigned char *_at = nullptr, *_end = nullptr;
+
+  void _enter(size_t segment) {
+    _segment = segment;
+    _at = segment < _segments.size() ? _segments[segment].data : nullptr;
+    _end = segment < _segments.size() ? _at + _segments[segment].size : nullptr;
+  }
+
+  // Values never straddle segments, so a short segment only means moving on to the next
+  const unsigned char *_take(size_t n) {
+    while ((size_t) (_end - _at) < n) {
+      if (_at != _end || _segment + 1 >= _segments.size())
+        throw std::length_error("SerialReader: read past the end");
+      _enter(_segment + 1);
+    }
+    const unsigned char *at = _at;
+    _at += n;
+    return at;
+  }
+
+  template<class T> T _read_fixed() {
+    return WellSpring::serial::_load_le<T>(_take(sizeof(T)));
+  }
+
+  void _skip_empty() {
+    while (_at == _end && _segment + 1 < _segments.size()) _enter(_segment + 1);
+  }
+public:
+  SerialReader(const void *data, size_t size) {
+    _segments.push_back(Segment{(const unsigned char *) data, size});
+    _enter(0);
+  }
+
+  explicit SerialReader(std::string_view flat) : SerialReader(flat.data(), flat.size()) {}
+
+  explicit SerialReader(const SerialBuffer &buffer) {
+    for (const SerialBuffer::Chunk &chunk : buffer._chunks) {
+      if (chunk.used) _segments.push_back(Segment{chunk.data, chunk.used});
+    }
+    if (_segments.empty()) _segments.push_back(Segment{nullptr, 0});
+    _enter(0);
+  }
+
+  bool at_end() {
+    _skip_empty();
+    return _at == _end;
+  }
+
+  uint8_t read_u8() { return _read_fixed<uint8_t>(); }
+  uint16_t read_u16() { return _read_fixed<uint16_t>(); }
+  uint32_t read_u32() { return _read_fixed<uint32_t>(); }
+  uint64_t read_u64() { return _read_fixed<uint64_t>(); }
+  int32_t read_i32() { return _read_fixed<int32_t>(); }
+  int64_t read_i64() { return _read_fixed<int64_t>(); }
+  float read_f32() { return _read_fixed<float>(); }
+  double read_f64() { return _read_fixed<double>(); }
+
+  uint64_t read_varint() {
+    _skip_empty();
+    uint64_t value = 0;
+    for (int shift = 0; shift < 7 * SerialBuffer::MAX_VARINT; shift += 7) {
+      if (_at == _end) throw std::length_error("SerialReader: read past the end");
+      unsigned char byte = *_at++;
+      value |= (uint64_t) (byte & 0x7f) << shift;
+      if (!(byte & 0x80)) return value;
+    }
+    throw std::runtime_error("SerialReader: varint longer than 10 bytes");
+  }
+
+  int64_t read_svarint() { return WellSpring::serial::unzigzag(read_varint()); }
+
+  std::string_view read_string() {
+    uint64_t size = read_varint();
+    if (size > (uint64_t) (_end - _at)) throw std::length_error("SerialReader: read past the end");
+    const unsigned char *at = _at;
+    _at += size;
+    return std::string_view((const char *) at, size);
+  }
+
+  std::string_view read_bytes() { return read_string(); }
+
+  std::string_view read_raw(size_t size) { return std::string_view((const char *) _take(size), size); }
+
+  template<class T> T read_pod() {
+    SerialArray<T> run = read_pods<T>();
+    if (run.count != 1) throw std::runtime_error("SerialReader: expected a single struct");
+    return run[0];
+  }
+
+  template<class T> SerialArray<T> read_pods() {
+    static_assert(std::is_trivially_copyable<T>::value, "read_pod is for trivially copyable types");
+    if (_read_fixed<uint32_t>() != WellSpring::serial::schema_of<T>())
+      throw std::runtime_error("SerialReader: struct layout does not match what was written");
+    uint64_t count = read_varint();
+    if (count > (uint64_t) (_end - _at) / sizeof(T)) throw std::length_error("SerialReader: read past the end");
+    SerialArray<T> run{_at, (size_t) count};
+    _at += count * sizeof(T);
+    return run;
+  }
+};
+
+#endif // _SERIAL_BUFFER_H_
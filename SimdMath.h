@@ -0,0 +1,810 @@
+#ifndef _SIMD_MATH_H_
+#define _SIMD_MATH_H_
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/* Instruction sets, picked at compile time from what the compiler targets (-msse2, -mavx2 -mfma,
+ * -march=native). Define any of these to 0 before including to compile without it.
+*/
+#ifndef SIMD_MATH_SSE
+#if defined(__SSE2__)
+#define SIMD_MATH_SSE 1
+#else
+#define SIMD_MATH_SSE 0
+#endif
+#endif
+
+#ifndef SIMD_MATH_AVX
+#if defined(__AVX__) && SIMD_MATH_SSE
+#define SIMD_MATH_AVX 1
+#else
+#define SIMD_MATH_AVX 0
+#endif
+#endif
+
+#ifndef SIMD_MATH_FMA
+#if defined(__FMA__) && SIMD_MATH_SSE
+#define SIMD_MATH_FMA 1
+#else
+#define SIMD_MATH_FMA 0
+#endif
+#endif
+
+// Elements the batch functions work on at once: 8 with AVX, 4 with SSE, otherwise 1
+#ifndef SIMD_MATH_WIDTH
+#if SIMD_MATH_AVX
+#define SIMD_MATH_WIDTH 8
+#elif SIMD_MATH_SSE
+#define SIMD_MATH_WIDTH 4
+#else
+#define SIMD_MATH_WIDTH 1
+#endif
+#endif
+
+#if !(SIMD_MATH_WIDTH == 1 || (SIMD_MATH_WIDTH == 4 && SIMD_MATH_SSE) || (SIMD_MATH_WIDTH == 8 && SIMD_MATH_AVX))
+#error "SIMD_MATH_WIDTH must be 1, 4 (needs SSE2) or 8 (needs AVX)"
+#endif
+
+// Conversions to GLM and Jolt types, when their headers are around
+#ifndef SIMD_MATH_GLM
+#if __has_include(<glm/glm.hpp>)
+#define SIMD_MATH_GLM 1
+#else
+#define SIMD_MATH_GLM 0
+#endif
+#endif
+
+#ifndef SIMD_MATH_JOLT
+#if __has_include(<Jolt/Jolt.h>)
+#define SIMD_MATH_JOLT 1
+#else
+#define SIMD_MATH_JOLT 0
+#endif
+#endif
+
+#if SIMD_MATH_GLM
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#endif
+
+#if SIMD_MATH_JOLT
+#include <Jolt/Jolt.h>
+#include <Jolt/Math/Quat.h>
+#endif
+
+namespace WellSpring {
+  namespace math {
+    /* Four floats in one register, and the handful of operations the types below are built
+     * from. The fallback is a plain array, so everything also compiles without SSE.
+    */
+    namespace simd {
+#if SIMD_MATH_SSE
+      typedef __m128 F4;
+
+      inline F4 set(float x, float y, float z, float w) { return _mm_setr_ps(x, y, z, w); }
+      inline F4 splat(float s) { return _mm_set1_ps(s); }
+      inline F4 load(const float *p) { return _mm_loadu_ps(p); }
+      inline void store(float *p, F4 v) { _mm_storeu_ps(p, v); }
+      inline F4 add(F4 a, F4 b) { return _mm_add_ps(a, b); }
+      inline F4 sub(F4 a, F4 b) { return _mm_sub_ps(a, b); }
+      inline F4 mul(F4 a, F4 b) { return _mm_mul_ps(a, b); }
+      inline F4 div(F4 a, F4 b) { return _mm_div_ps(a, b); }
+      inline F4 min(F4 a, F4 b) { return _mm_min_ps(a, b); }
+      inline F4 max(F4 a, F4 b) { return _mm_max_ps(a, b); }
+      inline F4 sqrt(F4 a) { return _mm_sqrt_ps(a); }
+#if SIMD_MATH_FMA
+      inline F4 madd(F4 a, F4 b, F4 c) { return _mm_fmadd_ps(a, b, c); }
+#else
+      inline F4 madd(F4 a, F4 b, F4 c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+#endif
+      // Lanes X, Y, Z, W of the result come from those lanes of v
+      template<int X, int Y, int Z, int W> inline F4 shuffle(F4 v) { return _mm_shuffle_ps(v, v, _MM_SHUFFLE(W, Z, Y, X)); }
+      template<int I> inline float get(F4 v) { return _mm_cvtss_f32(shuffle<I, I, I, I>(v)); }
+      inline F4 zero_w(F4 v) { return _mm_and_ps(v, _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0))); }
+      inline void transpose(F4 &a, F4 &b, F4 &c, F4 &d) { _MM_TRANSPOSE4_PS(a, b, c, d); }
+#else
+      struct F4 {
+        float v[4];
+      };
+
+      inline F4 set(float x, float y, float z, float w) { return F4{{x, y, z, w}}; }
+      inline F4 splat(float s) { return F4{{s, s, s, s}}; }
+      inline F4 load(const float *p) { return F4{{p[0], p[1], p[2], p[3]}}; }
+      inline void store(float *p, F4 v) { memcpy(p, v.v, sizeof(v.v)); }
+      inline F4 add(F4 a, F4 b) { return F4{{a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]}}; }
+      inline F4 sub(F4 a, F4 b) { return F4{{a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3]}}; }
+      inline F4 mul(F4 a, F4 b) { return F4{{a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]}}; }
+      inline F4 div(F4 a, F4 b) { return F4{{a.v[0] / b.v[0], a.v[1] / b.v[1], a.v[2] / b.v[2], a.v[3] / b.v[3]}}; }
+      inline F4 min(F4 a, F4 b) {
+        return F4{{std::fmin(a.v[0], b.v[0]), std::fmin(a.v[1], b.v[1]), std::fmin(a.v[2], b.v[2]), std::fmin(a.v[3], b.v[3])}};
+      }
+      inline F4 max(F4 a, F4 b) {
+        return F4{{std::fmax(a.v[0], b.v[0]), std::fmax(a.v[1], b.v[1]), std::fmax(a.v[2], b.v[2]), std::fmax(a.v[3], b.v[3])}};
+      }
+      inline F4 sqrt(F4 a) { return F4{{std::sqrt(a.v[0]), std::sqrt(a.v[1]), std::sqrt(a.v[2]), std::sqrt(a.v[3])}}; }
+      inline F4 madd(F4 a, F4 b, F4 c) { return add(mul(a, b), c); }
+      template<int X, int Y, int Z, int W> inline F4 shuffle(F4 v) { return F4{{v.v[X], v.v[Y], v.v[Z], v.v[W]}}; }
+      template<int I> inline float get(F4 v) { return v.v[I]; }
+      inline F4 zero_w(F4 v) { v.v[3] = 0; return v; }
+      inline void transpose(F4 &a, F4 &b, F4 &c, F4 &d) {
+        F4 r[4] = {a, b, c, d};
+        a = F4{{r[0].v[0], r[1].v[0], r[2].v[0], r[3].v[0]}};
+        b = F4{{r[0].v[1], r[1].v[1], r[2].v[1], r[3].v[1]}};
+        c = F4{{r[0].v[2], r[1].v[2], r[2].v[2], r[3].v[2]}};
+        d = F4{{r[0].v[3], r[1].v[3], r[2].v[3], r[3].v[3]}};
+      }
+#endif
+      template<int I> inline F4 lane(F4 v) { return shuffle<I, I, I, I>(v); }
+
+      // Sum of products, in every lane
+      inline F4 dot(F4 a, F4 b) {
+        F4 m = mul(a, b);
+        F4 s = add(m, shuffle<1, 0, 3, 2>(m));
+        return add(s, shuffle<2, 3, 0, 1>(s));
+      }
+    }
+
+    using simd::F4;
+
+    struct Vec4 {
+      F4 v;
+
+      Vec4() : v(simd::splat(0)) {}
+      explicit Vec4(F4 v) : v(v) {}
+      Vec4(float x, float y, float z, float w) : v(simd::set(x, y, z, w)) {}
+      static Vec4 splat(float s) { return Vec4(simd::splat(s)); }
+      static Vec4 load(const float *p) { return Vec4(simd::load(p)); }
+      void store(float *p) const { simd::store(p, v); }
+
+      float x() const { return simd::get<0>(v); }
+      float y() const { return simd::get<1>(v); }
+      float z() const { return simd::get<2>(v); }
+      float w() const { return simd::get<3>(v); }
+      float operator[](int i) const {
+        float out[4];
+        simd::store(out, v);
+        return out[i & 3];
+      }
+
+      Vec4 operator+(Vec4 o) const { return Vec4(simd::add(v, o.v)); }
+      Vec4 operator-(Vec4 o) const { return Vec4(simd::sub(v, o.v)); }
+      Vec4 operator*(Vec4 o) const { return Vec4(simd::mul(v, o.v)); }
+      Vec4 operator/(Vec4 o) const { return Vec4(simd::div(v, o.v)); }
+      Vec4 operator*(float s) const { return Vec4(simd::mul(v, simd::splat(s))); }
+      Vec4 operator/(float s) const { return Vec4(simd::div(v, simd::splat(s))); }
+      Vec4 operator-() const { return Vec4(simd::sub(simd::splat(0), v)); }
+      Vec4 &operator+=(Vec4 o) { v = simd::add(v, o.v); return *this; }
+      Vec4 &operator-=(Vec4 o) { v = simd::sub(v, o.v); return *this; }
+      Vec4 &operator*=(float s) { v = simd::mul(v, simd::splat(s)); return *this; }
+    };
+
+    // Kept in a full register with w at 0, so it costs the same as a Vec4
+    struct Vec3 {
+      F4 v;
+
+      Vec3() : v(simd::splat(0)) {}
+      explicit Vec3(F4 v) : v(simd::zero_w(v)) {}
+      explicit Vec3(Vec4 v) : v(simd::zero_w(v.v)) {}
+      Vec3(float x, float y, float z) : v(simd::set(x, y, z, 0)) {}
+      static Vec3 splat(float s) { return Vec3(s, s, s); }
+      static Vec3 load(const float *p) { return Vec3(p[0], p[1], p[2]); }
+      void store(float *p) const {
+        float out[4];
+        simd::store(out, v);
+        memcpy(p, out, 3 * sizeof(float));
+      }
+
+      float x() const { return simd::get<0>(v); }
+      float y() const { return simd::get<1>(v); }
+      float z() const { return simd::get<2>(v); }
+      float operator[](int i) const {
+        float out[4];
+        simd::store(out, v);
+        return out[i < 3 ? i : 2];
+      }
+
+      Vec3 operator+(Vec3 o) const { return _raw(simd::add(v, o.v)); }
+      Vec3 operator-(Vec3 o) const { return _raw(simd::sub(v, o.v)); }
+      Vec3 operator*(Vec3 o) const { return _raw(simd::mul(v, o.v)); }
+      Vec3 operator*(float s) const { return _raw(simd::mul(v, simd::splat(s))); }
+      Vec3 operator/(float s) const { return _raw(simd::div(v, simd::splat(s))); }
+      Vec3 operator-() const { return _raw(simd::sub(simd::splat(0), v)); }
+      Vec3 &operator+=(Vec3 o) { v = simd::add(v, o.v); return *this; }
+      Vec3 &operator-=(Vec3 o) { v = simd::sub(v, o.v); return *this; }
+      Vec3 &operator*=(float s) { v = simd::mul(v, simd::splat(s)); return *this; }
+
+      // For results whose w is already 0
+      static Vec3 _raw(F4 v) {
+        Vec3 out;
+        out.v = v;
+        return out;
+      }
+    };
+
+    inline Vec4 operator*(float s, Vec4 v) { return v * s; }
+    inline Vec3 operator*(float s, Vec3 v) { return v * s; }
+
+    inline float dot(Vec4 a, Vec4 b) { return simd::get<0>(simd::dot(a.v, b.v)); }
+    inline float dot(Vec3 a, Vec3 b) { return simd::get<0>(simd::dot(a.v, b.v)); }
+    inline float length(Vec4 v) { return std::sqrt(dot(v, v)); }
+    inline float length(Vec3 v) { return std::sqrt(dot(v, v)); }
+
+    // A zero vector stays zero instead of turning into NaNs
+    inline Vec4 normalize(Vec4 v) {
+      return Vec4(simd::div(v.v, simd::max(simd::sqrt(simd::dot(v.v, v.v)), simd::splat(1e-30f))));
+    }
+    inline Vec3 normalize(Vec3 v) {
+      return Vec3::_raw(simd::div(v.v, simd::max(simd::sqrt(simd::dot(v.v, v.v)), simd::splat(1e-30f))));
+    }
+
+    inline Vec3 cross(Vec3 a, Vec3 b) {
+      using simd::shuffle;
+      F4 left = simd::mul(shuffle<1, 2, 0, 3>(a.v), shuffle<2, 0, 1, 3>(b.v));
+      F4 right = simd::mul(shuffle<2, 0, 1, 3>(a.v), shuffle<1, 2, 0, 3>(b.v));
+      return Vec3::_raw(simd::sub(left, right));
+    }
+
+    inline Vec4 min(Vec4 a, Vec4 b) { return Vec4(simd::min(a.v, b.v)); }
+    inline Vec4 max(Vec4 a, Vec4 b) { return Vec4(simd::max(a.v, b.v)); }
+    inline Vec3 min(Vec3 a, Vec3 b) { return Vec3::_raw(simd::min(a.v, b.v)); }
+    inline Vec3 max(Vec3 a, Vec3 b) { return Vec3::_raw(simd::max(a.v, b.v)); }
+    inline Vec4 lerp(Vec4 a, Vec4 b, float t) { return Vec4(simd::madd(simd::sub(b.v, a.v), simd::splat(t), a.v)); }
+    inline Vec3 lerp(Vec3 a, Vec3 b, float t) { return Vec3::_raw(simd::madd(simd::sub(b.v, a.v), simd::splat(t), a.v)); }
+
+    // Rotation as x, y, z, w with w the real part, the same order GLM and Jolt keep in memory
+    struct Quat {
+      F4 v;
+
+      Quat() : v(simd::set(0, 0, 0, 1)) {}
+      explicit Quat(F4 v) : v(v) {}
+      Quat(float x, float y, float z, float w) : v(simd::set(x, y, z, w)) {}
+      static Quat identity() { return Quat(); }
+      static Quat axis_angle(Vec3 axis, float radians) {
+        Vec3 unit = normalize(axis);
+        float s = std::sin(radians * 0.5f);
+        return Quat(unit.x() * s, unit.y() * s, unit.z() * s, std::cos(radians * 0.5f));
+      }
+      static Quat load(const float *p) { return Quat(simd::load(p)); }
+      void store(float *p) const { simd::store(p, v); }
+
+      float x() const { return simd::get<0>(v); }
+      float y() const { return simd::get<1>(v); }
+      float z() const { return simd::get<2>(v); }
+      float w() const { return simd::get<3>(v); }
+      Vec3 xyz() const { return Vec3(v); }
+
+      // Hamilton product: rotates by o, then by this
+      Quat operator*(Quat o) const {
+        using simd::shuffle;
+        F4 r = simd::mul(simd::lane<3>(v), o.v);
+        r = simd::madd(simd::mul(simd::lane<0>(v), shuffle<3, 2, 1, 0>(o.v)), simd::set(1, -1, 1, -1), r);
+        r = simd::madd(simd::mul(simd::lane<1>(v), shuffle<2, 3, 0, 1>(o.v)), simd::set(1, 1, -1, -1), r);
+        r = simd::madd(simd::mul(simd::lane<2>(v), shuffle<1, 0, 3, 2>(o.v)), simd::set(-1, 1, 1, -1), r);
+        return Quat(r);
+      }
+
+      Quat conjugate() const { return Quat(simd::mul(v, simd::set(-1, -1, -1, 1))); }
+      Quat inverse() const { return Quat(simd::div(conjugate().v, simd::dot(v, v))); }
+      Quat normalized() const { return Quat(simd::div(v, simd::sqrt(simd::dot(v, v)))); }
+
+      // v + 2w(q x v) + 2q x (q x v), for a unit quaternion
+      Vec3 rotate(Vec3 p) const {
+        Vec3 axis = xyz();
+        Vec3 t = cross(axis, p) * 2.0f;
+        return p + t * w() + cross(axis, t);
+      }
+    };
+
+    inline float dot(Quat a, Quat b) { return simd::get<0>(simd::dot(a.v, b.v)); }
+
+    // Blend along the shorter arc and renormalize; close to slerp for the small steps of animation
+    inline Quat nlerp(Quat a, Quat b, float t) {
+      F4 to = dot(a, b) < 0 ? simd::sub(simd::splat(0), b.v) : b.v;
+      return Quat(simd::madd(simd::sub(to, a.v), simd::splat(t), a.v)).normalized();
+    }
+
+    inline Quat slerp(Quat a, Quat b, float t) {
+      float cosine = dot(a, b);
+      if (cosine < 0) {
+        b = Quat(simd::sub(simd::splat(0), b.v));
+        cosine = -cosine;
+      }
+      if (cosine > 0.9995f) return nlerp(a, b, t);
+      float angle = std::acos(cosine);
+      float s = 1.0f / std::sin(angle);
+      F4 r = simd::madd(a.v, simd::splat(std::sin((1 - t) * angle) * s), simd::mul(b.v, simd::splat(std::sin(t * angle) * s)));
+      return Quat(r);
+    }
+
+    /* Column-major, like GLM and Jolt: column 3 holds the translation and vectors are columns
+     * multiplied on the right, so (a * b) * v applies b first.
+    */
+    struct Mat4 {
+      Vec4 c[4];
+
+      Mat4() : c{Vec4(1, 0, 0, 0), Vec4(0, 1, 0, 0), Vec4(0, 0, 1, 0), Vec4(0, 0, 0, 1)} {}
+      Mat4(Vec4 c0, Vec4 c1, Vec4 c2, Vec4 c3) : c{c0, c1, c2, c3} {}
+      static Mat4 identity() { return Mat4(); }
+      static Mat4 translation(Vec3 t) { return Mat4(Vec4(1, 0, 0, 0), Vec4(0, 1, 0, 0), Vec4(0, 0, 1, 0), Vec4(t.x(), t.y(), t.z(), 1)); }
+      static Mat4 scale(Vec3 s) { return Mat4(Vec4(s.x(), 0, 0, 0), Vec4(0, s.y(), 0, 0), Vec4(0, 0, s.z(), 0), Vec4(0, 0, 0, 1)); }
+      static Mat4 rotation(Quat q) { return trs(Vec3(), q, Vec3::splat(1)); }
+
+      // Translation * rotation * scale, the usual local-to-parent transform
+      static Mat4 trs(Vec3 t, Quat q, Vec3 s) {
+        float x = q.x(), y = q.y(), z = q.z(), w = q.w();
+        float xx = x * x, yy = y * y, zz = z * z, xy = x * y, xz = x * z, yz = y * z, wx = w * x, wy = w * y, wz = w * z;
+        return Mat4(
+          Vec4(1 - 2 * (yy + zz), 2 * (xy + wz), 2 * (xz - wy), 0) * s.x(),
+          Vec4(2 * (xy - wz), 1 - 2 * (xx + zz), 2 * (yz + wx), 0) * s.y(),
+          Vec4(2 * (xz + wy), 2 * (yz - wx), 1 - 2 * (xx + yy), 0) * s.z(),
+          Vec4(t.x(), t.y(), t.z(), 1));
+      }
+
+      // 16 floats, column after column: the memory layout of glm::mat4 and JPH::Mat44
+      static Mat4 load(const float *p) { return Mat4(Vec4::load(p), Vec4::load(p + 4), Vec4::load(p + 8), Vec4::load(p + 12)); }
+      void store(float *p) const {
+        for (int i = 0; i < 4; ++i) c[i].store(p + 4 * i);
+      }
+
+      Vec4 column(int i) const { return c[i]; }
+      float operator()(int row, int column) const { return c[column][row]; }
+      Vec3 translation() const { return Vec3(c[3]); }
+
+      Vec4 operator*(Vec4 v) const {
+        F4 r = simd::mul(c[0].v, simd::lane<0>(v.v));
+        r = simd::madd(c[1].v, simd::lane<1>(v.v), r);
+        r = simd::madd(c[2].v, simd::lane<2>(v.v), r);
+        return Vec4(simd::madd(c[3].v, simd::lane<3>(v.v), r));
+      }
+      Mat4 operator*(const Mat4 &o) const { return Mat4(*this * o.c[0], *this * o.c[1], *this * o.c[2], *this * o.c[3]); }
+
+      // Points pick up the translation, directions don't
+      Vec3 transform_point(Vec3 p) const {
+        F4 r = simd::madd(c[0].v, simd::lane<0>(p.v), c[3].v);
+        r = simd::madd(c[1].v, simd::lane<1>(p.v), r);
+        return Vec3(simd::madd(c[2].v, simd::lane<2>(p.v), r));
+      }
+      Vec3 transform_vector(Vec3 d) const {
+        F4 r = simd::mul(c[0].v, simd::lane<0>(d.v));
+        r = simd::madd(c[1].v, simd::lane<1>(d.v), r);
+        return Vec3(simd::madd(c[2].v, simd::lane<2>(d.v), r));
+      }
+
+      Mat4 transposed() const {
+        F4 a = c[0].v, b = c[1].v, d = c[2].v, e = c[3].v;
+        simd::transpose(a, b, d, e);
+        return Mat4(Vec4(a), Vec4(b), Vec4(d), Vec4(e));
+      }
+
+      // Inverse of a matrix whose bottom row is 0 0 0 1 (any mix of translation, rotation and scale)
+      Mat4 inverse_affine() const {
+        Vec3 x(c[0]), y(c[1]), z(c[2]);
+        Vec3 yz = cross(y, z), zx = cross(z, x), xy = cross(x, y);
+        float determinant = dot(x, yz);
+        float scale = 1.0f / determinant;
+        // The rows of the inverse are yz, zx and xy over the determinant
+        F4 r0 = simd::mul(yz.v, simd::splat(scale)), r1 = simd::mul(zx.v, simd::splat(scale)), r2 = simd::mul(xy.v, simd::splat(scale));
+        F4 r3 = simd::splat(0);
+        simd::transpose(r0, r1, r2, r3);
+        Mat4 out(Vec4(r0), Vec4(r1), Vec4(r2), Vec4(0, 0, 0, 1));
+        Vec3 t = out.transform_vector(translation());
+        out.c[3] = Vec4(-t.x(), -t.y(), -t.z(), 1);
+        return out;
+      }
+    };
+
+    /* Lanes of W floats for the batch functions, one W per instruction set. Each batch function is
+     * written once against these and instantiated with SIMD_MATH_WIDTH unless told otherwise.
+    */
+    template<int W> struct Lanes;
+
+    template<> struct Lanes<1> {
+      typedef float type;
+      static type load(const float *p) { return *p; }
+      static void store(float *p, type v) { *p = v; }
+      static type splat(float s) { return s; }
+      static type add(type a, type b) { return a + b; }
+      static type sub(type a, type b) { return a - b; }
+      static type mul(type a, type b) { return a * b; }
+      static type div(type a, type b) { return a / b; }
+      static type max(type a, type b) { return a > b ? a : b; }
+      static type sqrt(type a) { return std::sqrt(a); }
+      static type madd(type a, type b, type c) { return a * b + c; }
+    };
+
+#if SIMD_MATH_SSE
+    template<> struct Lanes<4> {
+      typedef __m128 type;
+      static type load(const float *p) { return _mm_load_ps(p); }
+      static void store(float *p, type v) { _mm_store_ps(p, v); }
+      static type splat(float s) { return _mm_set1_ps(s); }
+      static type add(type a, type b) { return _mm_add_ps(a, b); }
+      static type sub(type a, type b) { return _mm_sub_ps(a, b); }
+      static type mul(type a, type b) { return _mm_mul_ps(a, b); }
+      static type div(type a, type b) { return _mm_div_ps(a, b); }
+      static type max(type a, type b) { return _mm_max_ps(a, b); }
+      static type sqrt(type a) { return _mm_sqrt_ps(a); }
+      static type madd(type a, type b, type c) { return simd::madd(a, b, c); }
+    };
+#endif
+
+#if SIMD_MATH_AVX
+    template<> struct Lanes<8> {
+      typedef __m256 type;
+      static type load(const float *p) { return _mm256_load_ps(p); }
+      static void store(float *p, type v) { _mm256_store_ps(p, v); }
+      static type splat(float s) { return _mm256_set1_ps(s); }
+      static type add(type a, type b) { return _mm256_add_ps(a, b); }
+      static type sub(type a, type b) { return _mm256_sub_ps(a, b); }
+      static type mul(type a, type b) { return _mm256_mul_ps(a, b); }
+      static type div(type a, type b) { return _mm256_div_ps(a, b); }
+      static type max(type a, type b) { return _mm256_max_ps(a, b); }
+      static type sqrt(type a) { return _mm256_sqrt_ps(a); }
+#if SIMD_MATH_FMA
+      static type madd(type a, type b, type c) { return _mm256_fmadd_ps(a, b, c); }
+#else
+      static type madd(type a, type b, type c) { return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+#endif
+    };
+#endif
+
+    /* FIELDS float arrays of one length in a single 64-byte aligned block, one field after the
+     * other. The capacity is kept a multiple of 8, so the batch functions can run whole lanes past
+     * the end without a scalar tail; that padding reads as zeros.
+    */
+    template<int FIELDS> class SoaArray {
+    protected:
+      float *_data = nullptr;
+      size_t _size = 0, _capacity = 0;
+    public:
+      static constexpr size_t PAD = 8;
+
+      SoaArray() {}
+      explicit SoaArray(size_t size) { resize(size); }
+      SoaArray(const SoaArray &o) {
+        if (!o._size) return;
+        reserve(o._size);
+        _size = o._size;
+        for (int f = 0; f < FIELDS; ++f) memcpy(field(f), o.field(f), _size * sizeof(float));
+      }
+      SoaArray(SoaArray &&o) noexcept : _data(o._data), _size(o._size), _capacity(o._capacity) {
+        o._data = nullptr;
+        o._size = o._capacity = 0;
+      }
+      SoaArray &operator=(SoaArray o) noexcept {
+        std::swap(_data, o._data);
+        std::swap(_size, o._size);
+        std::swap(_capacity, o._capacity);
+        return *this;
+      }
+      ~SoaArray() { free(_data); }
+
+      size_t size() const { return _size; }
+      size_t capacity() const { return _capacity; }
+      bool empty() const { return _size == 0; }
+      float *field(int f) { return _data + f * _capacity; }
+      const float *field(int f) const { return _data + f * _capacity; }
+
+      void reserve(size_t count) {
+        if (count <= _capacity) return;
+        size_t capacity = _capacity ? _capacity * 2 : 64;
+        while (capacity < count) capacity *= 2;
+        capacity = (capacity + PAD - 1) / PAD * PAD;
+        float *data = static_cast<float *>(aligned_alloc(64, FIELDS * capacity * sizeof(float)));
+        if (!data) throw std::bad_alloc();
+        memset(data, 0, FIELDS * capacity * sizeof(float));
+        for (int f = 0; f < FIELDS; ++f) {
+          if (_size) memcpy(data + f * capacity, field(f), _size * sizeof(float));
+        }
+        free(_data);
+        _data = data;
+        _capacity = capacity;
+      }
+
+      // New elements are zero
+      void resize(size_t count) {
+        if (count == _size) return;
+        reserve(count);
+        if (count > _size) {
+          for (int f = 0; f < FIELDS; ++f) memset(field(f) + _size, 0, (count - _size) * sizeof(float));
+        } else {
+          for (int f = 0; f < FIELDS; ++f) memset(field(f) + count, 0, (_size - count) * sizeof(float));
+        }
+        _size = count;
+      }
+
+      void clear() { resize(0); }
+    };
+
+    class Vec3Soa : public SoaArray<3> {
+    public:
+      using SoaArray<3>::SoaArray;
+
+      float *x() { return field(0); }
+      float *y() { return field(1); }
+      float *z() { return field(2); }
+      const float *x() const { return field(0); }
+      const float *y() const { return field(1); }
+      const float *z() const { return field(2); }
+
+      Vec3 get(size_t i) const { return Vec3(x()[i], y()[i], z()[i]); }
+      void set(size_t i, Vec3 v) {
+        x()[i] = v.x();
+        y()[i] = v.y();
+        z()[i] = v.z();
+      }
+      void push_back(Vec3 v) {
+        if (_size == _capacity) reserve(_size + 1);
+        set(_size++, v);
+      }
+
+      // From and to interleaved x y z: arrays of glm::vec3 or JPH::Float3, or any struct via stride (in floats)
+      void assign(const float *xyz, size_t count, size_t stride = 3) {
+        resize(count);
+        for (size_t i = 0; i < count; ++i, xyz += stride) {
+          x()[i] = xyz[0];
+          y()[i] = xyz[1];
+          z()[i] = xyz[2];
+        }
+      }
+      void copy_to(float *xyz, size_t stride = 3) const {
+        for (size_t i = 0; i < _size; ++i, xyz += stride) {
+          xyz[0] = x()[i];
+          xyz[1] = y()[i];
+          xyz[2] = z()[i];
+        }
+      }
+    };
+
+    class QuatSoa : public SoaArray<4> {
+    public:
+      using SoaArray<4>::SoaArray;
+
+      float *x() { return field(0); }
+      float *y() { return field(1); }
+      float *z() { return field(2); }
+      float *w() { return field(3); }
+      const float *x() const { return field(0); }
+      const float *y() const { return field(1); }
+      const float *z() const { return field(2); }
+      const float *w() const { return field(3); }
+
+      Quat get(size_t i) const { return Quat(x()[i], y()[i], z()[i], w()[i]); }
+      void set(size_t i, Quat q) {
+        x()[i] = q.x();
+        y()[i] = q.y();
+        z()[i] = q.z();
+        w()[i] = q.w();
+      }
+      void push_back(Quat q) {
+        if (_size == _capacity) reserve(_size + 1);
+        set(_size++, q);
+      }
+
+      // From and to interleaved x y z w (glm::quat, JPH::Quat)
+      void assign(const float *xyzw, size_t count, size_t stride = 4) {
+        resize(count);
+        for (size_t i = 0; i < count; ++i, xyzw += stride) set(i, Quat(xyzw[0], xyzw[1], xyzw[2], xyzw[3]));
+      }
+      void copy_to(float *xyzw, size_t stride = 4) const {
+        for (size_t i = 0; i < _size; ++i, xyzw += stride) {
+          xyzw[0] = x()[i];
+          xyzw[1] = y()[i];
+          xyzw[2] = z()[i];
+          xyzw[3] = w()[i];
+        }
+      }
+    };
+
+    /* Whole-array operations on SoA batches, W elements per step. Outputs are resized to the
+     * input's size (allocating only when they grow) and may be the same object as an input.
+    */
+    namespace batch {
+      template<int W> inline size_t _steps(size_t size) { return (size + W - 1) / W * W; }
+
+      // out = m * (in, 1)
+      template<int W = SIMD_MATH_WIDTH> void transform_points(const Mat4 &m, const Vec3Soa &in, Vec3Soa &out) {
+        typedef Lanes<W> L;
+        out.resize(in.size());
+        typename L::type m00 = L::splat(m(0, 0)), m01 = L::splat(m(0, 1)), m02 = L::splat(m(0, 2)), m03 = L::splat(m(0, 3));
+        typename L::type m10 = L::splat(m(1, 0)), m11 = L::splat(m(1, 1)), m12 = L::splat(m(1, 2)), m13 = L::splat(m(1, 3));
+        typename L::type m20 = L::splat(m(2, 0)), m21 = L::splat(m(2, 1)), m22 = L::splat(m(2, 2)), m23 = L::splat(m(2, 3));
+        for (size_t i = 0, n = _steps<W>(in.size()); i < n; i += W) {
+          typename L::type x = L::load(in.x() + i), y = L::load(in.y() + i), z = L::load(in.z() + i);
+          L::store(out.x() + i, L::madd(m00, x, L::madd(m01, y, L::madd(m02, z, m03))));
+          L::store(out.y() + i, L::madd(m10, x, L::madd(m11, y, L::madd(m12, z, m13))));
+          L::store(out.z() + i, L::madd(m20, x, L::madd(m21, y, L::madd(m22, z, m23))));
+        }
+      }
+
+      // out = m * (in, 0)
+      template<int W = SIMD_MATH_WIDTH> void transform_vectors(const Mat4 &m, const Vec3Soa &in, Vec3Soa &out) {
+        typedef Lanes<W> L;
+        out.resize(in.size());
+        typename L::type m00 = L::splat(m(0, 0)), m01 = L::splat(m(0, 1)), m02 = L::splat(m(0, 2));
+        typename L::type m10 = L::splat(m(1, 0)), m11 = L::splat(m(1, 1)), m12 = L::splat(m(1, 2));
+        typename L::type m20 = L::splat(m(2, 0)), m21 = L::splat(m(2, 1)), m22 = L::splat(m(2, 2));
+        for (size_t i = 0, n = _steps<W>(in.size()); i < n; i += W) {
+          typename L::type x = L::load(in.x() + i), y = L::load(in.y() + i), z = L::load(in.z() + i);
+          L::store(out.x() + i, L::madd(m00, x, L::madd(m01, y, L::mul(m02, z))));
+          L::store(out.y() + i, L::madd(m10, x, L::madd(m11, y, L::mul(m12, z))));
+          L::store(out.z() + i, L::madd(m20, x, L::madd(m21, y, L::mul(m22, z))));
+        }
+      }
+
+      // Zero vectors stay zero
+      template<int W = SIMD_MATH_WIDTH> void normalize(Vec3Soa &v) {
+        typedef Lanes<W> L;
+        typename L::type tiny = L::splat(1e-30f);
+        for (size_t i = 0, n = _steps<W>(v.size()); i < n; i += W) {
+          typename L::type x = L::load(v.x() + i), y = L::load(v.y() + i), z = L::load(v.z() + i);
+          typename L::type length = L::max(L::sqrt(L::madd(x, x, L::madd(y, y, L::mul(z, z)))), tiny);
+          L::store(v.x() + i, L::div(x, length));
+          L::store(v.y() + i, L::div(y, length));
+          L::store(v.z() + i, L::div(z, length));
+        }
+      }
+
+      template<int W = SIMD_MATH_WIDTH> void normalize(QuatSoa &q) {
+        typedef Lanes<W> L;
+        typename L::type tiny = L::splat(1e-30f);
+        for (size_t i = 0, n = _steps<W>(q.size()); i < n; i += W) {
+          typename L::type x = L::load(q.x() + i), y = L::load(q.y() + i), z = L::load(q.z() + i), w = L::load(q.w() + i);
+          typename L::type length = L::max(L::sqrt(L::madd(x, x, L::madd(y, y, L::madd(z, z, L::mul(w, w))))), tiny);
+          L::store(q.x() + i, L::div(x, length));
+          L::store(q.y() + i, L::div(y, length));
+          L::store(q.z() + i, L::div(z, length));
+          L::store(q.w() + i, L::div(w, length));
+        }
+      }
+
+      // v += d * scale, e.g. positions from velocities
+      template<int W = SIMD_MATH_WIDTH> void add_scaled(Vec3Soa &v, const Vec3Soa &d, float scale) {
+        typedef Lanes<W> L;
+        typename L::type s = L::splat(scale);
+        size_t n = _steps<W>(v.size() < d.size() ? v.size() : d.size());
+        for (size_t i = 0; i < n; i += W) {
+          L::store(v.x() + i, L::madd(L::load(d.x() + i), s, L::load(v.x() + i)));
+          L::store(v.y() + i, L::madd(L::load(d.y() + i), s, L::load(v.y() + i)));
+          L::store(v.z() + i, L::madd(L::load(d.z() + i), s, L::load(v.z() + i)));
+        }
+      }
+
+      // out[i] = a[i] * b[i]
+      template<int W = SIMD_MATH_WIDTH> void multiply(const QuatSoa &a, const QuatSoa &b, QuatSoa &out) {
+        typedef Lanes<W> L;
+        size_t size = a.size() < b.size() ? a.size() : b.size();
+        out.resize(size);
+        for (size_t i = 0, n = _steps<W>(size); i < n; i += W) {
+          typename L::type ax = L::load(a.x() + i), ay = L::load(a.y() + i), az = L::load(a.z() + i), aw = L::load(a.w() + i);
+          typename L::type bx = L::load(b.x() + i), by = L::load(b.y() + i), bz = L::load(b.z() + i), bw = L::load(b.w() + i);
+          L::store(out.x() + i, L::sub(L::madd(aw, bx, L::madd(ax, bw, L::mul(ay, bz))), L::mul(az, by)));
+          L::store(out.y() + i, L::sub(L::madd(aw, by, L::madd(ay, bw, L::mul(az, bx))), L::mul(ax, bz)));
+          L::store(out.z() + i, L::sub(L::madd(aw, bz, L::madd(az, bw, L::mul(ax, by))), L::mul(ay, bx)));
+          L::store(out.w() + i, L::sub(L::mul(aw, bw), L::madd(ax, bx, L::madd(ay, by, L::mul(az, bz)))));
+        }
+      }
+
+      // out[i] = q[i] rotating v[i]; q must be unit length
+      template<int W = SIMD_MATH_WIDTH> void rotate(const QuatSoa &q, const Vec3Soa &v, Vec3Soa &out) {
+        typedef Lanes<W> L;
+        size_t size = q.size() < v.size() ? q.size() : v.size();
+        out.resize(size);
+        typename L::type two = L::splat(2);
+        for (size_t i = 0, n = _steps<W>(size); i < n; i += W) {
+          typename L::type qx = L::load(q.x() + i), qy = L::load(q.y() + i), qz = L::load(q.z() + i), qw = L::load(q.w() + i);
+          typename L::type x = L::load(v.x() + i), y = L::load(v.y() + i), z = L::load(v.z() + i);
+          // t = 2 (q x v), then v + w t + q x t
+          typename L::type tx = L::mul(two, L::sub(L::mul(qy, z), L::mul(qz, y)));
+          typename L::type ty = L::mul(two, L::sub(L::mul(qz, x), L::mul(qx, z)));
+          typename L::type tz = L::mul(two, L::sub(L::mul(qx, y), L::mul(qy, x)));
+          L::store(out.x() + i, L::add(L::madd(qw, tx, x), L::sub(L::mul(qy, tz), L::mul(qz, ty))));
+          L::store(out.y() + i, L::add(L::madd(qw, ty, y), L::sub(L::mul(qz, tx), L::mul(qx, tz))));
+          L::store(out.z() + i, L::add(L::madd(qw, tz, z), L::sub(L::mul(qx, ty), L::mul(qy, tx))));
+        }
+      }
+
+      /* World matrices from positions, unit rotations and scales (Mat4::trs for each element),
+       * written to out[0, size) for the shortest of the three. This is the per-entity transform
+       * update; the result is AoS because that is what renderers upload.
+      */
+      template<int W = SIMD_MATH_WIDTH> void compose(const Vec3Soa &position, const QuatSoa &rotation, const Vec3Soa &scale, Mat4 *out) {
+        typedef Lanes<W> L;
+        size_t size = position.size() < rotation.size() ? position.size() : rotation.size();
+        if (scale.size() < size) size = scale.size();
+        typename L::type one = L::splat(1), two = L::splat(2);
+        alignas(64) float m[12][W];
+        for (size_t i = 0; i < size; i += W) {
+          typename L::type x = L::load(rotation.x() + i), y = L::load(rotation.y() + i), z = L::load(rotation.z() + i), w = L::load(rotation.w() + i);
+          typename L::type sx = L::load(scale.x() + i), sy = L::load(scale.y() + i), sz = L::load(scale.z() + i);
+          typename L::type x2 = L::mul(x, two), y2 = L::mul(y, two), z2 = L::mul(z, two);
+          typename L::type xx = L::mul(x, x2), yy = L::mul(y, y2), zz = L::mul(z, z2);
+          typename L::type xy = L::mul(x, y2), xz = L::mul(x, z2), yz = L::mul(y, z2);
+          typename L::type wx = L::mul(w, x2), wy = L::mul(w, y2), wz = L::mul(w, z2);
+          L::store(m[0], L::mul(L::sub(one, L::add(yy, zz)), sx));
+          L::store(m[1], L::mul(L::add(xy, wz), sx));
+          L::store(m[2], L::mul(L::sub(xz, wy), sx));
+          L::store(m[3], L::mul(L::sub(xy, wz), sy));
+          L::store(m[4], L::mul(L::sub(one, L::add(xx, zz)), sy));
+          L::store(m[5], L::mul(L::add(yz, wx), sy));
+          L::store(m[6], L::mul(L::add(xz, wy), sz));
+          L::store(m[7], L::mul(L::sub(yz, wx), sz));
+          L::store(m[8], L::mul(L::sub(one, L::add(xx, yy)), sz));
+          L::store(m[9], L::load(position.x() + i));
+          L::store(m[10], L::load(position.y() + i));
+          L::store(m[11], L::load(position.z() + i));
+          // Four elements at a time, each column a 4x4 transpose of three rows plus the w row
+          size_t lanes = size - i < (size_t) W ? size - i : (size_t) W, j = 0;
+          for (; j + 4 <= lanes; j += 4) {
+            for (int column = 0; column < 4; ++column) {
+              F4 a = simd::load(m[3 * column] + j), b = simd::load(m[3 * column + 1] + j), c = simd::load(m[3 * column + 2] + j);
+              F4 e = simd::splat(column == 3 ? 1.0f : 0.0f);
+              simd::transpose(a, b, c, e);
+              out[i + j].c[column].v = a;
+              out[i + j + 1].c[column].v = b;
+              out[i + j + 2].c[column].v = c;
+              out[i + j + 3].c[column].v = e;
+            }
+          }
+          for (; j < lanes; ++j) {
+            out[i + j] = Mat4(Vec4(m[0][j], m[1][j], m[2][j], 0), Vec4(m[3][j], m[4][j], m[5][j], 0),
+              Vec4(m[6][j], m[7][j], m[8][j], 0), Vec4(m[9][j], m[10][j], m[11][j], 1));
+          }
+        }
+      }
+
+      // out[i] = parent * local[i], for pushing a level of a hierarchy down to world space
+      inline void multiply(const Mat4 &parent, const Mat4 *local, Mat4 *out, size_t count) {
+        for (size_t i = 0; i < count; ++i) out[i] = parent * local[i];
+      }
+    }
+
+#if SIMD_MATH_GLM
+    inline glm::vec3 to_glm(Vec3 v) { return glm::vec3(v.x(), v.y(), v.z()); }
+    inline glm::vec4 to_glm(Vec4 v) { return glm::vec4(v.x(), v.y(), v.z(), v.w()); }
+    // glm::quat's constructor takes w first
+    inline glm::quat to_glm(Quat q) { return glm::quat(q.w(), q.x(), q.y(), q.z()); }
+    inline glm::mat4 to_glm(const Mat4 &m) {
+      return glm::mat4(to_glm(m.c[0]), to_glm(m.c[1]), to_glm(m.c[2]), to_glm(m.c[3]));
+    }
+    inline Vec3 from_glm(const glm::vec3 &v) { return Vec3(v.x, v.y, v.z); }
+    inline Vec4 from_glm(const glm::vec4 &v) { return Vec4(v.x, v.y, v.z, v.w); }
+    inline Quat from_glm(const glm::quat &q) { return Quat(q.x, q.y, q.z, q.w); }
+    inline Mat4 from_glm(const glm::mat4 &m) { return Mat4(from_glm(m[0]), from_glm(m[1]), from_glm(m[2]), from_glm(m[3])); }
+#endif
+
+#if SIMD_MATH_JOLT
+    inline JPH::Vec3 to_jolt(Vec3 v) { return JPH::Vec3(v.x(), v.y(), v.z()); }
+    inline JPH::Vec4 to_jolt(Vec4 v) { return JPH::Vec4(v.x(), v.y(), v.z(), v.w()); }
+    inline JPH::Quat to_jolt(Quat q) { return JPH::Quat(q.x(), q.y(), q.z(), q.w()); }
+    inline JPH::Mat44 to_jolt(const Mat4 &m) {
+      return JPH::Mat44(to_jolt(m.c[0]), to_jolt(m.c[1]), to_jolt(m.c[2]), to_jolt(m.c[3]));
+    }
+    inline Vec3 from_jolt(JPH::Vec3Arg v) { return Vec3(v.GetX(), v.GetY(), v.GetZ()); }
+    inline Vec4 from_jolt(JPH::Vec4Arg v) { return Vec4(v.GetX(), v.GetY(), v.GetZ(), v.GetW()); }
+    inline Quat from_jolt(JPH::QuatArg q) { return Quat(q.GetX(), q.GetY(), q.GetZ(), q.GetW()); }
+    inline Mat4 from_jolt(JPH::Mat44Arg m) {
+      return Mat4(from_jolt(m.GetColumn4(0)), from_jolt(m.GetColumn4(1)), from_jolt(m.GetColumn4(2)), from_jolt(m.GetColumn4(3)));
+    }
+#endif
+  }
+}
+
+using WellSpring::math::Vec3;
+using WellSpring::math::Vec4;
+using WellSpring::math::Quat;
+using WellSpring::math::Mat4;
+using WellSpring::math::Vec3Soa;
+using WellSpring::math::QuatSoa;
+
+#endif // _SIMD_MATH_H_
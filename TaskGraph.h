@@ -0,0 +1,452 @@
+#ifndef _TASK_GRAPH_H_
+#define _TASK_GRAPH_H_
+
+#include "callable.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Chase-Lev work-stealing deque of task indices (the C11 formulation by Lê et al.). The owner
+ * pushes and pops at the bottom without contention; other workers steal from the top. Fixed
+ * capacity, set by reserve() while nobody is using it.
+*/
+class ChaseLevDeque {
+public:
+  static constexpr uint32_t EMPTY = UINT32_MAX;
+private:
+  alignas(64) std::atomic<int64_t> _top{0};
+  alignas(64) std::atomic<int64_t> _bottom{0};
+  std::unique_ptr<std::atomic<uint32_t>[]> _slots;
+  int64_t _mask = -1;
+public:
+  ChaseLevDeque() {}
+
+  // Capacity rounded up to a power of two; only grows, and only between runs
+  void reserve(uint32_t capacity) {
+    if ((int64_t) capacity <= _mask + 1) return;
+    int64_t size = 1;
+    while (size < (int64_t) capacity) size <<= 1;
+    _slots.reset(new std::atomic<uint32_t>[size]);
+    _mask = size - 1;
+    _top.store(0);
+    _bottom.store(0);
+  }
+
+  // Owner only. The deque must have room, which run() guarantees by sizing it to the graph.
+  void push(uint32_t task) {
+    int64_t bottom = _bottom.load(std::memory_order_relaxed);
+    _slots[bottom & _mask].store(task, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    _bottom.store(bottom + 1, std::memory_order_relaxed);
+  }
+
+  // Owner only; EMPTY if there is nothing left
+  uint32_t pop() {
+    int64_t bottom = _bottom.load(std::memory_order_relaxed) - 1;
+    _bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = _top.load(std::memory_order_relaxed);
+    if (top > bottom) {
+      _bottom.store(bottom + 1, std::memory_order_relaxed);
+      return EMPTY;
+    }
+    uint32_t task = _slots[bottom & _mask].load(std::memory_order_relaxed);
+    if (top == bottom) {
+      // The last one; race the thieves for it
+      if (!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        task = EMPTY;
+      _bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return task;
+  }
+
+  // Any thread; EMPTY if there was nothing or another thief got there first
+  uint32_t steal() {
+    int64_t top = _top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t bottom = _bottom.load(std::memory_order_acquire);
+    if (top >= bottom) return EMPTY;
+    uint32_t task = _slots[top & _mask].load(std::memory_order_relaxed);
+    if (!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+      return EMPTY;
+    return task;
+  }
+};
+
+/* Tasks and the order they must run in, built once and run every frame. add() a task, then
+ * depend() on others; the graph is checked and flattened on the first run after a change, and
+ * reruns allocate nothing. Tasks with no path between them may run at the same time.
+*/
+class TaskGraph {
+public:
+  typedef uint32_t TaskId;
+  typedef Delegate<void()> Work;
+private:
+  struct Task {
+    Work work;
+    const char *name;
+    std::vector<TaskId> successors;
+    uint32_t dependencies = 0;
+  };
+
+  std::vector<Task> _tasks;
+  bool _compiled = false;
+
+  // Flattened by _compile()
+  std::vector<uint32_t> _first_successor; // Task i's successors are _successors[first[i], first[i + 1])
+  std::vector<TaskId> _successors;
+  std::vector<TaskId> _roots;
+  std::unique_ptr<std::atomic<uint32_t>[]> _pending;
+  std::vector<TaskId> _ready; // Inline runs' stack
+
+  void _compile() {
+    if (_compiled) return;
+    size_t count = _tasks.size();
+    _first_successor.assign(count + 1, 0);
+    _successors.clear();
+    _roots.clear();
+    for (size_t i = 0; i < count; ++i) {
+      _first_successor[i] = (uint32_t) _successors.size();
+      _successors.insert(_successors.end(), _tasks[i].successors.begin(), _tasks[i].successors.end());
+      if (_tasks[i].dependencies == 0) _roots.push_back((TaskId) i);
+    }
+    _first_successor[count] = (uint32_t) _successors.size();
+
+    // Kahn's algorithm: every task must be reachable in dependency order
+    std::vector<uint32_t> waiting(count);
+    for (size_t i = 0; i < count; ++i) waiting[i] = _tasks[i].dependencies;
+    std::vector<TaskId> ready(_roots);
+    size_t reached = 0;
+    while (!ready.empty()) {
+      TaskId task = ready.back();
+      ready.pop_back();
+      reached++;
+      for (uint32_t s = _first_successor[task]; s < _first_successor[task + 1]; ++s) {
+        if (--waiting[_successors[s]] == 0) ready.push_back(_successors[s]);
+      }
+    }
+    if (reached != count) throw std::invalid_argument("TaskGraph: dependency cycle");
+
+    _pending.reset(new std::atomic<uint32_t>[count]);
+    _ready.reserve(count);
+    _compiled = true;
+  }
+
+  friend class TaskScheduler;
+public:
+  TaskId add(const char *name, Work work) {
+    _tasks.emplace_back();
+    _tasks.back().work = work;
+    _tasks.back().name = name;
+    _compiled = false;
+    return (TaskId) (_tasks.size() - 1);
+  }
+
+  // after runs once before has finished
+  void depend(TaskId after, TaskId before) {
+    if (after >= _tasks.size() || before >= _tasks.size()) throw std::out_of_range("TaskGraph: no such task");
+    if (after == before) throw std::invalid_argument("TaskGraph: a task can't depend on itself");
+    _tasks[before].successors.push_back(after);
+    _tasks[after].dependencies++;
+    _compiled = false;
+  }
+
+  void clear() {
+    _tasks.clear();
+    _compiled = false;
+  }
+
+  size_t size() const { return _tasks.size(); }
+  const char *name(TaskId task) const { return _tasks[task].name; }
+};
+
+/* Where and when each task of a run ran, for finding stalls and idle workers. Pass one to
+ * TaskScheduler::run(); recording needs no locks and, once the timeline has seen a graph of that
+ * size, no allocation. Times are steady-clock nanoseconds.
+*/
+class FrameTimeline {
+public:
+  struct Span {
+    TaskGraph::TaskId task;
+    uint32_t worker;
+    uint64_t start, end;
+  };
+private:
+  struct alignas(64) Lane {
+    std::vector<Span> spans;
+  };
+
+  std::vector<Lane> _lanes;
+  const TaskGraph *_graph = nullptr;
+  uint64_t _frame_start = 0, _frame_end = 0;
+
+  // Each worker could run every task, so every lane gets room for all of them
+  void _begin(const TaskGraph &graph, int workers) {
+    if ((int) _lanes.size() < workers) _lanes.resize(workers);
+    for (Lane &lane : _lanes) {
+      lane.spans.clear();
+      lane.spans.reserve(graph.size());
+    }
+    _graph = &graph;
+    _frame_start = now();
+  }
+
+  void _record(int worker, TaskGraph::TaskId task, uint64_t start) {
+    _lanes[worker].spans.push_back(Span{task, (uint32_t) worker, start, now()});
+  }
+
+  friend class TaskScheduler;
+public:
+  static uint64_t now() {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  uint64_t frame_start() const { return _frame_start; }
+  uint64_t frame_end() const { return _frame_end; }
+  int workers() const { return (int) _lanes.size(); }
+  const std::vector<Span> &spans(int worker) const { return _lanes[worker].spans; }
+
+  // Time each worker spent inside tasks, out of the whole frame
+  double busy_fraction(int worker) const {
+    uint64_t busy = 0;
+    for (const Span &span : _lanes[worker].spans) busy += span.end - span.start;
+    return _frame_end > _frame_start ? (double) busy / (_frame_end - _frame_start) : 0;
+  }
+
+  // One row per worker in chrome://tracing or Perfetto; the frame itself is a span on row 0
+  bool write_chrome_trace(const char *path) const {
+    FILE *out = fopen(path, "w");
+    if (!out) return false;
+    fprintf(out, "{\"traceEvents\":[\n");
+    fprintf(out, "{\"name\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":0,\"ts\":0,\"dur\":%.3f}",
+      (_frame_end - _frame_start) / 1000.0);
+    for (const Lane &lane : _lanes) {
+      for (const Span &span : lane.spans) {
+        const char *name = _graph ? _graph->name(span.task) : nullptr;
+        fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+          name ? name : "task", span.worker + 1, (span.start - _frame_start) / 1000.0, (span.end - span.start) / 1000.0);
+      }
+    }
+    fprintf(out, "\n]}\n");
+    return fclose(out) == 0;
+  }
+};
+
+/* Runs TaskGraphs on a fixed set of worker threads plus the calling thread. Each participant
+ * keeps the tasks it made ready in its own Chase-Lev deque and runs them newest first; when it
+ * runs dry it steals the oldest from a random other. run() returns when every task of the graph
+ * has finished. One run at a time; a run started from inside a task runs inline.
+*/
+class TaskScheduler {
+  struct alignas(64) Worker {
+    ChaseLevDeque deque;
+    uint64_t random;
+  };
+
+  std::vector<std::thread> _threads;
+  std::unique_ptr<Worker[]> _workers;
+  int _participants;
+
+  // The graph being run
+  TaskGraph *_graph = nullptr;
+  FrameTimeline *_timeline = nullptr;
+  alignas(64) std::atomic<uint32_t> _remaining{0};
+  std::exception_ptr _error;
+  std::mutex _error_lock;
+
+  // Same handshake as WorkerPool: odd while a run is open, workers register in _active
+  alignas(64) std::atomic<uint64_t> _sequence{0};
+  alignas(64) std::atomic<int> _active{0};
+  std::atomic<int> _sleepers{0};
+  std::atomic<bool> _stop{false};
+  std::mutex _sleep_lock;
+  std::condition_variable _wake;
+  std::mutex _submit;
+
+  static bool &_inside() {
+    static thread_local bool inside = false;
+    return inside;
+  }
+
+  void _execute(int participant, TaskGraph::TaskId task) {
+    TaskGraph &graph = *_graph;
+    uint64_t start = _timeline ? FrameTimeline::now() : 0;
+    try {
+      graph._tasks[task].work();
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(_error_lock);
+      if (!_error) _error = std::current_exception();
+    }
+    if (_timeline) _timeline->_record(participant, task, start);
+    ChaseLevDeque &deque = _workers[participant].deque;
+    for (uint32_t s = graph._first_successor[task]; s < graph._first_successor[task + 1]; ++s) {
+      TaskGraph::TaskId next = graph._successors[s];
+      if (graph._pending[next].fetch_sub(1, std::memory_order_acq_rel) == 1) deque.push(next);
+    }
+    _remaining.fetch_sub(1, std::memory_order_acq_rel);
+  }
+
+  uint32_t _steal(int participant) {
+    Worker &self = _workers[participant];
+    // xorshift for the first victim, then everyone in turn
+    self.random ^= self.random << 13;
+    self.random ^= self.random >> 7;
+    self.random ^= self.random << 17;
+    int first = (int) (self.random % _participants);
+    for (int i = 0; i < _participants; ++i) {
+      int victim = (first + i) % _participants;
+      if (victim == participant) continue;
+      uint32_t task = _workers[victim].deque.steal();
+      if (task != ChaseLevDeque::EMPTY) return task;
+    }
+    return ChaseLevDeque::EMPTY;
+  }
+
+  void _work(int participant) {
+    ChaseLevDeque &deque = _workers[participant].deque;
+    int idle = 0;
+    while (_remaining.load(std::memory_order_acquire) != 0) {
+      uint32_t task = deque.pop();
+      if (task == ChaseLevDeque::EMPTY) task = _steal(participant);
+      if (task == ChaseLevDeque::EMPTY) {
+        // Others are still running the tasks that will make more ready
+        if (++idle > 64) std::this_thread::yield();
+        continue;
+      }
+      idle = 0;
+      _execute(participant, task);
+    }
+  }
+
+  void _worker(int participant) {
+    _inside() = true;
+    uint64_t seen = 0;
+    while (true) {
+      uint64_t sequence = _sequence.load();
+      for (int spin = 0; spin < 2000 && (sequence == seen || !(sequence & 1)); ++spin) {
+        if (_stop.load(std::memory_order_relaxed)) return;
+        std::this_thread::yield();
+        sequence = _sequence.load();
+      }
+      if (sequence == seen || !(sequence & 1)) {
+        std::unique_lock<std::mutex> lock(_sleep_lock);
+        _sleepers.fetch_add(1);
+        _wake.wait(lock, [&] {
+          uint64_t s = _sequence.load();
+          return _stop.load() || (s != seen && (s & 1));
+        });
+        _sleepers.fetch_sub(1);
+        if (_stop.load()) return;
+        continue;
+      }
+      seen = sequence;
+      _active.fetch_add(1);
+      if (_sequence.load() == sequence) _work(participant);
+      _active.fetch_sub(1);
+    }
+  }
+
+  // A run from inside a task, or with no workers: dependency order on this thread
+  void _run_inline(TaskGraph &graph, FrameTimeline *timeline) {
+    size_t count = graph._tasks.size();
+    std::vector<TaskGraph::TaskId> &ready = graph._ready;
+    ready.assign(graph._roots.begin(), graph._roots.end());
+    for (size_t i = 0; i < count; ++i) graph._pending[i].store(graph._tasks[i].dependencies, std::memory_order_relaxed);
+    if (timeline) timeline->_begin(graph, 1);
+    std::exception_ptr error;
+    while (!ready.empty()) {
+      TaskGraph::TaskId task = ready.back();
+      ready.pop_back();
+      uint64_t start = timeline ? FrameTimeline::now() : 0;
+      try {
+        graph._tasks[task].work();
+      } catch (...) {
+        if (!error) error = std::current_exception();
+      }
+      if (timeline) timeline->_record(0, task, start);
+      for (uint32_t s = graph._first_successor[task]; s < graph._first_successor[task + 1]; ++s) {
+        TaskGraph::TaskId next = graph._successors[s];
+        if (graph._pending[next].fetch_sub(1, std::memory_order_relaxed) == 1) ready.push_back(next);
+      }
+    }
+    if (timeline) timeline->_frame_end = FrameTimeline::now();
+    if (error) std::rethrow_exception(error);
+  }
+public:
+  // 0 threads means one fewer than the hardware has, since the caller takes part too
+  explicit TaskScheduler(int threads = 0) {
+    if (threads <= 0) threads = (int) std::thread::hardware_concurrency() - 1;
+    if (threads < 0) threads = 0;
+    _participants = threads + 1;
+    _workers.reset(new Worker[_participants]);
+    for (int i = 0; i < _participants; ++i) _workers[i].random = 0x9E3779B97F4A7C15ull * (i + 1);
+    for (int i = 0; i < threads; ++i) _threads.emplace_back(&TaskScheduler::_worker, this, i + 1);
+  }
+
+  TaskScheduler(const TaskScheduler &) = delete;
+  TaskScheduler &operator=(const TaskScheduler &) = delete;
+
+  ~TaskScheduler() {
+    _stop.store(true);
+    {
+      std::lock_guard<std::mutex> lock(_sleep_lock);
+    }
+    _wake.notify_all();
+    for (std::thread &t : _threads) t.join();
+  }
+
+  int thread_count() const { return (int) _threads.size(); }
+  int participants() const { return _participants; }
+
+  /* Runs every task of the graph once, in dependency order, and returns when all are done. The
+   * first exception thrown by a task is rethrown here after the rest of the graph has run.
+   * With a timeline, every task's span is recorded in it.
+  */
+  void run(TaskGraph &graph, FrameTimeline *timeline = nullptr) {
+    graph._compile();
+    size_t count = graph._tasks.size();
+    if (count == 0) return;
+    if (_threads.empty() || _inside()) return _run_inline(graph, timeline);
+
+    std::lock_guard<std::mutex> submit(_submit);
+    _inside() = true;
+    _graph = &graph;
+    _timeline = timeline;
+    _error = nullptr;
+    for (size_t i = 0; i < count; ++i) graph._pending[i].store(graph._tasks[i].dependencies, std::memory_order_relaxed);
+    for (int i = 0; i < _participants; ++i) _workers[i].deque.reserve((uint32_t) count);
+    if (timeline) timeline->_begin(graph, _participants);
+    _remaining.store((uint32_t) count, std::memory_order_relaxed);
+    // Roots start on the caller's deque; the others steal them
+    for (TaskGraph::TaskId root : graph._roots) _workers[0].deque.push(root);
+
+    _sequence.fetch_add(1); // Open
+    if (_sleepers.load()) {
+      {
+        std::lock_guard<std::mutex> lock(_sleep_lock);
+      }
+      _wake.notify_all();
+    }
+    _work(0);
+    _sequence.fetch_add(1); // Close
+    while (_active.load() != 0) std::this_thread::yield();
+    if (timeline) timeline->_frame_end = FrameTimeline::now();
+    _graph = nullptr;
+    _timeline = nullptr;
+    _inside() = false;
+    if (_error) std::rethrow_exception(_error);
+  }
+};
+
+#endif // _TASK_GRAPH_H_
@@ -0,0 +1,175 @@
+#ifndef _WORKER_POOL_H_
+#define _WORKER_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Fixed set of threads for fork/join fan-out. run(count, ...) calls a function for every index in
+ * [0, count) across the workers and the calling thread, and returns once all of them are done.
+ * The indices are split into one range per participant; a participant that empties its own
+ * range steals single indices from the others, so uneven work still spreads out.
+ * One run at a time: concurrent callers take turns, and a run started from inside a run (on a
+ * worker or on the caller) is executed inline instead of deadlocking.
+*/
+class WorkerPool {
+public:
+  typedef void (*Task)(void *context, uint32_t index);
+  typedef void (*Prelude)(void *context);
+private:
+  struct alignas(64) Range {
+    std::atomic<uint32_t> next{0};
+    uint32_t end = 0;
+  };
+
+  struct Job {
+    Task task = nullptr;
+    void *context = nullptr;
+    std::exception_ptr error;
+    std::mutex error_lock;
+  };
+
+  std::vector<std::thread> _threads;
+  Range *_ranges = nullptr;
+  int _participants = 0;
+  Job _job;
+
+  // Odd while a job is open. Workers that see it open register in _active, then check again.
+  alignas(64) std::atomic<uint64_t> _sequence{0};
+  alignas(64) std::atomic<int> _active{0};
+  std::atomic<int> _sleepers{0};
+  std::atomic<bool> _stop{false};
+  std::mutex _sleep_lock;
+  std::condition_variable _wake;
+  std::mutex _submit;
+
+  static bool &_inside() {
+    static thread_local bool inside = false;
+    return inside;
+  }
+
+  void _run_one(uint32_t index) {
+    try {
+      _job.task(_job.context, index);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(_job.error_lock);
+      if (!_job.error) _job.error = std::current_exception();
+    }
+  }
+
+  // Own range first, then everyone else's
+  void _work(int participant) {
+    for (int i = 0; i < _participants; ++i) {
+      Range &range = _ranges[(participant + i) % _participants];
+      while (range.next.load(std::memory_order_relaxed) < range.end) {
+        uint32_t index = range.next.fetch_add(1);
+        if (index >= range.end) break;
+        _run_one(index);
+      }
+    }
+  }
+
+  void _worker(int participant) {
+    _inside() = true;
+    uint64_t seen = 0;
+    while (true) {
+      uint64_t sequence = _sequence.load();
+      // Spin a little before sleeping; frames come back quickly
+      for (int spin = 0; spin < 2000 && (sequence == seen || !(sequence & 1)); ++spin) {
+        if (_stop.load(std::memory_order_relaxed)) return;
+        std::this_thread::yield();
+        sequence = _sequence.load();
+      }
+      if (sequence == seen || !(sequence & 1)) {
+        std::unique_lock<std::mutex> lock(_sleep_lock);
+        _sleepers.fetch_add(1);
+        _wake.wait(lock, [&] {
+          uint64_t s = _sequence.load();
+          return _stop.load() || (s != seen && (s & 1));
+        });
+        _sleepers.fetch_sub(1);
+        if (_stop.load()) return;
+        continue;
+      }
+      seen = sequence;
+      _active.fetch_add(1);
+      // The job may have closed between reading the sequence and registering
+      if (_sequence.load() == sequence) _work(participant);
+      _active.fetch_sub(1);
+    }
+  }
+public:
+  // 0 threads means one fewer than the hardware has, since the caller takes part too
+  explicit WorkerPool(int threads = 0) {
+    if (threads <= 0) threads = (int) std::thread::hardware_concurrency() - 1;
+    if (threads < 0) threads = 0;
+    _participants = threads + 1;
+    _ranges = new Range[_participants];
+    for (int i = 0; i < threads; ++i) _threads.emplace_back(&WorkerPool::_worker, this, i + 1);
+  }
+
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  ~WorkerPool() {
+    _stop.store(true);
+    {
+      std::lock_guard<std::mutex> lock(_sleep_lock);
+    }
+    _wake.notify_all();
+    for (std::thread &t : _threads) t.join();
+    delete[] _ranges;
+  }
+
+  int thread_count() const { return (int) _threads.size(); }
+
+  /* Runs task(context, i) for every i in [0, count). If given, prelude(context) runs on the
+   * calling thread first, while the workers already start on the indices. The first exception
+   * thrown by a task is rethrown here after everything has finished.
+  */
+  void run(uint32_t count, Task task, void *context, Prelude prelude = nullptr) {
+    if (_threads.empty() || _inside()) {
+      if (prelude) prelude(context);
+      for (uint32_t i = 0; i < count; ++i) task(context, i);
+      return;
+    }
+    std::lock_guard<std::mutex> submit(_submit);
+    _inside() = true;
+    _job.task = task;
+    _job.context = context;
+    _job.error = nullptr;
+    uint32_t per = (count + _participants - 1) / _participants;
+    for (int i = 0; i < _participants; ++i) {
+      uint32_t begin = per * i < count ? per * i : count;
+      _ranges[i].end = begin + per < count ? begin + per : count;
+      _ranges[i].next.store(begin, std::memory_order_relaxed);
+    }
+
+    _sequence.fetch_add(1); // Open
+    if (_sleepers.load()) {
+      {
+        std::lock_guard<std::mutex> lock(_sleep_lock);
+      }
+      _wake.notify_all();
+    }
+    if (prelude) {
+      try {
+        prelude(context);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(_job.error_lock);
+        if (!_job.error) _job.error = std::current_exception();
+      }
+    }
+    _work(0);
+    _sequence.fetch_add(1); // Close
+    while (_active.load() != 0) std::this_thread::yield();
+    _inside() = false;
+    if (_job.error) std::rethrow_exception(_job.error);
+  }
+};
+
+#endif // _WORKER_POOL_H_
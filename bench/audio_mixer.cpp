@@ -0,0 +1,124 @@
+// How many voices one core can mix in real time: renders offline with the scalar, SSE and AVX2
+//  kernels for a range of voice counts and reports the real-time factor (audio seconds mixed per
+//  second of CPU) and voices per core (voices times that factor). Half the voices stream WAV files
+//  (PCM16 mono, PCM24 stereo), half are generated sines.
+//
+// Build: g++ -O2 -std=c++17 -pthread -o audio_mixer_bench bench/audio_mixer.cpp
+// Run:   ./audio_mixer_bench [--seconds N] [--out results.json]
+
+#include "../AudioManagerF32.h"
+#include "bench.h"
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+struct Row {
+  const char *kernels;
+  int voices;
+  double seconds;
+  double audio_seconds;
+};
+
+// A wavetable oscillator, cheap enough that the mixer dominates
+static float table[4096];
+
+struct Sine {
+  uint32_t phase, step;
+};
+
+static int sine(Sine *state, float *out, int frames) {
+  for (int i = 0; i < frames; ++i) {
+    out[i] = table[state->phase >> 20];
+    state->phase += state->step;
+  }
+  return frames;
+}
+
+static void write_wav(const std::string &path, int bits, int channels, double seconds) {
+  File out(path, File::WRITE);
+  int frames = (int) (seconds * 48000), frame_bytes = channels * bits / 8;
+  uint32_t data = (uint32_t) (frames * frame_bytes);
+  unsigned char header[44];
+  auto put32 = [&](int at, uint32_t v) { for (int i = 0; i < 4; ++i) header[at + i] = (unsigned char) (v >> (8 * i)); };
+  auto put16 = [&](int at, uint16_t v) { header[at] = (unsigned char) v; header[at + 1] = (unsigned char) (v >> 8); };
+  memcpy(header, "RIFFxxxxWAVEfmt ", 16);
+  put32(4, 36 + data);
+  put32(16, 16);
+  put16(20, 1);
+  put16(22, (uint16_t) channels);
+  put32(24, 48000);
+  put32(28, 48000 * frame_bytes);
+  put16(32, (uint16_t) frame_bytes);
+  put16(34, (uint16_t) bits);
+  memcpy(header + 36, "data", 4);
+  put32(40, data);
+  out.write(header, sizeof(header));
+  std::vector<unsigned char> samples(data);
+  bench::Rng rng(11);
+  for (unsigned char &c : samples) c = (unsigned char) rng.below(256);
+  out.write(samples.data(), samples.size());
+}
+
+int main(int argc, char **argv) {
+  double seconds = (double) bench::arg_int(argc, argv, "--seconds", 4);
+  const char *out_path = bench::arg_str(argc, argv, "--out", nullptr);
+
+  char dir[] = "/tmp/audio_bench_XXXXXX";
+  if (!mkdtemp(dir)) return 1;
+  std::string mono = std::string(dir) + "/mono16.wav", stereo = std::string(dir) + "/stereo24.wav";
+  write_wav(mono, 16, 1, 3);
+  write_wav(stereo, 24, 2, 3);
+
+  for (int i = 0; i < 4096; ++i) table[i] = std::sin(i * 6.2831853f / 4096);
+
+  using WellSpring::audio::Simd;
+  const struct { Simd simd; const char *name; } levels[] = {{Simd::SCALAR, "scalar"}, {Simd::SSE, "sse"}, {Simd::AVX2, "avx2"}};
+  std::vector<Row> rows;
+  int blocks = (int) (seconds * 48000 / AudioManagerF32::BLOCK);
+  std::vector<float> out(2 * AudioManagerF32::BLOCK * 64);
+  for (const auto &level : levels) {
+    if (WellSpring::audio::kernels(level.simd).simd != level.simd) continue;
+    for (int voices : {64, 256, 1024}) {
+      AudioManagerF32 mixer(48000, level.simd, 2 * voices);
+      std::vector<Sine> sines(voices);
+      for (int v = 0; v < voices; ++v) {
+        float pan = (float) v / voices * 2 - 1;
+        if (v % 2) {
+          sines[v] = Sine{0, (uint32_t) (5000000 + 10000 * v)};
+          Sine *state = &sines[v];
+          mixer.play(AudioManagerF32::Generator([state](float *o, int n) { return sine(state, o, n); }), 0.01f, pan);
+        } else {
+          mixer.play(v % 4 ? stereo : mono, 0.01f, pan, true);
+        }
+      }
+      // Untimed, so the first case isn't measured cold
+      mixer.render(out.data(), 64);
+      double start = bench::now();
+      for (int done = 0; done < blocks; done += 64) {
+        mixer.render(out.data(), blocks - done < 64 ? blocks - done : 64);
+        bench::keep(out[0]);
+      }
+      rows.push_back(Row{level.name, voices, bench::now() - start, (double) blocks * AudioManagerF32::BLOCK / 48000});
+    }
+  }
+  unlink(mono.c_str());
+  unlink(stereo.c_str());
+  rmdir(dir);
+
+  bench::Json json;
+  json.begin_object();
+  json.field("benchmark", "audio_mixer");
+  json.field("block", AudioManagerF32::BLOCK);
+  json.begin_array("results");
+  for (const Row &row : rows) {
+    double realtime = row.audio_seconds / row.seconds;
+    json.begin_object()
+      .field("kernels", row.kernels).field("voices", row.voices).field("seconds", row.seconds)
+      .field("realtime_factor", realtime).field("voices_per_core", row.voices * realtime)
+      .end_object();
+  }
+  json.end_array();
+  json.end_object();
+  return json.write(out_path) ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+// Shared helpers for the benchmark programs in this folder. Every benchmark is a single
+//  translation unit with its own main(), built straight from the command line like the rest of
+//  the repo (see the top of each file), and prints its results as JSON.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace bench {
+  inline double now() {
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+  }
+
+  // Keeps the optimizer from throwing away a result we only compute to time it
+  template<class T> inline void keep(T &&value) {
+    asm volatile("" : : "g"(&value) : "memory");
+  }
+
+  // Deterministic across platforms and standard libraries, unlike <random>'s distributions
+  struct Rng {
+    uint64_t state;
+    explicit Rng(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+      uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+      return z ^ (z >> 31);
+    }
+
+    // [0, bound)
+    uint32_t below(uint32_t bound) { return bound ? (uint32_t) (next() % bound) : 0; }
+  };
+
+  // Picks an index with probability proportional to its weight
+  inline int weighted(Rng &rng, const int *weights, int count) {
+    int total = 0;
+    for (int i = 0; i < count; ++i) total += weights[i];
+    int pick = (int) rng.below(total);
+    for (int i = 0; i < count; ++i) {
+      if (pick < weights[i]) return i;
+      pick -= weights[i];
+    }
+    return count - 1;
+  }
+
+  // Minimal streaming JSON writer. Commas are inserted automatically.
+  class Json {
+    std::string out;
+    bool need_comma = false;
+
+    void comma() {
+      if (need_comma) out += ',';
+      need_comma = false;
+    }
+
+    void key(const char *name) {
+      comma();
+      out += '"';
+      out += name;
+      out += "\":";
+    }
+  public:
+    Json &begin_object(const char *name = nullptr) {
+      if (name) key(name); else comma();
+      out += '{';
+      return *this;
+    }
+    Json &end_object() { out += '}'; need_comma = true; return *this; }
+
+    Json &begin_array(const char *name = nullptr) {
+      if (name) key(name); else comma();
+      out += '[';
+      return *this;
+    }
+    Json &end_array() { out += ']'; need_comma = true; return *this; }
+
+    Json &field(const char *name, const char *value) {
+      key(name);
+      out += '"';
+      out += value;
+      out += '"';
+      need_comma = true;
+      return *this;
+    }
+    Json &field(const char *name, double value) {
+      char buf[64];
+      snprintf(buf, sizeof(buf), "%.6g", value);
+      key(name);
+      out += buf;
+      need_comma = true;
+      return *this;
+    }
+    Json &field(const char *name, int64_t value) {
+      key(name);
+      out += std::to_string(value);
+      need_comma = true;
+      return *this;
+    }
+    Json &field(const char *name, int value) { return field(name, (int64_t) value); }
+    Json &field(const char *name, uint64_t value) { return field(name, (int64_t) value); }
+
+    const std::string &str() const { return out; }
+
+    // Writes to the path, or to stdout if the path is null
+    bool write(const char *path) const {
+      FILE *f = path ? fopen(path, "w") : stdout;
+      if (!f) return false;
+      fputs(out.c_str(), f);
+      fputc('\n', f);
+      if (path) fclose(f);
+      return true;
+    }
+  };
+
+  // Reads "--name value" style integer options; returns fallback when the option is absent
+  inline long long arg_int(int argc, char **argv, const char *name, long long fallback) {
+    for (int i = 1; i + 1 < argc; ++i) {
+      if (strcmp(argv[i], name) == 0) return strtoll(argv[i + 1], nullptr, 10);
+    }
+    return fallback;
+  }
+
+  inline const char *arg_str(int argc, char **argv, const char *name, const char *fallback) {
+    for (int i = 1; i + 1 < argc; ++i) {
+      if (strcmp(argv[i], name) == 0) return argv[i + 1];
+    }
+    return fallback;
+  }
+}
+
+#endif // _BENCH_H_
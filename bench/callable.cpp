@@ -0,0 +1,196 @@
+// Allocations and time per operation for Callable against the heap-per-copy version it replaced:
+//  building, copying, moving, passing through a queue and calling. Then the cost of a call
+//  through each callable kind handed to a hot loop: Callable, Delegate, CallableRef and
+//  BoundCallable.
+//
+// Build: g++ -O2 -std=c++17 -o callable_bench bench/callable.cpp
+// Run:   ./callable_bench [--ops N] [--out results.json]
+
+#include "../callable.h"
+#include "bench.h"
+
+#include <cstdlib>
+#include <deque>
+#include <new>
+#include <vector>
+
+// Every allocation in the process goes through here
+static uint64_t allocations = 0;
+
+void *operator new(size_t size) {
+  allocations++;
+  if (void *p = malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+// Callable as it was: a fresh heap object per construction and per copy, and operator= leaked
+//  the old one. Kept to measure against.
+namespace legacy {
+  template<class Ret, class... Args> class Base {
+  public:
+    virtual ~Base() {}
+    virtual Ret call(Args...) const = 0;
+    virtual Base *clone() const = 0;
+    int refcount = 0;
+  };
+
+  template<class Ret, class... Args> class Func : public Base<Ret, Args...> {
+    Ret (*func)(Args...);
+  public:
+    Ret call(Args... args) const override { return func(args...); }
+    Base<Ret, Args...> *clone() const override { return new Func(*this); }
+    Func(Ret (*f)(Args...)) : func(f) {}
+  };
+
+  template<class T, class Ret, class... Args> class Method : public Base<Ret, Args...> {
+    T *data;
+    Ret (T::*func)(Args...);
+  public:
+    Ret call(Args... args) const override { return (data->*func)(args...); }
+    Base<Ret, Args...> *clone() const override { return new Method(*this); }
+    Method(Ret (T::*method)(Args...), T *obj) : data(obj), func(method) {}
+  };
+
+  template<class T> class Callable;
+  template<class Ret, class... Args> class Callable<Ret(Args...)> {
+    Base<Ret, Args...> *func;
+  public:
+    Ret operator()(Args... args) const { return func->call(args...); }
+    Callable &operator=(const Callable &other) {
+      func = other.func->clone();
+      func->refcount++;
+      return *this;
+    }
+    template<class T> Callable(Ret (T::*method)(Args...), T *obj) :
+      func(new Method<T, Ret, Args...>(method, obj)) { func->refcount++; }
+    Callable(Ret (*f)(Args...)) : func(new Func<Ret, Args...>(f)) { func->refcount++; }
+    Callable(const Callable &other) : func(other.func->clone()) { func->refcount++; }
+    ~Callable() {
+      if (--func->refcount <= 0) delete func;
+    }
+  };
+}
+
+static int64_t sink = 0;
+static int add_one(int x) { return x + 1; }
+
+struct Counter {
+  int64_t total = 0;
+  int add(int x) { total += x; return x; }
+};
+
+struct Row {
+  const char *name;
+  const char *kind;
+  double seconds;
+  uint64_t ops;
+  uint64_t allocations;
+};
+
+/* The same workload for both implementations: make a callable, copy it into a vector, move it
+ * through a queue, reassign it and call it.
+*/
+template<class C> static void run(std::vector<Row> &rows, const char *kind, const C &prototype, long long ops) {
+  std::vector<C> stored;
+  stored.reserve(64);
+  std::deque<C> queue;
+  for (int i = 0; i < 64; ++i) queue.push_back(prototype); // Warm the deque's blocks up
+
+  uint64_t before = allocations;
+  double start = bench::now();
+  for (long long i = 0; i < ops; ++i) {
+    C copy(prototype);
+    sink += copy((int) i);
+  }
+  rows.push_back({"construct_copy", kind, bench::now() - start, (uint64_t) ops, allocations - before});
+
+  before = allocations;
+  start = bench::now();
+  for (long long i = 0; i < ops; ++i) {
+    if (stored.size() == 64) stored.clear();
+    stored.push_back(prototype);
+  }
+  rows.push_back({"vector_push", kind, bench::now() - start, (uint64_t) ops, allocations - before});
+
+  before = allocations;
+  start = bench::now();
+  for (long long i = 0; i < ops; ++i) {
+    queue.push_back(std::move(queue.front()));
+    queue.pop_front();
+    sink += queue.back()((int) i);
+  }
+  // The deque itself frees and allocates a block every so often as it walks
+  rows.push_back({"queue_cycle", kind, bench::now() - start, (uint64_t) ops, allocations - before});
+
+  C target(prototype);
+  before = allocations;
+  start = bench::now();
+  for (long long i = 0; i < ops; ++i) {
+    target = stored[i & 31];
+    sink += target((int) i);
+  }
+  rows.push_back({"assign", kind, bench::now() - start, (uint64_t) ops, allocations - before});
+
+  before = allocations;
+  start = bench::now();
+  for (long long i = 0; i < ops; ++i) sink += target((int) i);
+  rows.push_back({"call", kind, bench::now() - start, (uint64_t) ops, allocations - before});
+}
+
+// What a per-element callback in a hot loop looks like; kept out of line so only the callable's
+//  own type can help the compiler
+template<class C> __attribute__((noinline)) static int64_t call_loop(const C &callback, long long ops) {
+  int64_t total = 0;
+  for (long long i = 0; i < ops; ++i) total += callback((int) i);
+  return total;
+}
+
+template<class C> static void run_calls(std::vector<Row> &rows, const char *kind, const C &callback, long long ops) {
+  uint64_t before = allocations;
+  double start = bench::now();
+  sink += call_loop(callback, ops);
+  rows.push_back({"call_loop", kind, bench::now() - start, (uint64_t) ops, allocations - before});
+}
+
+int main(int argc, char **argv) {
+  long long ops = bench::arg_int(argc, argv, "--ops", 2000000);
+  const char *out_path = bench::arg_str(argc, argv, "--out", nullptr);
+
+  Counter counter;
+  std::vector<Row> rows;
+  run(rows, "legacy_function", legacy::Callable<int(int)>(&add_one), ops);
+  run(rows, "callable_function", Callable<int(int)>(&add_one), ops);
+  run(rows, "legacy_member", legacy::Callable<int(int)>(&Counter::add, &counter), ops);
+  run(rows, "callable_member", Callable<int(int)>(&Counter::add, &counter), ops);
+  int64_t offset = 3;
+  run(rows, "callable_lambda", Callable<int(int)>([&counter, offset](int x) {
+    return counter.add(x + (int) offset);
+  }), ops);
+
+  run_calls(rows, "callable_member", Callable<int(int)>(&Counter::add, &counter), ops);
+  run_calls(rows, "delegate_member", Delegate<int(int)>(&Counter::add, &counter), ops);
+  BoundCallable<&Counter::add> bound(&counter);
+  run_calls(rows, "callable_ref_member", CallableRef<int(int)>(bound), ops);
+  run_calls(rows, "bound_callable_member", bound, ops);
+  sink += counter.total;
+  bench::keep(sink);
+
+  bench::Json json;
+  json.begin_object();
+  json.field("benchmark", "callable");
+  json.field("ops", (int64_t) ops);
+  json.begin_array("results");
+  for (const Row &row : rows) {
+    json.begin_object()
+      .field("case", row.name).field("kind", row.kind)
+      .field("seconds", row.seconds).field("operations", row.ops)
+      .field("ns_per_operation", row.seconds * 1e9 / row.ops)
+      .field("allocations_per_operation", (double) row.allocations / row.ops)
+      .end_object();
+  }
+  json.end_array();
+  json.end_object();
+  return json.write(out_path) ? 0 : 1;
+}
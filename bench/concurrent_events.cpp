@@ -0,0 +1,117 @@
+// Reader scaling of ConcurrentEvent against an Event guarded by a mutex, with one thread
+//  subscribing and unsubscribing the whole time.
+//
+// Build: g++ -O2 -std=c++17 -pthread -o concurrent_events_bench bench/concurrent_events.cpp
+// Run:   ./concurrent_events_bench [--max-threads N] [--listeners N] [--millis N] [--out results.json]
+//
+// Also the stress test for ThreadSanitizer:
+//   g++ -O1 -g -std=c++17 -fsanitize=thread -o concurrent_events_tsan bench/concurrent_events.cpp
+//   ./concurrent_events_tsan --max-threads 4 --millis 200
+
+#include "../concurrent_events.cpp"
+#include "bench.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static std::atomic<int64_t> sink{0};
+
+static void listen(int x) { sink.fetch_add(x & 1, std::memory_order_relaxed); }
+static void churn_listener(int x) { sink.fetch_add(x & 2, std::memory_order_relaxed); }
+
+struct LockedEvent {
+  Event<int> event;
+  mutable std::mutex lock;
+
+  ListenerHandle subscribe(void (*listener)(int)) {
+    std::lock_guard<std::mutex> guard(lock);
+    return event.subscribe(listener);
+  }
+  void unsubscribe(ListenerHandle handle) {
+    std::lock_guard<std::mutex> guard(lock);
+    event.unsubscribe(handle);
+  }
+  void call(int x) const {
+    std::lock_guard<std::mutex> guard(lock);
+    event.call(x);
+  }
+};
+
+// Returns calls per second summed over all reader threads
+template<class E> static double run(E &event, int threads, int millis) {
+  std::atomic<bool> stop{false};
+  std::atomic<int> ready{0};
+  std::vector<uint64_t> counts(threads * 8, 0); // Spread out to avoid false sharing
+  std::vector<std::thread> readers;
+  for (int t = 0; t < threads; ++t) {
+    readers.emplace_back([&, t] {
+      ready.fetch_add(1);
+      while (ready.load() < threads + 2) std::this_thread::yield();
+      uint64_t n = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        for (int i = 0; i < 64; ++i) event.call(i);
+        n += 64;
+      }
+      counts[t * 8] = n;
+    });
+  }
+  std::thread writer([&] {
+    ready.fetch_add(1);
+    while (ready.load() < threads + 2) std::this_thread::yield();
+    while (!stop.load(std::memory_order_relaxed)) {
+      ListenerHandle handle = event.subscribe(churn_listener);
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+      event.unsubscribe(handle);
+    }
+  });
+  while (ready.load() < threads + 1) std::this_thread::yield();
+  double start = bench::now();
+  ready.fetch_add(1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(millis));
+  stop.store(true);
+  for (std::thread &r : readers) r.join();
+  double seconds = bench::now() - start;
+  writer.join();
+  uint64_t total = 0;
+  for (int t = 0; t < threads; ++t) total += counts[t * 8];
+  return total / seconds;
+}
+
+int main(int argc, char **argv) {
+  int max_threads = bench::arg_int(argc, argv, "--max-threads", std::thread::hardware_concurrency());
+  int listener_count = bench::arg_int(argc, argv, "--listeners", 32);
+  int millis = bench::arg_int(argc, argv, "--millis", 500);
+  const char *out_path = bench::arg_str(argc, argv, "--out", nullptr);
+  if (max_threads < 1) max_threads = 1;
+
+  ConcurrentEvent<int> concurrent;
+  LockedEvent locked;
+  for (int i = 0; i < listener_count; ++i) {
+    concurrent.subscribe(listen);
+    locked.subscribe(listen);
+  }
+
+  bench::Json json;
+  json.begin_object();
+  json.field("benchmark", "concurrent_events");
+  json.field("listeners", listener_count);
+  json.field("millis", millis);
+  json.begin_array("results");
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    double rcu = run(concurrent, threads, millis);
+    double mutex = run(locked, threads, millis);
+    json.begin_object()
+      .field("reader_threads", threads)
+      .field("concurrent_calls_per_s", rcu)
+      .field("mutex_calls_per_s", mutex)
+      .end_object();
+    if (threads < max_threads && threads * 2 > max_threads) threads = max_threads / 2;
+  }
+  json.end_array();
+  json.end_object();
+  concurrent.synchronize();
+  bench::keep(sink);
+  return json.write(out_path) ? 0 : 1;
+}
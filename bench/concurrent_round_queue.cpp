@@ -0,0 +1,143 @@
+// Throughput and latency of the lock-free rings in ConcurrentRoundQueue.h against a RoundQueue
+//  behind a mutex, for 1 producer -> 1 consumer, N -> 1 and N -> M. Every item is the time it was
+//  pushed, so consumers can sample how long items waited.
+//
+// Build: g++ -O2 -std=c++17 -pthread -o concurrent_round_queue_bench bench/concurrent_round_queue.cpp
+// Run:   ./concurrent_round_queue_bench [--items N] [--producers N] [--consumers N] [--capacity N]
+//                                       [--out results.json]
+
+#include "../ConcurrentRoundQueue.h"
+#include "../RoundQueue.h"
+#include "bench.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static uint64_t now_ns() { return (uint64_t) (bench::now() * 1e9); }
+
+// The setup the lock-free rings replace
+class LockedQueue {
+  std::mutex lock;
+  RoundQueue<uint64_t> queue;
+  int limit;
+public:
+  explicit LockedQueue(int capacity) : queue(capacity), limit(capacity) {}
+  bool push(uint64_t value) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (queue.size() >= limit) return false;
+    queue.push(value);
+    return true;
+  }
+  bool pop(uint64_t &out) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (queue.empty()) return false;
+    out = queue.peek();
+    queue.pop();
+    return true;
+  }
+};
+
+struct Row {
+  const char *name;
+  int producers, consumers;
+  double seconds;
+  uint64_t items;
+  uint64_t p50_ns, p99_ns;
+};
+
+template<class Q> static Row run(const char *name, Q &queue, int producers, int consumers, long long per_producer) {
+  const uint64_t total = (uint64_t) per_producer * producers;
+  std::atomic<uint64_t> consumed{0};
+  std::atomic<bool> go{false};
+  std::vector<std::vector<uint64_t>> latencies(consumers);
+  std::vector<std::thread> threads;
+
+  for (int p = 0; p < producers; ++p) {
+    threads.emplace_back([&]() {
+      while (!go.load()) std::this_thread::yield();
+      for (long long i = 0; i < per_producer; ++i) {
+        while (!queue.push(now_ns())) std::this_thread::yield();
+      }
+    });
+  }
+  for (int c = 0; c < consumers; ++c) {
+    threads.emplace_back([&, c]() {
+      std::vector<uint64_t> &samples = latencies[c];
+      uint64_t count = 0, item;
+      while (!go.load()) std::this_thread::yield();
+      while (consumed.load(std::memory_order_relaxed) < total) {
+        if (!queue.pop(item)) {
+          std::this_thread::yield();
+          continue;
+        }
+        consumed.fetch_add(1, std::memory_order_relaxed);
+        if ((++count & 63) == 0) samples.push_back(now_ns() - item);
+      }
+    });
+  }
+
+  double start = bench::now();
+  go.store(true);
+  for (std::thread &t : threads) t.join();
+  double seconds = bench::now() - start;
+
+  std::vector<uint64_t> all;
+  for (const std::vector<uint64_t> &samples : latencies) all.insert(all.end(), samples.begin(), samples.end());
+  std::sort(all.begin(), all.end());
+  uint64_t p50 = all.empty() ? 0 : all[all.size() / 2];
+  uint64_t p99 = all.empty() ? 0 : all[all.size() * 99 / 100];
+  return Row{name, producers, consumers, seconds, total, p50, p99};
+}
+
+int main(int argc, char **argv) {
+  long long items = bench::arg_int(argc, argv, "--items", 2000000);
+  int producers = (int) bench::arg_int(argc, argv, "--producers", 3);
+  int consumers = (int) bench::arg_int(argc, argv, "--consumers", 2);
+  int capacity = (int) bench::arg_int(argc, argv, "--capacity", 4096);
+  const char *out_path = bench::arg_str(argc, argv, "--out", nullptr);
+
+  std::vector<Row> rows;
+  {
+    SpscRoundQueue<uint64_t> spsc(capacity);
+    MpmcRoundQueue<uint64_t> mpmc(capacity);
+    LockedQueue locked(capacity);
+    // Untimed: the first run pays for thread start-up and faulting the sample buffers in
+    run("warm_up", spsc, 1, 1, items / 4);
+    rows.push_back(run("spsc_1_to_1", spsc, 1, 1, items));
+    rows.push_back(run("mpmc_1_to_1", mpmc, 1, 1, items));
+    rows.push_back(run("locked_1_to_1", locked, 1, 1, items));
+  }
+  {
+    MpmcRoundQueue<uint64_t> mpmc(capacity);
+    LockedQueue locked(capacity);
+    rows.push_back(run("mpmc_n_to_1", mpmc, producers, 1, items / producers));
+    rows.push_back(run("locked_n_to_1", locked, producers, 1, items / producers));
+  }
+  {
+    MpmcRoundQueue<uint64_t> mpmc(capacity);
+    LockedQueue locked(capacity);
+    rows.push_back(run("mpmc_n_to_m", mpmc, producers, consumers, items / producers));
+    rows.push_back(run("locked_n_to_m", locked, producers, consumers, items / producers));
+  }
+
+  bench::Json json;
+  json.begin_object();
+  json.field("benchmark", "concurrent_round_queue");
+  json.field("hardware_threads", (int) std::thread::hardware_concurrency());
+  json.field("capacity", capacity);
+  json.begin_array("results");
+  for (const Row &row : rows) {
+    json.begin_object()
+      .field("case", row.name).field("producers", row.producers).field("consumers", row.consumers)
+      .field("seconds", row.seconds).field("items", row.items)
+      .field("items_per_second", row.items / row.seconds)
+      .field("p50_latency_ns", row.p50_ns).field("p99_latency_ns", row.p99_ns)
+      .end_object();
+  }
+  json.end_array();
+  json.end_object();
+  return json.write(out_path) ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+// Cost of the event instrumentation: build once plain and once with -DEVENTS_INSTRUMENTATION and
+//  compare ns_per_call. The instrumented build also prints the per-listener summary and, with
+//  --trace, writes the last frames as Chrome trace-event JSON for Perfetto / chrome://tracing.
+//
+// Build: g++ -O2 -std=c++17 -o event_profiler_bench bench/event_profiler.cpp
+//        g++ -O2 -std=c++17 -DEVENTS_INSTRUMENTATION -o event_profiler_bench bench/event_profiler.cpp
+// Run:   ./event_profiler_bench [--frames N] [--trace trace.json] [--out results.json]
+
+#include "../events.cpp"
+#include "bench.h"
+
+#include <cmath>
+#include <cstdio>
+
+static double sink = 0;
+
+// One listener in a frame is slow now and then; the summary and the trace should point at it
+struct Spiky {
+  int every = 0;
+  void tick(int frame) {
+    int iterations = frame % every == 0 ? 20000 : 20;
+    double x = frame;
+    for (int i = 0; i < iterations; ++i) x = std::sqrt(x + i);
+    sink += x;
+  }
+};
+
+static void cheap(int frame) { sink += frame; }
+
+int main(int argc, char **argv) {
+  int frames = (int) bench::arg_int(argc, argv, "--frames", 20000);
+  const char *trace_path = bench::arg_str(argc, argv, "--trace", nullptr);
+  const char *out_path = bench::arg_str(argc, argv, "--out", nullptr);
+
+  Event<int> update;
+  update.set_name("update");
+  Spiky spiky{97};
+  for (int i = 0; i < 15; ++i) update.subscribe(&cheap);
+  update.subscribe(&Spiky::tick, &spiky);
+
+  // Input routing: the deepest layer takes most events
+  EventUnhandled<int> input;
+  input.set_name("input");
+  for (int i = 0; i < 8; ++i) input.subscribe([i](int target) { return target % 8 == i; });
+
+  double start = bench::now();
+  for (int f = 0; f < frames; ++f) {
+    update.call(f);
+    for (int e = 0; e < 4; ++e) bench::keep(input.call(f % 16 ? 7 : e));
+  }
+  double seconds = bench::now() - start;
+  uint64_t calls = (uint64_t) frames * 5;
+
+#ifdef EVENTS_INSTRUMENTATION
+  EventProfiler &profiler = EventProfiler::instance();
+  profiler.write_summary(stderr);
+  if (trace_path) {
+    profiler.start_tracing();
+    for (int f = 0; f < 200; ++f) {
+      update.call(f);
+      for (int e = 0; e < 4; ++e) bench::keep(input.call(f % 16 ? 7 : e));
+    }
+    profiler.stop_tracing();
+    if (!profiler.write_chrome_trace(trace_path)) {
+      fprintf(stderr, "Could not write %s\n", trace_path);
+      return 1;
+    }
+  }
+  const bool instrumented = true;
+#else
+  if (trace_path) fprintf(stderr, "Tracing needs a build with -DEVENTS_INSTRUMENTATION\n");
+  const bool instrumented = false;
+#endif
+  bench::keep(sink);
+
+  bench::Json json;
+  json.begin_object();
+  json.field("benchmark", "event_profiler");
+  json.field("instrumented", instrumented ? "yes" : "no");
+  json.field("frames", frames);
+  json.field("seconds", seconds);
+  json.field("event_calls", calls);
+  json.field("ns_per_call", seconds * 1e9 / calls);
+  json.end_object();
+  return json.write(out_path) ? 0 : 1;
+}
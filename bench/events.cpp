@@ -0,0 +1,289 @@
+// Dispatch benchmarks for the event templates in events.cpp.
+//
+// Build: g++ -O2 -std=c++17 -o events_bench bench/events.cpp
+// Run:   ./events_bench [--calls N] [--seed N] [--out results.json]
+
+#include "../deferred_events.cpp"
+#include "bench.h"
+
+#include <utility>
+#include <vector>
+
+static int64_t sink = 0;
+
+template<int N> static void listen(int x) { sink += x ^ N; }
+template<int N> static bool decline(int x) { sink += x ^ N; return false; }
+
+template<int... N> static void fillListeners(std::integer_sequence<int, N...>,
+    void (**out)(int), bool (**out_unhandled)(int)) {
+  ((out[N] = &listen<N>), ...);
+  ((out_unhandled[N] = &decline<N>), ...);
+}
+
+static constexpr int MAX_LISTENERS = 512;
+static void (*listeners[MAX_LISTENERS])(int);
+static bool (*unhandled_listeners[MAX_LISTENERS])(int);
+
+// The QueueList layout Event used before its listeners moved into contiguous storage, kept to
+//  measure against. The only change is that unsubscribe no longer reads a deleted element. It
+//  holds the same Delegates Event does, so the rows differ only in how listeners are stored.
+template<class Listener> class LinkedEvent {
+public:
+  QueueList<Listener> listeners;
+  typedef typename QueueList<Listener>::Element Element;
+
+  void subscribe(Listener listener) { listeners.push(listener); }
+
+  void unsubscribe(Listener listener) {
+    Element *last = nullptr;
+    for (Element *el = listeners.head; el; last = el, el = el->next) {
+      if (el->value != listener) continue;
+      if (last) last->next = el->next; else listeners.head = el->next;
+      if (listeners.tail == el) listeners.tail = last;
+      delete el;
+      return;
+    }
+  }
+
+  void call(int x) const {
+    for (Element *el = listeners.head; el; el = el->next) el->value(x);
+  }
+
+  bool call_unhandled(int x) const {
+    for (Element *el = listeners.head; el; el = el->next) {
+      if (el->value(x)) return true;
+    }
+    return false;
+  }
+};
+
+// Long-running programs don't get their list nodes back to back, so spread them out the way a
+//  used heap would
+struct HeapNoise {
+  std::vector<void *> blocks;
+  bench::Rng rng{7};
+  void add() { blocks.push_back(operator new(16 + rng.below(240))); }
+  ~HeapNoise() { for (void *b : blocks) operator delete(b); }
+};
+
+struct Counter {
+  int64_t total = 0;
+  void add(int x) { total += x; }
+};
+
+/* Unsubscribing after a higher-priority insert must remove that listener, even while a dead
+ * entry is still waiting to be compacted out. Returns false if it doesn't.
+*/
+static bool checkPriorityUnsubscribe() {
+  static int calls[5];
+  EventUnhandled<int> event;
+  ListenerHandle handles[4];
+  handles[0] = event.subscribe([](int) { calls[0]++; return false; });
+  handles[1] = event.subscribe([](int) { calls[1]++; return false; });
+  handles[2] = event.subscribe([](int) { calls[2]++; return false; });
+  handles[3] = event.subscribe([](int) { calls[3]++; return false; });
+  event.unsubscribe(handles[1]);
+  ListenerHandle x = event.subscribe([](int) { calls[4]++; return false; }, 5);
+  event.unsubscribe(x);
+  event.call(0);
+  return calls[0] == 1 && calls[1] == 0 && calls[2] == 1 && calls[3] == 1 && calls[4] == 0 &&
+    event.listeners.size() == 3;
+}
+
+struct Row {
+  const char *name;
+  int listeners;
+  double seconds;
+  uint64_t listener_calls;
+};
+
+int main(int argc, char **argv) {
+  long long calls = bench::arg_int(argc, argv, "--calls", 20000);
+  uint64_t seed = bench::arg_int(argc, argv, "--seed", 1);
+  const char *out_path = bench::arg_str(argc, argv, "--out", nullptr);
+  fillListeners(std::make_integer_sequence<int, MAX_LISTENERS>(), listeners, unhandled_listeners);
+  if (!checkPriorityUnsubscribe()) {
+    fprintf(stderr, "Unsubscribing after a priority insert removed the wrong listener\n");
+    return 1;
+  }
+
+  std::vector<Row> rows;
+  const int counts[] = {16, 128, 512};
+  for (int count : counts) {
+    // Same total listener calls for every size
+    long long reps = calls * MAX_LISTENERS / count;
+    HeapNoise noise;
+
+    Event<int> event;
+    EventUnhandled<int> unhandled;
+    LinkedEvent<Event<int>::Listener> linked;
+    LinkedEvent<EventUnhandled<int>::Listener> linked_unhandled;
+    for (int i = 0; i < count; ++i) {
+      event.subscribe(listeners[i]);
+      unhandled.subscribe(unhandled_listeners[i]);
+      linked.subscribe(listeners[i]);
+      noise.add();
+      linked_unhandled.subscribe(unhandled_listeners[i]);
+      noise.add();
+    }
+
+    double start = bench::now();
+    for (long long r = 0; r < reps; ++r) event.call((int) r);
+    rows.push_back({"event_contiguous", count, bench::now() - start, (uint64_t) (reps * count)});
+
+    start = bench::now();
+    for (long long r = 0; r < reps; ++r) linked.call((int) r);
+    rows.push_back({"event_linked", count, bench::now() - start, (uint64_t) (reps * count)});
+
+    start = bench::now();
+    for (long long r = 0; r < reps; ++r) bench::keep(unhandled.call((int) r));
+    rows.push_back({"unhandled_contiguous", count, bench::now() - start, (uint64_t) (reps * count)});
+
+    start = bench::now();
+    for (long long r = 0; r < reps; ++r) bench::keep(linked_unhandled.call_unhandled((int) r));
+    rows.push_back({"unhandled_linked", count, bench::now() - start, (uint64_t) (reps * count)});
+
+    // Churn: drop a random listener and subscribe it again, the way per-object listeners come
+    //  and go. Handles make the removal constant time; the list has to search.
+    std::vector<ListenerHandle> handles;
+    Event<int> churn;
+    for (int i = 0; i < count; ++i) handles.push_back(churn.subscribe(listeners[i]));
+    bench::Rng rng(seed);
+    start = bench::now();
+    for (long long r = 0; r < reps; ++r) {
+      int which = rng.below(count);
+      churn.unsubscribe(handles[which]);
+      handles[which] = churn.subscribe(listeners[which]);
+    }
+    rows.push_back({"churn_contiguous", count, bench::now() - start, (uint64_t) reps});
+
+    rng = bench::Rng(seed);
+    start = bench::now();
+    for (long long r = 0; r < reps; ++r) {
+      int which = rng.below(count);
+      linked.unsubscribe(listeners[which]);
+      linked.subscribe(listeners[which]);
+    }
+    rows.push_back({"churn_linked", count, bench::now() - start, (uint64_t) reps});
+  }
+
+  // A frame's worth of input, physics and audio events: called one by one where they happen, or
+  //  posted and flushed once per listener. Coalescing keeps only the last move of the frame.
+  {
+    const int per_frame = 256, frames = (int) (calls / 8) + 1, frame_listeners = 8;
+    Event<int> immediate;
+    DeferredEvent<int> deferred, coalesced;
+    coalesced.set_coalescing(Coalesce::LATEST);
+    for (int i = 0; i < frame_listeners; ++i) {
+      immediate.subscribe(listeners[i]);
+      deferred.subscribe(listeners[i]);
+      coalesced.subscribe(listeners[i]);
+    }
+    uint64_t deliveries = (uint64_t) frames * per_frame * frame_listeners;
+
+    double start = bench::now();
+    for (int f = 0; f < frames; ++f) {
+      for (int e = 0; e < per_frame; ++e) immediate.call(e);
+    }
+    rows.push_back({"frame_immediate", frame_listeners, bench::now() - start, deliveries});
+
+    start = bench::now();
+    for (int f = 0; f < frames; ++f) {
+      for (int e = 0; e < per_frame; ++e) deferred.post(e);
+      deferred.flush();
+    }
+    rows.push_back({"frame_deferred", frame_listeners, bench::now() - start, deliveries});
+
+    start = bench::now();
+    for (int f = 0; f < frames; ++f) {
+      for (int e = 0; e < per_frame; ++e) coalesced.post(e);
+      coalesced.flush();
+    }
+    rows.push_back({"frame_coalesced", frame_listeners, bench::now() - start, deliveries});
+  }
+
+  // What a listener costs by kind, against a bare loop over raw function pointers
+  {
+    const int count = 128;
+    long long reps = calls * MAX_LISTENERS / count;
+    uint64_t deliveries = (uint64_t) (reps * count);
+    std::vector<void (*)(int)> raw(listeners, listeners + count);
+    std::vector<Counter> counters(count);
+    Event<int> functions, methods, lambdas;
+    for (int i = 0; i < count; ++i) {
+      functions.subscribe(listeners[i]);
+      methods.subscribe(&Counter::add, &counters[i]);
+      Counter *counter = &counters[i];
+      lambdas.subscribe([counter, i](int x) { counter->total += x ^ i; });
+    }
+
+    double start = bench::now();
+    for (long long r = 0; r < reps; ++r) {
+      for (void (*listener)(int) : raw) listener((int) r);
+    }
+    rows.push_back({"raw_pointer_loop", count, bench::now() - start, deliveries});
+
+    start = bench::now();
+    for (long long r = 0; r < reps; ++r) functions.call((int) r);
+    rows.push_back({"delegate_function", count, bench::now() - start, deliveries});
+
+    start = bench::now();
+    for (long long r = 0; r < reps; ++r) methods.call((int) r);
+    rows.push_back({"delegate_member", count, bench::now() - start, deliveries});
+
+    start = bench::now();
+    for (long long r = 0; r < reps; ++r) lambdas.call((int) r);
+    rows.push_back({"delegate_lambda", count, bench::now() - start, deliveries});
+    for (const Counter &counter : counters) sink += counter.total;
+  }
+
+  // Input routing: one UI layer per target id, events arrive in runs aimed at the same target.
+  //  The plain walk asks every layer above the target; affinity asks the target first.
+  {
+    const int layers = 32, run_length = 64;
+    long long reps = calls * 16;
+    EventUnhandled<int> walk, affine, adaptive;
+    affine.set_affinity([](const int &target) { return (uint64_t) target; });
+    adaptive.set_adaptive(1024);
+    for (int i = 0; i < layers; ++i) {
+      auto layer = [i](int target) { sink++; return target == i; };
+      walk.subscribe(layer);
+      affine.subscribe(layer);
+      adaptive.subscribe(layer);
+    }
+    // Deep layers get most of the traffic, like a game view under a stack of menus
+    auto target_of = [&](long long r) {
+      int run = (int) (r / run_length);
+      return run % 4 ? layers - 1 - run % 3 : run % layers;
+    };
+
+    double start = bench::now();
+    for (long long r = 0; r < reps; ++r) bench::keep(walk.call(target_of(r)));
+    rows.push_back({"routing_walk", layers, bench::now() - start, (uint64_t) reps});
+
+    start = bench::now();
+    for (long long r = 0; r < reps; ++r) bench::keep(affine.call(target_of(r)));
+    rows.push_back({"routing_affinity", layers, bench::now() - start, (uint64_t) reps});
+
+    start = bench::now();
+    for (long long r = 0; r < reps; ++r) bench::keep(adaptive.call(target_of(r)));
+    rows.push_back({"routing_adaptive", layers, bench::now() - start, (uint64_t) reps});
+  }
+  bench::keep(sink);
+
+  bench::Json json;
+  json.begin_object();
+  json.field("benchmark", "events");
+  json.field("calls", (int64_t) calls);
+  json.begin_array("results");
+  for (const Row &row : rows) {
+    json.begin_object()
+      .field("case", row.name).field("listeners", row.listeners)
+      .field("seconds", row.seconds).field("operations", row.listener_calls)
+      .field("ns_per_operation", row.seconds * 1e9 / row.listener_calls)
+      .end_object();
+  }
+  json.end_array();
+  json.end_object();
+  return json.write(out_path) ? 0 : 1;
+}
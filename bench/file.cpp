@@ -0,0 +1,155 @@
+// Reading a large file through std::ifstream against File's mapping and streaming readers, then
+//  listing a directory of many files with readdir + stat against FileDir. Each reader checksums
+//  every byte. The file is written first, so it is read from the page cache.
+//
+// Build: g++ -O2 -std=c++17 -o file_bench bench/file.cpp
+// Run:   ./file_bench [--megabytes N] [--entries N] [--out results.json]
+
+#include "../File.h"
+#include "bench.h"
+
+#include <dirent.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+struct Row {
+  const char *name;
+  double seconds;
+  uint64_t bytes;
+  uint64_t items;
+};
+
+static uint64_t checksum(const unsigned char *data, size_t size) {
+  uint64_t sum = 0;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, 8);
+    sum += word;
+  }
+  for (; i < size; ++i) sum += data[i];
+  return sum;
+}
+
+int main(int argc, char **argv) {
+  long long megabytes = bench::arg_int(argc, argv, "--megabytes", 512);
+  int entries = (int) bench::arg_int(argc, argv, "--entries", 20000);
+  const char *out_path = bench::arg_str(argc, argv, "--out", nullptr);
+
+  char dir[] = "/tmp/file_bench_XXXXXX";
+  if (!mkdtemp(dir)) return 1;
+  std::string big = std::string(dir) + "/pack.bin";
+  uint64_t bytes = (uint64_t) megabytes << 20;
+  {
+    File out(big, File::WRITE);
+    std::vector<unsigned char> block(1 << 20);
+    bench::Rng rng(9);
+    for (unsigned char &c : block) c = (unsigned char) rng.below(256);
+    for (long long i = 0; i < megabytes; ++i) out.write(block.data(), block.size());
+  }
+
+  std::vector<Row> rows;
+  uint64_t check = 0;
+  const size_t chunk = File::CHUNK;
+  {
+    double start = bench::now();
+    std::ifstream in(big, std::ios::binary);
+    std::vector<unsigned char> buffer(chunk);
+    while (in.read((char *) buffer.data(), buffer.size()) || in.gcount())
+      check += checksum(buffer.data(), (size_t) in.gcount());
+    rows.push_back({"ifstream_chunks", bench::now() - start, bytes, 0});
+  }
+  {
+    double start = bench::now();
+    std::ifstream in(big, std::ios::binary | std::ios::ate);
+    std::vector<unsigned char> whole((size_t) in.tellg());
+    in.seekg(0);
+    in.read((char *) whole.data(), whole.size());
+    check += checksum(whole.data(), whole.size());
+    rows.push_back({"ifstream_whole", bench::now() - start, bytes, 0});
+  }
+  {
+    double start = bench::now();
+    File in(big);
+    in.stream([&](const unsigned char *data, size_t size) { check += checksum(data, size); return true; }, chunk);
+    rows.push_back({"file_stream", bench::now() - start, bytes, 0});
+  }
+  {
+    double start = bench::now();
+    File in(big);
+    RoundQueue<unsigned char> queue((int) chunk);
+    while (in.read(queue, (int) chunk)) {
+      RoundQueue<unsigned char>::Regions used = queue.readable();
+      check += checksum(used.first.data, used.first.size) + checksum(used.second.data, used.second.size);
+      queue.consume(used.size());
+    }
+    rows.push_back({"file_round_queue", bench::now() - start, bytes, 0});
+  }
+  {
+    double start = bench::now();
+    File in(big);
+    MappedView view = in.map();
+    check += checksum(view.data(), view.size());
+    rows.push_back({"file_map", bench::now() - start, bytes, 0});
+  }
+  unlink(big.c_str());
+
+  // Directory listing with sizes, as an asset scan does
+  std::string listed = std::string(dir) + "/assets";
+  mkdir(listed.c_str(), 0755);
+  for (int i = 0; i < entries; ++i) File(listed + "/asset_" + std::to_string(i) + ".bin", File::WRITE).write("x", 1);
+  {
+    uint64_t total = 0, count = 0;
+    double start = bench::now();
+    DIR *d = opendir(listed.c_str());
+    while (struct dirent *entry = readdir(d)) {
+      if (entry->d_name[0] == '.') continue;
+      struct stat info;
+      if (stat((listed + "/" + entry->d_name).c_str(), &info) == 0) total += info.st_size;
+      count++;
+    }
+    closedir(d);
+    rows.push_back({"readdir_stat", bench::now() - start, total, count});
+  }
+  {
+    uint64_t total = 0, count = 0;
+    double start = bench::now();
+    FileDir d(listed);
+    d.stat_each([&](const FileDir::Entry &, const struct statx &info) {
+      total += info.stx_size;
+      return ++count, true;
+    }, STATX_SIZE);
+    rows.push_back({"filedir_statx", bench::now() - start, total, count});
+  }
+  {
+    uint64_t count = 0;
+    double start = bench::now();
+    FileDir d(listed);
+    d.for_each([&](const FileDir::Entry &entry) { return count += entry.name[0] != 0, true; });
+    rows.push_back({"filedir_names", bench::now() - start, 0, count});
+  }
+  {
+    FileDir d(listed);
+    d.for_each([&](const FileDir::Entry &entry) { unlinkat(d.fd(), entry.name, 0); return true; });
+  }
+  rmdir(listed.c_str());
+  rmdir(dir);
+  bench::keep(check);
+
+  bench::Json json;
+  json.begin_object();
+  json.field("benchmark", "file");
+  json.field("megabytes", (int64_t) megabytes);
+  json.field("entries", entries);
+  json.begin_array("results");
+  for (const Row &row : rows) {
+    json.begin_object().field("case", row.name).field("seconds", row.seconds);
+    if (row.items) json.field("entries", row.items).field("entries_per_second", row.items / row.seconds);
+    else json.field("bytes", row.bytes).field("gb_per_second", row.bytes / row.seconds / 1e9);
+    json.end_object();
+  }
+  json.end_array();
+  json.end_object();
+  return json.write(out_path) ? 0 : 1;
+}
@@ -0,0 +1,305 @@
+// Throughput benchmark for the scripting language pipeline: lexer, parser, compiler, verifier
+//  and VM, the last both with its run-time checks and on the verified path without them.
+//
+// Build: g++ -O2 -std=c++17 -o language_bench bench/language.cpp
+// Run:   ./language_bench [--seed N] [--count N] [--depth N] [--width N] [--reps N]
+//                         [--small-ints W] [--wide-ints W] [--floats W] [--doubles W]
+//                         [--unary PERCENT] [--out results.json]
+//
+// The corpora are generated from the seed alone, so the same options always measure the same
+//  input. Results are written as JSON (to stdout unless --out is given).
+
+// Deeply nested expressions push more than the default 256 bytes of temporaries
+#define MAX_STACK_SIZE (1 << 16)
+
+#include "../language/compiler.cpp"
+#include "../language/verifier.cpp"
+#include "bench.h"
+
+#include <string>
+#include <vector>
+
+struct CorpusConfig {
+  uint64_t seed = 1;
+  int count = 2000; // Expressions (and statements) per corpus
+  int depth = 4;    // Maximum nesting of parenthesised sub-expressions
+  int width = 4;    // Maximum operands per (sub-)expression
+  int unary = 15;   // Percent chance of a unary operator in front of an operand
+  // Literal mix, as relative weights: small ints (< 256), wide ints, floats and doubles
+  int mix[4] = {6, 1, 2, 1};
+};
+
+static const char *const binary_ops[] = {
+  "+", "-", "*", "/", "&", "|", "^", "==", "!=", "<", ">", "<=", ">="
+};
+
+static void genLiteral(bench::Rng &rng, const CorpusConfig &cfg, std::string &out, bool divisor) {
+  char buf[48];
+  switch (bench::weighted(rng, cfg.mix, 4)) {
+    case 0:
+      // Divisors must stay non-zero even after being narrowed to 8 bits by best_type
+      snprintf(buf, sizeof(buf), "%u", divisor ? 1 + rng.below(127) : rng.below(256));
+      break;
+    case 1:
+      snprintf(buf, sizeof(buf), "%u", divisor ? 1 + rng.below(127) : 256 + rng.below(1u << 30));
+      break;
+    case 2:
+      snprintf(buf, sizeof(buf), "%u.%uf", 1 + rng.below(1000), rng.below(100));
+      break;
+    default:
+      snprintf(buf, sizeof(buf), "%u.%ud", 1 + rng.below(100000), rng.below(1000));
+      break;
+  }
+  out += buf;
+}
+
+static void genExpr(bench::Rng &rng, const CorpusConfig &cfg, int depth, std::string &out) {
+  int operands = 1 + rng.below(cfg.width);
+  for (int i = 0; i < operands; ++i) {
+    if (i > 0) {
+      const char *op = binary_ops[rng.below(sizeof(binary_ops) / sizeof(*binary_ops))];
+      out += ' ';
+      out += op;
+      out += ' ';
+      // Keep integer division well defined by only ever dividing by a literal
+      if (op[0] == '/') {
+        genLiteral(rng, cfg, out, true);
+        continue;
+      }
+    }
+    if ((int) rng.below(100) < cfg.unary) out += rng.below(2) ? '-' : '!';
+    if (depth > 0 && rng.below(3) == 0) {
+      out += '(';
+      genExpr(rng, cfg, depth - 1, out);
+      out += ')';
+    } else {
+      genLiteral(rng, cfg, out, false);
+    }
+  }
+}
+
+// Statements exercise keywords, identifiers, strings and comments, which only the lexer
+//  understands so far
+static void genStatement(bench::Rng &rng, const CorpusConfig &cfg, std::string &out) {
+  char name[16], other[16];
+  snprintf(name, sizeof(name), "v%u", rng.below(64));
+  snprintf(other, sizeof(other), "w_%u", rng.below(64));
+  switch (rng.below(6)) {
+    case 0:
+      out += "let "; out += name; out += " = "; genExpr(rng, cfg, cfg.depth, out); out += ";\n";
+      break;
+    case 1:
+      out += "if ("; out += name; out += " >= "; out += other; out += ") {\n  ";
+      out += name; out += " += "; genExpr(rng, cfg, cfg.depth, out);
+      out += ";\n} else {\n  "; out += other; out += " = \"text \\\" with escapes\";\n}\n";
+      break;
+    case 2:
+      out += "while ("; out += name; out += " < "; genLiteral(rng, cfg, out, false);
+      out += ") { "; out += name; out += " *= 2; }\n";
+      break;
+    case 3:
+      out += "// "; out += name; out += " is updated every frame\n";
+      break;
+    case 4:
+      out += "func "; out += name; out += "(a, b) {\n  return a.x * b.y - ";
+      genExpr(rng, cfg, cfg.depth / 2, out); out += ";\n}\n";
+      break;
+    default:
+      out += "/* block\n comment */ do { "; out += other; out += " ^= "; out += name;
+      out += "; } while (!"; out += other; out += ");\n";
+      break;
+  }
+}
+
+static int countNodes(const ASTNode *node) {
+  if (!node) return 0;
+  if (const BinaryNode *b = dynamic_cast<const BinaryNode *>(node))
+    return 1 + countNodes(b->left) + countNodes(b->right);
+  if (const UnaryNode *u = dynamic_cast<const UnaryNode *>(node))
+    return 1 + countNodes(u->expr);
+  return 1;
+}
+
+struct StageResult {
+  const char *stage;
+  const char *unit;
+  uint64_t units;   // Work done in one repetition
+  double seconds;   // Best repetition
+  double rate;      // units / seconds, scaled to the unit's name
+};
+
+template<class F> static double bestOf(int reps, F &&run) {
+  double best = 1e300;
+  for (int r = 0; r < reps; ++r) {
+    double start = bench::now();
+    run();
+    double t = bench::now() - start;
+    if (t < best) best = t;
+  }
+  return best;
+}
+
+static uint64_t lexAll(const char *source) {
+  Lexer lexer;
+  lexer.init(source);
+  uint64_t tokens = 0;
+  while (lexer.getNext().type != TokenType::EOF_TOKEN) tokens++;
+  return tokens;
+}
+
+static VM vm;
+
+int main(int argc, char **argv) {
+  CorpusConfig cfg;
+  cfg.seed   = bench::arg_int(argc, argv, "--seed", cfg.seed);
+  cfg.count  = bench::arg_int(argc, argv, "--count", cfg.count);
+  cfg.depth  = bench::arg_int(argc, argv, "--depth", cfg.depth);
+  cfg.width  = bench::arg_int(argc, argv, "--width", cfg.width);
+  cfg.unary  = bench::arg_int(argc, argv, "--unary", cfg.unary);
+  cfg.mix[0] = bench::arg_int(argc, argv, "--small-ints", cfg.mix[0]);
+  cfg.mix[1] = bench::arg_int(argc, argv, "--wide-ints", cfg.mix[1]);
+  cfg.mix[2] = bench::arg_int(argc, argv, "--floats", cfg.mix[2]);
+  cfg.mix[3] = bench::arg_int(argc, argv, "--doubles", cfg.mix[3]);
+  int reps = bench::arg_int(argc, argv, "--reps", 5);
+  const char *out_path = bench::arg_str(argc, argv, "--out", nullptr);
+
+  bench::Rng rng(cfg.seed);
+  std::vector<std::string> exprs(cfg.count);
+  std::string expr_text, script_text;
+  for (std::string &e : exprs) {
+    genExpr(rng, cfg, cfg.depth, e);
+    expr_text += e;
+    expr_text += ";\n";
+  }
+  for (int i = 0; i < cfg.count; ++i) genStatement(rng, cfg, script_text);
+
+  std::vector<StageResult> results;
+
+  uint64_t tokens = 0;
+  double t = bestOf(reps, [&] { tokens = lexAll(expr_text.c_str()); });
+  results.push_back({"lex_expressions", "MB/s", expr_text.size(), t, expr_text.size() / t / 1e6});
+  t = bestOf(reps, [&] { tokens = lexAll(script_text.c_str()); });
+  results.push_back({"lex_script", "MB/s", script_text.size(), t, script_text.size() / t / 1e6});
+
+  std::vector<ASTNode *> trees(exprs.size(), nullptr);
+  auto freeTrees = [&] {
+    for (ASTNode *&tree : trees) {
+      delete tree;
+      tree = nullptr;
+    }
+  };
+  t = bestOf(reps, [&] {
+    freeTrees();
+    for (size_t i = 0; i < exprs.size(); ++i) {
+      Parser parser;
+      parser.parse(exprs[i].c_str());
+      trees[i] = parser.top;
+    }
+  });
+  uint64_t nodes = 0;
+  for (ASTNode *tree : trees) nodes += countNodes(tree);
+  results.push_back({"parse", "nodes/s", nodes, t, nodes / t});
+
+  std::vector<std::vector<byte>> programs(trees.size());
+  uint64_t code_bytes = 0;
+  t = bestOf(reps, [&] {
+    code_bytes = 0;
+    for (size_t i = 0; i < trees.size(); ++i) {
+      Compiler compiler;
+      compiler.compileTree(trees[i]);
+      programs[i].assign(compiler.getResultData(), compiler.getResultData() + compiler.getResultSize());
+      code_bytes += compiler.getResultSize();
+    }
+  });
+  results.push_back({"compile", "MB/s", code_bytes, t, code_bytes / t / 1e6});
+  freeTrees();
+
+  uint64_t executed = 0;
+  t = bestOf(reps, [&] {
+    executed = 0;
+    for (const std::vector<byte> &program : programs) {
+      vm.init();
+      vm.instructions = program.data();
+      vm.instructions_size = program.size();
+      // Same as VM::execute, but counting as it goes
+      vm.prog_counter = -10;
+      vm.push(&vm.stack_frame, 4);
+      vm.push(&vm.prog_counter, 4);
+      vm.prog_counter = 0;
+      do {
+        vm.execute_one();
+        executed++;
+      } while (vm.prog_counter >= 0);
+    }
+    bench::keep(vm.registers);
+  });
+  results.push_back({"vm", "instructions/s", executed, t, executed / t});
+
+  std::vector<int32_t> stack_needed(programs.size());
+  uint64_t rejected = 0;
+  t = bestOf(reps, [&] {
+    rejected = 0;
+    for (size_t i = 0; i < programs.size(); ++i) {
+      Verifier verifier;
+      if (!verifier.verify(programs[i].data(), programs[i].size())) {
+        rejected++;
+        stack_needed[i] = -1;
+      } else {
+        stack_needed[i] = verifier.max_stack;
+      }
+    }
+  });
+  results.push_back({"verify", "MB/s", code_bytes, t, code_bytes / t / 1e6});
+
+  // Same as VM::execute_verified, counting as it goes
+  t = bestOf(reps, [&] {
+    executed = 0;
+    for (size_t i = 0; i < programs.size(); ++i) {
+      if (stack_needed[i] < 0) continue;
+      vm.init();
+      vm.instructions = programs[i].data();
+      vm.instructions_size = programs[i].size();
+      vm.prog_counter = -10;
+      vm.push(&vm.stack_frame, 4);
+      vm.push(&vm.prog_counter, 4);
+      vm.prog_counter = 0;
+      do {
+        vm.execute_one<false>();
+        executed++;
+      } while (vm.prog_counter >= 0);
+    }
+    bench::keep(vm.registers);
+  });
+  results.push_back({"vm_verified", "instructions/s", executed, t, executed / t});
+
+  bench::Json json;
+  json.begin_object();
+  json.field("benchmark", "language");
+  json.begin_object("config")
+    .field("seed", cfg.seed).field("count", cfg.count)
+    .field("depth", cfg.depth).field("width", cfg.width).field("unary", cfg.unary)
+    .field("small_ints", cfg.mix[0]).field("wide_ints", cfg.mix[1])
+    .field("floats", cfg.mix[2]).field("doubles", cfg.mix[3])
+    .field("reps", reps)
+    .end_object();
+  json.begin_object("corpus")
+    .field("expression_bytes", (uint64_t) expr_text.size())
+    .field("script_bytes", (uint64_t) script_text.size())
+    .field("script_tokens", tokens)
+    .field("rejected_programs", rejected)
+    .end_object();
+  json.begin_array("results");
+  for (const StageResult &r : results) {
+    json.begin_object()
+      .field("stage", r.stage).field("units", r.units)
+      .field("seconds", r.seconds).field("unit", r.unit).field("rate", r.rate)
+      .end_object();
+  }
+  json.end_array();
+  json.end_object();
+  if (!json.write(out_path)) {
+    fprintf(stderr, "Could not write %s\n", out_path);
+    return 1;
+  }
+  return 0;
+}
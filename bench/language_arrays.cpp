@@ -0,0 +1,132 @@
+// Whole-array script expressions against running the scalar version of the same expression once
+//  per element (what scripts had to do before arrays), and against a native loop. The arrays
+//  are host buffers bound to the program, so nothing is copied in.
+//
+// Build: g++ -O2 -std=c++17 -mavx2 -o language_arrays_bench bench/language_arrays.cpp
+// Run:   ./language_arrays_bench [--count N] [--reps N] [--out results.json]
+
+#include "../language/compiler.cpp"
+#include "bench.h"
+
+#include <vector>
+
+static VM vm;
+
+struct Program {
+  std::vector<byte> code;
+
+  Program(const char *source) {
+    Compiler compiler;
+    compiler.bindArray("xs", MERGE(TYPE_FLOAT, FROM_SIZE(32)));
+    compiler.bindArray("ys", MERGE(TYPE_FLOAT, FROM_SIZE(32)));
+    Parser parser;
+    parser.parse(source);
+    compiler.compileTree(parser.top);
+    delete parser.top;
+    code.assign(compiler.getResultData(), compiler.getResultData() + compiler.getResultSize());
+  }
+
+  // Returns the instructions dispatched
+  uint64_t run(const float *xs, const float *ys, uint32_t count) {
+    vm.bind_array(0, xs, count, MERGE(TYPE_FLOAT, FROM_SIZE(32)));
+    vm.bind_array(1, ys, count, MERGE(TYPE_FLOAT, FROM_SIZE(32)));
+    vm.init();
+    vm.instructions = code.data();
+    vm.instructions_size = code.size();
+    vm.prog_counter = -10;
+    vm.push(&vm.stack_frame, 4);
+    vm.push(&vm.prog_counter, 4);
+    vm.prog_counter = 0;
+    uint64_t executed = 0;
+    do {
+      vm.execute_one();
+      executed++;
+    } while (vm.prog_counter >= 0);
+    return executed;
+  }
+};
+
+template<class F> static double best(int reps, F &&f) {
+  f(); // Untimed: sizes the VM's arena
+  double fastest = 1e30;
+  for (int r = 0; r < reps; ++r) {
+    double start = bench::now();
+    f();
+    double elapsed = bench::now() - start;
+    if (elapsed < fastest) fastest = elapsed;
+  }
+  return fastest;
+}
+
+int main(int argc, char **argv) {
+  int count = bench::arg_int(argc, argv, "--count", 100000);
+  int reps = bench::arg_int(argc, argv, "--reps", 20);
+  const char *out_path = bench::arg_str(argc, argv, "--out", nullptr);
+
+  std::vector<float> xs(count), ys(count);
+  bench::Rng rng(49);
+  for (int i = 0; i < count; ++i) {
+    xs[i] = (float) rng.below(20001) / 100.0f - 100.0f;
+    ys[i] = (float) rng.below(20001) / 100.0f - 100.0f;
+  }
+
+  struct Case {
+    const char *name;
+    const char *element; // Run once per element over one-element views
+    const char *whole;   // Run once over the whole arrays
+  } cases[] = {
+    {"scale_add_sum", "xs[0] * 2.0f + ys[0]", "(xs * 2.0f + ys).sum"},
+    {"count_greater", "xs[0] > ys[0]", "(xs > ys).sum"},
+    {"max", "xs[0]", "xs.max"},
+  };
+
+  bench::Json json;
+  json.begin_object();
+  json.field("benchmark", "language_arrays");
+  json.field("count", count);
+  json.field("vector_bytes", ARRAY_VECTOR_BYTES);
+  json.begin_array("results");
+  for (int kind = 0; kind < 3; ++kind) {
+    const Case &c = cases[kind];
+    Program element(c.element), whole(c.whole);
+    uint64_t element_instructions = 0, whole_instructions = 0;
+    double total = 0;
+    double per_element = best(reps, [&] {
+      element_instructions = 0;
+      double result = kind == 2 ? -1e30 : 0;
+      for (int i = 0; i < count; ++i) {
+        element_instructions += element.run(&xs[i], &ys[i], 1);
+        if (kind == 0) result += *(float *) vm.registers;
+        else if (kind == 1) result += *(uint8_t *) vm.registers & 1;
+        else if (*(float *) vm.registers > result) result = *(float *) vm.registers;
+      }
+      total += result;
+    });
+    double whole_array = best(reps, [&] {
+      whole_instructions = whole.run(xs.data(), ys.data(), count);
+      total += kind == 1 ? *(uint64_t *) vm.registers : *(float *) vm.registers;
+    });
+    double native = best(reps, [&] {
+      float result = kind == 2 ? -1e30f : 0;
+      for (int i = 0; i < count; ++i) {
+        if (kind == 0) result += xs[i] * 2.0f + ys[i];
+        else if (kind == 1) result += xs[i] > ys[i];
+        else result = xs[i] > result ? xs[i] : result;
+      }
+      total += result;
+    });
+    bench::keep(total);
+    json.begin_object()
+      .field("op", c.name)
+      .field("per_element_melems_per_s", count / per_element / 1e6)
+      .field("whole_array_melems_per_s", count / whole_array / 1e6)
+      .field("native_melems_per_s", count / native / 1e6)
+      .field("per_element_instructions", (double) element_instructions / count)
+      .field("whole_array_instructions", whole_instructions)
+      .field("speedup_vs_per_element", per_element / whole_array)
+      .end_object();
+  }
+  json.end_array();
+  json.end_object();
+  return json.write(out_path) ? 0 : 1;
+}
@@ -0,0 +1,167 @@
+// Loopback load generator for the networking core: thousands of TCP connections each keep one
+//  timestamped message in flight to an echo server, then UDP does the same with a window of
+//  datagrams. Reports round trips per second, messages per second (both directions) and round
+//  trip latency percentiles. Needs no network beyond 127.0.0.1.
+//
+// Build: g++ -O2 -std=c++17 -pthread -o networking_bench bench/networking.cpp
+// Run:   ./networking_bench [--connections N] [--seconds N] [--server-loops N] [--client-loops N]
+//          [--window N] [--out results.json]
+
+#include "../Networking.h"
+#include "bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <sys/resource.h>
+#include <vector>
+
+struct Row {
+  const char *name;
+  double seconds;
+  uint64_t round_trips;
+  double p50_us, p99_us;
+};
+
+static uint64_t now_ns() {
+  return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct Ping {
+  uint64_t sent;
+  uint64_t sequence;
+};
+
+// Client state, one latency log per client loop so listeners never share one
+static NetReactor *client;
+static NetReactor *server;
+static std::vector<std::vector<uint32_t>> latencies;
+static std::atomic<bool> sending{true};
+static sockaddr_in server_udp;
+
+static void echo(const NetMessage &message) { server->send(message.connection, message.data, message.size); }
+static void echo_datagram(const NetMessage &message) { server->send_udp(*message.from, message.data, message.size); }
+
+static void ping(ConnectionId connection) {
+  Ping p{now_ns(), 0};
+  client->send(connection, &p, sizeof(p));
+}
+
+static void pong(const NetMessage &message) {
+  Ping p;
+  memcpy(&p, message.data, sizeof(p));
+  latencies[message.loop].push_back((uint32_t) std::min<uint64_t>((now_ns() - p.sent) / 100, UINT32_MAX));
+  if (sending.load(std::memory_order_relaxed)) ping(message.connection);
+}
+
+static void pong_datagram(const NetMessage &message) {
+  Ping p;
+  memcpy(&p, message.data, sizeof(p));
+  latencies[message.loop].push_back((uint32_t) std::min<uint64_t>((now_ns() - p.sent) / 100, UINT32_MAX));
+  if (!sending.load(std::memory_order_relaxed)) return;
+  p.sent = now_ns();
+  client->send_udp(*message.from, &p, sizeof(p));
+}
+
+static Row collect(const char *name, double seconds) {
+  std::vector<uint32_t> all;
+  for (std::vector<uint32_t> &log : latencies) {
+    all.insert(all.end(), log.begin(), log.end());
+    log.clear();
+  }
+  std::sort(all.begin(), all.end());
+  // Logged in units of 100 ns
+  double p50 = all.empty() ? 0 : all[all.size() / 2] / 10.0;
+  double p99 = all.empty() ? 0 : all[all.size() * 99 / 100] / 10.0;
+  return Row{name, seconds, (uint64_t) all.size(), p50, p99};
+}
+
+int main(int argc, char **argv) {
+  int connections = (int) bench::arg_int(argc, argv, "--connections", 2000);
+  double seconds = (double) bench::arg_int(argc, argv, "--seconds", 3);
+  int server_loops = (int) bench::arg_int(argc, argv, "--server-loops", 0);
+  int client_loops = (int) bench::arg_int(argc, argv, "--client-loops", 1);
+  int window = (int) bench::arg_int(argc, argv, "--window", 256);
+  const char *out_path = bench::arg_str(argc, argv, "--out", nullptr);
+
+  // Both ends of every connection are in this process
+  struct rlimit limit;
+  getrlimit(RLIMIT_NOFILE, &limit);
+  limit.rlim_cur = limit.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &limit);
+  if ((rlim_t) (2 * connections + 64) > limit.rlim_cur) {
+    connections = (int) (limit.rlim_cur - 64) / 2;
+    fprintf(stderr, "descriptor limit: using %d connections\n", connections);
+  }
+
+  NetConfig server_config;
+  server_config.loops = server_loops;
+  NetworkingServer echo_server(0, server_config);
+  server = &echo_server;
+  echo_server.received.subscribe(echo);
+  echo_server.datagram.subscribe(echo_datagram);
+  echo_server.start();
+
+  NetConfig client_config;
+  client_config.loops = client_loops;
+  NetworkingClient load(client_config);
+  client = &load;
+  latencies.resize(load.loop_count());
+  for (std::vector<uint32_t> &log : latencies) log.reserve(1 << 22);
+  load.received.subscribe(pong);
+  load.datagram.subscribe(pong_datagram);
+  load.bind_udp(0);
+  load.start();
+
+  std::vector<Row> rows;
+  {
+    std::vector<ConnectionId> ids;
+    for (int i = 0; i < connections; ++i) ids.push_back(load.connect("127.0.0.1", echo_server.port()));
+    // Let the handshakes finish before timing
+    usleep(200000);
+    double start = bench::now();
+    for (ConnectionId id : ids) ping(id);
+    usleep((useconds_t) (seconds * 1e6));
+    sending.store(false);
+    double elapsed = bench::now() - start;
+    usleep(100000);
+    rows.push_back(collect("tcp_echo", elapsed));
+    for (ConnectionId id : ids) load.close(id);
+  }
+  {
+    sending.store(true);
+    server_udp = NetReactor::address("127.0.0.1", echo_server.port());
+    double start = bench::now();
+    for (int i = 0; i < window; ++i) {
+      Ping p{now_ns(), (uint64_t) i};
+      load.send_udp(server_udp, &p, sizeof(p));
+    }
+    usleep((useconds_t) (seconds * 1e6));
+    sending.store(false);
+    double elapsed = bench::now() - start;
+    usleep(100000);
+    rows.push_back(collect("udp_echo", elapsed));
+  }
+  load.stop();
+  echo_server.stop();
+
+  bench::Json json;
+  json.begin_object();
+  json.field("benchmark", "networking");
+  json.field("connections", connections);
+  json.field("udp_window", window);
+  json.field("server_loops", echo_server.loop_count());
+  json.field("client_loops", load.loop_count());
+  json.begin_array("results");
+  for (const Row &row : rows) {
+    json.begin_object()
+      .field("case", row.name).field("seconds", row.seconds).field("round_trips", row.round_trips)
+      .field("round_trips_per_second", row.round_trips / row.seconds)
+      .field("messages_per_second", 2 * row.round_trips / row.seconds)
+      .field("p50_us", row.p50_us).field("p99_us", row.p99_us)
+      .end_object();
+  }
+  json.end_array();
+  json.end_object();
+  return json.write(out_path) ? 0 : 1;
+}
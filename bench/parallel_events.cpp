@@ -0,0 +1,79 @@
+// Per-call latency of ParallelEvent against Event for listeners doing real work, and for cheap
+//  listeners that should stay inline.
+//
+// Build: g++ -O2 -std=c++17 -pthread -o parallel_events_bench bench/parallel_events.cpp
+// Run:   ./parallel_events_bench [--threads N] [--listeners N] [--work N] [--calls N] [--out results.json]
+
+#include "../parallel_events.cpp"
+#include "bench.h"
+
+#include <cmath>
+#include <vector>
+
+// Stand-in for a path update or an audio fill: a data-dependent loop the optimizer can't skip
+struct Worker {
+  int iterations = 0;
+  double state = 1.0;
+  void tick(int frame) {
+    double x = state + frame;
+    for (int i = 0; i < iterations; ++i) x = std::sqrt(x * 1.0001 + i);
+    state = x;
+  }
+};
+
+template<class E> static double perCall(E &event, int calls) {
+  double start = bench::now();
+  for (int c = 0; c < calls; ++c) event.call(c);
+  return (bench::now() - start) / calls;
+}
+
+int main(int argc, char **argv) {
+  int threads = bench::arg_int(argc, argv, "--threads", 0);
+  int listener_count = bench::arg_int(argc, argv, "--listeners", 64);
+  int work = bench::arg_int(argc, argv, "--work", 2000);
+  int calls = bench::arg_int(argc, argv, "--calls", 200);
+  const char *out_path = bench::arg_str(argc, argv, "--out", nullptr);
+
+  WorkerPool pool(threads);
+  bench::Json json;
+  json.begin_object();
+  json.field("benchmark", "parallel_events");
+  json.field("worker_threads", pool.thread_count());
+  json.field("listeners", listener_count);
+  json.begin_array("results");
+
+  // Heavy listeners, then trivial ones where fanning out would cost more than it saves
+  const int iterations[] = {work, 0};
+  for (int iters : iterations) {
+    std::vector<Worker> workers(listener_count);
+    Event<int> serial;
+    ParallelEvent<int> parallel(&pool), never_inline(&pool);
+    never_inline.set_inline_below(0);
+    for (Worker &w : workers) {
+      w.iterations = iters;
+      serial.subscribe(&Worker::tick, &w);
+      parallel.subscribe(&Worker::tick, &w, ListenerThreading::PARALLEL);
+      never_inline.subscribe(&Worker::tick, &w, ListenerThreading::PARALLEL);
+    }
+    // Light listeners: fewer of them, so the automatic fallback kicks in
+    if (iters == 0) parallel.set_inline_below(listener_count + 1);
+    int n = iters ? calls : calls * 100;
+
+    double serial_s = perCall(serial, n);
+    double parallel_s = perCall(parallel, n);
+    double forced_s = perCall(never_inline, n);
+    json.begin_object()
+      .field("work_per_listener", iters)
+      .field("serial_us_per_call", serial_s * 1e6)
+      .field("parallel_us_per_call", parallel_s * 1e6)
+      .field("always_fan_out_us_per_call", forced_s * 1e6)
+      .field("speedup", serial_s / parallel_s)
+      .end_object();
+    double total = 0;
+    for (const Worker &w : workers) total += w.state;
+    bench::keep(total);
+  }
+  json.end_array();
+  json.end_object();
+  return json.write(out_path) ? 0 : 1;
+}
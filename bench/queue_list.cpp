@@ -0,0 +1,94 @@
+// Message-queue traffic through QueueList, UnrolledQueueList and std::deque: bursts of small items
+//  pushed and then drained, with allocator calls counted.
+//
+// Build: g++ -O2 -std=c++17 -o queue_list_bench bench/queue_list.cpp
+// Run:   ./queue_list_bench [--items N] [--burst N] [--out results.json]
+
+#include "../events.cpp"
+#include "bench.h"
+
+#include <cstdlib>
+#include <deque>
+#include <new>
+
+static uint64_t allocations = 0;
+
+void *operator new(size_t size) {
+  allocations++;
+  if (void *p = malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+// A typical small message
+struct Message {
+  uint32_t type;
+  uint32_t target;
+  uint64_t payload;
+};
+
+struct Row {
+  const char *name;
+  double seconds;
+  uint64_t items;
+  uint64_t allocations;
+};
+
+template<class Push, class Pop> static Row run(const char *name, long long items, int burst, Push push, Pop pop) {
+  uint64_t before = allocations, sum = 0;
+  double start = bench::now();
+  for (long long done = 0; done < items; done += burst) {
+    for (int i = 0; i < burst; ++i) push(Message{(uint32_t) i, (uint32_t) done, (uint64_t) i * 3});
+    for (int i = 0; i < burst; ++i) sum += pop().payload;
+  }
+  double seconds = bench::now() - start;
+  bench::keep(sum);
+  return Row{name, seconds, (uint64_t) items, allocations - before};
+}
+
+int main(int argc, char **argv) {
+  long long items = bench::arg_int(argc, argv, "--items", 20000000);
+  int burst = (int) bench::arg_int(argc, argv, "--burst", 1000);
+  const char *out_path = bench::arg_str(argc, argv, "--out", nullptr);
+
+  std::vector<Row> rows;
+  {
+    QueueList<Message> queue;
+    rows.push_back(run("queue_list", items, burst,
+      [&](Message m) { queue.push(m); }, [&]() { return queue.pop(); }));
+  }
+  {
+    UnrolledQueueList<Message> queue;
+    rows.push_back(run("unrolled_queue_list", items, burst,
+      [&](Message m) { queue.push(m); }, [&]() { return queue.pop(); }));
+  }
+  {
+    UnrolledQueueList<Message, 256> queue;
+    rows.push_back(run("unrolled_queue_list_256", items, burst,
+      [&](Message m) { queue.push(m); }, [&]() { return queue.pop(); }));
+  }
+  {
+    std::deque<Message> queue;
+    rows.push_back(run("std_deque", items, burst,
+      [&](Message m) { queue.push_back(m); },
+      [&]() { Message m = queue.front(); queue.pop_front(); return m; }));
+  }
+
+  bench::Json json;
+  json.begin_object();
+  json.field("benchmark", "queue_list");
+  json.field("items", (int64_t) items);
+  json.field("burst", burst);
+  json.begin_array("results");
+  for (const Row &row : rows) {
+    json.begin_object()
+      .field("case", row.name).field("seconds", row.seconds).field("items", row.items)
+      .field("ns_per_item", row.seconds * 1e9 / row.items)
+      .field("allocations", row.allocations)
+      .end_object();
+  }
+  json.end_array();
+  json.end_object();
+  return json.write(out_path) ? 0 : 1;
+}
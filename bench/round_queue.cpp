@@ -0,0 +1,183 @@
+// Streaming through RoundQueue: bytes and audio samples moved in chunks, one element at a time
+//  (as before, and against the old modulo-indexed queue) or with push_n/pop_n and the spans.
+//  Then a parser that needs each record contiguous, over heap and mirrored storage.
+//
+// Build: g++ -O2 -std=c++17 -o round_queue_bench bench/round_queue.cpp
+// Run:   ./round_queue_bench [--megabytes N] [--out results.json]
+
+#include "../MirroredRing.h"
+#include "bench.h"
+
+#include <cstring>
+#include <vector>
+
+// The element-at-a-time core of RoundQueue before the power-of-two rework, kept to measure against
+template<class T> class ModuloQueue {
+  int _used = 0, _size, _start = 0;
+  T *_data;
+  int _index_to_buffer(int index) const { return (index + _start) % _size; }
+public:
+  explicit ModuloQueue(int size) : _size(size), _data(new T[size]) {}
+  ~ModuloQueue() { delete[] _data; }
+  void push(T value) { _data[_index_to_buffer(_used++)] = value; }
+  T &peek() { return _data[_index_to_buffer(0)]; }
+  void pop() {
+    _used--;
+    _start = _used == 0 ? 0 : (_start + 1) % _size;
+  }
+};
+
+struct Row {
+  const char *name;
+  double seconds;
+  uint64_t bytes;
+};
+
+// A producer writes chunk elements, a consumer reads them back, over and over
+template<class T> static void run(std::vector<Row> &rows, const char *kind, int chunk, uint64_t total_bytes) {
+  // Capacity that isn't a power of two for the modulo queue, as callers used to pick
+  const int capacity = 3 * chunk;
+  std::vector<T> in(chunk), out(chunk);
+  for (int i = 0; i < chunk; ++i) in[i] = (T) (i * 7);
+  long long rounds = (long long) (total_bytes / (chunk * sizeof(T)));
+  uint64_t bytes = (uint64_t) rounds * chunk * sizeof(T);
+  int64_t check = 0;
+  char name[64];
+
+  {
+    ModuloQueue<T> queue(capacity);
+    double start = bench::now();
+    for (long long r = 0; r < rounds; ++r) {
+      for (int i = 0; i < chunk; ++i) queue.push(in[i]);
+      for (int i = 0; i < chunk; ++i) {
+        out[i] = queue.peek();
+        queue.pop();
+      }
+      check += (int64_t) out[r % chunk];
+    }
+    snprintf(name, sizeof(name), "%s_modulo_per_element", kind);
+    rows.push_back({strdup(name), bench::now() - start, bytes});
+  }
+
+  {
+    RoundQueue<T> queue(capacity);
+    double start = bench::now();
+    for (long long r = 0; r < rounds; ++r) {
+      for (int i = 0; i < chunk; ++i) queue.push(in[i]);
+      for (int i = 0; i < chunk; ++i) {
+        out[i] = queue.peek();
+        queue.pop();
+      }
+      check += (int64_t) out[r % chunk];
+    }
+    snprintf(name, sizeof(name), "%s_per_element", kind);
+    rows.push_back({strdup(name), bench::now() - start, bytes});
+  }
+
+  {
+    RoundQueue<T> queue(capacity);
+    double start = bench::now();
+    for (long long r = 0; r < rounds; ++r) {
+      queue.push_n(in.data(), chunk);
+      queue.pop_n(out.data(), chunk);
+      check += (int64_t) out[r % chunk];
+    }
+    snprintf(name, sizeof(name), "%s_push_n_pop_n", kind);
+    rows.push_back({strdup(name), bench::now() - start, bytes});
+  }
+
+  // What a read(2)/write(2) caller does: copy straight into and out of the buffer
+  {
+    RoundQueue<T> queue(capacity);
+    double start = bench::now();
+    for (long long r = 0; r < rounds; ++r) {
+      typename RoundQueue<T>::Regions free = queue.writable(chunk);
+      int first = free.first.size < chunk ? free.first.size : chunk;
+      memcpy(free.first.data, in.data(), first * sizeof(T));
+      memcpy(free.second.data, in.data() + first, (chunk - first) * sizeof(T));
+      queue.commit(chunk);
+
+      typename RoundQueue<T>::Regions used = queue.readable();
+      memcpy(out.data(), used.first.data, used.first.size * sizeof(T));
+      memcpy(out.data() + used.first.size, used.second.data, used.second.size * sizeof(T));
+      queue.consume(used.size());
+      check += (int64_t) out[r % chunk];
+    }
+    snprintf(name, sizeof(name), "%s_spans", kind);
+    rows.push_back({strdup(name), bench::now() - start, bytes});
+  }
+  bench::keep(check);
+}
+
+/* Length-prefixed records arrive in fixed-size reads and are parsed in place. A record that
+ * wraps around the end of a heap buffer has to be copied out first; mirrored storage never wraps.
+*/
+template<class Q> static void parse(std::vector<Row> &rows, const char *name, uint64_t total_bytes) {
+  const int chunk = 1500;
+  // A stream of records of 1 to 200 bytes, each a length byte and that many payload bytes
+  std::vector<unsigned char> stream;
+  bench::Rng rng(3);
+  while (stream.size() < (1 << 20)) {
+    int length = 1 + rng.below(200);
+    stream.push_back((unsigned char) length);
+    for (int i = 0; i < length; ++i) stream.push_back((unsigned char) rng.below(256));
+  }
+  stream.resize(stream.size() / chunk * chunk);
+
+  Q queue(8192);
+  unsigned char scratch[256];
+  uint64_t bytes = 0, copied = 0, checksum = 0;
+  size_t at = 0;
+  double start = bench::now();
+  while (bytes < total_bytes) {
+    queue.push_n(&stream[at], chunk);
+    at = (at + chunk) % stream.size();
+    bytes += chunk;
+    while (true) {
+      typename Q::Regions used = queue.readable();
+      if (used.size() == 0) break;
+      int length = used.first.data[0];
+      if (used.size() < length + 1) break;
+      const unsigned char *record = used.first.data;
+      if (used.first.size < length + 1) {
+        int first = used.first.size;
+        memcpy(scratch, used.first.data, first);
+        memcpy(scratch + first, used.second.data, length + 1 - first);
+        record = scratch;
+        copied += length + 1;
+      }
+      for (int i = 1; i <= length; ++i) checksum += record[i];
+      queue.consume(length + 1);
+    }
+  }
+  rows.push_back({name, bench::now() - start, bytes});
+  bench::keep(checksum);
+  bench::keep(copied);
+}
+
+int main(int argc, char **argv) {
+  long long megabytes = bench::arg_int(argc, argv, "--megabytes", 256);
+  const char *out_path = bench::arg_str(argc, argv, "--out", nullptr);
+  uint64_t total = (uint64_t) megabytes << 20;
+
+  std::vector<Row> rows;
+  run<unsigned char>(rows, "bytes", 4096, total);
+  run<float>(rows, "samples", 256, total);
+  parse<RoundQueue<unsigned char>>(rows, "parse_heap", total);
+  parse<MirroredRoundQueue<unsigned char>>(rows, "parse_mirrored", total);
+
+  bench::Json json;
+  json.begin_object();
+  json.field("benchmark", "round_queue");
+  json.field("megabytes", (int64_t) megabytes);
+  json.begin_array("results");
+  for (const Row &row : rows) {
+    json.begin_object()
+      .field("case", row.name).field("seconds", row.seconds).field("bytes", row.bytes)
+      .field("gb_per_second", row.bytes / row.seconds / 1e9)
+      .end_object();
+  }
+  json.end_array();
+  json.end_object();
+  return json.write(out_path) ? 0 : 1;
+}
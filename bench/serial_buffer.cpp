@@ -0,0 +1,187 @@
+// Encoding and decoding a stream of small records with SerialBuffer/SerialReader, against the
+//  usual std::string appends and copying reads. Throughput is in encoded bytes.
+//
+// Build: g++ -O2 -std=c++17 -o serial_buffer_bench bench/serial_buffer.cpp
+// Run:   ./serial_buffer_bench [--records N] [--rounds N] [--out results.json]
+
+#include "../SerialBuffer.h"
+#include "bench.h"
+
+#include <string>
+#include <vector>
+
+struct Transform {
+  float position[3];
+  float rotation[4];
+  uint32_t entity;
+};
+
+struct Record {
+  uint32_t id;
+  int64_t delta;
+  double value;
+  std::string name;
+  Transform transform;
+};
+
+struct Row {
+  const char *name;
+  double seconds;
+  uint64_t bytes;
+};
+
+// Appending each field to a std::string, a byte at a time for varints
+namespace naive {
+  template<class T> void put(std::string &out, T value) { out.append((const char *) &value, sizeof(T)); }
+
+  void put_varint(std::string &out, uint64_t value) {
+    while (value >= 0x80) {
+      out.push_back((char) (value | 0x80));
+      value >>= 7;
+    }
+    out.push_back((char) value);
+  }
+
+  template<class T> T get(const std::string &in, size_t &at) {
+    T value;
+    memcpy(&value, in.data() + at, sizeof(T));
+    at += sizeof(T);
+    return value;
+  }
+
+  uint64_t get_varint(const std::string &in, size_t &at) {
+    uint64_t value = 0;
+    for (int shift = 0;; shift += 7) {
+      unsigned char byte = (unsigned char) in[at++];
+      value |= (uint64_t) (byte & 0x7f) << shift;
+      if (!(byte & 0x80)) return value;
+    }
+  }
+
+  void encode(std::string &out, const Record &r) {
+    put(out, r.id);
+    put_varint(out, WellSpring::serial::zigzag(r.delta));
+    put(out, r.value);
+    put_varint(out, r.name.size());
+    out += r.name;
+    put(out, r.transform);
+  }
+
+  // Strings are copied out, as with std::string fields
+  uint64_t decode(const std::string &in, size_t &at) {
+    uint64_t sum = get<uint32_t>(in, at);
+    sum += WellSpring::serial::unzigzag(get_varint(in, at));
+    sum += (uint64_t) get<double>(in, at);
+    size_t size = get_varint(in, at);
+    std::string name = in.substr(at, size);
+    at += size;
+    sum += name.size() + (unsigned char) name[0];
+    sum += get<Transform>(in, at).entity;
+    return sum;
+  }
+}
+
+static void encode(SerialBuffer &out, const Record &r) {
+  out.write_u32(r.id);
+  out.write_svarint(r.delta);
+  out.write_f64(r.value);
+  out.write_string(r.name);
+  out.write_pod(r.transform);
+}
+
+static uint64_t decode(SerialReader &in) {
+  uint64_t sum = in.read_u32();
+  sum += in.read_svarint();
+  sum += (uint64_t) in.read_f64();
+  std::string_view name = in.read_string();
+  sum += name.size() + (unsigned char) name[0];
+  sum += in.read_pod<Transform>().entity;
+  return sum;
+}
+
+int main(int argc, char **argv) {
+  int count = (int) bench::arg_int(argc, argv, "--records", 100000);
+  int rounds = (int) bench::arg_int(argc, argv, "--rounds", 50);
+  const char *out_path = bench::arg_str(argc, argv, "--out", nullptr);
+
+  // Names long enough to defeat the small string optimization
+  std::vector<Record> records(count);
+  bench::Rng rng(42);
+  for (int i = 0; i < count; ++i) {
+    Record &r = records[i];
+    r.id = (uint32_t) i;
+    r.delta = (int64_t) rng.below(2000) - 1000;
+    r.value = i * 0.25;
+    r.name = "entity_" + std::to_string(rng.next() % 1000000) + std::string(rng.below(24), 'x');
+    for (int k = 0; k < 3; ++k) r.transform.position[k] = (float) rng.below(1000);
+    for (int k = 0; k < 4; ++k) r.transform.rotation[k] = 0.5f;
+    r.transform.entity = (uint32_t) i;
+  }
+
+  std::vector<Row> rows;
+  uint64_t check = 0;
+
+  // A fresh string per round, as a serializer returning std::string would
+  {
+    std::string flat;
+    double start = bench::now();
+    for (int round = 0; round < rounds; ++round) {
+      flat = std::string();
+      for (const Record &r : records) naive::encode(flat, r);
+      bench::keep(flat.size());
+    }
+    rows.push_back({"naive_encode", bench::now() - start, (uint64_t) flat.size() * rounds});
+
+    start = bench::now();
+    for (int round = 0; round < rounds; ++round) {
+      size_t at = 0;
+      for (int i = 0; i < count; ++i) check += naive::decode(flat, at);
+    }
+    rows.push_back({"naive_decode", bench::now() - start, (uint64_t) flat.size() * rounds});
+  }
+
+  // One buffer cleared per round keeps its first chunk
+  {
+    SerialBuffer buffer;
+    double start = bench::now();
+    for (int round = 0; round < rounds; ++round) {
+      buffer.clear();
+      for (const Record &r : records) encode(buffer, r);
+      bench::keep(buffer.size());
+    }
+    rows.push_back({"serial_buffer_encode", bench::now() - start, (uint64_t) buffer.size() * rounds});
+
+    start = bench::now();
+    for (int round = 0; round < rounds; ++round) {
+      SerialReader reader(buffer);
+      for (int i = 0; i < count; ++i) check += decode(reader);
+    }
+    rows.push_back({"serial_reader_decode", bench::now() - start, (uint64_t) buffer.size() * rounds});
+
+    // As it would arrive off the network, in one piece
+    std::string flat = buffer.to_string();
+    start = bench::now();
+    for (int round = 0; round < rounds; ++round) {
+      SerialReader reader(flat);
+      for (int i = 0; i < count; ++i) check += decode(reader);
+    }
+    rows.push_back({"serial_reader_decode_flat", bench::now() - start, (uint64_t) flat.size() * rounds});
+  }
+  bench::keep(check);
+
+  bench::Json json;
+  json.begin_object();
+  json.field("benchmark", "serial_buffer");
+  json.field("records", count);
+  json.field("rounds", rounds);
+  json.begin_array("results");
+  for (const Row &row : rows) {
+    json.begin_object()
+      .field("case", row.name).field("seconds", row.seconds).field("bytes", row.bytes)
+      .field("gb_per_second", row.bytes / row.seconds / 1e9)
+      .end_object();
+  }
+  json.end_array();
+  json.end_object();
+  return json.write(out_path) ? 0 : 1;
+}
@@ -0,0 +1,158 @@
+// Throughput of the SimdMath batch functions at each SIMD width against plain scalar loops over
+//  AoS structs (what thin GLM/Jolt wrappers end up doing per entity).
+//
+// Build: g++ -O2 -std=c++17 -mavx2 -mfma -o simd_math_bench bench/simd_math.cpp
+// Run:   ./simd_math_bench [--count N] [--reps N] [--out results.json]
+
+#include "../SimdMath.h"
+#include "bench.h"
+
+#include <cmath>
+#include <vector>
+
+using namespace WellSpring::math;
+
+// The scalar baseline: one element at a time, data interleaved
+namespace scalar {
+  struct Float3 { float x, y, z; };
+  struct Float4 { float x, y, z, w; };
+  struct Matrix { float m[16]; }; // Column-major
+
+  inline Float3 transform_point(const Matrix &a, Float3 p) {
+    const float *m = a.m;
+    return Float3{m[0] * p.x + m[4] * p.y + m[8] * p.z + m[12], m[1] * p.x + m[5] * p.y + m[9] * p.z + m[13],
+      m[2] * p.x + m[6] * p.y + m[10] * p.z + m[14]};
+  }
+  inline Float3 normalize(Float3 v) {
+    float length = std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+    if (length < 1e-30f) length = 1e-30f;
+    return Float3{v.x / length, v.y / length, v.z / length};
+  }
+  inline Float4 multiply(Float4 a, Float4 b) {
+    return Float4{a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y, a.w * b.y + a.y * b.w + a.z * b.x - a.x * b.z,
+      a.w * b.z + a.z * b.w + a.x * b.y - a.y * b.x, a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z};
+  }
+  inline Float3 rotate(Float4 q, Float3 v) {
+    Float3 t{2 * (q.y * v.z - q.z * v.y), 2 * (q.z * v.x - q.x * v.z), 2 * (q.x * v.y - q.y * v.x)};
+    return Float3{v.x + q.w * t.x + q.y * t.z - q.z * t.y, v.y + q.w * t.y + q.z * t.x - q.x * t.z,
+      v.z + q.w * t.z + q.x * t.y - q.y * t.x};
+  }
+  inline Matrix compose(Float3 p, Float4 q, Float3 s) {
+    float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z, xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+    float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+    return Matrix{{(1 - 2 * (yy + zz)) * s.x, 2 * (xy + wz) * s.x, 2 * (xz - wy) * s.x, 0,
+      2 * (xy - wz) * s.y, (1 - 2 * (xx + zz)) * s.y, 2 * (yz + wx) * s.y, 0,
+      2 * (xz + wy) * s.z, 2 * (yz - wx) * s.z, (1 - 2 * (xx + yy)) * s.z, 0, p.x, p.y, p.z, 1}};
+  }
+}
+
+struct Data {
+  std::vector<scalar::Float3> points, vectors, scales, out3;
+  std::vector<scalar::Float4> rotations, spins, out4;
+  std::vector<scalar::Matrix> matrices;
+  Vec3Soa soa_points, soa_vectors, soa_scales, soa_out;
+  QuatSoa soa_rotations, soa_spins, soa_qout;
+  std::vector<Mat4> soa_matrices;
+};
+
+template<class F> static double best(int reps, F &&f) {
+  f(); // Untimed: faults the outputs in
+  double fastest = 1e30;
+  for (int r = 0; r < reps; ++r) {
+    double start = bench::now();
+    f();
+    double elapsed = bench::now() - start;
+    if (elapsed < fastest) fastest = elapsed;
+  }
+  return fastest;
+}
+
+template<int W> static void runBatch(const char *op, Data &d, const Mat4 &m, double &seconds, int reps) {
+  std::string name(op);
+  if (name == "transform_points") seconds = best(reps, [&] { batch::transform_points<W>(m, d.soa_points, d.soa_out); });
+  else if (name == "normalize") seconds = best(reps, [&] { batch::normalize<W>(d.soa_vectors); });
+  else if (name == "quat_multiply") seconds = best(reps, [&] { batch::multiply<W>(d.soa_rotations, d.soa_spins, d.soa_qout); });
+  else if (name == "rotate") seconds = best(reps, [&] { batch::rotate<W>(d.soa_rotations, d.soa_points, d.soa_out); });
+  else if (name == "compose") seconds = best(reps, [&] { batch::compose<W>(d.soa_points, d.soa_rotations, d.soa_scales, d.soa_matrices.data()); });
+}
+
+int main(int argc, char **argv) {
+  int count = bench::arg_int(argc, argv, "--count", 50000);
+  int reps = bench::arg_int(argc, argv, "--reps", 50);
+  const char *out_path = bench::arg_str(argc, argv, "--out", nullptr);
+
+  Data d;
+  bench::Rng rng(48);
+  auto random = [&] { return (float) rng.below(2000001) / 1000000.0f - 1.0f; };
+  for (int i = 0; i < count; ++i) {
+    scalar::Float3 p{random() * 100, random() * 100, random() * 100}, v{random(), random(), random()}, s{1 + random() * 0.5f, 1, 1};
+    Quat q = Quat::axis_angle(Vec3(random(), random(), 1), random() * 3), spin = Quat::axis_angle(Vec3(0, 1, 0), random() * 0.1f);
+    d.points.push_back(p);
+    d.vectors.push_back(v);
+    d.scales.push_back(s);
+    d.rotations.push_back(scalar::Float4{q.x(), q.y(), q.z(), q.w()});
+    d.spins.push_back(scalar::Float4{spin.x(), spin.y(), spin.z(), spin.w()});
+    d.soa_points.push_back(Vec3(p.x, p.y, p.z));
+    d.soa_vectors.push_back(Vec3(v.x, v.y, v.z));
+    d.soa_scales.push_back(Vec3(s.x, s.y, s.z));
+    d.soa_rotations.push_back(q);
+    d.soa_spins.push_back(spin);
+  }
+  d.out3.resize(count);
+  d.out4.resize(count);
+  d.matrices.resize(count);
+  d.soa_matrices.resize(count);
+  Mat4 m = Mat4::trs(Vec3(1, 2, 3), Quat::axis_angle(Vec3(1, 1, 0), 0.7f), Vec3(2, 2, 2));
+  scalar::Matrix sm;
+  m.store(sm.m);
+
+  bench::Json json;
+  json.begin_object();
+  json.field("benchmark", "simd_math");
+  json.field("count", count);
+  json.field("native_width", SIMD_MATH_WIDTH);
+  json.begin_array("results");
+  const char *ops[] = {"transform_points", "normalize", "quat_multiply", "rotate", "compose"};
+  for (const char *op : ops) {
+    std::string name(op);
+    double scalar_s = 0;
+    if (name == "transform_points") {
+      scalar_s = best(reps, [&] { for (int i = 0; i < count; ++i) d.out3[i] = scalar::transform_point(sm, d.points[i]); });
+    } else if (name == "normalize") {
+      // In place, like the batch version; after the first pass it renormalizes unit vectors
+      scalar_s = best(reps, [&] { for (int i = 0; i < count; ++i) d.vectors[i] = scalar::normalize(d.vectors[i]); });
+    } else if (name == "quat_multiply") {
+      scalar_s = best(reps, [&] { for (int i = 0; i < count; ++i) d.out4[i] = scalar::multiply(d.rotations[i], d.spins[i]); });
+    } else if (name == "rotate") {
+      scalar_s = best(reps, [&] { for (int i = 0; i < count; ++i) d.out3[i] = scalar::rotate(d.rotations[i], d.points[i]); });
+    } else {
+      scalar_s = best(reps, [&] {
+        for (int i = 0; i < count; ++i) d.matrices[i] = scalar::compose(d.points[i], d.rotations[i], d.scales[i]);
+      });
+    }
+    double w1 = 0, w4 = 0, w8 = 0;
+    runBatch<1>(op, d, m, w1, reps);
+#if SIMD_MATH_SSE
+    runBatch<4>(op, d, m, w4, reps);
+#endif
+#if SIMD_MATH_AVX
+    runBatch<8>(op, d, m, w8, reps);
+#endif
+    json.begin_object()
+      .field("op", op)
+      .field("scalar_aos_melems_per_s", count / scalar_s / 1e6)
+      .field("soa_w1_melems_per_s", count / w1 / 1e6);
+    if (w4 > 0) json.field("soa_w4_melems_per_s", count / w4 / 1e6);
+    if (w8 > 0) json.field("soa_w8_melems_per_s", count / w8 / 1e6);
+    double fastest = w8 > 0 ? w8 : w4 > 0 ? w4 : w1;
+    json.field("speedup_vs_scalar", scalar_s / fastest);
+    json.end_object();
+  }
+  json.end_array();
+  json.end_object();
+
+  double total = 0;
+  for (int i = 0; i < count; i += 97) total += d.out3[i].x + d.out4[i].w + d.matrices[i].m[12] + d.vectors[i].x + d.soa_out.x()[i] + d.soa_vectors.y()[i] + d.soa_matrices[i](0, 3);
+  bench::keep(total);
+  return json.write(out_path) ? 0 : 1;
+}
@@ -0,0 +1,183 @@
+// Frame time of an engine-shaped task graph on TaskScheduler, against running the same work
+//  serially and as WorkerPool stages with a barrier between each. Also counts heap allocations
+//  per frame once the graph has run once, which should be zero.
+//
+// Build: g++ -O2 -std=c++17 -pthread -o task_graph_bench bench/task_graph.cpp
+// Run:   ./task_graph_bench [--threads N] [--chunks N] [--work N] [--frames N] [--trace frame.json] [--out results.json]
+
+#include "../TaskGraph.h"
+#include "../WorkerPool.h"
+#include "bench.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+static std::atomic<long> allocations{0};
+void *operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  void *p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+// One chunk of a system's update; uneven on purpose so stealing has something to do
+struct Chunk {
+  int iterations = 0;
+  double state = 1.0;
+  void update() {
+    double x = state;
+    for (int i = 0; i < iterations; ++i) x = std::sqrt(x * 1.0001 + i);
+    state = x;
+  }
+};
+
+/* input -> physics[chunks] -> broadphase -> animation[chunks], ai[chunks] -> render[chunks]
+ * audio runs alongside all of it
+*/
+struct Frame {
+  std::vector<Chunk> input, physics, broadphase, animation, ai, render, audio;
+  std::vector<std::vector<Chunk> *> stages;
+
+  Frame(int chunks, int work) {
+    bench::Rng rng(47);
+    auto make = [&](std::vector<Chunk> &system, int count, int base) {
+      system.resize(count);
+      for (Chunk &c : system) c.iterations = base / 2 + (int) rng.below(base + 1);
+    };
+    make(input, 1, work);
+    make(physics, chunks, work);
+    make(broadphase, 1, work * 2);
+    make(animation, chunks, work);
+    make(ai, chunks, work / 2);
+    make(render, chunks, work);
+    make(audio, 1, work * 4);
+    stages = {&input, &physics, &broadphase, &animation, &ai, &render, &audio};
+  }
+
+  double checksum() const {
+    double total = 0;
+    for (const std::vector<Chunk> *stage : stages)
+      for (const Chunk &c : *stage) total += c.state;
+    return total;
+  }
+};
+
+static void build(TaskGraph &graph, Frame &frame) {
+  auto system = [&](const char *name, std::vector<Chunk> &chunks) {
+    std::vector<TaskGraph::TaskId> ids;
+    for (Chunk &c : chunks) ids.push_back(graph.add(name, TaskGraph::Work(&Chunk::update, &c)));
+    return ids;
+  };
+  auto after = [&](const std::vector<TaskGraph::TaskId> &later, const std::vector<TaskGraph::TaskId> &earlier) {
+    for (TaskGraph::TaskId l : later)
+      for (TaskGraph::TaskId e : earlier) graph.depend(l, e);
+  };
+  std::vector<TaskGraph::TaskId> input = system("input", frame.input);
+  std::vector<TaskGraph::TaskId> physics = system("physics", frame.physics);
+  std::vector<TaskGraph::TaskId> broadphase = system("broadphase", frame.broadphase);
+  std::vector<TaskGraph::TaskId> animation = system("animation", frame.animation);
+  std::vector<TaskGraph::TaskId> ai = system("ai", frame.ai);
+  std::vector<TaskGraph::TaskId> render = system("render", frame.render);
+  system("audio", frame.audio);
+  after(physics, input);
+  after(broadphase, physics);
+  after(animation, broadphase);
+  after(ai, broadphase);
+  // Render chunk i only needs the animation and ai chunks for the same slice
+  for (size_t i = 0; i < render.size(); ++i) {
+    graph.depend(render[i], animation[i]);
+    graph.depend(render[i], ai[i]);
+  }
+}
+
+struct Stats {
+  double mean_us, p99_us;
+  double allocations_per_frame;
+};
+
+template<class F> static Stats measure(int frames, F &&frame) {
+  frame(); // Untimed: sizes deques and timelines, wakes the workers
+  std::vector<double> times(frames);
+  long before = allocations.load();
+  for (int f = 0; f < frames; ++f) {
+    double start = bench::now();
+    frame();
+    times[f] = bench::now() - start;
+  }
+  long after = allocations.load();
+  double total = 0;
+  for (double t : times) total += t;
+  std::sort(times.begin(), times.end());
+  return Stats{total / frames * 1e6, times[(size_t) (frames * 0.99)] * 1e6, (double) (after - before) / frames};
+}
+
+static void runChunk(void *context, uint32_t index) {
+  (*static_cast<std::vector<Chunk> *>(context))[index].update();
+}
+
+int main(int argc, char **argv) {
+  int threads = bench::arg_int(argc, argv, "--threads", 0);
+  int chunks = bench::arg_int(argc, argv, "--chunks", 32);
+  int work = bench::arg_int(argc, argv, "--work", 2000);
+  int frames = bench::arg_int(argc, argv, "--frames", 300);
+  const char *trace_path = bench::arg_str(argc, argv, "--trace", nullptr);
+  const char *out_path = bench::arg_str(argc, argv, "--out", nullptr);
+
+  Frame frame(chunks, work);
+  TaskScheduler scheduler(threads);
+  WorkerPool pool(threads);
+  TaskGraph graph;
+  build(graph, frame);
+  FrameTimeline timeline;
+
+  Stats serial = measure(frames, [&] {
+    for (std::vector<Chunk> *stage : frame.stages)
+      for (Chunk &c : *stage) c.update();
+  });
+  // Stages in dependency order, each one a fork/join the next waits for
+  Stats staged = measure(frames, [&] {
+    frame.input[0].update();
+    pool.run((uint32_t) frame.physics.size(), runChunk, &frame.physics);
+    frame.broadphase[0].update();
+    pool.run((uint32_t) frame.animation.size(), runChunk, &frame.animation);
+    pool.run((uint32_t) frame.ai.size(), runChunk, &frame.ai);
+    pool.run((uint32_t) frame.render.size(), runChunk, &frame.render);
+    frame.audio[0].update();
+  });
+  Stats graphed = measure(frames, [&] { scheduler.run(graph); });
+  Stats profiled = measure(frames, [&] { scheduler.run(graph, &timeline); });
+
+  bench::Json json;
+  json.begin_object();
+  json.field("benchmark", "task_graph");
+  json.field("worker_threads", scheduler.thread_count());
+  json.field("tasks", (int) graph.size());
+  json.begin_array("results");
+  auto row = [&](const char *name, const Stats &s) {
+    json.begin_object()
+      .field("schedule", name)
+      .field("frame_us_mean", s.mean_us)
+      .field("frame_us_p99", s.p99_us)
+      .field("speedup", serial.mean_us / s.mean_us)
+      .field("allocations_per_frame", s.allocations_per_frame)
+      .end_object();
+  };
+  row("serial", serial);
+  row("worker_pool_stages", staged);
+  row("task_graph", graphed);
+  row("task_graph_profiled", profiled);
+  json.end_array();
+  json.begin_array("worker_busy_fraction");
+  for (int w = 0; w < timeline.workers(); ++w) json.begin_object().field("worker", w).field("busy", timeline.busy_fraction(w)).end_object();
+  json.end_array();
+  json.end_object();
+  bench::keep(frame.checksum());
+  if (trace_path && !timeline.write_chrome_trace(trace_path)) return 1;
+  return json.write(out_path) ? 0 : 1;
+}
@@ -1,4 +1,12 @@
+#ifndef _CALLABLE_H_
+#define _CALLABLE_H_
+
+#include <cstring>
+#include <new>
 #include <stdexcept>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
 
 namespace WellSpring {
   // Contains helper classes for Callable, as well as Callable itself
@@ -8,16 +16,41 @@ namespace WellSpring {
       NONE = 0,
       FUNC,
       METHOD,
+      FUNCTOR,
     };
+    
+    // Callables keep targets up to this size inline: enough for a vtable pointer, an object
+    //  pointer and a member function pointer
+    constexpr size_t _INLINE_SIZE = 4 * sizeof(void *);
+    
+    // Inline targets must also move without throwing, so that moving a Callable can't fail
+    template<class T> constexpr bool _fits_inline() {
+      return sizeof(T) <= _INLINE_SIZE && alignof(T) <= alignof(void *) &&
+        std::is_nothrow_move_constructible<T>::value;
+    }
+    
+    template<class T> T *_clone_into(const T &self, void *buffer) {
+      if constexpr (_fits_inline<T>()) return new (buffer) T(self);
+      else return new T(self);
+    }
+    
+    // Only ever called for targets that fit inline
+    template<class T> T *_move_into(T &self, void *buffer) noexcept {
+      if constexpr (_fits_inline<T>()) return new (buffer) T(std::move(self));
+      else return nullptr;
+    }
 
     template<class Ret, class... Args> class _FunctionBase {
     public:
+      virtual ~_FunctionBase() {}
       virtual _FuncType get_type() const { return _FuncType::NONE; }
       virtual Ret call(Args...) const = 0;
-      virtual _FunctionBase *clone() const = 0;
+      // Copies into buffer (_INLINE_SIZE bytes) if the target fits there, otherwise onto the heap
+      virtual _FunctionBase *clone_into(void *buffer) const = 0;
+      // Moves an inline target into another buffer
+      virtual _FunctionBase *move_into(void *buffer) noexcept = 0;
       // other should be of the same type as this
       virtual bool equals(const _FunctionBase *other) const { return true; }
-      int refcount = 0;
     };
     
     template<class Ret, class... Args> class _FunctionFunc : public _FunctionBase<Ret, Args...> {
@@ -31,12 +64,14 @@ namespace WellSpring {
         return func == ((_FunctionFunc<Ret, Args...> *)(other))->func;
       }
       
-      _FunctionBase<Ret, Args...> *clone() const override {
-        return new _FunctionFunc(*this);
+      _FunctionBase<Ret, Args...> *clone_into(void *buffer) const override {
+        return _clone_into(*this, buffer);
+      }
+      _FunctionBase<Ret, Args...> *move_into(void *buffer) noexcept override {
+        return _move_into(*this, buffer);
       }
       
       _FunctionFunc(FPtr f) : func(f) {}
-      _FunctionFunc(const _FunctionFunc &other) : func(other.func) {}
     };
     
     template<class T, class Ret, class... Args> class _FunctionMethod : public _FunctionBase<Ret, Args...> {
@@ -56,19 +91,74 @@ namespace WellSpring {
         return func == ((_FunctionMethod<T, Ret, Args...> *)(other))->func && data == ((_FunctionMethod<T, Ret, Args...> *)(other))->data;
       }
       
-      _FunctionBase<Ret, Args...> *clone() const override {
-        return new _FunctionMethod(*this);
+      _FunctionBase<Ret, Args...> *clone_into(void *buffer) const override {
+        return _clone_into(*this, buffer);
+      }
+      _FunctionBase<Ret, Args...> *move_into(void *buffer) noexcept override {
+        return _move_into(*this, buffer);
       }
       
       _FunctionMethod(FPtr method, T *obj) : data(obj), func(method) {}
-      _FunctionMethod(const _FunctionMethod &other) : data(other.data), func(other.func) {}
     };
     
+    // Lambdas and other function objects. Small ones are kept inline, large ones on the heap.
+    template<class F, class Ret, class... Args> class _FunctionFunctor : public _FunctionBase<Ret, Args...> {
+    protected:
+      // Mutable lambdas change their captures when called
+      mutable F functor;
+    public:
+      _FuncType get_type() const override { return _FuncType::FUNCTOR; }
+      Ret call(Args... args) const override { return functor(args...); }
+      // Functors can't be compared, so a functor only equals itself
+      bool equals(const _FunctionBase<Ret, Args...> *other) const override { return this == other; }
+      
+      _FunctionBase<Ret, Args...> *clone_into(void *buffer) const override {
+        return _clone_into(*this, buffer);
+      }
+      _FunctionBase<Ret, Args...> *move_into(void *buffer) noexcept override {
+        return _move_into(*this, buffer);
+      }
+      
+      _FunctionFunctor(const F &f) : functor(f) {}
+      _FunctionFunctor(F &&f) : functor(std::move(f)) {}
+    };
+    
+    static_assert(_fits_inline<_FunctionMethod<_FunctionBase<void>, void>>(), "Member bindings must fit inline");
+    
     template<class T> class Callable;
     
+    /* Owns a copy of its target. Function pointers, member function bindings and small functors
+     * live inside the Callable itself, so constructing, copying and moving them never allocates;
+     * only functors larger than _INLINE_SIZE go to the heap. Moves never throw and leave the
+     * source empty.
+    */
     template<class Ret, class... Args> class Callable<Ret(Args...)> {
     protected:
-      _FunctionBase<Ret, Args...> *func;
+      typedef _FunctionBase<Ret, Args...> Base;
+      
+      alignas(void *) unsigned char storage[_INLINE_SIZE];
+      // Points into storage for inline targets
+      Base *func;
+      
+      bool _is_inline() const { return (const void *) func == (const void *) storage; }
+      
+      void _reset() noexcept {
+        if (!func) return;
+        if (_is_inline()) func->~Base();
+        else delete func;
+        func = nullptr;
+      }
+      
+      // Leaves other empty
+      void _take(Callable &other) noexcept {
+        if (other._is_inline()) {
+          func = other.func->move_into(storage);
+          other._reset();
+        } else {
+          func = other.func;
+          other.func = nullptr;
+        }
+      }
     public:
       bool is_valid() const {
         if (!func) return false;
@@ -77,58 +167,286 @@ namespace WellSpring {
       }
       
       Ret operator()(Args... args) const {
-        // Better to warn them first
-        if (!is_valid()) throw std::runtime_error("Attempted to invoke an invalid Callable");
+        // Better to warn them first. Every stored target has a real type, so no need to ask it.
+        if (!func) throw std::runtime_error("Attempted to invoke an invalid Callable");
         return func->call(args...);
       }
 
       Callable &operator=(const Callable &other) {
-        if (other.is_valid()) {
-          func = other.func->clone();
-          func->refcount++;
-        } else {
-          throw std::invalid_argument("Attempted to set to an invalid Callable");
-        }
+        if (&other == this) return *this;
+        if (!other.is_valid()) throw std::invalid_argument("Attempted to set to an invalid Callable");
+        _reset();
+        func = other.func->clone_into(storage);
+        return *this;
+      }
+      
+      Callable &operator=(Callable &&other) noexcept {
+        if (&other == this) return *this;
+        _reset();
+        _take(other);
         return *this;
       }
 
-      bool operator==(const Callable &other) {
+      bool operator==(const Callable &other) const {
         if (other.func == func) return true;
-        if (other.func->get_type() != other.func->get_type()) return false;
+        if (!func || !other.func) return false;
+        if (typeid(*func) != typeid(*other.func)) return false;
         return func->equals(other.func);
       }
 
-      bool operator!=(const Callable &other) {
+      bool operator!=(const Callable &other) const {
         return !(*this==other);
       }
       
       template<class T> Callable(Ret (T::*method)(Args...), T *obj) :
-        func(new _FunctionMethod<T, Ret, Args...>(method, obj))
-      { func->refcount++; }
+        func(new (storage) _FunctionMethod<T, Ret, Args...>(method, obj))
+      {}
       
-      Callable(Ret (*f)(Args...)) : func(new _FunctionFunc<Ret, Args...>(f)) { func->refcount++; }
-      Callable() : func(nullptr) {}
-      Callable(const Callable &other) {
-        if (other.is_valid()) {
-          func = other.func->clone();
-          func->refcount++;
+      Callable(Ret (*f)(Args...)) : func(new (storage) _FunctionFunc<Ret, Args...>(f)) {}
+      
+      // Lambdas without captures are stored as the function pointer they convert to
+      template<class F, class = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, Callable>::value &&
+        std::is_invocable_r<Ret, typename std::decay<F>::type &, Args...>::value
+      >::type> Callable(F &&functor) : func(nullptr) {
+        typedef typename std::decay<F>::type Functor;
+        if constexpr (std::is_convertible<Functor, Ret (*)(Args...)>::value) {
+          func = new (storage) _FunctionFunc<Ret, Args...>((Ret (*)(Args...)) functor);
+        } else {
+          typedef _FunctionFunctor<Functor, Ret, Args...> Target;
+          if constexpr (_fits_inline<Target>()) func = new (storage) Target(std::forward<F>(functor));
+          else func = new Target(std::forward<F>(functor));
         }
       }
       
+      Callable() : func(nullptr) {}
+      Callable(const Callable &other) : func(other.func ? other.func->clone_into(storage) : nullptr) {}
+      Callable(Callable &&other) noexcept : func(nullptr) {
+        if (other.func) _take(other);
+      }
+      
       ~Callable() {
-        if (func) {
-          func->refcount--;
-          // You never know...
-          if (func->refcount <= 0)
-            delete func;
+        _reset();
+      }
+    };
+    
+    template<class T> class Delegate;
+    
+    /* A Callable that never allocates: function pointers, member function bindings and small
+     * trivially copyable functors (lambdas that capture a few pointers or values) are stored
+     * inline. Delegates compare equal when they call the same thing on the same object, or hold
+     * byte-identical functors, so they can be used as listener identities.
+    */
+    template<class Ret, class... Args> class Delegate<Ret(Args...)> {
+    public:
+      // Room for an object pointer plus a member function pointer, which is two words on most ABIs
+      static constexpr size_t STORAGE_SIZE = 3 * sizeof(void *);
+    protected:
+      typedef Ret (*Thunk)(const void *, Args...);
+      typedef Ret (*FPtr)(Args...);
+      
+      template<class T, class M> struct _Binding {
+        T *obj;
+        M method;
+      };
+      
+      alignas(void *) unsigned char storage[STORAGE_SIZE];
+      Thunk thunk;
+      
+      static Ret _call_func(const void *data, Args... args) {
+        return (*(const FPtr *) data)(std::forward<Args>(args)...);
+      }
+      
+      template<class B> static Ret _call_method(const void *data, Args... args) {
+        const B *binding = (const B *) data;
+        return (binding->obj->*binding->method)(std::forward<Args>(args)...);
+      }
+      
+      // Functors may be mutable; each Delegate owns its copy, so calling it through const is fine
+      template<class F> static Ret _call_functor(const void *data, Args... args) {
+        return (*(F *) const_cast<void *>(data))(std::forward<Args>(args)...);
+      }
+      
+      // Zeroed first so that padding never makes equal delegates compare unequal
+      template<class T> void _store(const T &value) {
+        static_assert(sizeof(T) <= STORAGE_SIZE, "Too large for a Delegate; capture a pointer instead");
+        static_assert(alignof(T) <= alignof(void *), "Over-aligned functors can't be stored in a Delegate");
+        static_assert(std::is_trivially_copyable<T>::value, "Delegates only hold trivially copyable functors");
+        memset(storage, 0, STORAGE_SIZE);
+        new (storage) T(value);
+      }
+    public:
+      Delegate() : storage{}, thunk(nullptr) {}
+      Delegate(std::nullptr_t) : Delegate() {}
+      
+      Delegate(FPtr f) : Delegate() {
+        if (!f) return;
+        _store(f);
+        thunk = &_call_func;
+      }
+      
+      template<class T> Delegate(Ret (T::*method)(Args...), T *obj) : Delegate() {
+        typedef _Binding<T, Ret (T::*)(Args...)> B;
+        _store(B{obj, method});
+        thunk = &_call_method<B>;
+      }
+      
+      template<class T> Delegate(Ret (T::*method)(Args...) const, const T *obj) : Delegate() {
+        typedef _Binding<const T, Ret (T::*)(Args...) const> B;
+        _store(B{obj, method});
+        thunk = &_call_method<B>;
+      }
+      
+      // Lambdas without captures are stored as the function pointer they convert to
+      template<class F, class = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, Delegate>::value &&
+        std::is_invocable_r<Ret, F &, Args...>::value
+      >::type> Delegate(const F &functor) : Delegate() {
+        if constexpr (std::is_convertible<F, FPtr>::value) {
+          _store((FPtr) functor);
+          thunk = &_call_func;
+        } else {
+          _store(functor);
+          thunk = &_call_functor<F>;
         }
       }
+      
+      bool is_valid() const { return thunk != nullptr; }
+      explicit operator bool() const { return is_valid(); }
+      
+      // Unchecked, like calling a function pointer
+      Ret operator()(Args... args) const {
+        return thunk(storage, std::forward<Args>(args)...);
+      }
+      
+      bool operator==(const Delegate &other) const {
+        return thunk == other.thunk && memcmp(storage, other.storage, STORAGE_SIZE) == 0;
+      }
+      
+      bool operator!=(const Delegate &other) const {
+        return !(*this == other);
+      }
+    };
+    
+    // How a CallableRef or BoundCallable passes an argument on: scalars by value, the rest by reference
+    template<class T> using _Arg = typename std::conditional<std::is_scalar<T>::value, T, T &&>::type;
+    
+    /* Hands an argument to a parameter of type _Arg<T>. Rvalues and references pass straight
+     * through; only an lvalue given for a by-value class parameter is copied, once.
+    */
+    template<class T, class U> decltype(auto) _pass(U &&value) {
+      if constexpr (std::is_reference<T>::value || std::is_scalar<T>::value) return std::forward<U>(value);
+      else if constexpr (std::is_lvalue_reference<U>::value) return T(value);
+      else return std::forward<U>(value);
+    }
+    
+    template<class T> class CallableRef;
+    
+    /* A non-owning view of something callable: one pointer plus one thunk, trivially copyable and
+     * never checked. It refers to the target rather than copying it, so only use it for
+     * parameters and locals that don't outlive the target (lambdas without captures and function
+     * pointers are stored by value and are always safe).
+    */
+    template<class Ret, class... Args> class CallableRef<Ret(Args...)> {
+    protected:
+      typedef Ret (*FPtr)(Args...);
+      // Gets the address of the union
+      typedef Ret (*Thunk)(const void *, _Arg<Args>...);
+      
+      union {
+        void *obj;
+        FPtr func;
+      };
+      Thunk thunk;
+      
+      static Ret _call_func(const void *data, _Arg<Args>... args) {
+        return (*(const FPtr *) data)(std::forward<_Arg<Args>>(args)...);
+      }
+      
+      template<class F> static Ret _call_functor(const void *data, _Arg<Args>... args) {
+        return (*(F *) *(void *const *) data)(std::forward<_Arg<Args>>(args)...);
+      }
+    public:
+      CallableRef() : obj(nullptr), thunk(nullptr) {}
+      CallableRef(std::nullptr_t) : CallableRef() {}
+      CallableRef(FPtr f) : func(f), thunk(f ? &_call_func : nullptr) {}
+      
+      // Also takes Callables, Delegates and BoundCallables, by reference
+      template<class F, class = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, CallableRef>::value &&
+        std::is_invocable_r<Ret, F &, Args...>::value
+      >::type> CallableRef(F &&functor) {
+        typedef typename std::remove_reference<F>::type Functor;
+        if constexpr (std::is_convertible<Functor, FPtr>::value) {
+          func = (FPtr) functor;
+          thunk = &_call_func;
+        } else {
+          obj = (void *) std::addressof(functor);
+          thunk = &_call_functor<Functor>;
+        }
+      }
+      
+      bool is_valid() const { return thunk != nullptr; }
+      explicit operator bool() const { return is_valid(); }
+      
+      // Unchecked, like calling a function pointer
+      template<class... CallArgs> Ret operator()(CallArgs &&...args) const {
+        static_assert(sizeof...(CallArgs) == sizeof...(Args), "Wrong number of arguments");
+        return thunk(&obj, _pass<Args>(std::forward<CallArgs>(args))...);
+      }
+    };
+    
+    /* A call whose target is fixed at compile time, so calls through it can be inlined:
+     *   BoundCallable<&Player::on_hit> hit(&player);  hit(damage);
+     *   BoundCallable<&update_physics> physics;        physics(dt);
+     * It is as small as the object pointer, and can be stored in a Delegate or viewed by a CallableRef.
+    */
+    template<auto Target> class BoundCallable;
+    
+    template<class Ret, class... Args, Ret (*F)(Args...)> class BoundCallable<F> {
+    public:
+      typedef Ret Signature(Args...);
+      
+      template<class... CallArgs> Ret operator()(CallArgs &&...args) const {
+        return F(_pass<Args>(std::forward<CallArgs>(args))...);
+      }
+    };
+    
+    template<class T, class Ret, class... Args, Ret (T::*M)(Args...)> class BoundCallable<M> {
+    protected:
+      T *obj;
+    public:
+      typedef Ret Signature(Args...);
+      
+      explicit BoundCallable(T *instance) : obj(instance) {}
+      
+      template<class... CallArgs> Ret operator()(CallArgs &&...args) const {
+        return (obj->*M)(_pass<Args>(std::forward<CallArgs>(args))...);
+      }
+    };
+    
+    template<class T, class Ret, class... Args, Ret (T::*M)(Args...) const> class BoundCallable<M> {
+    protected:
+      const T *obj;
+    public:
+      typedef Ret Signature(Args...);
+      
+      explicit BoundCallable(const T *instance) : obj(instance) {}
+      
+      template<class... CallArgs> Ret operator()(CallArgs &&...args) const {
+        return (obj->*M)(_pass<Args>(std::forward<CallArgs>(args))...);
+      }
     };
   }
 }
 
 // Export Callable
 using WellSpring::callable::Callable;
+using WellSpring::callable::Delegate;
+using WellSpring::callable::CallableRef;
+using WellSpring::callable::BoundCallable;
 
 // NOTE: Use this in a Callable constructor to make a Callable to an instance member function, especially an anonymous one
 #define MEMBER_FUNC(instance, func) &decltype(instance)::func, &instance
+
+#endif // _CALLABLE_H_
@@ -0,0 +1,289 @@
+#ifndef _CONCURRENT_EVENTS_CPP_
+#define _CONCURRENT_EVENTS_CPP_
+
+#include "events.cpp"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Threads that may call concurrent events at the same time. Each one claims a reader slot the
+//  first time it dispatches and gives it back when it exits.
+#ifndef EVENT_MAX_READER_THREADS
+#define EVENT_MAX_READER_THREADS 128
+#endif
+
+/* Epoch-based reclamation shared by every concurrent event. A dispatching thread publishes the
+ * global epoch it started in; memory retired at epoch E may be freed once no thread is still
+ * inside a dispatch that started before E.
+*/
+class EventEpochs {
+public:
+    struct alignas(64) ReaderSlot {
+        std::atomic<uint64_t> epoch{0}; // 0 while not dispatching
+        std::atomic<bool> claimed{false};
+    };
+private:
+    ReaderSlot slots[EVENT_MAX_READER_THREADS];
+    alignas(64) std::atomic<uint64_t> global{1};
+
+    struct ThreadState {
+        int slot = -1;
+        int depth = 0; // Dispatches can nest when a listener fires another event
+        ~ThreadState() {
+            if (slot >= 0) instance().slots[slot].claimed.store(false, std::memory_order_release);
+        }
+    };
+
+    static ThreadState &thread_state() {
+        static thread_local ThreadState state;
+        return state;
+    }
+
+    int claim() {
+        for (int i = 0; i < EVENT_MAX_READER_THREADS; ++i) {
+            bool expected = false;
+            if (!slots[i].claimed.load(std::memory_order_relaxed) &&
+                slots[i].claimed.compare_exchange_strong(expected, true)) return i;
+        }
+        throw std::runtime_error("More threads dispatching than EVENT_MAX_READER_THREADS");
+    }
+public:
+    static EventEpochs &instance() {
+        static EventEpochs epochs;
+        return epochs;
+    }
+
+    void enter() {
+        ThreadState &state = thread_state();
+        if (state.depth++ != 0) return;
+        if (state.slot < 0) state.slot = claim();
+        slots[state.slot].epoch.store(global.load());
+    }
+
+    void leave() {
+        ThreadState &state = thread_state();
+        if (--state.depth != 0) return;
+        slots[state.slot].epoch.store(0, std::memory_order_release);
+    }
+
+    // Keeps the thread inside the epoch it entered for as long as it lives
+    struct Guard {
+        EventEpochs &epochs;
+        explicit Guard(EventEpochs &e) : epochs(e) { epochs.enter(); }
+        ~Guard() { epochs.leave(); }
+    };
+
+    // Called after unpublishing something; returns the epoch to retire it at
+    uint64_t advance() {
+        return global.fetch_add(1) + 1;
+    }
+
+    // Whether nothing retired at this epoch can still be in use
+    bool quiescent(uint64_t retired) const {
+        for (const ReaderSlot &slot : slots) {
+            uint64_t epoch = slot.epoch.load();
+            if (epoch != 0 && epoch < retired) return false;
+        }
+        return true;
+    }
+};
+
+/* Listener storage for the concurrent events. Readers see an immutable snapshot; writers copy it,
+ * change the copy and swap it in, then free old snapshots once no reader can still hold them.
+ * Writers are serialized with each other but never block readers.
+*/
+template<class L> class SnapshotList {
+    struct Entry {
+        L listener;
+        uint64_t id;
+    };
+
+    struct Snapshot {
+        std::vector<Entry> entries;
+    };
+
+    struct Retired {
+        Snapshot *snapshot;
+        uint64_t epoch;
+    };
+
+    std::atomic<Snapshot *> current{new Snapshot()};
+    std::mutex writer;
+    std::vector<Retired> retired;
+    uint64_t next_id = 0;
+
+    static ListenerHandle to_handle(uint64_t id) {
+        return ListenerHandle{(uint32_t) id, (uint32_t) (id >> 32)};
+    }
+
+    static uint64_t from_handle(ListenerHandle handle) {
+        return handle.slot | ((uint64_t) handle.generation << 32);
+    }
+
+    // Must hold writer
+    void publish(Snapshot *next) {
+        Snapshot *old = current.exchange(next);
+        retired.push_back(Retired{old, EventEpochs::instance().advance()});
+        reclaim();
+    }
+
+    // Must hold writer
+    void reclaim() {
+        EventEpochs &epochs = EventEpochs::instance();
+        size_t kept = 0;
+        for (Retired &r : retired) {
+            if (epochs.quiescent(r.epoch)) delete r.snapshot;
+            else retired[kept++] = r;
+        }
+        retired.resize(kept);
+    }
+
+    template<class Keep> bool rebuild(Keep &&keep) {
+        std::lock_guard<std::mutex> lock(writer);
+        const Snapshot *old = current.load();
+        Snapshot *next = new Snapshot();
+        next->entries.reserve(old->entries.size());
+        for (const Entry &entry : old->entries) {
+            if (keep(entry)) next->entries.push_back(entry);
+        }
+        if (next->entries.size() == old->entries.size()) {
+            delete next;
+            return false;
+        }
+        publish(next);
+        return true;
+    }
+public:
+    SnapshotList() = default;
+    SnapshotList(const SnapshotList &) = delete;
+    SnapshotList &operator=(const SnapshotList &) = delete;
+
+    // Nothing may be dispatching when the list is destroyed
+    ~SnapshotList() {
+        for (Retired &r : retired) delete r.snapshot;
+        delete current.load();
+    }
+
+    ListenerHandle add(const L &listener) {
+        std::lock_guard<std::mutex> lock(writer);
+        const Snapshot *old = current.load();
+        Snapshot *next = new Snapshot();
+        next->entries.reserve(old->entries.size() + 1);
+        next->entries.assign(old->entries.begin(), old->entries.end());
+        uint64_t id = next_id++;
+        next->entries.push_back(Entry{listener, id});
+        publish(next);
+        return to_handle(id);
+    }
+
+    bool remove(ListenerHandle handle) {
+        uint64_t id = from_handle(handle);
+        return rebuild([id](const Entry &entry) { return entry.id != id; });
+    }
+
+    bool remove(const L &listener) {
+        return rebuild([&listener](const Entry &entry) { return !(entry.listener == listener); });
+    }
+
+    /* Waits until every dispatch that could have seen a removed listener has finished, then frees
+     * what it can. Call it before destroying whatever a removed listener uses, but never from
+     * inside a listener, since the calling dispatch would wait on itself.
+    */
+    void synchronize() {
+        uint64_t epoch = EventEpochs::instance().advance();
+        while (!EventEpochs::instance().quiescent(epoch)) std::this_thread::yield();
+        std::lock_guard<std::mutex> lock(writer);
+        reclaim();
+    }
+
+    // Wait-free: bounded by the number of listeners in the snapshot it picks up
+    template<class F> bool dispatch(F &&f) const {
+        EventEpochs::Guard guard(EventEpochs::instance());
+        const Snapshot *snapshot = current.load();
+        for (const Entry &entry : snapshot->entries) {
+            if (f(entry.listener)) return true;
+        }
+        return false;
+    }
+
+    size_t size() const {
+        EventEpochs::Guard guard(EventEpochs::instance());
+        return current.load()->entries.size();
+    }
+};
+
+/* Event that can be called from any number of threads while others subscribe and unsubscribe.
+ * A call sees the listeners as they were when it started. Like all RCU, a listener can still be
+ * running shortly after unsubscribe returns; use synchronize() if that matters.
+*/
+template<typename ...Args> class ConcurrentEvent {
+public:
+    using Listener = Delegate<void(Args...)>;
+
+    SnapshotList<Listener> listeners;
+
+    ListenerHandle subscribe(Listener listener) {
+        return listeners.add(listener);
+    }
+
+    template<class T> ListenerHandle subscribe(void (T::*method)(Args...), T *obj) {
+        return listeners.add(Listener(method, obj));
+    }
+
+    void unsubscribe(ListenerHandle handle) {
+        listeners.remove(handle);
+    }
+
+    void unsubscribe(Listener listener) {
+        listeners.remove(listener);
+    }
+
+    void synchronize() {
+        listeners.synchronize();
+    }
+
+    void call(Args... args) const {
+        listeners.dispatch([&](const Listener &listener) {
+            listener(args...);
+            return false;
+        });
+    }
+};
+
+// EventUnhandled counterpart of ConcurrentEvent. The order added is the order called.
+template<typename ...Args> class ConcurrentEventUnhandled {
+public:
+    using Listener = Delegate<bool(Args...)>;
+
+    SnapshotList<Listener> listeners;
+
+    ListenerHandle subscribe(Listener listener) {
+        return listeners.add(listener);
+    }
+
+    template<class T> ListenerHandle subscribe(bool (T::*method)(Args...), T *obj) {
+        return listeners.add(Listener(method, obj));
+    }
+
+    void unsubscribe(ListenerHandle handle) {
+        listeners.remove(handle);
+    }
+
+    void unsubscribe(Listener listener) {
+        listeners.remove(listener);
+    }
+
+    void synchronize() {
+        listeners.synchronize();
+    }
+
+    bool call(Args... args) const {
+        return listeners.dispatch([&](const Listener &listener) {
+            return listener(args...);
+        });
+    }
+};
+
+#endif // _CONCURRENT_EVENTS_CPP_
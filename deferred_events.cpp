@@ -0,0 +1,168 @@
+#ifndef _DEFERRED_EVENTS_CPP_
+#define _DEFERRED_EVENTS_CPP_
+
+#include "events.cpp"
+#include "RoundQueue.h"
+
+#include <tuple>
+#include <type_traits>
+
+// What post() does when an equivalent event is already waiting for the next flush
+enum class Coalesce {
+    NONE,       // Keep everything
+    DUPLICATES, // Drop the new event if an identical one is pending
+    LATEST,     // Only the most recent event survives, e.g. mouse movement
+    BY_KEY,     // A pending event with the same key is overwritten in place
+};
+
+// Whether T has an ==; std::tuple's own == isn't constrained, so check each element instead
+template<class T, class = void> struct HasEquality : std::false_type {};
+template<class T> struct HasEquality<T, decltype((void) (std::declval<const T &>() == std::declval<const T &>()))>
+    : std::true_type {};
+
+/* Event whose calls are queued with post() and delivered in one batch by flush(), typically
+ * once per frame. The batch is delivered listener by listener: each listener sees every pending
+ * event before the next listener runs, which keeps its code and data hot.
+ * Queued arguments live in a RoundQueue that only grows, so once it has reached the largest
+ * frame's size, posting no longer allocates.
+*/
+template<typename ...Args> class DeferredEvent {
+public:
+    using Listener = Delegate<void(Args...)>;
+    using Key = uint64_t (*)(const typename std::decay<Args>::type &...);
+
+    ListenerList<Listener> listeners;
+private:
+    struct Pending {
+        std::tuple<typename std::decay<Args>::type...> args;
+        uint64_t key;
+    };
+
+    // Posts made while flushing go to the other queue, so the batch being delivered never moves
+    RoundQueue<Pending> queues[2];
+    int front = 0;
+    bool flushing = false;
+    Coalesce mode = Coalesce::NONE;
+    Key key_of = nullptr;
+
+    // DUPLICATES is the only mode that compares arguments, so only it needs them to have ==
+    static constexpr bool comparable = (HasEquality<typename std::decay<Args>::type>::value && ...);
+
+    // Searches newest first, since that is where a superseded event most likely is
+    int find(const RoundQueue<Pending> &queue, const Pending &item) const {
+        for (int i = queue.size() - 1; i >= 0; --i) {
+            if (mode == Coalesce::BY_KEY) {
+                if (queue[i].key == item.key) return i;
+            } else if constexpr (comparable) {
+                if (queue[i].args == item.args) return i;
+            }
+        }
+        return -1;
+    }
+public:
+    explicit DeferredEvent(int capacity = 64) {
+        queues[0].rebuild(capacity);
+        queues[1].rebuild(capacity);
+    }
+
+    DeferredEvent(const DeferredEvent &) = delete;
+    DeferredEvent &operator=(const DeferredEvent &) = delete;
+
+    /* BY_KEY needs a key function, and DUPLICATES arguments that have ==. Coalescing only ever
+     * looks at events from the same frame.
+    */
+    void set_coalescing(Coalesce coalesce, Key key = nullptr) {
+        if (coalesce == Coalesce::BY_KEY && !key)
+            throw std::invalid_argument("Coalescing by key needs a key function");
+        if (coalesce == Coalesce::DUPLICATES && !comparable)
+            throw std::invalid_argument("Coalescing duplicates needs arguments with ==");
+        mode = coalesce;
+        key_of = key;
+    }
+
+    ListenerHandle subscribe(Listener listener) {
+        return listeners.add(listener);
+    }
+
+    template<class T> ListenerHandle subscribe(void (T::*method)(Args...), T *obj) {
+        return listeners.add(Listener(method, obj));
+    }
+
+    void unsubscribe(ListenerHandle handle) {
+        listeners.remove(handle);
+    }
+
+    void unsubscribe(Listener listener) {
+        listeners.remove(listener);
+    }
+
+    void post(Args... args) {
+        RoundQueue<Pending> &queue = queues[front];
+        Pending item{std::tuple<typename std::decay<Args>::type...>(args...), 0};
+        switch (mode) {
+            case Coalesce::NONE:
+                break;
+            case Coalesce::LATEST:
+                if (!queue.empty()) {
+                    queue[queue.size() - 1] = item;
+                    return;
+                }
+                break;
+            case Coalesce::BY_KEY:
+                item.key = std::apply(key_of, item.args);
+                [[fallthrough]];
+            case Coalesce::DUPLICATES: {
+                int found = find(queue, item);
+                if (found >= 0) {
+                    // Duplicates are identical already; a newer keyed event replaces the old one
+                    if (mode == Coalesce::BY_KEY) queue[found] = item;
+                    return;
+                }
+                break;
+            }
+        }
+        queue.push(item);
+    }
+
+    // Skips the queue entirely
+    void call(Args... args) {
+        listeners.dispatch([&](const Listener &listener, uint32_t) {
+            listener(args...);
+            return false;
+        });
+    }
+
+    // Delivers everything posted since the last flush. Returns how many events that was.
+    int flush() {
+        if (flushing) return 0;
+        RoundQueue<Pending> &batch = queues[front];
+        const int count = batch.size();
+        if (count == 0) return 0;
+        flushing = true;
+        front ^= 1;
+        struct Reset {
+            DeferredEvent &event;
+            RoundQueue<Pending> &batch;
+            int count;
+            ~Reset() {
+                batch.consume(count);
+                event.flushing = false;
+            }
+        } reset{*this, batch, count};
+        listeners.dispatch([&](const Listener &listener, uint32_t) {
+            for (int i = 0; i < count; ++i) std::apply(listener, batch[i].args);
+            return false;
+        });
+        return count;
+    }
+
+    // Drops everything posted since the last flush
+    void discard() {
+        RoundQueue<Pending> &queue = queues[front];
+        queue.consume(queue.size());
+    }
+
+    int pending() const { return queues[front].size(); }
+};
+
+#endif // _DEFERRED_EVENTS_CPP_
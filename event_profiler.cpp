@@ -0,0 +1,325 @@
+#ifndef _EVENT_PROFILER_CPP_
+#define _EVENT_PROFILER_CPP_
+
+/* Instrumentation for Event and EventUnhandled, compiled in only when EVENTS_INSTRUMENTATION is
+ * defined (events.cpp includes this file itself in that case). Every instrumented event counts
+ * its calls and, per listener, calls, handled events and a latency histogram. While tracing is on,
+ * every dispatch and listener call is also recorded for export as Chrome trace-event JSON, which
+ * Perfetto and chrome://tracing open directly.
+*/
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+// Trace records kept per thread; the oldest are overwritten once it is full
+#ifndef EVENT_TRACE_CAPACITY
+#define EVENT_TRACE_CAPACITY (1 << 16)
+#endif
+
+inline uint64_t event_clock_ns() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+/* Log-bucketed latency histogram: every power of two is split into 4 linear sub-buckets, so any
+ * value is within 25% of its bucket's lower bound. Recording is a relaxed atomic increment.
+*/
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BITS = 2;
+    static constexpr int SUBS = 1 << SUB_BITS;
+    static constexpr int BUCKETS = 64 * SUBS;
+private:
+    std::atomic<uint64_t> buckets[BUCKETS] = {};
+    std::atomic<uint64_t> max_ns{0};
+public:
+    static int bucket_of(uint64_t ns) {
+        if (ns < SUBS) return (int) ns;
+        int top = 63 - __builtin_clzll(ns);
+        int sub = (int) (ns >> (top - SUB_BITS)) & (SUBS - 1);
+        return (top - SUB_BITS + 1) * SUBS + sub;
+    }
+
+    static uint64_t lower_bound(int bucket) {
+        if (bucket < SUBS) return bucket;
+        int top = bucket / SUBS + SUB_BITS - 1;
+        return ((uint64_t) (SUBS + bucket % SUBS)) << (top - SUB_BITS);
+    }
+
+    void record(uint64_t ns) {
+        buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+        uint64_t seen = max_ns.load(std::memory_order_relaxed);
+        while (ns > seen && !max_ns.compare_exchange_weak(seen, ns, std::memory_order_relaxed)) {}
+    }
+
+    uint64_t count() const {
+        uint64_t total = 0;
+        for (const std::atomic<uint64_t> &b : buckets) total += b.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    // Lower bound of the bucket holding the q-quantile, q in [0, 1]
+    uint64_t quantile(double q) const {
+        uint64_t total = count();
+        if (total == 0) return 0;
+        uint64_t target = (uint64_t) (q * (total - 1)), seen = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen > target) return lower_bound(i);
+        }
+        return max();
+    }
+
+    uint64_t max() const { return max_ns.load(std::memory_order_relaxed); }
+
+    void reset() {
+        for (std::atomic<uint64_t> &b : buckets) b.store(0, std::memory_order_relaxed);
+        max_ns.store(0, std::memory_order_relaxed);
+    }
+};
+
+struct ListenerProfile {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> handled{0};
+    LatencyHistogram latency;
+
+    void reset() {
+        calls.store(0, std::memory_order_relaxed);
+        handled.store(0, std::memory_order_relaxed);
+        latency.reset();
+    }
+};
+
+class EventProfile;
+
+// One trace record: a whole dispatch when slot is NO_LISTENER, otherwise a single listener call
+struct EventTraceRecord {
+    static constexpr uint32_t NO_LISTENER = UINT32_MAX;
+    const EventProfile *event;
+    const char *name; // Copied at record time, since the event may be gone by export
+    uint32_t slot;
+    bool handled;
+    uint64_t start_ns, duration_ns;
+};
+
+// Global registry of instrumented events and per-thread trace buffers
+class EventProfiler {
+    struct TraceBuffer {
+        EventTraceRecord records[EVENT_TRACE_CAPACITY];
+        std::atomic<uint64_t> written{0};
+        uint32_t thread_id;
+    };
+
+    std::mutex lock;
+    std::vector<EventProfile *> events;
+    std::vector<TraceBuffer *> buffers;
+    std::atomic<bool> tracing{false};
+    uint64_t origin_ns = event_clock_ns();
+
+    TraceBuffer *thread_buffer() {
+        static thread_local TraceBuffer *buffer = nullptr;
+        if (!buffer) {
+            buffer = new TraceBuffer();
+            std::lock_guard<std::mutex> guard(lock);
+            buffer->thread_id = (uint32_t) buffers.size() + 1;
+            buffers.push_back(buffer); // Kept until exit, so traces outlive their threads
+        }
+        return buffer;
+    }
+public:
+    static EventProfiler &instance() {
+        static EventProfiler profiler;
+        return profiler;
+    }
+
+    void add(EventProfile *event) {
+        std::lock_guard<std::mutex> guard(lock);
+        events.push_back(event);
+    }
+
+    void remove(EventProfile *event) {
+        std::lock_guard<std::mutex> guard(lock);
+        for (size_t i = 0; i < events.size(); ++i) {
+            if (events[i] == event) {
+                events[i] = events.back();
+                events.pop_back();
+                break;
+            }
+        }
+    }
+
+    // Starting again drops what was recorded before
+    void start_tracing() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            for (TraceBuffer *buffer : buffers) buffer->written.store(0);
+        }
+        tracing.store(true);
+    }
+    void stop_tracing() { tracing.store(false); }
+    bool is_tracing() const { return tracing.load(std::memory_order_relaxed); }
+
+    void trace(const EventTraceRecord &record) {
+        TraceBuffer *buffer = thread_buffer();
+        uint64_t at = buffer->written.load(std::memory_order_relaxed);
+        buffer->records[at % EVENT_TRACE_CAPACITY] = record;
+        buffer->written.store(at + 1, std::memory_order_release);
+    }
+
+    // Per event and listener: calls, handled, p50/p99/max latency
+    void write_summary(FILE *out);
+
+    // Stop tracing first; records still being written are skipped. Returns false on I/O errors.
+    bool write_chrome_trace(const char *path);
+};
+
+/* Per-event statistics. Listener profiles are allocated in chunks the first time their slot is
+ * seen and never move, so recording never takes a lock. They are cleared when the event hands
+ * their slot to a new listener.
+*/
+class EventProfile {
+    static constexpr int CHUNK = 64;
+    static constexpr int MAX_CHUNKS = 1024;
+
+    std::atomic<ListenerProfile *> chunks[MAX_CHUNKS] = {};
+    std::mutex grow;
+public:
+    const char *name = "event";
+    std::atomic<uint64_t> calls{0};
+    LatencyHistogram latency;
+
+    EventProfile() { EventProfiler::instance().add(this); }
+    // Copies start out empty under the same name
+    EventProfile(const EventProfile &other) : name(other.name) { EventProfiler::instance().add(this); }
+    EventProfile &operator=(const EventProfile &other) {
+        name = other.name;
+        return *this;
+    }
+    ~EventProfile() {
+        EventProfiler::instance().remove(this);
+        for (std::atomic<ListenerProfile *> &chunk : chunks) delete[] chunk.load();
+    }
+
+    // Null for slots beyond what the profile can track
+    ListenerProfile *listener(uint32_t slot) {
+        if (slot >= (uint32_t) CHUNK * MAX_CHUNKS) return nullptr;
+        std::atomic<ListenerProfile *> &chunk = chunks[slot / CHUNK];
+        ListenerProfile *profiles = chunk.load(std::memory_order_acquire);
+        if (!profiles) {
+            std::lock_guard<std::mutex> guard(grow);
+            profiles = chunk.load();
+            if (!profiles) {
+                profiles = new ListenerProfile[CHUNK];
+                chunk.store(profiles, std::memory_order_release);
+            }
+        }
+        return &profiles[slot % CHUNK];
+    }
+
+    // A slot is being handed to a new listener; forget whatever the last one recorded there
+    void listener_added(uint32_t slot) {
+        if (slot >= (uint32_t) CHUNK * MAX_CHUNKS) return;
+        if (ListenerProfile *profiles = chunks[slot / CHUNK].load(std::memory_order_acquire))
+            profiles[slot % CHUNK].reset();
+    }
+
+    // Visits every listener slot that has been called at least once
+    template<class F> void for_each_listener(F &&f) const {
+        for (int c = 0; c < MAX_CHUNKS; ++c) {
+            ListenerProfile *profiles = chunks[c].load(std::memory_order_acquire);
+            if (!profiles) continue;
+            for (int i = 0; i < CHUNK; ++i) {
+                if (profiles[i].calls.load(std::memory_order_relaxed))
+                    f((uint32_t) (c * CHUNK + i), profiles[i]);
+            }
+        }
+    }
+
+    // Times a whole call()
+    struct CallScope {
+        EventProfile &profile;
+        uint64_t start = event_clock_ns();
+        explicit CallScope(EventProfile &p) : profile(p) {}
+        ~CallScope() {
+            uint64_t duration = event_clock_ns() - start;
+            profile.calls.fetch_add(1, std::memory_order_relaxed);
+            profile.latency.record(duration);
+            EventProfiler &profiler = EventProfiler::instance();
+            if (profiler.is_tracing())
+                profiler.trace({&profile, profile.name, EventTraceRecord::NO_LISTENER, false, start, duration});
+        }
+    };
+
+    // Times one listener call; set handled before it ends if the listener took the event
+    struct ListenerScope {
+        EventProfile &profile;
+        uint32_t slot;
+        bool handled = false;
+        uint64_t start = event_clock_ns();
+        ListenerScope(EventProfile &p, uint32_t s) : profile(p), slot(s) {}
+        ~ListenerScope() {
+            uint64_t duration = event_clock_ns() - start;
+            if (ListenerProfile *listener = profile.listener(slot)) {
+                listener->calls.fetch_add(1, std::memory_order_relaxed);
+                if (handled) listener->handled.fetch_add(1, std::memory_order_relaxed);
+                listener->latency.record(duration);
+            }
+            EventProfiler &profiler = EventProfiler::instance();
+            if (profiler.is_tracing())
+                profiler.trace({&profile, profile.name, slot, handled, start, duration});
+        }
+    };
+};
+
+inline void EventProfiler::write_summary(FILE *out) {
+    std::lock_guard<std::mutex> guard(lock);
+    for (const EventProfile *event : events) {
+        fprintf(out, "%s: %llu calls, p50 %lluns, p99 %lluns, max %lluns\n", event->name,
+            (unsigned long long) event->calls.load(),
+            (unsigned long long) event->latency.quantile(0.5),
+            (unsigned long long) event->latency.quantile(0.99),
+            (unsigned long long) event->latency.max());
+        event->for_each_listener([out](uint32_t slot, const ListenerProfile &listener) {
+            fprintf(out, "  listener %u: %llu calls, %llu handled, p50 %lluns, p99 %lluns, max %lluns\n", slot,
+                (unsigned long long) listener.calls.load(),
+                (unsigned long long) listener.handled.load(),
+                (unsigned long long) listener.latency.quantile(0.5),
+                (unsigned long long) listener.latency.quantile(0.99),
+                (unsigned long long) listener.latency.max());
+        });
+    }
+}
+
+inline bool EventProfiler::write_chrome_trace(const char *path) {
+    FILE *out = fopen(path, "w");
+    if (!out) return false;
+    std::lock_guard<std::mutex> guard(lock);
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", out);
+    bool first = true;
+    for (const TraceBuffer *buffer : buffers) {
+        uint64_t written = buffer->written.load(std::memory_order_acquire);
+        uint64_t begin = written > EVENT_TRACE_CAPACITY ? written - EVENT_TRACE_CAPACITY : 0;
+        for (uint64_t i = begin; i < written; ++i) {
+            const EventTraceRecord &r = buffer->records[i % EVENT_TRACE_CAPACITY];
+            // Timestamps are microseconds with fractions
+            double ts = (r.start_ns - origin_ns) / 1000.0, dur = r.duration_ns / 1000.0;
+            fprintf(out, "%s\n{\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,", first ? "" : ",",
+                buffer->thread_id, ts, dur);
+            if (r.slot == EventTraceRecord::NO_LISTENER) {
+                fprintf(out, "\"cat\":\"event\",\"name\":\"%s\"}", r.name);
+            } else {
+                fprintf(out, "\"cat\":\"listener\",\"name\":\"%s[%u]\",\"args\":{\"handled\":%s}}",
+                    r.name, r.slot, r.handled ? "true" : "false");
+            }
+            first = false;
+        }
+    }
+    fputs("\n]}\n", out);
+    return fclose(out) == 0;
+}
+
+#endif // _EVENT_PROFILER_CPP_
@@ -1,10 +1,43 @@
+#ifndef _EVENTS_CPP_
+#define _EVENTS_CPP_
+
+#include "callable.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/* Define EVENTS_INSTRUMENTATION to profile every Event and EventUnhandled (see event_profiler.cpp).
+ * Without it the hooks below expand to nothing and set_name() is a no-op.
+*/
+#ifdef EVENTS_INSTRUMENTATION
+#include "event_profiler.cpp"
+#define EVENT_PROFILE mutable EventProfile profile;
+#define EVENT_PROFILE_NAME(name) profile.name = (name);
+#define EVENT_PROFILE_ADDED(slot) profile.listener_added(slot);
+#define EVENT_PROFILE_CALL EventProfile::CallScope profile_call(profile);
+#define EVENT_PROFILE_LISTENER(slot) EventProfile::ListenerScope profile_listener(profile, (slot));
+#define EVENT_PROFILE_HANDLED(handled) profile_listener.handled = (handled);
+#else
+#define EVENT_PROFILE
+#define EVENT_PROFILE_NAME(name) (void) (name);
+#define EVENT_PROFILE_ADDED(slot) (void) (slot);
+#define EVENT_PROFILE_CALL
+#define EVENT_PROFILE_LISTENER(slot) (void) (slot);
+#define EVENT_PROFILE_HANDLED(handled)
+#endif
+
 // Implements a queue through a linked list, but exposes the pointers for your leisure
 template<class T> class QueueList {
 public:
     ~QueueList() {
-        Element current = head;
+        Element *current = head;
         while (current) {
-            Element next = current->next;
+            Element *next = current->next;
             delete current;
             current = next;
         }
@@ -18,7 +51,7 @@ public:
     Element *head = nullptr, *tail = nullptr;
     
     void push(T v) {
-        Element *el = new Element{nullptr, v};
+        Element *el = new Element{nullptr, std::move(v)};
         if (!head) {
             head = el;
             tail = el;
@@ -31,98 +64,517 @@ public:
     T pop() {
         if (!head) throw std::length_error("Empty list!");
         if (head == tail) {
-            T v = head->value;
+            T v = std::move(head->value);
             delete head;
             head = nullptr;
             tail = nullptr;
             return v;
         }
-        Element e = *head;
+        Element *next = head->next;
+        T v = std::move(head->value);
         delete head;
-        head = e.next;
-        return e.value;
+        head = next;
+        return v;
     }
 };
 
-// Allows you to call multiple function pointers at a time
-template<typename ...Args> class Event {
+/* QueueList for many small items: each node holds a block of them, so a push or pop is usually
+ * just an index bump, and emptied blocks go to a per-queue pool instead of back to the allocator.
+ * As with QueueList, head and tail are exposed: walk blocks through next and read the items in
+ * [begin, end) of each. Elements are moved in and out, never copied.
+*/
+template<class T, size_t BLOCK_BYTES = 4096> class UnrolledQueueList {
 public:
-    using Listener = void (*)(Args...);
+    static constexpr int COUNT = (BLOCK_BYTES - 2 * sizeof(void *)) / sizeof(T) > 0 ?
+        (int) ((BLOCK_BYTES - 2 * sizeof(void *)) / sizeof(T)) : 1;
     
-    QueueList<Listener> listeners;
+    struct Block {
+        Block *next;
+        int begin, end;
+        alignas(T) unsigned char storage[COUNT * sizeof(T)];
+        
+        T *items() { return (T *) storage; }
+        T &operator[](int index) { return items()[index]; }
+    };
     
-    typedef typename QueueList<Listener>::Element Element;
+    Block *head = nullptr, *tail = nullptr;
+private:
+    Block *pool = nullptr; // Empty blocks kept for reuse, linked through next
+    size_t count = 0;
     
-    void subscribe(Listener listener) {
-        listeners.push(listener);
+    Block *take_block() {
+        Block *block = pool;
+        if (block) pool = block->next;
+        else block = new Block;
+        block->next = nullptr;
+        block->begin = block->end = 0;
+        return block;
     }
     
-    void unsubscribe(Listener listener) {
-        if (!listeners.head) {return;}
-        if (listeners.head->value == listener) {
-            listeners.pop();
-        }
-        Element *el = listeners.head->next;
-        Element *last = listeners.head;
-        while (el != nullptr) {
-            if (el->value == listener) {
-                last->next = el->next;
-                delete el;
+    static void free_blocks(Block *block) {
+        while (block) {
+            Block *next = block->next;
+            delete block;
+            block = next;
+        }
+    }
+public:
+    UnrolledQueueList() {}
+    UnrolledQueueList(const UnrolledQueueList &) = delete;
+    UnrolledQueueList &operator=(const UnrolledQueueList &) = delete;
+    
+    ~UnrolledQueueList() {
+        clear();
+        free_blocks(head);
+        free_blocks(pool);
+    }
+    
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    
+    void push(T v) {
+        if (!tail) {
+            head = tail = take_block();
+        } else if (tail->end == COUNT) {
+            tail->next = take_block();
+            tail = tail->next;
+        }
+        new (&(*tail)[tail->end]) T(std::move(v));
+        tail->end++;
+        count++;
+    }
+    
+    T &front() {
+        if (!count) throw std::length_error("Empty list!");
+        return (*head)[head->begin];
+    }
+    
+    T pop() {
+        if (!count) throw std::length_error("Empty list!");
+        T &slot = (*head)[head->begin];
+        T v = std::move(slot);
+        slot.~T();
+        head->begin++;
+        count--;
+        if (head->begin == head->end) {
+            if (head == tail) {
+                // Keep the last block; start it over
+                head->begin = head->end = 0;
+            } else {
+                Block *next = head->next;
+                head->next = pool;
+                pool = head;
+                head = next;
             }
-            last = el;
-            el = el->next;
         }
+        return v;
     }
     
-    void call(Args... args) const {
-        if (!listeners.head) {return;}
-        Element *el = listeners.head;
-        while (el != nullptr) {
-            el->value(args...);
-            el = el->next;
+    // Destroys every element; the blocks stay in the pool
+    void clear() {
+        while (head) {
+            for (int i = head->begin; i < head->end; ++i) (*head)[i].~T();
+            Block *next = head->next;
+            head->next = pool;
+            pool = head;
+            head = next;
         }
+        tail = nullptr;
+        count = 0;
+    }
+    
+    // Hands the pooled blocks back to the allocator
+    void shrink() {
+        free_blocks(pool);
+        pool = nullptr;
+    }
+};
+
+// Returned by subscribe, and lets you unsubscribe in constant time. Stale handles are ignored.
+struct ListenerHandle {
+    uint32_t slot = UINT32_MAX;
+    uint32_t generation = 0;
+    
+    bool valid() const { return slot != UINT32_MAX; }
+    bool operator==(const ListenerHandle &other) const {
+        return slot == other.slot && generation == other.generation;
     }
+    bool operator!=(const ListenerHandle &other) const { return !(*this == other); }
 };
 
-/* Allows you to call function pointers until one handles the event. The order added is the order called.
+/* Contiguous listener storage shared by the events. Listeners are called from the highest
+ * priority down, and in the order they were added within a priority. Removal only marks the entry
+ * dead; dead entries are compacted out once no dispatch is running, so listeners may subscribe
+ * and unsubscribe (themselves or others) from inside a call. Listeners added during a dispatch
+ * are first called by the next one.
+*/
+template<class L> class ListenerList {
+public:
+    struct Entry {
+        L listener;
+        uint32_t slot; // The slot whose position points back here
+        int32_t priority;
+        bool alive;
+    };
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+    
+    std::vector<Entry> entries;
+    // Per slot: the index into entries while in use, or the next free slot while unused
+    std::vector<uint32_t> positions;
+    std::vector<uint32_t> generations;
+    uint32_t free_slot = NONE;
+    uint32_t dead = 0;
+    int dispatching = 0;
+    bool unsorted = false; // Something was appended out of priority order during a dispatch
+    
+    struct DispatchGuard {
+        ListenerList &list;
+        explicit DispatchGuard(ListenerList &l) : list(l) { list.dispatching++; }
+        ~DispatchGuard() {
+            if (--list.dispatching != 0) return;
+            if (list.dead) list.compact();
+            if (list.unsorted) list.sort([](const Entry &, const Entry &) { return false; });
+        }
+    };
+    
+    // Dead entries are skipped: their slot is already on the free list, or in use again
+    void reindex(size_t from) {
+        for (size_t i = from; i < entries.size(); ++i) {
+            if (entries[i].alive) positions[entries[i].slot] = (uint32_t) i;
+        }
+    }
+    
+    void kill(uint32_t index) {
+        Entry &entry = entries[index];
+        entry.alive = false;
+        dead++;
+        generations[entry.slot]++;
+        positions[entry.slot] = free_slot;
+        free_slot = entry.slot;
+    }
+    
+    // Keeps the amortized cost of removal constant while never letting dead entries outnumber
+    //  live ones
+    void maybe_compact() {
+        if (!dispatching && dead * 2 > entries.size()) compact();
+    }
+public:
+    // Appending is constant time; only a priority above the lowest one present has to shift
+    ListenerHandle add(const L &listener, int32_t priority = 0) {
+        uint32_t slot = free_slot;
+        if (slot != NONE) {
+            free_slot = positions[slot];
+        } else {
+            slot = (uint32_t) positions.size();
+            positions.push_back(0);
+            generations.push_back(0);
+        }
+        Entry entry{listener, slot, priority, true};
+        if (entries.empty() || entries.back().priority >= priority || dispatching) {
+            if (!entries.empty() && entries.back().priority < priority) unsorted = true;
+            positions[slot] = (uint32_t) entries.size();
+            entries.push_back(entry);
+        } else {
+            auto at = std::upper_bound(entries.begin(), entries.end(), priority,
+                [](int32_t p, const Entry &e) { return p > e.priority; });
+            size_t index = at - entries.begin();
+            entries.insert(at, entry);
+            reindex(index);
+        }
+        return ListenerHandle{slot, generations[slot]};
+    }
+    
+    // Returns false if the handle was stale
+    bool remove(ListenerHandle handle) {
+        if (handle.slot >= generations.size() || generations[handle.slot] != handle.generation)
+            return false;
+        kill(positions[handle.slot]);
+        maybe_compact();
+        return true;
+    }
+    
+    // Removes every entry for the listener. Linear; prefer handles.
+    int remove(const L &listener) {
+        int removed = 0;
+        for (uint32_t i = 0; i < entries.size(); ++i) {
+            if (entries[i].alive && entries[i].listener == listener) {
+                kill(i);
+                removed++;
+            }
+        }
+        maybe_compact();
+        return removed;
+    }
+    
+    // Stable removal of dead entries
+    void compact() {
+        uint32_t out = 0;
+        for (uint32_t i = 0; i < entries.size(); ++i) {
+            if (!entries[i].alive) continue;
+            if (out != i) entries[out] = entries[i];
+            positions[entries[out].slot] = out;
+            out++;
+        }
+        entries.resize(out);
+        dead = 0;
+    }
+    
+    /* Stable sort by priority, then by less within a priority. Must not be called while
+     * dispatching.
+    */
+    template<class Less> void sort(Less &&less) {
+        std::stable_sort(entries.begin(), entries.end(), [&](const Entry &a, const Entry &b) {
+            if (a.priority != b.priority) return a.priority > b.priority;
+            return less(a, b);
+        });
+        reindex(0);
+        unsorted = false;
+    }
+    
+    /* Calls f(listener, slot) for every live listener in order until f returns true. Returns
+     * whether one did. The listener is copied out first, since the storage may move if it
+     * subscribes.
+    */
+    template<class F> bool dispatch(F &&f) {
+        DispatchGuard guard(*this);
+        const size_t count = entries.size();
+        for (size_t i = 0; i < count; ++i) {
+            if (!entries[i].alive) continue;
+            L listener = entries[i].listener;
+            if (f(listener, entries[i].slot)) return true;
+        }
+        return false;
+    }
+    
+    // Null if the handle is stale
+    const Entry *find(ListenerHandle handle) const {
+        if (handle.slot >= generations.size() || generations[handle.slot] != handle.generation)
+            return nullptr;
+        return &entries[positions[handle.slot]];
+    }
+    
+    // Only meaningful for a slot that is in use
+    ListenerHandle handle_of(uint32_t slot) const { return ListenerHandle{slot, generations[slot]}; }
+    
+    bool is_dispatching() const { return dispatching != 0; }
+    size_t slot_count() const { return positions.size(); }
+    size_t size() const { return entries.size() - dead; }
+    bool empty() const { return size() == 0; }
+    void reserve(size_t count) { entries.reserve(count); }
+};
+
+// Allows you to call multiple listeners at a time
+template<typename ...Args> class Event {
+public:
+    // Function pointers, member functions (see MEMBER_FUNC) and small lambdas
+    using Listener = Delegate<void(Args...)>;
+    
+    // Mutable so that call() can compact entries removed while it was running
+    mutable ListenerList<Listener> listeners;
+private:
+    EVENT_PROFILE
+    
+    ListenerHandle added(ListenerHandle handle) {
+        EVENT_PROFILE_ADDED(handle.slot)
+        return handle;
+    }
+public:
+    // Label for profiles and traces; must outlive the event
+    void set_name(const char *name) { EVENT_PROFILE_NAME(name) }
+    
+    ListenerHandle subscribe(Listener listener) {
+        return added(listeners.add(listener));
+    }
+    
+    template<class T> ListenerHandle subscribe(void (T::*method)(Args...), T *obj) {
+        return added(listeners.add(Listener(method, obj)));
+    }
+    
+    void unsubscribe(ListenerHandle handle) {
+        listeners.remove(handle);
+    }
+    
+    void unsubscribe(Listener listener) {
+        listeners.remove(listener);
+    }
+    
+    void call(Args... args) const {
+        EVENT_PROFILE_CALL
+        listeners.dispatch([&](const Listener &listener, uint32_t slot) {
+            EVENT_PROFILE_LISTENER(slot)
+            listener(args...);
+            return false;
+        });
+    }
+};
+
+// How often a listener of an EventUnhandled took or passed on an event
+struct ListenerStats {
+    uint64_t handled = 0;
+    uint64_t declined = 0;
+};
+
+/* Allows you to call listeners until one handles the event. Higher priorities are called first;
+ * within a priority, the order added is the order called.
  * Do not subscribe functions that could/will modify inputs or perform external actions yet not handle the event.
+ *
+ * Two opt-in shortcuts trade that strict order for speed when the same listener tends to take a
+ * run of events:
+ *  - Affinity: a key function (e.g. the target id) picks a cache entry remembering which listener
+ *    last handled that key, and that listener is asked first. If it declines, the normal walk
+ *    follows. The cache is cleared whenever listeners are added or removed.
+ *  - Adaptive order: every so many calls, listeners within each priority are reordered by how
+ *    often they handle events, and the counters are halved so the order follows recent traffic.
+ *    The counters are only kept while this is on.
 */
 template<typename ...Args> class EventUnhandled {
 public:
-    using Listener = bool (*)(Args...);
+    // Function pointers, member functions (see MEMBER_FUNC) and small lambdas
+    using Listener = Delegate<bool(Args...)>;
+    using AffinityKey = uint64_t (*)(const typename std::decay<Args>::type &...);
+    
+    static constexpr int AFFINITY_CACHE_SIZE = 64;
     
-    QueueList<Listener> listeners;
+    // Mutable so that call() can compact entries removed while it was running
+    mutable ListenerList<Listener> listeners;
+private:
+    struct AffinityEntry {
+        uint64_t key = 0;
+        ListenerHandle handle; // Invalid when empty
+    };
     
-    typedef typename QueueList<Listener>::Element Element;
+    // Indexed by slot
+    mutable std::vector<ListenerStats> stats;
+    AffinityKey affinity = nullptr;
+    mutable AffinityEntry cache[AFFINITY_CACHE_SIZE];
+    uint32_t adapt_interval = 0; // 0 when not adaptive
+    mutable uint32_t calls_until_adapt = 0;
+    EVENT_PROFILE
     
-    void subscribe(Listener listener) {
-        listeners.push(listener);
+    void clear_cache() const {
+        for (AffinityEntry &entry : cache) entry.handle = ListenerHandle();
     }
     
-    void unsubscribe(Listener listener) {
-        if (!listeners.head) {return;}
-        if (listeners.head->value == listener) {
-            listeners.pop();
-        }
-        Element *el = listeners.head->next;
-        Element *last = listeners.head;
-        while (el != nullptr) {
-            if (el->value == listener) {
-                last->next = el->next;
-                delete el;
-            }
-            last = el;
-            el = el->next;
+    ListenerHandle added(ListenerHandle handle) {
+        if (stats.size() < listeners.slot_count()) stats.resize(listeners.slot_count());
+        stats[handle.slot] = ListenerStats();
+        EVENT_PROFILE_ADDED(handle.slot)
+        clear_cache();
+        return handle;
+    }
+    
+    void adapt() const {
+        listeners.sort([this](const typename ListenerList<Listener>::Entry &a,
+                              const typename ListenerList<Listener>::Entry &b) {
+            return stats[a.slot].handled > stats[b.slot].handled;
+        });
+        for (ListenerStats &s : stats) {
+            s.handled /= 2;
+            s.declined /= 2;
         }
+        calls_until_adapt = adapt_interval;
+        clear_cache();
+    }
+public:
+    // Label for profiles and traces; must outlive the event
+    void set_name(const char *name) { EVENT_PROFILE_NAME(name) }
+    
+    ListenerHandle subscribe(Listener listener, int32_t priority = 0) {
+        return added(listeners.add(listener, priority));
+    }
+    
+    template<class T> ListenerHandle subscribe(bool (T::*method)(Args...), T *obj, int32_t priority = 0) {
+        return added(listeners.add(Listener(method, obj), priority));
+    }
+    
+    void unsubscribe(ListenerHandle handle) {
+        listeners.remove(handle);
+        clear_cache();
+    }
+    
+    void unsubscribe(Listener listener) {
+        listeners.remove(listener);
+        clear_cache();
+    }
+    
+    // Pass nullptr to turn the affinity cache off
+    void set_affinity(AffinityKey key) {
+        affinity = key;
+        clear_cache();
+    }
+    
+    // Reorders each priority by handled counts every interval calls. 0 turns it off.
+    void set_adaptive(uint32_t interval) {
+        adapt_interval = interval;
+        calls_until_adapt = interval;
+    }
+    
+    // Null if the handle is stale. All zero unless adaptive order is on.
+    const ListenerStats *get_stats(ListenerHandle handle) const {
+        return listeners.find(handle) ? &stats[handle.slot] : nullptr;
     }
     
     bool call(Args... args) const {
-        if (!listeners.head) {return false;}
-        Element *el = listeners.head;
-        while (el != nullptr) {
-            if (el->value(args...)) return true;
-            el = el->next;
+        EVENT_PROFILE_CALL
+        if (adapt_interval && !listeners.is_dispatching() && --calls_until_adapt == 0) adapt();
+        
+        AffinityEntry *cached = nullptr;
+        uint32_t skip = UINT32_MAX;
+        uint64_t key = 0;
+        if (affinity) {
+            key = affinity(args...);
+            cached = &cache[key % AFFINITY_CACHE_SIZE];
+            const typename ListenerList<Listener>::Entry *entry =
+                cached->key == key ? listeners.find(cached->handle) : nullptr;
+            if (entry && entry->alive) {
+                uint32_t slot = entry->slot;
+                Listener listener = entry->listener;
+                bool handled;
+                {
+                    EVENT_PROFILE_LISTENER(slot)
+                    handled = listener(args...);
+                    EVENT_PROFILE_HANDLED(handled)
+                }
+                if (handled) {
+                    if (adapt_interval) stats[slot].handled++;
+                    return true;
+                }
+                if (adapt_interval) stats[slot].declined++;
+                skip = slot;
+            }
         }
-        return false;
+        
+        // Plain ordered walk when no shortcut is in use
+        if (!cached && !adapt_interval) {
+            return listeners.dispatch([&](const Listener &listener, uint32_t slot) {
+                EVENT_PROFILE_LISTENER(slot)
+                bool handled = listener(args...);
+                EVENT_PROFILE_HANDLED(handled)
+                return handled;
+            });
+        }
+        
+        // Copies, so that the listener calls don't force them to be reloaded each time
+        const bool counting = adapt_interval != 0;
+        const uint32_t skipped = skip;
+        return listeners.dispatch([&, counting, skipped](const Listener &listener, uint32_t slot) {
+            if (slot == skipped) return false;
+            bool handled;
+            {
+                EVENT_PROFILE_LISTENER(slot)
+                handled = listener(args...);
+                EVENT_PROFILE_HANDLED(handled)
+            }
+            if (!handled) {
+                if (counting) stats[slot].declined++;
+                return false;
+            }
+            if (counting) stats[slot].handled++;
+            if (cached) *cached = AffinityEntry{key, listeners.handle_of(slot)};
+            return true;
+        });
     }
 };
+
+#endif // _EVENTS_CPP_
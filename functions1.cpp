@@ -1,74 +1,315 @@
 #include <iostream>
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
 #include <functional>
-#include <unordered_map>
-#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
 
 template<class Ret, class... Args> class FunctionRegistry;
 
+// Handle to a registered function. Goes stale once the function is removed, even if its slot is reused.
 template<class Ret, class... Args>
 class Function {
 private:
-    int value;
+    uint32_t index;
+    uint32_t generation; // Never 0 for a registered function
     friend class FunctionRegistry<Ret, Args...>;
-    
-    Function() : value(0) {}
-    
-    static constexpr Function from_int(int x) {
+
+    Function() : index(0), generation(0) {}
+
+    static constexpr Function from_slot(uint32_t index, uint32_t generation) {
       Function func;
-      func.value = x;
+      func.index = index;
+      func.generation = generation;
       return func;
     }
-    
-    int to_int() const {
-      return value;
-    }
 public:
     // Deleted conversions to prevent implicit casting
     template<class R, class... A>
     Function(const Function<R, A...>&) = delete;
 
-    bool operator==(const Function& other) const { return value == other.value; }
-    bool operator!=(const Function& other) const { return value != other.value; }
+    bool operator==(const Function& other) const { return index == other.index && generation == other.generation; }
+    bool operator!=(const Function& other) const { return !(*this == other); }
+    // By slot, so sorting handles groups calls to the same function together
+    bool operator<(const Function& other) const {
+      return index != other.index ? index < other.index : generation < other.generation;
+    }
 };
 
+/* Functions live in slots indexed directly by their handle. Slots are allocated in pages that
+ * never move, so a call is a page lookup, an index and a generation compare, without locks.
+ * Adding and removing are thread-safe; removed slots are reused under a new generation.
+ * Removing a function while another thread is still calling it is not allowed.
+*/
 template<class Ret, class... Args> class FunctionRegistry {
 public:
     using FuncType = std::function<Ret(Args...)>;
     using FuncIndex = Function<Ret, Args...>;
+
+    static constexpr uint32_t PAGE_BITS = 10;
+    static constexpr uint32_t PAGE_SIZE = 1 << PAGE_BITS;
+    static constexpr uint32_t MAX_PAGES = 1024;
 private:
-    static std::unordered_map<int, FuncType> funcs;
-    static int current_index;
+    struct Slot {
+        FuncType func;
+        std::atomic<uint32_t> generation{0}; // Odd while a function is registered here
+    };
+
+    static std::atomic<Slot *> pages[MAX_PAGES];
+    static std::mutex write_lock;
+    static std::vector<uint32_t> free_slots;
+    static uint32_t slot_count;
+
+    // Null if the slot was never allocated
+    static Slot *find_slot(uint32_t index) {
+        if (index >= PAGE_SIZE * MAX_PAGES) return nullptr;
+        Slot *page = pages[index >> PAGE_BITS].load(std::memory_order_acquire);
+        return page ? &page[index & (PAGE_SIZE - 1)] : nullptr;
+    }
+
+    // Under write_lock
+    static uint32_t claim_slot() {
+        if (!free_slots.empty()) {
+            uint32_t index = free_slots.back();
+            free_slots.pop_back();
+            return index;
+        }
+        if (slot_count == PAGE_SIZE * MAX_PAGES) throw std::length_error("FunctionRegistry is full");
+        uint32_t index = slot_count++;
+        if (!pages[index >> PAGE_BITS].load(std::memory_order_relaxed))
+            pages[index >> PAGE_BITS].store(new Slot[PAGE_SIZE], std::memory_order_release);
+        return index;
+    }
 public:
     static Ret call(FuncIndex function, Args... args) {
-        int index = function.to_int();
-        if (funcs.count(index) < 0) throw std::bad_function_call();
-        return funcs.at(index)(args...);
+        Slot *slot = find_slot(function.index);
+        if (!slot || slot->generation.load(std::memory_order_acquire) != function.generation)
+            throw std::bad_function_call();
+        return slot->func(args...);
     }
-    
+
+    // Null if the handle is stale. Same rules as call: don't hold on to it across a remove.
+    static const FuncType *find(FuncIndex function) {
+        Slot *slot = find_slot(function.index);
+        if (!slot || !(function.generation & 1) ||
+            slot->generation.load(std::memory_order_acquire) != function.generation) return nullptr;
+        return &slot->func;
+    }
+
+    static bool contains(FuncIndex function) {
+        Slot *slot = find_slot(function.index);
+        return slot && (function.generation & 1) &&
+            slot->generation.load(std::memory_order_acquire) == function.generation;
+    }
+
     template<class T> static FuncIndex add(const T &func) {
         return add(FuncType(func));
     }
-    
-    static FuncIndex add(const FuncType &func) {
-        funcs[++current_index] = func;
-        return Function<Ret, Args...>::from_int(current_index);
+
+    static FuncIndex add(FuncType func) {
+        std::lock_guard<std::mutex> guard(write_lock);
+        uint32_t index = claim_slot();
+        Slot *slot = find_slot(index);
+        if (!slot) throw std::runtime_error("FunctionRegistry claimed a slot with no page");
+        slot->func = std::move(func);
+        uint32_t generation = slot->generation.load(std::memory_order_relaxed) + 1;
+        slot->generation.store(generation, std::memory_order_release);
+        return Function<Ret, Args...>::from_slot(index, generation);
+    }
+
+    // False if the handle was already stale
+    static bool remove(FuncIndex function) {
+        std::lock_guard<std::mutex> guard(write_lock);
+        Slot *slot = find_slot(function.index);
+        if (!slot || !(function.generation & 1) ||
+            slot->generation.load(std::memory_order_relaxed) != function.generation) return false;
+        // Stale from here on; the function itself goes after
+        slot->generation.store(function.generation + 1, std::memory_order_release);
+        slot->func = nullptr;
+        // A slot whose generation would wrap around is retired rather than risk an old handle matching
+        if (function.generation < UINT32_MAX - 2) free_slots.push_back(function.index);
+        return true;
     }
 };
 
 template<class Ret, class... Args>
-std::unordered_map<int, std::function<Ret(Args...)>>
-FunctionRegistry<Ret, Args...>::funcs = std::unordered_map<int, std::function<Ret(Args...)>>();
+std::atomic<typename FunctionRegistry<Ret, Args...>::Slot *>
+FunctionRegistry<Ret, Args...>::pages[FunctionRegistry<Ret, Args...>::MAX_PAGES] = {};
+
+template<class Ret, class... Args>
+std::mutex
+FunctionRegistry<Ret, Args...>::write_lock;
+
+template<class Ret, class... Args>
+std::vector<uint32_t>
+FunctionRegistry<Ret, Args...>::free_slots = std::vector<uint32_t>();
 
 template<class Ret, class... Args>
-int
-FunctionRegistry<Ret, Args...>::current_index = 0;
+uint32_t
+FunctionRegistry<Ret, Args...>::slot_count = 0;
+
+/* Hands calls to registered functions from producer threads to one consumer thread. Each
+ * producer records (handle, args) into its own Recorder; submit() passes the filled batch over
+ * with a single atomic exchange and takes back an empty one the consumer has finished with, so
+ * once every batch has grown to its working size nothing allocates.
+ * The consumer's execute() runs everything submitted so far. Within a batch, calls are grouped by
+ * function (each looked up once) and keep their recorded order per function; batches run in the
+ * order they were submitted. Results are discarded, and stale handles are skipped.
+*/
+template<class Ret, class... Args> class CommandQueue {
+public:
+    using FuncIndex = Function<Ret, Args...>;
+    class Recorder;
+private:
+    struct Entry {
+        FuncIndex function;
+        uint32_t order;
+        std::tuple<typename std::decay<Args>::type...> args;
+    };
+
+    struct Batch {
+        std::vector<Entry> entries;
+        Recorder *owner;
+        Batch *next = nullptr;
+    };
+
+    // Pushed by producers, taken all at once by the consumer
+    std::atomic<Batch *> submitted{nullptr};
+
+    static bool by_function(const Entry &a, const Entry &b) {
+        if (a.function != b.function) return a.function < b.function;
+        return a.order < b.order;
+    }
+
+    static uint32_t run(Batch *batch) {
+        std::vector<Entry> &entries = batch->entries;
+        std::sort(entries.begin(), entries.end(), &by_function);
+        uint32_t executed = 0;
+        for (size_t i = 0; i < entries.size();) {
+            const FuncIndex function = entries[i].function;
+            const typename FunctionRegistry<Ret, Args...>::FuncType *func = FunctionRegistry<Ret, Args...>::find(function);
+            for (; i < entries.size() && entries[i].function == function; ++i) {
+                if (!func) continue;
+                std::apply(*func, entries[i].args);
+                executed++;
+            }
+        }
+        entries.clear();
+        return executed;
+    }
+public:
+    // Owned by one producer thread. Destroy it only after the consumer has executed its batches.
+    class Recorder {
+        friend class CommandQueue;
+        CommandQueue &queue;
+        std::vector<Batch *> owned; // Before current, which is made in the constructor
+        Batch *current;
+        Batch *spare = nullptr; // Private list of empty batches
+        std::atomic<Batch *> returned{nullptr}; // Pushed by the consumer
+
+        Batch *make_batch() {
+            Batch *batch = new Batch();
+            batch->owner = this;
+            owned.push_back(batch);
+            return batch;
+        }
+    public:
+        explicit Recorder(CommandQueue &q) : queue(q), current(make_batch()) {}
+        Recorder(const Recorder &) = delete;
+        Recorder &operator=(const Recorder &) = delete;
+        ~Recorder() {
+            for (Batch *batch : owned) delete batch;
+        }
+
+        void reserve(size_t count) { current->entries.reserve(count); }
+
+        void record(FuncIndex function, Args... args) {
+            current->entries.push_back(Entry{function, (uint32_t) current->entries.size(),
+                std::tuple<typename std::decay<Args>::type...>(args...)});
+        }
+
+        size_t recorded() const { return current->entries.size(); }
+
+        // Does nothing if nothing was recorded
+        void submit() {
+            if (current->entries.empty()) return;
+            Batch *batch = current;
+            batch->next = queue.submitted.load(std::memory_order_relaxed);
+            while (!queue.submitted.compare_exchange_weak(batch->next, batch, std::memory_order_release,
+                                                          std::memory_order_relaxed)) {}
+
+            if (!spare) spare = returned.exchange(nullptr, std::memory_order_acquire);
+            if (spare) {
+                current = spare;
+                spare = spare->next;
+            } else {
+                current = make_batch();
+            }
+        }
+    };
+
+    // Consumer thread only. Returns how many calls were made.
+    uint32_t execute() {
+        Batch *batch = submitted.exchange(nullptr, std::memory_order_acquire);
+        // The list comes newest first
+        Batch *ordered = nullptr;
+        while (batch) {
+            Batch *next = batch->next;
+            batch->next = ordered;
+            ordered = batch;
+            batch = next;
+        }
+
+        uint32_t executed = 0;
+        while (ordered) {
+            Batch *next = ordered->next;
+            executed += run(ordered);
+            std::atomic<Batch *> &returned = ordered->owner->returned;
+            ordered->next = returned.load(std::memory_order_relaxed);
+            while (!returned.compare_exchange_weak(ordered->next, ordered, std::memory_order_release,
+                                                   std::memory_order_relaxed)) {}
+            ordered = next;
+        }
+        return executed;
+    }
+};
 
 int main() {
     Function<void> func = FunctionRegistry<void>::add([&](){
       std::cout << "Ooga Booga\n";
     });
-    
+
     FunctionRegistry<void>::call(func);
 
+    FunctionRegistry<void>::remove(func);
+    Function<void> reused = FunctionRegistry<void>::add([&](){
+      std::cout << "Same slot, new generation\n";
+    });
+    FunctionRegistry<void>::call(reused);
+    try {
+      FunctionRegistry<void>::call(func);
+    } catch (const std::bad_function_call &) {
+      std::cout << "Stale handle caught\n";
+    }
+
+    // A producer thread records work for this one. Its recorder outlives the thread, since this
+    //  one may still be running the batch when the producer finishes.
+    Function<void, int> print = FunctionRegistry<void, int>::add([](int x) {
+      std::cout << "Command " << x << "\n";
+    });
+    CommandQueue<void, int> commands;
+    CommandQueue<void, int>::Recorder recorder(commands);
+    std::thread producer([&]() {
+      for (int i = 0; i < 3; ++i) recorder.record(print, i);
+      recorder.submit();
+    });
+    while (commands.execute() == 0) {}
+    producer.join();
+
     return 0;
 }
@@ -0,0 +1,295 @@
+#ifndef _ARRAYS_CPP_
+#define _ARRAYS_CPP_
+
+// Kernels behind the array opcodes. Included by vm.cpp after the type constants.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <type_traits>
+
+// Bytes per vector in the kernels: one AVX register when the target has them, else SSE/NEON
+#ifndef ARRAY_VECTOR_BYTES
+#ifdef __AVX__
+#define ARRAY_VECTOR_BYTES 32
+#else
+#define ARRAY_VECTOR_BYTES 16
+#endif
+#endif
+
+/* An array value; registers hold a pointer to one. Arrays are never written after they are
+ * made, so they can point straight into host buffers and into the program's constants.
+*/
+struct VMArray {
+  const byte *data;
+  uint32_t count;
+  byte type; // Element type, one of the scalar types
+};
+
+enum : byte {
+  // Which operands of OPCODE_AOP are arrays
+  ARRAY_BOTH         = 0x00,
+  ARRAY_SCALAR_RIGHT = 0x01,
+  ARRAY_SCALAR_LEFT  = 0x02,
+
+  // Added to OPCODE_CMP* in OPCODE_AOP for !=, <= and >=
+  ARRAY_NEGATE = 0x80,
+
+  // Reductions for OPCODE_AREDUCE
+  ARRAY_SUM = 0x00,
+  ARRAY_MIN = 0x01,
+  ARRAY_MAX = 0x02,
+};
+
+// Vectors of T, through GCC/Clang vector extensions: SSE/AVX on x86, NEON on ARM
+template<class T> struct ArrayLanes {
+  static constexpr uint32_t count = ARRAY_VECTOR_BYTES / sizeof(T);
+  typedef T vector __attribute__((vector_size(ARRAY_VECTOR_BYTES)));
+  typedef uint8_t mask __attribute__((vector_size(ARRAY_VECTOR_BYTES / sizeof(T))));
+
+  static vector load(const byte *p) { vector v; memcpy(&v, p, sizeof(v)); return v; }
+  static void store(byte *p, vector v) { memcpy(p, &v, sizeof(v)); }
+};
+
+template<class T> static T array_load(const byte *p) { T v; memcpy(&v, p, sizeof(T)); return v; }
+template<class T> static void array_store(byte *p, T v) { memcpy(p, &v, sizeof(T)); }
+
+// out[i] = f(a[i], b[i]), where a scalar operand is a single value broadcast to every element
+template<class T, int SHAPE, class F> static void array_map_shape(byte *out, const byte *a, const byte *b, uint32_t count, F f) {
+  typedef ArrayLanes<T> L;
+  T sa = SHAPE == ARRAY_SCALAR_LEFT  ? array_load<T>(a) : T();
+  T sb = SHAPE == ARRAY_SCALAR_RIGHT ? array_load<T>(b) : T();
+  typename L::vector va = typename L::vector{} + sa, vb = typename L::vector{} + sb;
+  uint32_t i = 0;
+  for (; i + L::count <= count; i += L::count) {
+    typename L::vector x = SHAPE == ARRAY_SCALAR_LEFT  ? va : L::load(a + i * sizeof(T));
+    typename L::vector y = SHAPE == ARRAY_SCALAR_RIGHT ? vb : L::load(b + i * sizeof(T));
+    L::store(out + i * sizeof(T), f(x, y));
+  }
+  for (; i < count; ++i) {
+    T x = SHAPE == ARRAY_SCALAR_LEFT  ? sa : array_load<T>(a + i * sizeof(T));
+    T y = SHAPE == ARRAY_SCALAR_RIGHT ? sb : array_load<T>(b + i * sizeof(T));
+    array_store<T>(out + i * sizeof(T), f(x, y));
+  }
+}
+
+template<class T, class F> static void array_map(byte shape, byte *out, const byte *a, const byte *b, uint32_t count, F f) {
+  switch (shape) {
+    case ARRAY_BOTH:         array_map_shape<T, ARRAY_BOTH        >(out, a, b, count, f); break;
+    case ARRAY_SCALAR_RIGHT: array_map_shape<T, ARRAY_SCALAR_RIGHT>(out, a, b, count, f); break;
+    case ARRAY_SCALAR_LEFT:  array_map_shape<T, ARRAY_SCALAR_LEFT >(out, a, b, count, f); break;
+    default: exit(12);
+  }
+}
+
+// out[i] = f(a[i], b[i]) as 0 or 1 (1 or 0 when negated), one byte per element
+template<class T, int SHAPE, class F> static void array_compare_shape(byte *out, const byte *a, const byte *b, uint32_t count, bool negate, F f) {
+  typedef ArrayLanes<T> L;
+  T sa = SHAPE == ARRAY_SCALAR_LEFT  ? array_load<T>(a) : T();
+  T sb = SHAPE == ARRAY_SCALAR_RIGHT ? array_load<T>(b) : T();
+  typename L::vector va = typename L::vector{} + sa, vb = typename L::vector{} + sb;
+  typename L::mask flip = typename L::mask{} + (uint8_t) negate;
+  uint32_t i = 0;
+  for (; i + L::count <= count; i += L::count) {
+    typename L::vector x = SHAPE == ARRAY_SCALAR_LEFT  ? va : L::load(a + i * sizeof(T));
+    typename L::vector y = SHAPE == ARRAY_SCALAR_RIGHT ? vb : L::load(b + i * sizeof(T));
+    // Lanes come back as 0 or -1 at the width of T; narrow them to bytes
+    typename L::mask result = (__builtin_convertvector(f(x, y), typename L::mask) & 1) ^ flip;
+    memcpy(out + i, &result, sizeof(result));
+  }
+  for (; i < count; ++i) {
+    T x = SHAPE == ARRAY_SCALAR_LEFT  ? sa : array_load<T>(a + i * sizeof(T));
+    T y = SHAPE == ARRAY_SCALAR_RIGHT ? sb : array_load<T>(b + i * sizeof(T));
+    out[i] = (byte) f(x, y) ^ (byte) negate;
+  }
+}
+
+template<class T, class F> static void array_compare(byte shape, byte *out, const byte *a, const byte *b, uint32_t count, bool negate, F f) {
+  switch (shape) {
+    case ARRAY_BOTH:         array_compare_shape<T, ARRAY_BOTH        >(out, a, b, count, negate, f); break;
+    case ARRAY_SCALAR_RIGHT: array_compare_shape<T, ARRAY_SCALAR_RIGHT>(out, a, b, count, negate, f); break;
+    case ARRAY_SCALAR_LEFT:  array_compare_shape<T, ARRAY_SCALAR_LEFT >(out, a, b, count, negate, f); break;
+    default: exit(12);
+  }
+}
+
+// Integer sums are kept in 64 bits; float sums stay in their type, spread over the vector's lanes
+template<class T, class Sum> static Sum array_sum(const byte *a, uint32_t count) {
+  constexpr uint32_t lanes = 4;
+  typedef T narrow __attribute__((vector_size(lanes * sizeof(T))));
+  typedef Sum wide __attribute__((vector_size(lanes * sizeof(Sum))));
+  wide total = {};
+  uint32_t i = 0;
+  for (; i + lanes <= count; i += lanes) {
+    narrow v;
+    memcpy(&v, a + i * sizeof(T), sizeof(v));
+    total += __builtin_convertvector(v, wide);
+  }
+  Sum sum = 0;
+  for (uint32_t l = 0; l < lanes; ++l) sum += total[l];
+  for (; i < count; ++i) sum += (Sum) array_load<T>(a + i * sizeof(T));
+  return sum;
+}
+
+template<class T> static T array_float_sum(const byte *a, uint32_t count) {
+  typedef ArrayLanes<T> L;
+  typename L::vector total = {};
+  uint32_t i = 0;
+  for (; i + L::count <= count; i += L::count) total += L::load(a + i * sizeof(T));
+  T sum = 0;
+  for (uint32_t l = 0; l < L::count; ++l) sum += total[l];
+  for (; i < count; ++i) sum += array_load<T>(a + i * sizeof(T));
+  return sum;
+}
+
+// The array must not be empty
+template<class T, bool MIN> static T array_extreme(const byte *a, uint32_t count) {
+  typedef ArrayLanes<T> L;
+  uint32_t i = 0;
+  T best = array_load<T>(a);
+  if (count >= L::count) {
+    typename L::vector v = L::load(a);
+    for (i = L::count; i + L::count <= count; i += L::count) {
+      typename L::vector x = L::load(a + i * sizeof(T));
+      v = MIN ? (x < v ? x : v) : (x > v ? x : v);
+    }
+    best = v[0];
+    for (uint32_t l = 1; l < L::count; ++l) best = MIN ? (v[l] < best ? v[l] : best) : (v[l] > best ? v[l] : best);
+  }
+  for (; i < count; ++i) {
+    T x = array_load<T>(a + i * sizeof(T));
+    best = MIN ? (x < best ? x : best) : (x > best ? x : best);
+  }
+  return best;
+}
+
+// Same rules as convert_register: through a double when a float is involved, otherwise 64 bits
+template<class From, class To> static void array_convert(byte *out, const byte *a, uint32_t count) {
+  constexpr bool floating = std::is_floating_point<From>::value || std::is_floating_point<To>::value;
+  for (uint32_t i = 0; i < count; ++i) {
+    From value = array_load<From>(a + i * sizeof(From));
+    To result;
+    if (!floating) {
+      result = (To) (int64_t) value;
+    } else if (std::is_floating_point<To>::value) {
+      result = (To) (double) value;
+    } else {
+      result = (To) (int64_t) (double) value;
+    }
+    array_store<To>(out + i * sizeof(To), result);
+  }
+}
+
+// The bitwise operations work on floats' bits, like their scalar versions
+#define BITS_CASES(apply) \
+  case MERGE(TYPE_UNSIGNED, FROM_SIZE(8)):  case MERGE(TYPE_SIGNED, FROM_SIZE(8)):  apply(uint8_t ); \
+  case MERGE(TYPE_UNSIGNED, FROM_SIZE(16)): case MERGE(TYPE_SIGNED, FROM_SIZE(16)): apply(uint16_t); \
+  case MERGE(TYPE_UNSIGNED, FROM_SIZE(32)): case MERGE(TYPE_SIGNED, FROM_SIZE(32)): \
+  case MERGE(TYPE_FLOAT, FROM_SIZE(32)):    apply(uint32_t); \
+  case MERGE(TYPE_UNSIGNED, FROM_SIZE(64)): case MERGE(TYPE_SIGNED, FROM_SIZE(64)): \
+  case MERGE(TYPE_FLOAT, FROM_SIZE(64)):    apply(uint64_t);
+
+template<class F> static void array_map_typed(byte type, byte shape, byte *out, const byte *a, const byte *b, uint32_t count, F f) {
+  #define APPLY(T) array_map<T>(shape, out, a, b, count, f); return
+  switch (type) { TYPE_CASES(APPLY) }
+  #undef APPLY
+  exit(12);
+}
+
+template<class F> static void array_bits_typed(byte type, byte shape, byte *out, const byte *a, const byte *b, uint32_t count, F f) {
+  #define APPLY(T) array_map<T>(shape, out, a, b, count, f); return
+  switch (type) { BITS_CASES(APPLY) }
+  #undef APPLY
+  exit(12);
+}
+
+template<class F> static void array_compare_typed(byte type, byte shape, byte *out, const byte *a, const byte *b, uint32_t count, bool negate, F f) {
+  #define APPLY(T) array_compare<T>(shape, out, a, b, count, negate, f); return
+  switch (type) { TYPE_CASES(APPLY) }
+  #undef APPLY
+  exit(12);
+}
+
+/* out = a op b for OPCODE_AOP, where a scalar operand points at its register. The result has
+ * the operands' element type, or one byte per element for compares. NEG and NOT only read a.
+*/
+static void array_operation(byte op, byte type, byte shape, byte *out, const byte *a, const byte *b, uint32_t count) {
+  bool negate = op & ARRAY_NEGATE;
+  switch (op & ~ARRAY_NEGATE) {
+    case OPCODE_ADD: return array_map_typed(type, shape, out, a, b, count, [](auto x, auto y) { return x + y; });
+    case OPCODE_SUB: return array_map_typed(type, shape, out, a, b, count, [](auto x, auto y) { return x - y; });
+    case OPCODE_MUL: return array_map_typed(type, shape, out, a, b, count, [](auto x, auto y) { return x * y; });
+    case OPCODE_DIV: return array_map_typed(type, shape, out, a, b, count, [](auto x, auto y) { return x / y; });
+    case OPCODE_NEG: return array_map_typed(type, ARRAY_SCALAR_RIGHT, out, a, a, count, [](auto x, auto) { return -x; });
+    case OPCODE_AND: return array_bits_typed(type, shape, out, a, b, count, [](auto x, auto y) { return x & y; });
+    case OPCODE_OR:  return array_bits_typed(type, shape, out, a, b, count, [](auto x, auto y) { return x | y; });
+    case OPCODE_XOR: return array_bits_typed(type, shape, out, a, b, count, [](auto x, auto y) { return x ^ y; });
+    case OPCODE_NOT: return array_bits_typed(type, ARRAY_SCALAR_RIGHT, out, a, a, count, [](auto x, auto) { return ~x; });
+    case OPCODE_CMPE: return array_compare_typed(type, shape, out, a, b, count, negate, [](auto x, auto y) { return x == y; });
+    case OPCODE_CMPL: return array_compare_typed(type, shape, out, a, b, count, negate, [](auto x, auto y) { return x < y; });
+    case OPCODE_CMPG: return array_compare_typed(type, shape, out, a, b, count, negate, [](auto x, auto y) { return x > y; });
+  }
+  exit(12);
+}
+
+// Element type of what array_operation writes
+static byte array_result_type(byte op, byte type) {
+  switch (op & ~ARRAY_NEGATE) {
+    case OPCODE_CMPE:
+    case OPCODE_CMPL:
+    case OPCODE_CMPG:
+      return MERGE(TYPE_UNSIGNED, FROM_SIZE(8));
+  }
+  return type;
+}
+
+/* Reduces an array into reg (8 bytes, zeroed first). Sums of integers are 64-bit of the same
+ * signedness; everything else keeps the element type. Returns false for the min or max of
+ * an empty array.
+*/
+static bool array_reduce(byte reduction, byte type, const VMArray *a, byte *reg) {
+  memset(reg, 0, 8);
+  if (reduction == ARRAY_SUM) {
+    #define SUM(T) \
+      if (std::is_floating_point<T>::value) array_store<T>(reg, array_float_sum<T>(a->data, a->count)); \
+      else if (std::is_signed<T>::value) array_store<int64_t>(reg, array_sum<T, int64_t>(a->data, a->count)); \
+      else array_store<uint64_t>(reg, array_sum<T, uint64_t>(a->data, a->count)); \
+      return true
+    switch (type) { TYPE_CASES(SUM) }
+    #undef SUM
+    exit(12);
+  }
+  if (a->count == 0) return false;
+  #define EXTREME(T) \
+    array_store<T>(reg, reduction == ARRAY_MIN ? array_extreme<T, true>(a->data, a->count) : array_extreme<T, false>(a->data, a->count)); \
+    return true
+  if (reduction == ARRAY_MIN || reduction == ARRAY_MAX) {
+    switch (type) { TYPE_CASES(EXTREME) }
+  }
+  #undef EXTREME
+  exit(12);
+}
+
+// Type of what array_reduce produces
+static byte array_reduce_type(byte reduction, byte type) {
+  if (reduction == ARRAY_SUM && UPPER(type) != TYPE_FLOAT) return MERGE(UPPER(type), FROM_SIZE(64));
+  return type;
+}
+
+template<class From> static void array_convert_from(byte to, byte *out, const byte *a, uint32_t count) {
+  #define APPLY(T) array_convert<From, T>(out, a, count); return
+  switch (to) { TYPE_CASES(APPLY) }
+  #undef APPLY
+  exit(12);
+}
+
+static void array_convert_any(byte from, byte to, byte *out, const byte *a, uint32_t count) {
+  #define APPLY(T) array_convert_from<T>(to, out, a, count); return
+  switch (from) { TYPE_CASES(APPLY) }
+  #undef APPLY
+  exit(12);
+}
+
+#undef BITS_CASES
+
+#endif // _ARRAYS_CPP_
@@ -3,6 +3,7 @@
 
 #include "lexer.cpp"
 #include <stdio.h>
+#include <vector>
 
 static void printIndent(int indent) {
   for (int i = 0; i < indent; ++i) {
@@ -131,6 +132,43 @@ struct IdentifierNode : ASTNode {
   }
 };
 
+struct ArrayNode : ASTNode {
+  std::vector<ASTNode *> elements;
+  
+  ~ArrayNode() {
+    for (ASTNode *element : elements) {
+      if (element) delete element;
+    }
+  }
+  
+  void print(int indent) const override {
+    printIndent(indent);
+    printf("[\n");
+    for (const ASTNode *element : elements) element->print(indent + 1);
+    printIndent(indent);
+    printf("]\n");
+  }
+};
+
+struct IndexNode : ASTNode {
+  ASTNode *array, *index;
+  
+  explicit IndexNode(ASTNode *array, ASTNode *index) : 
+    array(array), index(index) {}
+  
+  ~IndexNode() {
+    if (array) delete array;
+    if (index) delete index;
+  }
+  
+  void print(int indent) const override {
+    array->print(indent + 1);
+    printIndent(indent);
+    printf("[]\n");
+    index->print(indent + 1);
+  }
+};
+
 class Parser {
   Lexer lexer;
   Token previous, current;
@@ -171,7 +209,7 @@ class Parser {
     return -1;
   }
   
-  ASTNode *parsePrimary() {
+  ASTNode *parseOperand() {
     switch (current.type) {
       case TokenType::NUMBER: {
         advance();
@@ -196,12 +234,39 @@ class Parser {
         TokenType op = previous.type;
         return new UnaryNode(op, parsePrimary());
       }
+      case TokenType::LEFT_SQUARE: {
+        advance();
+        ArrayNode *array = new ArrayNode();
+        while (current.type != TokenType::RIGHT_SQUARE) {
+          // Commas separate the elements here, so stop below their precedence
+          array->elements.push_back(parseBinaryRHS(1, parsePrimary()));
+          if (array->elements.back() == nullptr) break;
+          if (current.type != TokenType::COMMA) break;
+          advance();
+        }
+        if (current.type != TokenType::RIGHT_SQUARE) printf("Expected ']'\n");
+        advance();
+        return array;
+      }
       default:
         printf("Invalid expression!\n");
         return nullptr;
     }
   }
   
+  ASTNode *parsePrimary() {
+    ASTNode *result = parseOperand();
+    // Indexing binds tighter than any operator
+    while (result != nullptr && current.type == TokenType::LEFT_SQUARE) {
+      advance();
+      ASTNode *index = parseExpr();
+      if (current.type != TokenType::RIGHT_SQUARE) printf("Expected ']'\n");
+      advance();
+      result = new IndexNode(result, index);
+    }
+    return result;
+  }
+  
   ASTNode *parseBinaryRHS(int min_prec, ASTNode *lhs) {
     while (true) {
       int op_prec = getPrec(current.type);
@@ -20,12 +20,15 @@ class Compiler {
   };
   
   template<class T> void addData(const T &d) {
+    addBlob(&d, sizeof(T));
+  }
+  
+  void addBlob(const void *data, int length) {
     AddData ad;
     ad.where = out_buf.size();
-    T *buf = new T[1];
-    buf[0] = d;
-    ad.what = (byte *) buf;
-    ad.length = sizeof(T);
+    ad.what = new byte[length];
+    if (length > 0) memcpy(ad.what, data, length);
+    ad.length = length;
     emitNulls(4);
     add_data.push_back(ad);
   }
@@ -45,6 +48,10 @@ class Compiler {
   std::vector<AddData> add_data;
   std::vector<byte> out_buf;
   
+  // Names the host binds arrays to, by slot
+  std::vector<std::string> host_names;
+  std::vector<byte> host_types;
+  
   void emitByte(byte b) {
     out_buf.push_back(b);
   }
@@ -54,6 +61,12 @@ class Compiler {
     out_buf.push_back(b1);
   }
   
+  void emitInt32(int32_t value) {
+    byte bytes[4];
+    memcpy(bytes, &value, 4);
+    out_buf.insert(out_buf.end(), bytes, bytes + 4);
+  }
+  
   void emitNulls(int num) {
     for (int i = 0; i < num; ++i) {
       out_buf.push_back(0);
@@ -62,21 +75,40 @@ class Compiler {
   
   void convert(byte from, byte to) {
     if (from == to) return;
+    if (IS_ARRAY(from)) {
+      emitByte(OPCODE_ACONV);
+      emitPair(ELEMENT_TYPE(from), ELEMENT_TYPE(to));
+      return;
+    }
     emitByte(OPCODE_CONV);
     emitPair(from , to);
   }
   
+  // Arrays are held as pointers
+  static byte regSize(byte type) {
+    return IS_ARRAY(type) ? FROM_SIZE(64) : LOWER(type);
+  }
+  
   void tempStore(byte reg) {
-    emitPair(OPCODE_PUSH, LOWER(reg));
+    emitPair(OPCODE_PUSH, regSize(reg));
   }
   
   void tempLoad(byte reg) {
     emitByte(OPCODE_SWAP);
-    emitPair(OPCODE_POP, LOWER(reg));
+    emitPair(OPCODE_POP, regSize(reg));
   }
   
   byte processNum(Token tok) {
+    uint64_t value = 0;
+    byte type = numberType(tok, &value);
     emitByte(OPCODE_LOADC);
+    emitByte(LOWER(type));
+    addBlob(&value, 1 << LOWER(type));
+    return type;
+  }
+  
+  // The type a number literal gets, and its value as that type
+  static byte numberType(Token tok, uint64_t *value) {
     char suffix = tok.start[tok.length - 1];
     if (
       suffix == 'f' || suffix == 'd' ||
@@ -92,41 +124,125 @@ class Compiler {
       ) {
         // Congratulations! It's a float! I think...
         // It'll convert
-        emitByte(FROM_SIZE(32));
-        addData<float>(num);
+        float f = num;
+        memcpy(value, &f, 4);
         return MERGE(TYPE_FLOAT, FROM_SIZE(32));
       }
-      emitByte(FROM_SIZE(64));
-      addData<double>(num);
+      memcpy(value, &num, 8);
       return MERGE(TYPE_FLOAT, FROM_SIZE(64));
     } // It's an integer
     uint32_t num = strtoull(tok.start, NULL, 10);
+    *value = num;
     if (num < 1ull << 8) {
-      emitByte(FROM_SIZE(8));
-      addData<uint8_t>(num);
       return MERGE(TYPE_UNSIGNED, FROM_SIZE(8));
     }
     if (num < 1ull << 16) {
-      emitByte(FROM_SIZE(16));
-      addData<uint16_t>(num);
       return MERGE(TYPE_UNSIGNED, FROM_SIZE(16));
     }
     if (num < 1ull << 32) {
-      emitByte(FROM_SIZE(32));
-      addData<uint32_t>(num);
       return MERGE(TYPE_UNSIGNED, FROM_SIZE(32));
     }
-    emitByte(FROM_SIZE(64));
-    addData<uint64_t>(num);
     return MERGE(TYPE_UNSIGNED, FROM_SIZE(64));
   }
   
+  // Literal elements go into the constants as they are; anything else is pushed and gathered
+  byte processArray(const ArrayNode *array) {
+    std::vector<const NumberNode *> numbers;
+    for (const ASTNode *element : array->elements) {
+      if (const NumberNode *num = dynamic_cast<const NumberNode *>(element)) numbers.push_back(num);
+    }
+    if (numbers.size() == array->elements.size()) {
+      byte type = MERGE(TYPE_UNSIGNED, FROM_SIZE(8));
+      for (const NumberNode *num : numbers) {
+        uint64_t value;
+        type = best_type(type, numberType(num->tok, &value));
+      }
+      std::vector<byte> data;
+      for (const NumberNode *num : numbers) {
+        byte reg[8] = {};
+        byte from = numberType(num->tok, (uint64_t *) reg);
+        convert_register(reg, from, type);
+        data.insert(data.end(), reg, reg + (1 << LOWER(type)));
+      }
+      emitPair(OPCODE_ACONST, type);
+      emitInt32(array->elements.size());
+      addBlob(data.data(), data.size());
+      return ARRAY_OF(type);
+    }
+    
+    // The elements' types are only known once they are compiled, so compile them back to back,
+    //  then move each one's code out to make room for its conversion and push
+    struct Compiled {
+      byte type;
+      size_t code_end, data_end;
+    };
+    std::vector<Compiled> compiled;
+    byte type = MERGE(TYPE_UNSIGNED, FROM_SIZE(8));
+    bool valid = true;
+    size_t code_size = out_buf.size(), data_count = add_data.size();
+    for (const ASTNode *element : array->elements) {
+      byte element_type = evalExpr(element);
+      if (element_type == TYPE_NONE || IS_ARRAY(element_type)) valid = false;
+      type = best_type(type, element_type);
+      compiled.push_back({element_type, out_buf.size(), add_data.size()});
+    }
+    if (!valid) {
+      printf("Invalid array element!\n");
+      return TYPE_NONE;
+    }
+    
+    std::vector<byte> code(out_buf.begin() + code_size, out_buf.end());
+    out_buf.resize(code_size);
+    size_t code_start = code_size, data_start = data_count;
+    for (const Compiled &element : compiled) {
+      // Constants the element added are patched in by position, so follow its code
+      for (size_t i = data_start; i < element.data_end; ++i) {
+        add_data[i].where += out_buf.size() - code_start;
+      }
+      out_buf.insert(out_buf.end(), code.begin() + (code_start - code_size),
+        code.begin() + (element.code_end - code_size));
+      convert(element.type, type);
+      emitPair(OPCODE_PUSH, LOWER(type));
+      code_start = element.code_end;
+      data_start = element.data_end;
+    }
+    emitPair(OPCODE_ANEW, type);
+    emitInt32(array->elements.size());
+    return ARRAY_OF(type);
+  }
+  
+  byte processMember(byte type, const ASTNode *member) {
+    const IdentifierNode *id = dynamic_cast<const IdentifierNode *>(member);
+    if (!IS_ARRAY(type) || id == nullptr) {
+      printf("Invalid member!\n");
+      return TYPE_NONE;
+    }
+    std::string name = std::string(id->id, id->length);
+    type = ELEMENT_TYPE(type);
+    if (name == "length") {
+      emitByte(OPCODE_ALEN);
+      return MERGE(TYPE_UNSIGNED, FROM_SIZE(32));
+    }
+    byte reduction;
+    if (name == "sum") reduction = ARRAY_SUM;
+    else if (name == "min") reduction = ARRAY_MIN;
+    else if (name == "max") reduction = ARRAY_MAX;
+    else {
+      printf("Invalid member!\n");
+      return TYPE_NONE;
+    }
+    emitByte(OPCODE_AREDUCE);
+    emitPair(reduction, type);
+    return array_reduce_type(reduction, type);
+  }
+  
   byte processUnary(byte _type_in, TokenType op) {
     byte type = _type_in; // Maybe the compiler doesn't like it?
+    if (IS_ARRAY(type)) return processArrayUnary(ELEMENT_TYPE(type), op);
     switch (op) {
       case TokenType::MINUS:
         if (UPPER(type) == TYPE_UNSIGNED) {
-          byte newt = MERGE(TYPE_SIGNED, LOWER(newt));
+          byte newt = MERGE(TYPE_SIGNED, LOWER(type));
           convert(type, newt);
           type = newt;
         }
@@ -143,6 +259,58 @@ class Compiler {
     return TYPE_NONE;
   }
   
+  byte processArrayUnary(byte type, TokenType op) {
+    switch (op) {
+      case TokenType::MINUS:
+        if (UPPER(type) == TYPE_UNSIGNED) {
+          byte newt = MERGE(TYPE_SIGNED, LOWER(type));
+          convert(ARRAY_OF(type), ARRAY_OF(newt));
+          type = newt;
+        }
+        emitByte(OPCODE_AOP);
+        emitPair(OPCODE_NEG, type);
+        emitByte(ARRAY_SCALAR_RIGHT);
+        return ARRAY_OF(type);
+      case TokenType::EX:
+        emitByte(OPCODE_AOP);
+        emitPair(OPCODE_NOT, type);
+        emitByte(ARRAY_SCALAR_RIGHT);
+        return ARRAY_OF(type);
+      default:
+        break;
+    }
+    
+    printf("Invalid unary operator!\n");
+    return TYPE_NONE;
+  }
+  
+  // Whole-array version of processBinary; the element types already match
+  byte processArrayBinary(byte type, byte shape, TokenType op) {
+    byte code;
+    switch (op) {
+      case TokenType::PLUS:     code = OPCODE_ADD; break;
+      case TokenType::MINUS:    code = OPCODE_SUB; break;
+      case TokenType::STAR:     code = OPCODE_MUL; break;
+      case TokenType::SLASH:    code = OPCODE_DIV; break;
+      case TokenType::CAR:      code = OPCODE_XOR; break;
+      case TokenType::AMP:      code = OPCODE_AND; break;
+      case TokenType::PIP:      code = OPCODE_OR ; break;
+      case TokenType::EQ_EQUAL: code = OPCODE_CMPE; break;
+      case TokenType::EX_EQUAL: code = OPCODE_CMPE | ARRAY_NEGATE; break;
+      case TokenType::GT:       code = OPCODE_CMPG; break;
+      case TokenType::LT_EQUAL: code = OPCODE_CMPG | ARRAY_NEGATE; break;
+      case TokenType::LT:       code = OPCODE_CMPL; break;
+      case TokenType::GT_EQUAL: code = OPCODE_CMPL | ARRAY_NEGATE; break;
+      default:
+        printf("Invalid array operator!\n");
+        return TYPE_NONE;
+    }
+    emitByte(OPCODE_AOP);
+    emitPair(code, type);
+    emitByte(shape);
+    return ARRAY_OF(array_result_type(code, type));
+  }
+  
   byte processBinary(byte _type_in, TokenType op) {
     byte type = _type_in; // Same as above;
     switch (op) {
@@ -213,9 +381,37 @@ if (const type *name = dynamic_cast<const type *>(node_base))
     
     CONDITION(IdentifierNode, id) {
       std::string name = std::string(id->id, id->length);
+      for (size_t slot = 0; slot < host_names.size(); ++slot) {
+        if (host_names[slot] != name) continue;
+        emitPair(OPCODE_AHOST, slot);
+        emitByte(host_types[slot]);
+        return ARRAY_OF(host_types[slot]);
+      }
       return TYPE_NONE;
     }
     
+    CONDITION(ArrayNode, array) {
+      return processArray(array);
+    }
+    
+    CONDITION(IndexNode, index) {
+      byte type = evalExpr(index->array);
+      if (!IS_ARRAY(type)) {
+        printf("Indexing a non-array!\n");
+        return TYPE_NONE;
+      }
+      tempStore(type);
+      byte index_type = evalExpr(index->index);
+      if (IS_ARRAY(index_type)) {
+        printf("Invalid index!\n");
+        return TYPE_NONE;
+      }
+      convert(index_type, MERGE(TYPE_UNSIGNED, FROM_SIZE(64)));
+      tempLoad(type);
+      emitPair(OPCODE_AGET, ELEMENT_TYPE(type));
+      return ELEMENT_TYPE(type);
+    }
+    
     CONDITION(UnaryNode, unary) {
       byte type = evalExpr(unary->expr);
       return processUnary(type, unary->op);
@@ -223,8 +419,17 @@ if (const type *name = dynamic_cast<const type *>(node_base))
     
     CONDITION(BinaryNode, binary) {
       byte left = evalExpr(binary->left);
+      if (binary->op == TokenType::DOT) return processMember(left, binary->right);
       tempStore(left);
       byte right = evalExpr(binary->right);
+      if (IS_ARRAY(left) || IS_ARRAY(right)) {
+        byte best = best_type(ELEMENT_TYPE(left), ELEMENT_TYPE(right));
+        convert(right, IS_ARRAY(right) ? ARRAY_OF(best) : best);
+        tempLoad(left);
+        convert(left, IS_ARRAY(left) ? ARRAY_OF(best) : best);
+        byte shape = !IS_ARRAY(right) ? ARRAY_SCALAR_RIGHT : !IS_ARRAY(left) ? ARRAY_SCALAR_LEFT : ARRAY_BOTH;
+        return processArrayBinary(best, shape, binary->op);
+      }
       byte best = best_type(left, right);
       convert(right, best);
       tempLoad(left);
@@ -238,11 +443,29 @@ if (const type *name = dynamic_cast<const type *>(node_base))
 
 #undef CONDITION
 public:
+  /* Makes name refer to the host array the VM gets through bind_array(slot, ...), which must be
+   * of the given element type. Returns the slot.
+  */
+  int bindArray(const char *name, byte type) {
+    if ((int) host_names.size() >= MAX_HOST_ARRAYS) {
+      printf("Too many host arrays!\n");
+      return -1;
+    }
+    host_names.push_back(name);
+    host_types.push_back(type);
+    return host_names.size() - 1;
+  }
+  
   void compile(const char *source) {
     Parser parser;
     parser.parse(source);
     parser.top->print(0);
-    evalExpr(parser.top);
+    compileTree(parser.top);
+  }
+  
+  // Compiles an already parsed tree without printing it. The tree is not taken over.
+  void compileTree(const ASTNode *top) {
+    evalExpr(top);
     emitByte(OPCODE_RETURN);
     incorporateAddData();
   }
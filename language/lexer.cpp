@@ -97,14 +97,14 @@ class Lexer {
           advance();
           break;
         case '/':
-          // Consume it
-          advance();
           // Single-line comment
-          if (peek() == '/') {
+          if (peekNext() == '/') {
+            advance(); // Consume both /
             advance();
             while (peek() != '\n' && !atEnd()) advance();
-          } else if (peek() == '*') {
-            // Consume the *
+          } else if (peekNext() == '*') {
+            // Consume the / and the *
+            advance();
             advance();
             while (true) {
               if (atEnd()) break;
@@ -115,6 +115,9 @@ class Lexer {
               }
               advance(); // Continue
             }
+          } else {
+            // Just a slash, leave it for getNext
+            return;
           }
           break;
         default:
@@ -0,0 +1,303 @@
+#ifndef _VERIFIER_CPP_
+#define _VERIFIER_CPP_
+
+#include "vm.cpp"
+#include <stdarg.h>
+#include <stdio.h>
+#include <vector>
+
+/* Checks a program once so that VM::execute_verified can run it without checking every
+ * instruction. It proves that:
+ * - every reachable instruction is a known opcode, whole, and decodes the same way from
+ *   every path (jumps and calls land on instruction starts, never inside one)
+ * - type, size and register bytes are valid, and constants are inside the program
+ * - every path into an instruction agrees on the stack depth there, nothing pops what its
+ *   function didn't push, RETURN leaves the stack as the function found it, calls don't
+ *   recurse, and the deepest path fits in MAX_STACK_SIZE
+ * Pointers in registers aren't tracked: LOAD and STORE trust them as always, and the array
+ * opcodes keep their run-time checks on the arrays they're given.
+*/
+struct Verifier {
+  int32_t max_stack = 0; // Bytes of stack a run needs, counting the frame execute pushes
+  int32_t error_pc = -1; // Where the program was rejected
+  char message[192] = {};
+
+  bool verify(const byte *instructions, int instructions_size) {
+    code = instructions;
+    size = instructions_size;
+    max_stack = 0;
+    error_pc = -1;
+    message[0] = '\0';
+    owner.assign(size, -1);
+    state.assign(size, UNSEEN);
+    needed.assign(size, 0);
+    depth.assign(size, 0);
+    walk.assign(size, 0);
+    walks = 0;
+    if (size <= 0) return fail(0, "the program is empty");
+    if (!function(0, MAX_STACK_SIZE - 8)) return false; // Above the 8 bytes execute pushes
+    max_stack = 8 + needed[0];
+    return true;
+  }
+
+private:
+  enum : byte { UNSEEN, VISITING, DONE };
+
+  const byte *code = nullptr;
+  int size = 0;
+  std::vector<int32_t> owner;  // Start of the instruction covering each byte, or -1
+  std::vector<byte> state;     // Per call target
+  std::vector<int32_t> needed; // Per call target: the most stack it uses above its frame
+  // Shared by every function's walk: the depth at each instruction, valid where walk[pc] is
+  //  the current walk's number
+  std::vector<int64_t> depth;
+  std::vector<uint32_t> walk;
+  uint32_t walks = 0;
+
+  static const char *name(byte opcode) {
+    static const char *const names[] = {
+      "CALL", "RETURN", "SPP", "FPP", "STORE", "LOAD", "LOADC", "SWAP", "CONV", "JMP", "JMPNZ",
+      "CMPE", "CMPL", "CMPG", "PUSH", "POP", "ADD", "SUB", "MUL", "DIV", "NEG",
+      "FFLOOR", "FCEIL", "FTRIG", "AND", "OR", "XOR", "NOT", "SPECCALL",
+      "ACONST", "ANEW", "AHOST", "AGET", "ALEN", "ACONV", "AOP", "AREDUCE",
+    };
+    return opcode < sizeof(names) / sizeof(*names) ? names[opcode] : "?";
+  }
+
+  static int32_t read32(const byte *p) {
+    int32_t value;
+    memcpy(&value, p, 4);
+    return value;
+  }
+
+  bool fail(int32_t pc, const char *format, ...) {
+    error_pc = pc;
+    int length = 0;
+    if (pc < size) length = snprintf(message, sizeof(message), "pc %d (%s): ", pc, name(code[pc]));
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message + length, sizeof(message) - length, format, args);
+    va_end(args);
+    return false;
+  }
+
+  // Instruction length including the opcode, or 0 for opcodes the VM doesn't run
+  static int length(byte opcode) {
+    switch (opcode) {
+      case OPCODE_RETURN: case OPCODE_SWAP: case OPCODE_ALEN:
+        return 1;
+      case OPCODE_STORE: case OPCODE_LOAD: case OPCODE_PUSH: case OPCODE_POP:
+      case OPCODE_CMPE: case OPCODE_CMPL: case OPCODE_CMPG:
+      case OPCODE_ADD: case OPCODE_SUB: case OPCODE_MUL: case OPCODE_DIV: case OPCODE_NEG:
+      case OPCODE_AND: case OPCODE_OR: case OPCODE_XOR: case OPCODE_NOT:
+      case OPCODE_AGET:
+        return 2;
+      case OPCODE_CONV: case OPCODE_AHOST: case OPCODE_ACONV: case OPCODE_AREDUCE:
+        return 3;
+      case OPCODE_AOP:
+        return 4;
+      case OPCODE_CALL: case OPCODE_SPP: case OPCODE_FPP: case OPCODE_JMP: case OPCODE_JMPNZ:
+        return 5;
+      case OPCODE_LOADC: case OPCODE_ANEW:
+        return 6;
+      case OPCODE_ACONST:
+        return 10;
+    }
+    return 0;
+  }
+
+  bool type(int32_t pc, byte t) {
+    return valid_type(t) || fail(pc, "invalid type 0x%02x", t);
+  }
+
+  // Decodes the instruction at pc, claiming its bytes, and checks its operands
+  bool decode(int32_t pc) {
+    const byte *op = code + pc;
+    int len = length(op[0]);
+    if (len == 0) return fail(pc, "opcode %d is not one the VM runs", op[0]);
+    if (pc + len > size) return fail(pc, "cut off by the end of the program at %d", size);
+    for (int i = 0; i < len; ++i) {
+      if (owner[pc + i] != -1 && owner[pc + i] != pc) {
+        return fail(pc, "overlaps the instruction at %d", owner[pc + i]);
+      }
+      owner[pc + i] = pc;
+    }
+
+    switch (op[0]) {
+      case OPCODE_STORE:
+      case OPCODE_LOAD:
+        if (op[1] > TYPE_SIZE_64) return fail(pc, "invalid size %d", op[1]);
+        return true;
+      case OPCODE_LOADC: {
+        int32_t pos = read32(op + 2);
+        if (op[1] > TYPE_SIZE_64) return fail(pc, "invalid size %d", op[1]);
+        if (pos < 0 || (int64_t) pos + (1 << op[1]) > size) {
+          return fail(pc, "constant at %d of %d bytes is outside the program", pos, 1 << op[1]);
+        }
+        return true;
+      }
+      case OPCODE_PUSH:
+      case OPCODE_POP:
+        if ((UPPER(op[1]) != REG_LEFT && UPPER(op[1]) != REG_RIGHT) || LOWER(op[1]) > TYPE_SIZE_64) {
+          return fail(pc, "invalid register 0x%02x", op[1]);
+        }
+        return true;
+      case OPCODE_CONV:
+      case OPCODE_ACONV:
+        return type(pc, op[1]) && type(pc, op[2]);
+      case OPCODE_CMPE: case OPCODE_CMPL: case OPCODE_CMPG:
+      case OPCODE_ADD: case OPCODE_SUB: case OPCODE_MUL: case OPCODE_DIV: case OPCODE_NEG:
+      case OPCODE_AND: case OPCODE_OR: case OPCODE_XOR: case OPCODE_NOT:
+      case OPCODE_AGET:
+      case OPCODE_ANEW:
+        return type(pc, op[1]);
+      case OPCODE_ACONST: {
+        uint32_t count = read32(op + 2);
+        int32_t pos = read32(op + 6);
+        if (!type(pc, op[1])) return false;
+        int64_t bytes = (int64_t) count << LOWER(op[1]);
+        if (pos < 0 || pos + bytes > size) {
+          return fail(pc, "constant at %d of %lld bytes is outside the program", pos, (long long) bytes);
+        }
+        return true;
+      }
+      case OPCODE_AHOST:
+        if (op[1] >= MAX_HOST_ARRAYS) return fail(pc, "host array slot %d is past MAX_HOST_ARRAYS", op[1]);
+        return type(pc, op[2]);
+      case OPCODE_AOP: {
+        byte operation = op[1] & ~ARRAY_NEGATE;
+        bool compare = operation == OPCODE_CMPE || operation == OPCODE_CMPL || operation == OPCODE_CMPG;
+        bool unary = operation == OPCODE_NEG || operation == OPCODE_NOT;
+        bool arithmetic = (operation >= OPCODE_ADD && operation <= OPCODE_DIV) ||
+          (operation >= OPCODE_AND && operation <= OPCODE_XOR);
+        if (!(compare || unary || arithmetic) || ((op[1] & ARRAY_NEGATE) && !compare)) {
+          return fail(pc, "invalid array operation 0x%02x", op[1]);
+        }
+        if (op[3] > ARRAY_SCALAR_LEFT || (unary && op[3] != ARRAY_SCALAR_RIGHT)) {
+          return fail(pc, "invalid operand shape %d", op[3]);
+        }
+        return type(pc, op[2]);
+      }
+      case OPCODE_AREDUCE:
+        if (op[1] > ARRAY_MAX) return fail(pc, "invalid reduction %d", op[1]);
+        return type(pc, op[2]);
+    }
+    return true;
+  }
+
+  /* Walks every path from entry, working out how deep each one takes the stack. budget is the
+   * stack left above the function's frame; calls that wouldn't fit are rejected before their
+   * target is walked, so nesting stops at MAX_STACK_SIZE / 8 levels.
+  */
+  bool function(int32_t entry, int64_t budget) {
+    state[entry] = VISITING;
+    uint32_t current = ++walks;
+    int64_t base = MAX_STACK_SIZE - budget; // Stack below the frame, for messages
+    std::vector<int32_t> work;
+    // Instructions this walk took over from a caller's unfinished one, and what it had there
+    struct Saved {
+      int32_t pc;
+      uint32_t walk;
+      int64_t depth;
+    };
+    std::vector<Saved> saved;
+    int64_t most = 0;
+
+    auto reach = [&](int32_t from, int32_t to, int64_t d) {
+      if (to < 0 || to >= size) return fail(from, "goes to %d, outside the program", to);
+      if (owner[to] != -1 && owner[to] != to) {
+        return fail(from, "goes to %d, inside the instruction at %d", to, owner[to]);
+      }
+      if (walk[to] != current) {
+        if (walk[to] != 0) saved.push_back({to, walk[to], depth[to]});
+        walk[to] = current;
+        depth[to] = d; // Above the function's frame, on entry to the instruction
+        work.push_back(to);
+      } else if (depth[to] != d) {
+        return fail(from, "reaches %d with %lld bytes on the stack, another path with %lld",
+          to, (long long) d, (long long) depth[to]);
+      }
+      return true;
+    };
+
+    if (walk[entry] != 0) saved.push_back({entry, walk[entry], depth[entry]});
+    walk[entry] = current;
+    depth[entry] = 0;
+    work.push_back(entry);
+    while (!work.empty()) {
+      int32_t pc = work.back();
+      work.pop_back();
+      if (!decode(pc)) return false;
+      const byte *op = code + pc;
+      int64_t d = depth[pc], after = d;
+      bool falls = true;
+
+      switch (op[0]) {
+        case OPCODE_PUSH:
+          after += 1 << LOWER(op[1]);
+          break;
+        case OPCODE_POP:
+          after -= 1 << LOWER(op[1]);
+          break;
+        case OPCODE_ANEW:
+          after -= (int64_t) (uint32_t) read32(op + 2) << LOWER(op[1]);
+          break;
+        case OPCODE_RETURN:
+          if (d != 0) return fail(pc, "returns with %lld bytes of its own on the stack", (long long) d);
+          falls = false;
+          break;
+        case OPCODE_JMP:
+          if (!reach(pc, read32(op + 1), d)) return false;
+          falls = false;
+          break;
+        case OPCODE_JMPNZ:
+          if (!reach(pc, read32(op + 1), d)) return false;
+          break;
+        case OPCODE_CALL: {
+          int32_t target = read32(op + 1);
+          if (target < 0 || target >= size) return fail(pc, "calls %d, outside the program", target);
+          if (owner[target] != -1 && owner[target] != target) {
+            return fail(pc, "calls %d, inside the instruction at %d", target, owner[target]);
+          }
+          if (state[target] == VISITING) return fail(pc, "calls %d recursively", target);
+          // The frame pointer and return address, then whatever the callee uses
+          if (d + 8 > budget) {
+            return fail(pc, "the call needs %lld bytes of stack, more than MAX_STACK_SIZE (%d)",
+              (long long) (base + d + 8), MAX_STACK_SIZE);
+          }
+          if (state[target] == UNSEEN && !function(target, budget - d - 8)) return false;
+          int64_t peak = d + 8 + needed[target];
+          if (peak > budget) {
+            return fail(pc, "the call needs %lld bytes of stack, more than MAX_STACK_SIZE (%d)",
+              (long long) (base + peak), MAX_STACK_SIZE);
+          }
+          most = max(most, peak);
+          break;
+        }
+      }
+
+      if (after < 0) return fail(pc, "pops %lld bytes its function didn't push", (long long) -after);
+      if (after > budget) {
+        return fail(pc, "needs %lld bytes of stack, more than MAX_STACK_SIZE (%d)",
+          (long long) (base + after), MAX_STACK_SIZE);
+      }
+      most = max(most, after);
+      if (falls) {
+        int32_t next = pc + length(op[0]);
+        if (next >= size) return fail(pc, "runs off the end of the program");
+        if (!reach(pc, next, after)) return false;
+      }
+    }
+
+    // Hand back what the caller's walk had where this one overlapped it
+    for (size_t i = saved.size(); i-- > 0;) {
+      walk[saved[i].pc] = saved[i].walk;
+      depth[saved[i].pc] = saved[i].depth;
+    }
+    needed[entry] = most;
+    state[entry] = DONE;
+    return true;
+  }
+};
+
+#endif // _VERIFIER_CPP_
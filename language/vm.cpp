@@ -5,6 +5,10 @@
 #define MAX_STACK_SIZE 256
 #endif
 
+#ifndef MAX_HOST_ARRAYS
+#define MAX_HOST_ARRAYS 16
+#endif
+
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -72,6 +76,16 @@ enum : byte { // If no register is specified, assume left
   OPCODE_NOT, // Reverse bits of register
   
   OPCODE_SPECCALL, // Call a VM function of given ID
+  
+  // Arrays: the register holds a pointer to a VMArray, and the type parameters are element types
+  OPCODE_ACONST, // Array over constant data: type, count(4), offset(4)
+  OPCODE_ANEW,   // Array of the last count elements pushed: type, count(4)
+  OPCODE_AHOST,  // Array bound by the host: slot, type
+  OPCODE_AGET,   // Left = left[right], right being a 64-bit unsigned index: type
+  OPCODE_ALEN,   // Left = 32-bit unsigned element count
+  OPCODE_ACONV,  // Convert every element from type to type
+  OPCODE_AOP,    // Element-wise operation: opcode (ADD...NOT, CMP*), type, shape
+  OPCODE_AREDUCE, // Left = sum, min or max of left: reduction, type
 
   REG_LEFT  = 0x00,
   REG_RIGHT = 0x08,
@@ -80,6 +94,7 @@ enum : byte { // If no register is specified, assume left
   TYPE_UNSIGNED = 0x01,
   TYPE_SIGNED   = 0x02,
   TYPE_FLOAT    = 0x03,
+  TYPE_ARRAY    = 0x04, // Only in the compiler, as a flag on the element type
   
   TYPE_SIZE_8  = 0x00,
   TYPE_SIZE_16 = 0x01,
@@ -93,6 +108,10 @@ enum : byte { // If no register is specified, assume left
 #define LOWER(x) (x & 0x0F)
 #define MERGE(u, d) ((u << 4) | d)
 
+#define IS_ARRAY(x) (UPPER(x) & TYPE_ARRAY)
+#define ARRAY_OF(x) (x | MERGE(TYPE_ARRAY, 0))
+#define ELEMENT_TYPE(x) (x & ~MERGE(TYPE_ARRAY, 0))
+
 #define TYPE_TO_LEFT(x)  MERGE(REG_LEFT , LOWER(x))
 #define TYPE_TO_RIGHT(x) MERGE(REG_RIGHT, LOWER(x))
 
@@ -113,6 +132,60 @@ static void swap_u64(uint64_t *a, uint64_t *b) {
   *b = t;
 }
 
+#define TYPE_CASES(apply) \
+  case MERGE(TYPE_UNSIGNED, FROM_SIZE(8)):  apply(uint8_t ); \
+  case MERGE(TYPE_UNSIGNED, FROM_SIZE(16)): apply(uint16_t); \
+  case MERGE(TYPE_UNSIGNED, FROM_SIZE(32)): apply(uint32_t); \
+  case MERGE(TYPE_UNSIGNED, FROM_SIZE(64)): apply(uint64_t); \
+  case MERGE(TYPE_SIGNED, FROM_SIZE(8)):    apply( int8_t ); \
+  case MERGE(TYPE_SIGNED, FROM_SIZE(16)):   apply( int16_t); \
+  case MERGE(TYPE_SIGNED, FROM_SIZE(32)):   apply( int32_t); \
+  case MERGE(TYPE_SIGNED, FROM_SIZE(64)):   apply( int64_t); \
+  case MERGE(TYPE_FLOAT, FROM_SIZE(32)):    apply(float   ); \
+  case MERGE(TYPE_FLOAT, FROM_SIZE(64)):    apply(double  );
+
+static bool valid_type(byte type) {
+  #define VALID(type) return true
+  switch (type) { TYPE_CASES(VALID) }
+  #undef VALID
+  return false;
+}
+
+// Integer conversions go through 64 bits so that no precision is lost, anything touching a
+//  float goes through a double
+static void convert_register(byte *reg, byte from, byte to) {
+  if (UPPER(from) == TYPE_FLOAT || UPPER(to) == TYPE_FLOAT) {
+    double value = 0;
+    #define READ(type) value = (double) *(type *) reg; break
+    switch (from) { TYPE_CASES(READ) }
+    #undef READ
+    #define WRITE(type) *(type *) reg = (type) (int64_t) value; break
+    switch (to) {
+      case MERGE(TYPE_FLOAT, FROM_SIZE(32)): *(float  *) reg = (float) value; break;
+      case MERGE(TYPE_FLOAT, FROM_SIZE(64)): *(double *) reg = value; break;
+      case MERGE(TYPE_UNSIGNED, FROM_SIZE(8)):  WRITE(uint8_t );
+      case MERGE(TYPE_UNSIGNED, FROM_SIZE(16)): WRITE(uint16_t);
+      case MERGE(TYPE_UNSIGNED, FROM_SIZE(32)): WRITE(uint32_t);
+      case MERGE(TYPE_UNSIGNED, FROM_SIZE(64)): WRITE(uint64_t);
+      case MERGE(TYPE_SIGNED, FROM_SIZE(8)):    WRITE( int8_t );
+      case MERGE(TYPE_SIGNED, FROM_SIZE(16)):   WRITE( int16_t);
+      case MERGE(TYPE_SIGNED, FROM_SIZE(32)):   WRITE( int32_t);
+      case MERGE(TYPE_SIGNED, FROM_SIZE(64)):   WRITE( int64_t);
+    }
+    #undef WRITE
+    return;
+  }
+  int64_t value = 0;
+  #define READ(type) value = (int64_t) *(type *) reg; break
+  switch (from) { TYPE_CASES(READ) }
+  #undef READ
+  #define WRITE(type) *(type *) reg = (type) value; break
+  switch (to) { TYPE_CASES(WRITE) }
+  #undef WRITE
+}
+
+#include "arrays.cpp"
+
 struct VM {
   const byte *instructions = nullptr;
   int instructions_size = 0;
@@ -122,32 +195,104 @@ struct VM {
   int32_t stack_end;
   int32_t stack_frame;
   
+  VMArray host_arrays[MAX_HOST_ARRAYS] = {};
+  
+  // Array values live here until the next init(). A run that outgrows it spills to the heap,
+  //  and init() then grows it to fit, so repeated runs stop allocating.
+  byte *arena = nullptr;
+  size_t arena_size = 0;
+  size_t arena_used = 0;
+  size_t arena_needed = 0;
+  void *spills = nullptr; // Linked through their first pointer
+  
+  VM() = default;
+  VM(const VM &) = delete;
+  VM &operator=(const VM &) = delete;
+  
+  ~VM() {
+    free_spills();
+    free(arena);
+  }
+  
   #define stack_ptr (stack_base + stack_end)
   #define frame_ptr (stack_base + stack_frame)
   
-  void push(const void *data, int size) {
-    if (stack_base + MAX_STACK_SIZE < stack_ptr) exit(1);
+  // CHECKED = false is for programs Verifier accepted, which it proved can't need the checks
+  template<bool CHECKED = true> void push(const void *data, int size) {
+    if (CHECKED && stack_end + size > MAX_STACK_SIZE) exit(1);
     memcpy(stack_ptr, data, size);
     stack_end += size;
   }
   
-  void pop(void *dest, int size) {
-    if (stack_base + size > stack_ptr) exit(1);
+  template<bool CHECKED = true> void pop(void *dest, int size) {
+    if (CHECKED && size > stack_end) exit(1);
     stack_end -= size;
     memcpy(dest, stack_ptr, size);
   }
   
+  void free_spills() {
+    while (spills) {
+      void *next = *(void **) spills;
+      free(spills);
+      spills = next;
+    }
+  }
+  
+  byte *allocate(size_t size) {
+    size = (size + 31) & ~(size_t) 31;
+    arena_needed += size;
+    if (arena_used + size <= arena_size) {
+      byte *p = arena + arena_used;
+      arena_used += size;
+      return p;
+    }
+    void *spill = aligned_alloc(32, size + 32);
+    if (spill == nullptr) exit(3);
+    *(void **) spill = spills;
+    spills = spill;
+    return (byte *) spill + 32;
+  }
+  
+  VMArray *new_array(byte type, uint32_t count) {
+    static_assert(sizeof(VMArray) <= 32, "The header takes one allocation unit");
+    byte *memory = allocate(32 + (size_t) count * (1 << LOWER(type)));
+    VMArray *array = (VMArray *) memory;
+    array->data  = memory + 32;
+    array->count = count;
+    array->type  = type;
+    return array;
+  }
+  
+  // Lets the program read a host buffer in place, through the slot the compiler bound its name to.
+  //  The buffer must outlive the runs that use it.
+  void bind_array(int slot, const void *data, uint32_t count, byte type) {
+    if (slot < 0 || slot >= MAX_HOST_ARRAYS) exit(1);
+    if (!valid_type(type)) exit(2);
+    host_arrays[slot] = VMArray{(const byte *) data, count, type};
+  }
+  
+  // The array a program returned; valid until the next init()
+  const VMArray *result_array() const {
+    return *(VMArray * const *) registers;
+  }
+  
   #define GET_BYTES(num) (instructions + (prog_counter+=num)-num)
-  void execute_one() {
-    if (prog_counter >= instructions_size) exit(20);
+  template<bool CHECKED = true> void execute_one() {
+    if (CHECKED && prog_counter >= instructions_size) exit(20);
     switch(*GET_BYTES(1)) {
       SWITCH_CASE(OPCODE_LOADC, {
         char size = 1 << (*GET_BYTES(1));
         int32_t pos = *(int32_t *) GET_BYTES(4);
-        if (instructions_size < pos + size) exit(1);
+        if (CHECKED && instructions_size < pos + size) exit(1);
         memcpy(registers, instructions + pos, size);
       })
       
+      SWITCH_CASE(OPCODE_CONV, {
+        byte from = *GET_BYTES(1);
+        byte to   = *GET_BYTES(1);
+        convert_register(registers, from, to);
+      })
+      
       SWITCH_CASE(OPCODE_SWAP, {
         swap_u64(
           (uint64_t *) registers,
@@ -265,25 +410,27 @@ struct VM {
       OP_CASE(NOT, ~, U)
       
       SWITCH_CASE(OPCODE_RETURN, {
-        pop(&prog_counter, 4);
-        pop(&stack_frame, 4);
+        pop<CHECKED>(&prog_counter, 4);
+        pop<CHECKED>(&stack_frame, 4);
       })
       
       SWITCH_CASE(OPCODE_CALL, {
-        push(&stack_frame, 4);
-        push(&prog_counter, 4);
-        prog_counter = *(int32_t *) GET_BYTES(4);
+        // Return to the instruction after this one, not into its operand
+        int32_t target = *(int32_t *) GET_BYTES(4);
+        push<CHECKED>(&stack_frame, 4);
+        push<CHECKED>(&prog_counter, 4);
+        prog_counter = target;
         stack_frame = stack_end;
       })
       
       SWITCH_CASE(OPCODE_PUSH, {
         byte reg = *GET_BYTES(1);
-        push(registers + UPPER(reg), 1 << LOWER(reg));
+        push<CHECKED>(registers + UPPER(reg), 1 << LOWER(reg));
       })
       
       SWITCH_CASE(OPCODE_POP, {
         byte reg = *GET_BYTES(1);
-        pop(registers + UPPER(reg), 1 << LOWER(reg));
+        pop<CHECKED>(registers + UPPER(reg), 1 << LOWER(reg));
       })
       
       SWITCH_CASE(OPCODE_LOAD, {
@@ -310,14 +457,102 @@ struct VM {
         prog_counter = *(int32_t *) GET_BYTES(4);
       })
       
+      SWITCH_CASE(OPCODE_ACONST, {
+        byte type = *GET_BYTES(1);
+        uint32_t count = *(uint32_t *) GET_BYTES(4);
+        int32_t pos = *(int32_t *) GET_BYTES(4);
+        if (CHECKED && !valid_type(type)) exit(12);
+        if (CHECKED && (pos < 0 || instructions_size < pos + ((int64_t) count << LOWER(type)))) exit(1);
+        VMArray *array = (VMArray *) allocate(sizeof(VMArray));
+        array->data  = instructions + pos;
+        array->count = count;
+        array->type  = type;
+        *(VMArray **) registers = array;
+      })
+      
+      SWITCH_CASE(OPCODE_ANEW, {
+        byte type = *GET_BYTES(1);
+        uint32_t count = *(uint32_t *) GET_BYTES(4);
+        if (CHECKED && !valid_type(type)) exit(12);
+        int64_t size = (int64_t) count << LOWER(type);
+        if (CHECKED && size > stack_end) exit(1);
+        VMArray *array = new_array(type, count);
+        stack_end -= size;
+        memcpy((byte *) array->data, stack_ptr, size);
+        *(VMArray **) registers = array;
+      })
+      
+      SWITCH_CASE(OPCODE_AHOST, {
+        byte slot = *GET_BYTES(1);
+        byte type = *GET_BYTES(1);
+        if (CHECKED && slot >= MAX_HOST_ARRAYS) exit(12);
+        if (host_arrays[slot].type != type) exit(12);
+        *(VMArray **) registers = &host_arrays[slot];
+      })
+      
+      SWITCH_CASE(OPCODE_AGET, {
+        byte type = *GET_BYTES(1);
+        const VMArray *array = *(VMArray **) registers;
+        uint64_t index = *(uint64_t *) (registers + 8);
+        if (array->type != type) exit(12);
+        if (index >= array->count) exit(1);
+        *(uint64_t *) registers = 0;
+        memcpy(registers, array->data + (index << LOWER(type)), 1 << LOWER(type));
+      })
+      
+      SWITCH_CASE(OPCODE_ALEN, {
+        const VMArray *array = *(VMArray **) registers;
+        *(uint64_t *) registers = array->count;
+      })
+      
+      SWITCH_CASE(OPCODE_ACONV, {
+        byte from = *GET_BYTES(1);
+        byte to   = *GET_BYTES(1);
+        const VMArray *array = *(VMArray **) registers;
+        if (array->type != from || (CHECKED && !valid_type(to))) exit(12);
+        VMArray *result = new_array(to, array->count);
+        array_convert_any(from, to, (byte *) result->data, array->data, array->count);
+        *(VMArray **) registers = result;
+      })
+      
+      SWITCH_CASE(OPCODE_AOP, {
+        byte op    = *GET_BYTES(1);
+        byte type  = *GET_BYTES(1);
+        byte shape = *GET_BYTES(1);
+        if (CHECKED && shape > ARRAY_SCALAR_LEFT) exit(12);
+        // The scalar operand, if any, stays in its register
+        const VMArray *left  = shape != ARRAY_SCALAR_LEFT  ? *(VMArray **) registers : nullptr;
+        const VMArray *right = shape != ARRAY_SCALAR_RIGHT ? *(VMArray **) (registers + 8) : nullptr;
+        const VMArray *array = left ? left : right;
+        if ((left && left->type != type) || (right && right->type != type)) exit(12);
+        if (left && right && left->count != right->count) exit(2);
+        VMArray *result = new_array(array_result_type(op, type), array->count);
+        array_operation(op, type, shape, (byte *) result->data,
+          left  ? left->data  : registers,
+          right ? right->data : registers + 8, array->count);
+        *(VMArray **) registers = result;
+      })
+      
+      SWITCH_CASE(OPCODE_AREDUCE, {
+        byte reduction = *GET_BYTES(1);
+        byte type = *GET_BYTES(1);
+        const VMArray *array = *(VMArray **) registers;
+        if (array->type != type) exit(12);
+        if (!array_reduce(reduction, type, array, registers)) exit(2);
+      })
+      
       SWITCH_CASE(OPCODE_JMPNZ, {
         // If 0b11111110 (not true) , then no
         // If 0b00000000 (false)    , then no
         // If 0b00000001 (true)     , then yes
         // If 0b11111111 (not false), then yes
-        if ((*(uint8_t *) registers) & 1) return;
-        prog_counter = *(int32_t *) GET_BYTES(4);
+        int32_t target = *(int32_t *) GET_BYTES(4);
+        if ((*(uint8_t *) registers) & 1) prog_counter = target;
       })
+      
+      default:
+        if (CHECKED) exit(10);
+        __builtin_unreachable(); // The verifier only lets the opcodes above through
     }
   }
   
@@ -331,10 +566,33 @@ struct VM {
     } while(prog_counter >= 0);
   }
   
+  /* Runs a program Verifier accepted, without the checks it made redundant. stack_needed is
+   * the verifier's max_stack; the stack must have room for it on top of what's already there.
+  */
+  void execute_verified(int32_t stack_needed) {
+    if (stack_end + stack_needed > MAX_STACK_SIZE) exit(1);
+    prog_counter = -10;
+    push<false>(&stack_frame, 4);
+    push<false>(&prog_counter, 4);
+    prog_counter = 0;
+    do {
+      execute_one<false>();
+    } while(prog_counter >= 0);
+  }
+  
   void init() {
     if (sizeof(void *) != 8) exit(-20);
     stack_end   = 0;
     stack_frame = 0;
+    free_spills();
+    if (arena_needed > arena_size) {
+      free(arena);
+      arena_size = (arena_needed + 4095) & ~(size_t) 4095;
+      arena = (byte *) aligned_alloc(32, arena_size);
+      if (arena == nullptr) exit(3);
+    }
+    arena_used   = 0;
+    arena_needed = 0;
   }
   #undef GET_BYTES
   #undef APPLY_OPU
@@ -343,5 +601,6 @@ struct VM {
 };
 
 #undef SWITCH_CASE
+#undef TYPE_CASES
 
 #endif // _VM_CPP_
@@ -0,0 +1,108 @@
+#ifndef _PARALLEL_EVENTS_CPP_
+#define _PARALLEL_EVENTS_CPP_
+
+#include "events.cpp"
+#include "WorkerPool.h"
+
+#include <tuple>
+
+// Whether a listener may run on a worker thread alongside the event's other listeners
+enum class ListenerThreading {
+    SERIAL,   // Runs on the calling thread, in subscription order
+    PARALLEL, // Independent of every other listener; may run anywhere, in any order
+};
+
+/* Event for listeners that do real work. Parallel listeners are spread over a WorkerPool while
+ * serial ones run on the calling thread; call() returns once all of them have finished.
+ * With no pool, or fewer parallel listeners than the inline threshold, everything simply runs on
+ * the calling thread. Like Event, call() is for one thread at a time, and parallel listeners
+ * must not subscribe to or unsubscribe from the event they are called by.
+*/
+template<typename ...Args> class ParallelEvent {
+public:
+    using Listener = Delegate<void(Args...)>;
+
+    ListenerList<Listener> serial;
+    ListenerList<Listener> parallel;
+private:
+    WorkerPool *pool = nullptr;
+    uint32_t inline_below = 4;
+    // Parallel listeners of the current call, so the workers can index them. Reused between calls.
+    std::vector<Listener> batch;
+    bool running = false; // Nested calls from our own listeners run inline
+
+    struct Call {
+        ParallelEvent *event;
+        std::tuple<Args &...> args;
+    };
+
+    static void run_parallel(void *context, uint32_t index) {
+        Call *call = (Call *) context;
+        const Listener &listener = call->event->batch[index];
+        std::apply(listener, call->args);
+    }
+
+    static void run_serial(void *context) {
+        Call *call = (Call *) context;
+        call->event->serial.dispatch([call](const Listener &listener, uint32_t) {
+            std::apply(listener, call->args);
+            return false;
+        });
+    }
+public:
+    explicit ParallelEvent(WorkerPool *workers = nullptr) : pool(workers) {}
+
+    void set_pool(WorkerPool *workers) { pool = workers; }
+
+    // Fewer parallel listeners than this are called inline; fanning out costs a few microseconds
+    void set_inline_below(uint32_t count) { inline_below = count; }
+
+    ListenerHandle subscribe(Listener listener, ListenerThreading threading = ListenerThreading::SERIAL) {
+        return (threading == ListenerThreading::PARALLEL ? parallel : serial).add(listener);
+    }
+
+    template<class T> ListenerHandle subscribe(void (T::*method)(Args...), T *obj,
+                                               ListenerThreading threading = ListenerThreading::SERIAL) {
+        return subscribe(Listener(method, obj), threading);
+    }
+
+    // Handles from the two lists can collide, so say which one it came from
+    void unsubscribe(ListenerHandle handle, ListenerThreading threading) {
+        (threading == ListenerThreading::PARALLEL ? parallel : serial).remove(handle);
+    }
+
+    void unsubscribe(Listener listener) {
+        serial.remove(listener);
+        parallel.remove(listener);
+    }
+
+    void call(Args... args) {
+        Call call{this, std::tuple<Args &...>(args...)};
+        // Also taken when called again from one of our own listeners: the workers are still
+        //  reading batch
+        if (running || !pool || parallel.size() < inline_below) {
+            run_serial(&call);
+            parallel.dispatch([&](const Listener &listener, uint32_t) {
+                listener(args...);
+                return false;
+            });
+            return;
+        }
+
+        parallel.dispatch([this](const Listener &listener, uint32_t) {
+            batch.push_back(listener);
+            return false;
+        });
+        struct Reset {
+            ParallelEvent &event;
+            ~Reset() {
+                event.batch.clear();
+                event.running = false;
+            }
+        } reset{*this};
+        running = true;
+        pool->run((uint32_t) batch.size(), &run_parallel, &call, &run_serial);
+    }
+};
+
+#endif // _PARALLEL_EVENTS_CPP_